@@ -0,0 +1,664 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Phase timings are collected through the library profiling hooks. Only the
+// outermost profiled scope is timed, nested scopes (e.g. _get_max_aabb_extent
+// within _get_max_extent) are accounted to their parent to keep the timer
+// overhead out of the hot loops.
+namespace bench
+{
+    typedef std::chrono::steady_clock Clock;
+
+    static int s_profile_depth = 0;
+    static const char* s_profile_function = nullptr;
+    static Clock::time_point s_profile_start;
+    static std::map<std::string, double> s_phase_seconds;
+
+    static void ProfileBegin(const char* function)
+    {
+        if (s_profile_depth++ == 0)
+        {
+            s_profile_function = function;
+            s_profile_start = Clock::now();
+        }
+    }
+
+    static void ProfileEnd()
+    {
+        if (--s_profile_depth == 0)
+        {
+            std::chrono::duration<double> elapsed = Clock::now() - s_profile_start;
+            s_phase_seconds[s_profile_function] += elapsed.count();
+        }
+    }
+}
+
+#define MELT_PROFILE_BEGIN() bench::ProfileBegin(__func__)
+#define MELT_PROFILE_END() bench::ProfileEnd()
+#define MELT_IMPLEMENTATION
+#include "melt.h"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include "procedural.h"
+
+#include <limits>
+
+struct Stat
+{
+    double median;
+    double min;
+};
+
+struct Run
+{
+    std::string model;
+    uint32_t triangle_count;
+    uint32_t resolution;
+    float voxel_size;
+    float fill_pct;
+    bool success;
+    uint32_t box_count;
+    // Box count of each level of detail of the occluder.
+    uint32_t lod_box_counts[MELT_LOD_COUNT];
+    // Boxes removed by merging boxes sharing a whole face.
+    uint32_t merged_box_count;
+    double fill_achieved;
+    uint64_t estimated_bytes;
+    uint64_t peak_bytes;
+    std::vector<double> total_seconds;
+    std::map<std::string, std::vector<double>> phase_seconds;
+};
+
+struct Options
+{
+    std::vector<std::string> models;
+    std::vector<float> voxel_sizes;
+    std::vector<float> fill_pcts;
+    std::vector<std::string> shapes;
+    std::vector<uint32_t> triangle_counts;
+    std::vector<uint32_t> resolutions;
+    bool scaling;
+    melt_grid_type_t grid_type;
+    uint32_t hole_closing_voxels;
+    uint32_t thin_wall_voxels;
+    bool split_components;
+    melt_extent_search_t extent_search;
+    uint32_t coarse_levels;
+    bool merge_boxes;
+    bool refine_boxes;
+    melt_grid_frame_t grid_frame;
+    std::vector<float> voxel_axis_scale;
+    uint32_t repeat;
+    const char* json_path;
+};
+
+// Known library phases, in pipeline order.
+static const std::pair<const char*, const char*> s_phase_names[] =
+{
+    { "melt_generate_occluder",        "voxelize"   },
+    { "_classify_interior",            "classify"   },
+    { "_label_components",             "components" },
+    { "_init_coarse_context",          "coarse"     },
+    { "_generate_fields",              "fields"     },
+    { "_init_summed_volume_table",     "table"      },
+    { "_get_max_extent",               "max_extent" },
+    { "_get_max_anchored_extent",      "anchored"   },
+    { "_clip_voxel_field",             "clip"       },
+    { "_clip_summed_volume_table",     "clip_table" },
+    { "_update_min_distance_field",    "distance"   },
+    { "_merge_max_extents",            "merge"      },
+    { "_init_triangle_bvh",            "bvh"        },
+};
+
+static const char* PhaseName(const std::string& function)
+{
+    for (const auto& phase_name : s_phase_names)
+    {
+        if (function == phase_name.first)
+            return phase_name.second;
+    }
+    return function.c_str();
+}
+
+static Stat ComputeStat(std::vector<double> samples)
+{
+    Stat stat = { 0.0, 0.0 };
+    if (samples.empty()) return stat;
+    std::sort(samples.begin(), samples.end());
+    size_t half = samples.size() / 2;
+    stat.median = samples.size() % 2 ? samples[half] : (samples[half - 1] + samples[half]) * 0.5;
+    stat.min = samples.front();
+    return stat;
+}
+
+static bool LoadModelMesh(const std::string& model_path, melt_mesh_t& mesh)
+{
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string error;
+    bool obj_parsing_res = tinyobj::LoadObj(shapes, materials, error, model_path.c_str(), NULL);
+
+    if (!error.empty() || !obj_parsing_res) return false;
+
+    memset(&mesh, 0, sizeof(melt_mesh_t));
+
+    for (size_t i = 0; i < shapes.size(); i++)
+    {
+        mesh.index_count += (uint32_t)shapes[i].mesh.indices.size();
+        mesh.vertex_count += (uint32_t)shapes[i].mesh.positions.size() / 3;
+    }
+
+    if (mesh.vertex_count - 1 > std::numeric_limits<melt_index_t>::max()) return false;
+
+    mesh.vertices = MELT_MALLOC(melt_vec3_t, mesh.vertex_count);
+    mesh.indices = MELT_MALLOC(melt_index_t, mesh.index_count);
+
+    uint32_t vertex_offset = 0;
+    uint32_t index_offset = 0;
+    for (size_t i = 0; i < shapes.size(); i++)
+    {
+        for (size_t f = 0; f < shapes[i].mesh.indices.size(); f++)
+            mesh.indices[index_offset++] = (melt_index_t)(shapes[i].mesh.indices[f] + vertex_offset);
+
+        for (size_t v = 0; v < shapes[i].mesh.positions.size() / 3; v++)
+        {
+            mesh.vertices[vertex_offset].x = shapes[i].mesh.positions[3 * v + 0];
+            mesh.vertices[vertex_offset].y = shapes[i].mesh.positions[3 * v + 1];
+            mesh.vertices[vertex_offset].z = shapes[i].mesh.positions[3 * v + 2];
+            ++vertex_offset;
+        }
+    }
+
+    return true;
+}
+
+static double MeshVolume(const melt_mesh_t& mesh)
+{
+    double volume = 0.0;
+    for (uint32_t i = 0; i + 2 < mesh.index_count; i += 3)
+    {
+        const melt_vec3_t& a = mesh.vertices[mesh.indices[i + 0]];
+        const melt_vec3_t& b = mesh.vertices[mesh.indices[i + 1]];
+        const melt_vec3_t& c = mesh.vertices[mesh.indices[i + 2]];
+        volume += (double)a.x * ((double)b.y * c.z - (double)b.z * c.y)
+                - (double)a.y * ((double)b.x * c.z - (double)b.z * c.x)
+                + (double)a.z * ((double)b.x * c.y - (double)b.y * c.x);
+    }
+    return fabs(volume) / 6.0;
+}
+
+// Each occluder box is emitted as 8 consecutive vertices, the box volume is
+// recovered from their bounds.
+static double BoxesVolume(const melt_mesh_t& mesh)
+{
+    double volume = 0.0;
+    for (uint32_t i = 0; i + 8 <= mesh.vertex_count; i += 8)
+    {
+        melt_vec3_t min = mesh.vertices[i];
+        melt_vec3_t max = mesh.vertices[i];
+        for (uint32_t j = 1; j < 8; ++j)
+        {
+            const melt_vec3_t& v = mesh.vertices[i + j];
+            min.x = std::min(min.x, v.x); max.x = std::max(max.x, v.x);
+            min.y = std::min(min.y, v.y); max.y = std::max(max.y, v.y);
+            min.z = std::min(min.z, v.z); max.z = std::max(max.z, v.z);
+        }
+        volume += (double)(max.x - min.x) * (max.y - min.y) * (max.z - min.z);
+    }
+    return volume;
+}
+
+static Run RunBenchmark(const std::string& model, const melt_mesh_t& mesh, float voxel_size, float fill_pct, const Options& options)
+{
+    Run run;
+    run.model = model;
+    run.triangle_count = mesh.index_count / 3;
+    run.resolution = 0;
+    run.voxel_size = voxel_size;
+    run.fill_pct = fill_pct;
+    run.success = true;
+    run.box_count = 0;
+    memset(run.lod_box_counts, 0, sizeof(run.lod_box_counts));
+    run.merged_box_count = 0;
+    run.fill_achieved = 0.0;
+    run.peak_bytes = 0;
+
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.mesh = mesh;
+    params.voxel_size = voxel_size;
+    if (options.voxel_axis_scale.size() == 3)
+    {
+        params.voxel_size_per_axis.x = voxel_size * options.voxel_axis_scale[0];
+        params.voxel_size_per_axis.y = voxel_size * options.voxel_axis_scale[1];
+        params.voxel_size_per_axis.z = voxel_size * options.voxel_axis_scale[2];
+    }
+    params.fill_pct = fill_pct;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    params.grid_type = options.grid_type;
+    params.hole_closing_voxels = options.hole_closing_voxels;
+    params.thin_wall_voxels = options.thin_wall_voxels;
+    params.split_components = options.split_components;
+    params.extent_search = options.extent_search;
+    params.coarse_levels = options.coarse_levels;
+    params.merge_boxes = options.merge_boxes;
+    params.refine_boxes = options.refine_boxes;
+    params.grid_frame = options.grid_frame;
+
+    const double mesh_volume = MeshVolume(mesh);
+    run.estimated_bytes = melt_estimate_memory(params);
+
+    for (uint32_t i = 0; i < options.repeat && run.success; ++i)
+    {
+        bench::s_phase_seconds.clear();
+
+        melt_result_t result;
+        bench::Clock::time_point start = bench::Clock::now();
+        run.success = melt_generate_occluder(params, &result) != 0;
+        std::chrono::duration<double> elapsed = bench::Clock::now() - start;
+
+        double profiled_seconds = 0.0;
+        run.total_seconds.push_back(elapsed.count());
+        for (const auto& phase : bench::s_phase_seconds)
+        {
+            run.phase_seconds[PhaseName(phase.first)].push_back(phase.second);
+            profiled_seconds += phase.second;
+        }
+        run.phase_seconds["other"].push_back(std::max(0.0, elapsed.count() - profiled_seconds));
+
+        if (!run.success) break;
+
+        run.box_count = result.box_count;
+        for (uint32_t lod = 0; lod < MELT_LOD_COUNT; ++lod)
+            run.lod_box_counts[lod] = result.lods[lod].box_count;
+        run.merged_box_count = result.merged_box_count;
+        run.peak_bytes = result.peak_memory_bytes;
+        run.fill_achieved = mesh_volume > 0.0 ? BoxesVolume(result.mesh) / mesh_volume : 0.0;
+        melt_free_result(result);
+    }
+
+    return run;
+}
+
+static std::vector<std::string> CollectPhases(const std::vector<Run>& runs)
+{
+    std::vector<std::string> phases;
+    auto add_phase = [&](const std::string& phase)
+    {
+        if (std::find(phases.begin(), phases.end(), phase) != phases.end()) return;
+        for (const Run& run : runs)
+        {
+            if (run.phase_seconds.count(phase))
+            {
+                phases.push_back(phase);
+                return;
+            }
+        }
+    };
+    for (const auto& phase_name : s_phase_names)
+        add_phase(phase_name.second);
+    for (const Run& run : runs)
+    {
+        for (const auto& phase : run.phase_seconds)
+            add_phase(phase.first);
+    }
+    add_phase("other");
+    return phases;
+}
+
+static void PrintTable(const std::vector<Run>& runs)
+{
+    std::vector<std::string> phases = CollectPhases(runs);
+
+    printf("%-10s %7s %6s %4s %7s %7s %17s %19s", "model", "voxel", "fill", "ok", "boxes", "filled", "MB (est/peak)", "total ms (med/min)");
+    for (const std::string& phase : phases)
+        printf(" %19s", (phase + " (med/min)").c_str());
+    printf("\n");
+
+    for (const Run& run : runs)
+    {
+        Stat total = ComputeStat(run.total_seconds);
+        printf("%-10s %7.3f %6.2f %4s %7u %6.1f%% %8.1f/%8.1f %9.2f/%9.2f", run.model.c_str(), run.voxel_size, run.fill_pct,
+            run.success ? "yes" : "no", run.box_count, run.fill_achieved * 100.0, run.estimated_bytes / 1048576.0, run.peak_bytes / 1048576.0,
+            total.median * 1e3, total.min * 1e3);
+        for (const std::string& phase : phases)
+        {
+            auto it = run.phase_seconds.find(phase);
+            Stat stat = it != run.phase_seconds.end() ? ComputeStat(it->second) : Stat{ 0.0, 0.0 };
+            printf(" %9.2f/%9.2f", stat.median * 1e3, stat.min * 1e3);
+        }
+        printf("\n");
+    }
+}
+
+static double PhaseMedian(const Run& run, const std::string& phase)
+{
+    if (phase == "total") return ComputeStat(run.total_seconds).median;
+    auto it = run.phase_seconds.find(phase);
+    return it != run.phase_seconds.end() ? ComputeStat(it->second).median : 0.0;
+}
+
+// Prints, for each group of runs ordered by 'size', the median time of each
+// phase and the empirical scaling exponent between consecutive sizes, which is
+// log(t1 / t0) / log(n1 / n0). Exponents above 'threshold' are flagged with '!'.
+static void PrintScalingGroup(const std::string& title, const std::vector<const Run*>& group,
+    const std::vector<std::string>& phases, double (*size)(const Run&), double threshold)
+{
+    printf("\n%s\n", title.c_str());
+    printf("  %-12s", "phase");
+    for (const Run* run : group)
+        printf(" %20s", (std::to_string(run->triangle_count) + " tris @" + std::to_string(run->resolution)).c_str());
+    printf("\n");
+
+    std::vector<std::string> rows = phases;
+    rows.insert(rows.begin(), "total");
+    for (const std::string& phase : rows)
+    {
+        printf("  %-12s", phase.c_str());
+        for (size_t i = 0; i < group.size(); ++i)
+        {
+            double t = PhaseMedian(*group[i], phase);
+            char cell[64];
+            if (i == 0 || !group[i]->success || !group[i - 1]->success)
+                snprintf(cell, sizeof(cell), "%9.2fms        ", t * 1e3);
+            else
+            {
+                double t0 = PhaseMedian(*group[i - 1], phase);
+                double n0 = size(*group[i - 1]), n1 = size(*group[i]);
+                if (t0 > 1e-6 && t > 1e-6 && n1 > n0)
+                {
+                    double exponent = std::log(t / t0) / std::log(n1 / n0);
+                    snprintf(cell, sizeof(cell), "%9.2fms ^%5.2f%s", t * 1e3, exponent, exponent > threshold ? "!" : " ");
+                }
+                else
+                    snprintf(cell, sizeof(cell), "%9.2fms        ", t * 1e3);
+            }
+            printf(" %20s", cell);
+        }
+        printf("\n");
+    }
+
+    double max_total = 0.0;
+    for (const Run* run : group)
+        max_total = std::max(max_total, PhaseMedian(*run, "total"));
+    for (const Run* run : group)
+    {
+        double total = PhaseMedian(*run, "total");
+        int width = max_total > 0.0 ? (int)std::lround(50.0 * total / max_total) : 0;
+        printf("  %20s |%s %.2fms%s\n", (std::to_string(run->triangle_count) + " tris @" + std::to_string(run->resolution)).c_str(),
+            std::string((size_t)width, '#').c_str(), total * 1e3, run->success ? "" : " (failed)");
+    }
+}
+
+static double TriangleCountSize(const Run& run) { return (double)run.triangle_count; }
+static double GridSize(const Run& run) { return (double)run.resolution * run.resolution * run.resolution; }
+
+static void PrintScalingReport(const std::vector<Run>& runs)
+{
+    std::vector<std::string> phases = CollectPhases(runs);
+
+    std::map<std::pair<std::string, uint32_t>, std::vector<const Run*>> by_resolution;
+    std::map<std::pair<std::string, uint32_t>, std::vector<const Run*>> by_triangles;
+    for (const Run& run : runs)
+    {
+        by_resolution[std::make_pair(run.model, run.resolution)].push_back(&run);
+        by_triangles[std::make_pair(run.model, run.triangle_count)].push_back(&run);
+    }
+
+    for (auto& group : by_resolution)
+    {
+        std::sort(group.second.begin(), group.second.end(), [](const Run* a, const Run* b) { return a->triangle_count < b->triangle_count; });
+        if (group.second.size() < 2) continue;
+        PrintScalingGroup(group.first.first + ", grid resolution " + std::to_string(group.first.second) +
+            ": time vs triangle count", group.second, phases, TriangleCountSize, 1.25);
+    }
+    for (auto& group : by_triangles)
+    {
+        std::sort(group.second.begin(), group.second.end(), [](const Run* a, const Run* b) { return a->resolution < b->resolution; });
+        if (group.second.size() < 2) continue;
+        PrintScalingGroup(group.first.first + ", " + std::to_string(group.first.second) +
+            " triangles: time vs grid voxel count", group.second, phases, GridSize, 1.25);
+    }
+}
+
+static void WriteJson(FILE* file, const std::vector<Run>& runs)
+{
+    fprintf(file, "{\n  \"runs\": [\n");
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        const Run& run = runs[i];
+        Stat total = ComputeStat(run.total_seconds);
+        fprintf(file, "    {\"model\": \"%s\", \"triangles\": %u, \"resolution\": %u, \"voxel_size\": %g, \"fill_pct\": %g, \"success\": %s, "
+            "\"boxes\": %u, \"lod_boxes\": [%u, %u, %u, %u], \"merged_boxes\": %u, \"fill_achieved\": %.6f, \"estimated_bytes\": %llu, \"peak_bytes\": %llu, \"repeat\": %zu, \"total_ms\": {\"median\": %.4f, \"min\": %.4f}, \"phases_ms\": {",
+            run.model.c_str(), run.triangle_count, run.resolution, run.voxel_size, run.fill_pct, run.success ? "true" : "false",
+            run.box_count, run.lod_box_counts[0], run.lod_box_counts[1], run.lod_box_counts[2], run.lod_box_counts[3], run.merged_box_count,
+            run.fill_achieved, (unsigned long long)run.estimated_bytes, (unsigned long long)run.peak_bytes, run.total_seconds.size(), total.median * 1e3, total.min * 1e3);
+        size_t phase_index = 0;
+        for (const auto& phase : run.phase_seconds)
+        {
+            Stat stat = ComputeStat(phase.second);
+            fprintf(file, "%s\"%s\": {\"median\": %.4f, \"min\": %.4f}", phase_index++ ? ", " : "",
+                phase.first.c_str(), stat.median * 1e3, stat.min * 1e3);
+        }
+        fprintf(file, "}}%s\n", i + 1 < runs.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static std::vector<std::string> SplitList(const char* list)
+{
+    std::vector<std::string> values;
+    std::string value;
+    for (const char* c = list; ; ++c)
+    {
+        if (*c == ',' || *c == '\0')
+        {
+            if (!value.empty()) values.push_back(value);
+            value.clear();
+            if (*c == '\0') break;
+        }
+        else
+            value += *c;
+    }
+    return values;
+}
+
+static std::vector<float> SplitFloatList(const char* list)
+{
+    std::vector<float> values;
+    for (const std::string& value : SplitList(list))
+        values.push_back((float)atof(value.c_str()));
+    return values;
+}
+
+static std::vector<uint32_t> SplitUintList(const char* list)
+{
+    std::vector<uint32_t> values;
+    for (const std::string& value : SplitList(list))
+        values.push_back((uint32_t)strtoul(value.c_str(), NULL, 10));
+    return values;
+}
+
+static void PrintUsage(const char* program)
+{
+    printf("usage: %s [--models a,b,..] [--voxel-sizes v0,v1,..] [--fill f0,f1,..] [--sparse] [--hole-closing n]\n", program);
+    printf("       [--thin-walls n] [--split-components] [--extent-search diagonal|summed-volume|exact] [--coarse-levels n] [--merge-boxes]\n");
+    printf("       [--refine-boxes] [--principal-axes] [--voxel-axis-scale x,y,z] [--repeat n] [--json path|-]\n");
+    printf("       %s --scaling [--shapes sphere,torus,boxes,blob] [--triangles t0,t1,..] [--resolutions r0,r1,..]\n", program);
+    printf("       [--fill f0,f1,..] [--sparse] [--hole-closing n] [--thin-walls n] [--split-components]\n");
+    printf("       [--extent-search diagonal|summed-volume|exact] [--coarse-levels n] [--merge-boxes]\n");
+    printf("       [--refine-boxes] [--principal-axes] [--voxel-axis-scale x,y,z] [--repeat n] [--json path|-]\n");
+    printf("  --sparse uses the sparse brick grid instead of the dense grid\n");
+    printf("  --hole-closing closes gaps in the meshes up to 2n voxels wide\n");
+    printf("  --thin-walls fills walls of the meshes up to n voxels thick as slabs\n");
+    printf("  --split-components fills each connected component of the meshes in its own cropped grid\n");
+    printf("  --extent-search selects how the greedy fill searches the largest box at each voxel\n");
+    printf("  --coarse-levels fills n grids with 2x, 4x, .. larger voxels before the grid of the voxel size\n");
+    printf("  --merge-boxes merges boxes sharing a whole face once the greedy fill is done\n");
+    printf("  --refine-boxes pushes the faces of the boxes against the triangles of the meshes\n");
+    printf("  --principal-axes aligns the grid with the principal axes of the meshes\n");
+    printf("  --voxel-axis-scale scales the voxel sizes along each axis of the grid\n");
+    printf("  --scaling runs procedurally generated meshes, voxel sizes are derived from the resolution\n");
+    printf("  (number of voxels along the longest axis of the mesh bounds)\n");
+}
+
+static void RunScalingBenchmarks(const Options& options, std::vector<Run>& runs)
+{
+    for (const std::string& shape : options.shapes)
+    {
+        for (uint32_t triangle_count : options.triangle_counts)
+        {
+            procedural::Mesh mesh;
+            if (!procedural::Generate(shape, triangle_count, mesh))
+            {
+                fprintf(stderr, "Unknown shape %s\n", shape.c_str());
+                continue;
+            }
+            if (mesh.vertices.size() - 1 > std::numeric_limits<melt_index_t>::max())
+            {
+                fprintf(stderr, "Skipping %s with %u triangles, too many vertices for melt_index_t\n", shape.c_str(), mesh.TriangleCount());
+                continue;
+            }
+
+            melt_vec3_t min = mesh.vertices[0];
+            melt_vec3_t max = mesh.vertices[0];
+            for (const melt_vec3_t& v : mesh.vertices)
+            {
+                min.x = std::min(min.x, v.x); max.x = std::max(max.x, v.x);
+                min.y = std::min(min.y, v.y); max.y = std::max(max.y, v.y);
+                min.z = std::min(min.z, v.z); max.z = std::max(max.z, v.z);
+            }
+            const float longest_extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+
+            for (uint32_t resolution : options.resolutions)
+            {
+                for (float fill_pct : options.fill_pcts)
+                {
+                    Run run = RunBenchmark(shape, mesh.View(), longest_extent / resolution, fill_pct, options);
+                    run.resolution = resolution;
+                    runs.push_back(run);
+                }
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    options.models = { "bunny", "suzanne", "column", "sphere", "teapot", "cube" };
+    options.voxel_sizes = { 0.5f, 0.25f, 0.15f, 0.1f };
+    options.fill_pcts = { 0.5f, 1.0f };
+    options.shapes = { "sphere", "torus", "boxes", "blob" };
+    options.triangle_counts = { 1000, 8000, 64000, 512000, 2000000 };
+    options.resolutions = { 32, 64 };
+    options.scaling = false;
+    options.grid_type = MELT_GRID_TYPE_DENSE;
+    options.hole_closing_voxels = 0;
+    options.thin_wall_voxels = 0;
+    options.split_components = false;
+    options.extent_search = MELT_EXTENT_SEARCH_DIAGONAL;
+    options.coarse_levels = 0;
+    options.merge_boxes = false;
+    options.refine_boxes = false;
+    options.grid_frame = MELT_GRID_FRAME_WORLD;
+    options.repeat = 5;
+    options.json_path = nullptr;
+    bool fill_pcts_set = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!strcmp(arg, "--help") || !strcmp(arg, "-h")) { PrintUsage(argv[0]); return 0; }
+        if (!strcmp(arg, "--scaling")) { options.scaling = true; continue; }
+        if (!strcmp(arg, "--sparse")) { options.grid_type = MELT_GRID_TYPE_SPARSE; continue; }
+        if (!strcmp(arg, "--split-components")) { options.split_components = true; continue; }
+        if (!strcmp(arg, "--merge-boxes")) { options.merge_boxes = true; continue; }
+        if (!strcmp(arg, "--refine-boxes")) { options.refine_boxes = true; continue; }
+        if (!strcmp(arg, "--principal-axes")) { options.grid_frame = MELT_GRID_FRAME_PRINCIPAL_AXES; continue; }
+        if (!value) { PrintUsage(argv[0]); return 1; }
+
+        if (!strcmp(arg, "--models")) options.models = SplitList(value);
+        else if (!strcmp(arg, "--voxel-sizes")) options.voxel_sizes = SplitFloatList(value);
+        else if (!strcmp(arg, "--fill")) { options.fill_pcts = SplitFloatList(value); fill_pcts_set = true; }
+        else if (!strcmp(arg, "--shapes")) options.shapes = SplitList(value);
+        else if (!strcmp(arg, "--triangles")) options.triangle_counts = SplitUintList(value);
+        else if (!strcmp(arg, "--resolutions")) options.resolutions = SplitUintList(value);
+        else if (!strcmp(arg, "--hole-closing")) options.hole_closing_voxels = (uint32_t)strtoul(value, NULL, 10);
+        else if (!strcmp(arg, "--thin-walls")) options.thin_wall_voxels = (uint32_t)strtoul(value, NULL, 10);
+        else if (!strcmp(arg, "--extent-search"))
+        {
+            if (!strcmp(value, "diagonal")) options.extent_search = MELT_EXTENT_SEARCH_DIAGONAL;
+            else if (!strcmp(value, "summed-volume")) options.extent_search = MELT_EXTENT_SEARCH_SUMMED_VOLUME;
+            else if (!strcmp(value, "exact")) options.extent_search = MELT_EXTENT_SEARCH_EXACT;
+            else { PrintUsage(argv[0]); return 1; }
+        }
+        else if (!strcmp(arg, "--voxel-axis-scale"))
+        {
+            options.voxel_axis_scale = SplitFloatList(value);
+            if (options.voxel_axis_scale.size() != 3) { PrintUsage(argv[0]); return 1; }
+        }
+        else if (!strcmp(arg, "--coarse-levels")) options.coarse_levels = (uint32_t)strtoul(value, NULL, 10);
+        else if (!strcmp(arg, "--repeat")) options.repeat = (uint32_t)std::max(1, atoi(value));
+        else if (!strcmp(arg, "--json")) options.json_path = value;
+        else { PrintUsage(argv[0]); return 1; }
+        ++i;
+    }
+
+    std::vector<Run> runs;
+    if (options.scaling)
+    {
+        if (!fill_pcts_set) options.fill_pcts = { 0.75f };
+        RunScalingBenchmarks(options, runs);
+    }
+    else
+    {
+        for (const std::string& model : options.models)
+        {
+            melt_mesh_t mesh;
+            std::string model_path = std::string(MELT_BENCH_MODELS_DIR) + "/" + model + ".obj";
+            if (!LoadModelMesh(model_path, mesh))
+            {
+                fprintf(stderr, "Failed to load model %s\n", model_path.c_str());
+                return 1;
+            }
+
+            for (float voxel_size : options.voxel_sizes)
+            {
+                for (float fill_pct : options.fill_pcts)
+                {
+                    runs.push_back(RunBenchmark(model, mesh, voxel_size, fill_pct, options));
+                }
+            }
+
+            MELT_FREE(mesh.vertices);
+            MELT_FREE(mesh.indices);
+        }
+    }
+
+    PrintTable(runs);
+    if (options.scaling)
+        PrintScalingReport(runs);
+
+    if (options.json_path)
+    {
+        FILE* file = strcmp(options.json_path, "-") ? fopen(options.json_path, "w") : stdout;
+        if (!file)
+        {
+            fprintf(stderr, "Failed to open %s\n", options.json_path);
+            return 1;
+        }
+        WriteJson(file, runs);
+        if (file != stdout) fclose(file);
+    }
+
+    return 0;
+}
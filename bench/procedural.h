@@ -0,0 +1,247 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Watertight procedural meshes of controllable triangle count, used to measure
+// how the library scales past the size of the bundled models.
+namespace procedural
+{
+    struct Mesh
+    {
+        std::vector<melt_vec3_t> vertices;
+        std::vector<melt_index_t> indices;
+
+        melt_mesh_t View() const
+        {
+            melt_mesh_t mesh;
+            mesh.vertices = (melt_vec3_t*)vertices.data();
+            mesh.indices = (melt_index_t*)indices.data();
+            mesh.vertex_count = (uint32_t)vertices.size();
+            mesh.index_count = (uint32_t)indices.size();
+            return mesh;
+        }
+
+        uint32_t TriangleCount() const
+        {
+            return (uint32_t)indices.size() / 3;
+        }
+    };
+
+    inline melt_vec3_t Vec3(float x, float y, float z)
+    {
+        melt_vec3_t v;
+        v.x = x;
+        v.y = y;
+        v.z = z;
+        return v;
+    }
+
+    // Improved Perlin noise with a seeded permutation table.
+    class Perlin
+    {
+    public:
+        explicit Perlin(uint32_t seed)
+        {
+            for (int i = 0; i < 256; ++i)
+                m_permutation[i] = (uint8_t)i;
+            for (int i = 255; i > 0; --i)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                int j = (int)((seed >> 8) % (uint32_t)(i + 1));
+                uint8_t tmp = m_permutation[i];
+                m_permutation[i] = m_permutation[j];
+                m_permutation[j] = tmp;
+            }
+            for (int i = 0; i < 256; ++i)
+                m_permutation[256 + i] = m_permutation[i];
+        }
+
+        float Noise(float x, float y, float z) const
+        {
+            int xi = (int)std::floor(x) & 255;
+            int yi = (int)std::floor(y) & 255;
+            int zi = (int)std::floor(z) & 255;
+            x -= std::floor(x);
+            y -= std::floor(y);
+            z -= std::floor(z);
+            float u = Fade(x), v = Fade(y), w = Fade(z);
+
+            const uint8_t* p = m_permutation;
+            int a = p[xi] + yi, aa = p[a] + zi, ab = p[a + 1] + zi;
+            int b = p[xi + 1] + yi, ba = p[b] + zi, bb = p[b + 1] + zi;
+
+            return Lerp(w, Lerp(v, Lerp(u, Grad(p[aa], x, y, z), Grad(p[ba], x - 1, y, z)),
+                                   Lerp(u, Grad(p[ab], x, y - 1, z), Grad(p[bb], x - 1, y - 1, z))),
+                           Lerp(v, Lerp(u, Grad(p[aa + 1], x, y, z - 1), Grad(p[ba + 1], x - 1, y, z - 1)),
+                                   Lerp(u, Grad(p[ab + 1], x, y - 1, z - 1), Grad(p[bb + 1], x - 1, y - 1, z - 1))));
+        }
+
+    private:
+        static float Fade(float t) { return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f); }
+        static float Lerp(float t, float a, float b) { return a + t * (b - a); }
+        static float Grad(int hash, float x, float y, float z)
+        {
+            int h = hash & 15;
+            float u = h < 8 ? x : y;
+            float v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+            return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+        }
+
+        uint8_t m_permutation[512];
+    };
+
+    // Closed cube surface subdivided n times per edge, every lattice point is
+    // mapped through map(p) with p in [-1, 1]^3. Lattice points are shared
+    // between faces so the result is watertight for any continuous mapping.
+    template <typename MapFunction>
+    inline void AppendCubeLattice(Mesh& mesh, uint32_t n, MapFunction map)
+    {
+        std::unordered_map<uint64_t, melt_index_t> lattice_vertices;
+        const uint64_t stride = n + 1;
+
+        auto vertex_index = [&](uint32_t coords[3]) -> melt_index_t
+        {
+            uint64_t key = coords[0] + stride * (coords[1] + stride * coords[2]);
+            auto it = lattice_vertices.find(key);
+            if (it != lattice_vertices.end()) return it->second;
+
+            melt_index_t index = (melt_index_t)mesh.vertices.size();
+            float scale = 2.0f / (float)n;
+            mesh.vertices.push_back(map(Vec3(coords[0] * scale - 1.0f, coords[1] * scale - 1.0f, coords[2] * scale - 1.0f)));
+            lattice_vertices.emplace(key, index);
+            return index;
+        };
+
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            for (int sign = -1; sign <= 1; sign += 2)
+            {
+                // Tangent axes chosen such that cross(u, v) points outward.
+                uint32_t u_axis = (axis + 1) % 3;
+                uint32_t v_axis = (axis + 2) % 3;
+                if (sign < 0) std::swap(u_axis, v_axis);
+
+                for (uint32_t j = 0; j < n; ++j)
+                {
+                    for (uint32_t i = 0; i < n; ++i)
+                    {
+                        melt_index_t corners[4];
+                        const uint32_t offsets[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+                        for (int c = 0; c < 4; ++c)
+                        {
+                            uint32_t coords[3];
+                            coords[axis] = sign > 0 ? n : 0;
+                            coords[u_axis] = i + offsets[c][0];
+                            coords[v_axis] = j + offsets[c][1];
+                            corners[c] = vertex_index(coords);
+                        }
+                        const melt_index_t triangles[6] = { corners[0], corners[1], corners[2], corners[0], corners[2], corners[3] };
+                        mesh.indices.insert(mesh.indices.end(), triangles, triangles + 6);
+                    }
+                }
+            }
+        }
+    }
+
+    inline uint32_t LatticeSubdivisions(uint32_t triangle_count, uint32_t lattice_count)
+    {
+        return (uint32_t)std::max(1.0, std::round(std::sqrt(triangle_count / (12.0 * lattice_count))));
+    }
+
+    inline Mesh Sphere(uint32_t triangle_count)
+    {
+        Mesh mesh;
+        AppendCubeLattice(mesh, LatticeSubdivisions(triangle_count, 1), [](melt_vec3_t p)
+        {
+            float inv_length = 1.0f / std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            return Vec3(p.x * inv_length, p.y * inv_length, p.z * inv_length);
+        });
+        return mesh;
+    }
+
+    inline Mesh Blob(uint32_t triangle_count)
+    {
+        Mesh mesh;
+        Perlin perlin(0x6d656c74);
+        AppendCubeLattice(mesh, LatticeSubdivisions(triangle_count, 1), [&](melt_vec3_t p)
+        {
+            float inv_length = 1.0f / std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            melt_vec3_t d = Vec3(p.x * inv_length, p.y * inv_length, p.z * inv_length);
+            float radius = 1.0f + 0.35f * perlin.Noise(d.x * 2.5f + 7.1f, d.y * 2.5f + 3.3f, d.z * 2.5f + 1.7f)
+                                + 0.1f * perlin.Noise(d.x * 9.0f + 2.9f, d.y * 9.0f + 5.4f, d.z * 9.0f + 8.2f);
+            return Vec3(d.x * radius, d.y * radius, d.z * radius);
+        });
+        return mesh;
+    }
+
+    // Tower of boxes of decreasing size, separated by a small gap.
+    inline Mesh StackedBoxes(uint32_t triangle_count)
+    {
+        const uint32_t box_count = 4;
+        const uint32_t n = LatticeSubdivisions(triangle_count, box_count);
+
+        Mesh mesh;
+        float base_y = 0.0f;
+        for (uint32_t b = 0; b < box_count; ++b)
+        {
+            const float half_width = 1.0f - 0.2f * b;
+            const float half_height = 0.25f + 0.05f * b;
+            const float center_y = base_y + half_height;
+            AppendCubeLattice(mesh, n, [&](melt_vec3_t p)
+            {
+                return Vec3(p.x * half_width, p.y * half_height + center_y, p.z * half_width * 0.75f);
+            });
+            base_y += half_height * 2.0f + 0.1f;
+        }
+        return mesh;
+    }
+
+    inline Mesh Torus(uint32_t triangle_count)
+    {
+        const float major_radius = 1.0f;
+        const float minor_radius = 0.35f;
+        const uint32_t major_segments = (uint32_t)std::max(3.0, std::round(std::sqrt(triangle_count * 1.5)));
+        const uint32_t minor_segments = (uint32_t)std::max(3.0, std::round(triangle_count / (2.0 * major_segments)));
+
+        Mesh mesh;
+        for (uint32_t i = 0; i < major_segments; ++i)
+        {
+            float theta = 2.0f * (float)M_PI * i / major_segments;
+            for (uint32_t j = 0; j < minor_segments; ++j)
+            {
+                float phi = 2.0f * (float)M_PI * j / minor_segments;
+                float r = major_radius + minor_radius * std::cos(phi);
+                mesh.vertices.push_back(Vec3(r * std::cos(theta), minor_radius * std::sin(phi), r * std::sin(theta)));
+            }
+        }
+        for (uint32_t i = 0; i < major_segments; ++i)
+        {
+            uint32_t i1 = (i + 1) % major_segments;
+            for (uint32_t j = 0; j < minor_segments; ++j)
+            {
+                uint32_t j1 = (j + 1) % minor_segments;
+                melt_index_t a = (melt_index_t)(i * minor_segments + j);
+                melt_index_t b = (melt_index_t)(i1 * minor_segments + j);
+                melt_index_t c = (melt_index_t)(i1 * minor_segments + j1);
+                melt_index_t d = (melt_index_t)(i * minor_segments + j1);
+                const melt_index_t triangles[6] = { a, c, b, a, d, c };
+                mesh.indices.insert(mesh.indices.end(), triangles, triangles + 6);
+            }
+        }
+        return mesh;
+    }
+
+    inline bool Generate(const std::string& shape, uint32_t triangle_count, Mesh& mesh)
+    {
+        if (shape == "sphere") mesh = Sphere(triangle_count);
+        else if (shape == "torus") mesh = Torus(triangle_count);
+        else if (shape == "boxes") mesh = StackedBoxes(triangle_count);
+        else if (shape == "blob") mesh = Blob(triangle_count);
+        else return false;
+        return true;
+    }
+}
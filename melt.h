@@ -44,6 +44,19 @@
 
 #include <stdint.h>
 
+// Index type of the input and output meshes, define MELT_INDEX_TYPE to uint32_t
+// before including the library to process meshes of more than 65536 vertices.
+#ifndef MELT_INDEX_TYPE
+#define MELT_INDEX_TYPE uint16_t
+#endif
+
+// Dense grids store their fields row by row. Define MELT_TILED_FIELDS before
+// including the implementation to store them in tiles of 4^3 voxels instead, so
+// that voxels close along y and z are close in memory. Results are the same with
+// either layout.
+
+typedef MELT_INDEX_TYPE melt_index_t;
+
 typedef struct
 {
     float x;
@@ -54,11 +67,21 @@ typedef struct
 typedef struct
 {
     melt_vec3_t* vertices;
-    uint16_t* indices;
+    melt_index_t* indices;
     uint32_t vertex_count;
     uint32_t index_count;
 }  melt_mesh_t;
 
+// Placement of a mesh of params.meshes in the scene of an occluder.
+typedef struct
+{
+    // Index of the mesh in params.meshes.
+    uint32_t mesh_index;
+    // Row major 3x4 affine transform, 12 floats, from the space of the mesh to
+    // world space. NULL for the identity.
+    const float* transform;
+} melt_instance_t;
+
 typedef enum melt_occluder_box_type_t
 {
     MELT_OCCLUDER_BOX_TYPE_NONE      = 0,
@@ -93,6 +116,53 @@ typedef struct
     float voxelScale;
 } melt_debug_params_t;
 
+typedef enum melt_grid_type_t
+{
+    // One entry per voxel of the mesh bounds.
+    MELT_GRID_TYPE_DENSE  = 0,
+    // Bricks of 16^3 voxels allocated only where shell or inner voxels exist,
+    // memory scales with the surface and the interior of the mesh rather than
+    // with its bounds.
+    MELT_GRID_TYPE_SPARSE = 1
+} melt_grid_type_t;
+
+typedef enum melt_extent_search_t
+{
+    // Grows a box along the x = y diagonal of each z slice from every inner voxel
+    // and keeps the z slice giving the largest box.
+    MELT_EXTENT_SEARCH_DIAGONAL      = 0,
+    // Grows the diagonal boxes further one layer at a time while the layers hold
+    // only inner voxels left to fill, each layer is checked at once with a summed
+    // volume table of these voxels. Finds larger boxes, the table takes 4 bytes
+    // per voxel of the grid, or about 2.4 bytes per voxel of the field bricks of
+    // sparse grids.
+    MELT_EXTENT_SEARCH_SUMMED_VOLUME = 1,
+    // Finds the largest box whose first corner is each inner voxel, the greedy
+    // fill takes the largest box of the grid at each iteration. Slower on large
+    // solids, no extra memory.
+    MELT_EXTENT_SEARCH_EXACT         = 2
+} melt_extent_search_t;
+
+typedef enum melt_grid_frame_t
+{
+    // The grid is aligned with the world axes.
+    MELT_GRID_FRAME_WORLD          = 0,
+    // The grid is aligned with the principal axes of the surface of the mesh,
+    // unless the world axes bound the mesh more tightly.
+    MELT_GRID_FRAME_PRINCIPAL_AXES = 1,
+    // The grid is aligned with params.grid_axes.
+    MELT_GRID_FRAME_CUSTOM         = 2
+} melt_grid_frame_t;
+
+typedef enum melt_error_t
+{
+    MELT_ERROR_NONE                  = 0,
+    MELT_ERROR_MESH_NOT_WATER_TIGHT  = 1,
+    MELT_ERROR_MEMORY_LIMIT_EXCEEDED = 2,
+    MELT_ERROR_BOX_LIMIT_EXCEEDED    = 3,
+    MELT_ERROR_MESH_NOT_HEIGHTFIELD  = 4
+} melt_error_t;
+
 typedef struct
 {
     uint32_t _start_canary;
@@ -100,18 +170,197 @@ typedef struct
     melt_occluder_box_type_flags_t box_type_flags;
     melt_debug_params_t debug;
     float voxel_size;
+    // Size of the voxels along each axis of the grid, used instead of voxel_size
+    // when all its components are above 0. Flat or elongated meshes keep their
+    // detail along their short axes with far fewer voxels along their long ones.
+    melt_vec3_t voxel_size_per_axis;
     float fill_pct;
+    // Upper bound on the memory the generation may use, 0 for no limit. The
+    // generation fails with MELT_ERROR_MEMORY_LIMIT_EXCEEDED before allocating
+    // anything when melt_estimate_memory(params) is above this limit.
+    uint64_t max_memory_bytes;
+    melt_grid_type_t grid_type;
+    // Radius in voxels of the morphological closing applied to the shell of
+    // meshes that are not water tight, 0 to disable. Gaps in the mesh up to twice
+    // this many voxels wide are closed. The interior is grown back toward the
+    // mesh by the same radius without crossing it, so the occluder reaches at
+    // most the radius into the closed gaps, and parts of the mesh thinner than
+    // about twice the radius may be left out of it. Water tight meshes are not
+    // affected. Grows the grid by the radius on each side.
+    uint32_t hole_closing_voxels;
+    // Upper bound on the number of boxes of the occluder, 0 for no limit. The
+    // greedy fill stops at this many boxes even if fill_pct is not reached.
+    uint32_t max_box_count;
+    // Nonzero to fill each connected component of the inner voxels in its own
+    // grid, in parallel with OpenMP. fill_pct applies to each component.
+    uint32_t split_components;
+    // How the greedy fill searches the largest box at each inner voxel.
+    melt_extent_search_t extent_search;
+    // Number of grids of voxels twice as large as the next one that the greedy
+    // fill fits boxes on before the grid of voxel_size, 0 to disable.
+    uint32_t coarse_levels;
+    // Set to merge boxes sharing a whole face once the greedy fill is done, the
+    // merged boxes cover the same voxels with fewer boxes.
+    uint32_t merge_boxes;
+    // Set to push each face of each box outwards, by up to one voxel, until it
+    // touches the triangles of the mesh.
+    uint32_t refine_boxes;
+    // Orientation of the voxel grid, the boxes of a rotated grid are oriented
+    // boxes.
+    melt_grid_frame_t grid_frame;
+    // Axes of the grid in world space for MELT_GRID_FRAME_CUSTOM, orthonormalized
+    // in order.
+    melt_vec3_t grid_axes[3];
+    // Meshes of a scene voxelized into one grid, used instead of mesh when
+    // mesh_count is above 0.
+    const melt_mesh_t* meshes;
+    uint32_t mesh_count;
+    // Instances of params.meshes, several instances may share a mesh. Each mesh
+    // is placed once as is when instance_count is 0.
+    const melt_instance_t* instances;
+    uint32_t instance_count;
+    // Set to fill the instances of a scene as one solid, boxes then span across
+    // the faces where instances meet.
+    uint32_t fuse_instances;
+    // Largest thickness in voxels of the walls, single sided planes and fences
+    // filled as flat slabs, 0 to disable. Meshes that are not water tight are
+    // filled when slabs are found, see result slab_voxel_count.
+    uint32_t thin_wall_voxels;
     uint32_t _end_canary;
 } melt_params_t;
 
+// Number of levels of detail of a result, the levels stop at 50%, 75%, 90% and
+// 100% of the volume of the inner voxels.
+#define MELT_LOD_COUNT 4
+
+// Level of detail of an occluder, the first box_count boxes of the occluder mesh.
+typedef struct
+{
+    uint32_t box_count;
+    // Fraction of the volume of the inner voxels filled by these boxes.
+    float fill_pct;
+} melt_lod_t;
+
 typedef struct
 {
+    // Boxes are ordered by decreasing volume, any prefix of the boxes is an
+    // occluder of lower detail. Each box uses the same number of vertices and
+    // indices and only references its own vertices.
     melt_mesh_t mesh;
     melt_mesh_t debug_mesh;
+    melt_error_t error;
+    uint64_t peak_memory_bytes;
+    // Voxel size the occluder was generated with.
+    float voxel_size;
+    // Size of the voxels along each axis of the grid the occluder was generated
+    // with, voxel_size on each axis unless params.voxel_size_per_axis was set.
+    melt_vec3_t voxel_size_per_axis;
+    // Per box, fraction of the volume of the inner voxels filled by the boxes up
+    // to and including that box.
+    float* box_fill_pcts;
+    uint32_t box_count;
+    // Shortest prefixes of the boxes reaching each level, or all the boxes when
+    // the generation stopped before.
+    melt_lod_t lods[MELT_LOD_COUNT];
+    // Number of boxes removed by params.merge_boxes.
+    uint32_t merged_box_count;
+    // Number of shell voxels filled as slabs by params.thin_wall_voxels.
+    uint64_t slab_voxel_count;
+    // Axes of the grid in world space, the edges of the boxes follow them.
+    melt_vec3_t grid_axes[3];
+    // For scenes, indices in params.instances, or params.meshes, of the instances
+    // box i overlaps, from box_instances[box_instance_offsets[i]] up to
+    // box_instances[box_instance_offsets[i + 1]]. NULL for single meshes.
+    uint32_t* box_instance_offsets;
+    uint32_t* box_instances;
 } melt_result_t;
 
+// Returns 1 on success, 0 on failure in which case result->error holds the reason.
 int melt_generate_occluder(melt_params_t params, melt_result_t* result);
 
+// Generates the occluder of the finest multiple of params.voxel_size with at most
+// max_box_count boxes (0 for no limit) within params.max_memory_bytes, or of the
+// coarsest one filling target_fill_pct when above 0. See result->voxel_size.
+int melt_generate_occluder_auto(melt_params_t params, uint32_t max_box_count, float target_fill_pct, melt_result_t* result);
+
+// Voxelized mesh, the classified voxels of a mesh from which several occluders
+// can be generated.
+typedef struct melt_voxelized_mesh_t melt_voxelized_mesh_t;
+
+// Voxelizes and classifies the mesh or the scene of params once for several
+// occluders. Returns NULL on failure in which case out_error holds the reason.
+melt_voxelized_mesh_t* melt_voxelize_mesh(melt_params_t params, melt_error_t* out_error);
+
+// Generates an occluder from a voxelized mesh, which is left unchanged and may be
+// shared between threads.
+int melt_generate_occluder_from_voxelized_mesh(const melt_voxelized_mesh_t* voxelized_mesh, melt_params_t params, melt_result_t* result);
+
+void melt_free_voxelized_mesh(melt_voxelized_mesh_t* voxelized_mesh);
+
+// Height grid of a terrain, y up. Sample (x, z) lies at (origin.x + x * spacing_x,
+// origin.y + heights[x + z * width], origin.z + z * spacing_z), the surface is
+// linear between the samples of each cell.
+typedef struct
+{
+    const float* heights;
+    uint32_t width;
+    uint32_t depth;
+    melt_vec3_t origin;
+    float spacing_x;
+    float spacing_z;
+    // Height of the bottom of the boxes, relative to origin.y like the heights.
+    // Cells below the bottom get no box.
+    float bottom;
+    // Cells along each side of the tiles, rounded up to a power of two, 0 for 64.
+    // The boxes of a tile never cross its border.
+    uint32_t tile_size;
+} melt_heightfield_t;
+
+// Generates the occluder of a terrain, or of the mesh of params when
+// heightfield.heights is NULL, from boxes under its surface. Returns 1 on
+// success, 0 on failure in which case result->error holds the reason.
+int melt_generate_heightfield_occluder(melt_heightfield_t heightfield, melt_params_t params, melt_result_t* result);
+
+// Upper bound of the memory melt_generate_heightfield_occluder allocates.
+uint64_t melt_estimate_heightfield_memory(melt_heightfield_t heightfield, melt_params_t params);
+
+// Bounding volume hierarchy of the triangles of a mesh, for the queries of the
+// triangles near a box in logarithmic time.
+typedef struct melt_triangle_bvh_t melt_triangle_bvh_t;
+
+// Builds the hierarchy of the triangles of mesh, it holds a copy of them.
+melt_triangle_bvh_t* melt_build_triangle_bvh(melt_mesh_t mesh);
+
+// Writes up to max_triangle_count indices of the triangles overlapping the box
+// from min to max to out_triangles, returns the number of such triangles.
+uint32_t melt_query_triangle_bvh(const melt_triangle_bvh_t* bvh, melt_vec3_t min, melt_vec3_t max, uint32_t* out_triangles, uint32_t max_triangle_count);
+
+// Returns 1 when a triangle intersects the box from min to max, 0 otherwise.
+int melt_triangle_bvh_intersects_box(const melt_triangle_bvh_t* bvh, melt_vec3_t min, melt_vec3_t max);
+
+void melt_free_triangle_bvh(melt_triangle_bvh_t* bvh);
+
+typedef struct
+{
+    // Boxes intersecting or touching a triangle of the mesh.
+    uint32_t intersecting_box_count;
+    // Boxes clear of the triangles whose center is outside the mesh.
+    uint32_t outside_box_count;
+    // Index of the first invalid box, UINT32_MAX when every box is valid.
+    uint32_t first_invalid_box;
+} melt_validation_t;
+
+// Returns 1 when every box of result lies strictly inside mesh, 0 otherwise, and
+// fills out_validation when it is not NULL.
+int melt_validate_occluder(melt_mesh_t mesh, const melt_result_t* result, melt_validation_t* out_validation);
+
+// Predicts the peak number of bytes melt_generate_occluder allocates for these
+// params from the mesh bounds and voxel size, without voxelizing the mesh. The
+// prediction is an upper bound and does not include the output meshes. Sparse
+// grids predict their bricks from the volume of the mesh, which assumes a
+// closed mesh, or bound them by the grid when hole closing is enabled.
+uint64_t melt_estimate_memory(melt_params_t params);
+
 void melt_free_result(melt_result_t result);
 
 #ifndef MELT_ASSERT
@@ -148,15 +397,36 @@ void melt_free_result(melt_result_t result);
 #define MELT_ALLOCA(T, N) (T*)_alloca(N * sizeof(T))
 #endif // !_MSC_VER
 
+#include <stdlib.h>  // qsort
 #include <math.h>    // fabsf
 #include <float.h>   // FLT_MAX
 #include <limits.h>  // INT_MAX
 #include <string.h>  // memset
 #include <stdbool.h> // bool
 
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 #define MELT_ARRAY_LENGTH(array) ((int)(sizeof(array) / sizeof(*array)))
 #define MELT_UNUSED(value) (void)value
 
+#define MELT_TILE_SIZE_LOG2 2
+#define MELT_TILE_SIZE (1u << MELT_TILE_SIZE_LOG2)
+#define MELT_TILE_VOXEL_COUNT (MELT_TILE_SIZE * MELT_TILE_SIZE * MELT_TILE_SIZE)
+
+#define MELT_BRICK_SIZE_LOG2 4
+#define MELT_BRICK_SIZE (1u << MELT_BRICK_SIZE_LOG2)
+#define MELT_BRICK_VOXEL_COUNT (MELT_BRICK_SIZE * MELT_BRICK_SIZE * MELT_BRICK_SIZE)
+#define MELT_BRICK_WORD_COUNT (MELT_BRICK_VOXEL_COUNT / 64)
+#define MELT_BRICK_CORNER_COUNT ((MELT_BRICK_SIZE + 1) * (MELT_BRICK_SIZE + 1) * (MELT_BRICK_SIZE + 1))
+#define MELT_EMPTY_BRICK UINT32_MAX
+#define MELT_FULL_BRICK (UINT32_MAX - 1)
+#define MELT_INVALID_INDEX UINT64_MAX
+
+// Bricks filled in parallel by each step of the flood fill of the exterior.
+#define MELT_FILL_BATCH_SIZE 256
+
 typedef melt_vec3_t vec3_t;
 typedef struct
 {
@@ -188,7 +458,6 @@ typedef struct
 
 typedef struct
 {
-    _aabb_t aabb;
     uvec3_t position;
 } _voxel_t;
 
@@ -222,30 +491,58 @@ typedef struct
 
 typedef struct
 {
-    uint8_t visibility : 6;
     uint8_t clipped : 1;
     uint8_t inner : 1;
 } _voxel_status_t;
 
-typedef enum _visibility_t
+// Run of voxels [x0, x1) of the row (y, z).
+typedef struct
+{
+    uint32_t y;
+    uint32_t z;
+    uint32_t x0;
+    uint32_t x1;
+} _span_t;
+
+typedef struct
+{
+    _span_t* spans;
+    uint32_t count;
+    uint32_t capacity;
+} _span_stack_t;
+
+// First and last bricks holding set voxels of each line of bricks along each
+// axis, first is past last on the lines without set voxels. A line along an axis
+// is indexed by the two other coordinates of its bricks.
+typedef struct
 {
-    MELT_AXIS_VISIBILITY_NULL    =      0,
-    MELT_AXIS_VISIBILITY_PLUS_X  = 1 << 0,
-    MELT_AXIS_VISIBILITY_MINUS_X = 1 << 1,
-    MELT_AXIS_VISIBILITY_PLUS_Y  = 1 << 2,
-    MELT_AXIS_VISIBILITY_MINUS_Y = 1 << 3,
-    MELT_AXIS_VISIBILITY_PLUS_Z  = 1 << 4,
-    MELT_AXIS_VISIBILITY_MINUS_Z = 1 << 5,
-    MELT_AXIS_VISIBILITY_ALL     =   0x3f
-} _visibility_t;
+    uvec3_t dimension;
+    uint32_t* bounds[3];
+} _brick_lines_t;
 
 typedef struct
 {
     uvec3_t position;
     uvec3_t extent;
-    uint32_t volume;
+    uint64_t volume;
 } _max_extent_t;
 
+// Connected component of inner voxels, the runs [run_begin, run_end) of the
+// labelled runs, and the boxes filling it once generated.
+typedef struct
+{
+    uint32_t run_begin;
+    uint32_t run_end;
+    // Bounds of the voxels of the component, max is exclusive.
+    uvec3_t min;
+    uvec3_t max;
+
+    _max_extent_t* max_extents;
+    uint32_t max_extent_count;
+    uint64_t inner_voxel_count;
+    uint64_t allocated_bytes;
+} _component_t;
+
 typedef struct
 {
     uint32_t element_count;
@@ -265,17 +562,73 @@ typedef struct
     _voxel_set_plane_t* y;
     _voxel_set_plane_t* z;
 
+    // Storage of the voxels of all planes, each plane points to its own range.
+    _voxel_t* voxels;
+
     uint32_t x_count;
     uint32_t y_count;
     uint32_t z_count;
 } _voxel_set_planes_t;
 
+typedef struct
+{
+    // Number of bricks along each axis.
+    uvec3_t dimension;
+    // Per brick of the grid, index of the brick in the storage or MELT_EMPTY_BRICK.
+    uint32_t* slots;
+    // Per stored brick, its position in bricks.
+    uvec3_t* positions;
+    uint32_t count;
+    uint32_t capacity;
+} _brick_map_t;
+
+// One bit per voxel of a grid, stored per brick in the order of the voxels of
+// the shell bricks: each word holds four rows of a brick along x. Bricks whose
+// voxels within the grid are all clear or all set have no storage, their slot is
+// MELT_EMPTY_BRICK or MELT_FULL_BRICK. Stored voxels past the grid are clear.
+typedef struct
+{
+    uvec3_t dimension;
+    _brick_map_t map;
+    uint64_t* words;
+} _brick_bitset_t;
+
+// Per corner of the voxels of a grid, the number of voxels left to fill, inner
+// voxels that are not clipped, in the box between the origin of the grid and the
+// corner. The table has one more corner than the grid has voxels along each axis,
+// its sums are kept modulo 2^32. Sparse grids keep a table per field brick of
+// bricks in place of the table of the grid, over the voxels of the brick only.
+typedef struct
+{
+    uvec3_t dimension;
+    uint32_t* sums;
+
+    const _brick_map_t* bricks;
+    uint16_t* brick_sums;
+} _summed_volume_table_t;
+
+typedef struct
+{
+    // Size of the voxels of the probe in voxels of the shell it is downsampled from.
+    uint32_t factor;
+    melt_result_t result;
+    // Fraction of the mesh volume filled by the boxes.
+    float fill_pct;
+} _auto_probe_t;
+
 typedef struct
 {
     uvec3_t dimension;
-    uint32_t size;
+    // Number of entries of the voxel field and the minimum distance field.
+    uint64_t size;
+    bool sparse;
 
-    int32_t* voxel_indices;
+    // Sparse grids only, bricks of the shell bitset and of the fields.
+    _brick_map_t shell_bricks;
+    _brick_map_t field_bricks;
+
+    // One bit per voxel, set for shell voxels (voxels intersecting the mesh).
+    uint64_t* shell_voxels;
     _voxel_status_t* voxel_field;
     _min_distance_t* min_distance_field;
 
@@ -286,8 +639,57 @@ typedef struct
 
     _max_extent_t* max_extents;
     uint32_t max_extents_count;
+
+    // Bytes allocated at most by the classification of the voxels and the
+    // generation of the fields on top of the context.
+    uint64_t classification_bytes;
+    // Whether the classification built the hierarchy of the triangles of the
+    // scene to find whether the exterior leaks.
+    bool classification_bvh;
+    // Number of shell voxels the classification filled as slabs.
+    uint64_t slab_voxel_count;
+    // Hierarchy of the triangles of the scene held by the caller across several
+    // generations, or NULL when each step builds its own.
+    const melt_triangle_bvh_t* scene_bvh;
 } _context_t;
 
+struct melt_voxelized_mesh_t
+{
+    // Context holding the voxel field and the minimum distance field before any
+    // box is clipped.
+    _context_t context;
+    _aabb_t grid_aabb;
+    float voxel_size;
+    vec3_t voxel_size_per_axis;
+    // Axes of the grid in world space, oriented when they are not the world axes.
+    vec3_t grid_axes[3];
+    bool oriented;
+};
+
+// Node of a bounding volume hierarchy of triangles. Leaves hold triangle_count
+// triangles from first, inner nodes have no triangle and their children are
+// first and first + 1.
+typedef struct
+{
+    _aabb_t aabb;
+    uint32_t first;
+    uint32_t triangle_count;
+} _bvh_node_t;
+
+struct melt_triangle_bvh_t
+{
+    _bvh_node_t* nodes;
+    uint32_t node_count;
+    uint32_t triangle_count;
+    // Index in the mesh of each triangle, in the order of the leaves.
+    uint32_t* triangles;
+    // Coordinates of the triangles in the order of the leaves, one array per
+    // coordinate of each vertex, x, y and z of v0 first.
+    float* coordinates[9];
+};
+
+static const float _lod_fill_pcts[MELT_LOD_COUNT] = { 0.5f, 0.75f, 0.9f, 1.0f };
+
 static const color_3u8_t _color_null = { 0, 0, 0 };
 
 #ifdef MELT_DEBUG
@@ -417,6 +819,11 @@ static vec3_t _vec3_div(vec3_t v, float divisor)
     return _vec3_mulf(v, 1.0f / divisor);
 }
 
+static vec3_t _vec3_div_vec3(vec3_t a, vec3_t b)
+{
+    return _vec3_init(a.x / b.x, a.y / b.y, a.z / b.z);
+}
+
 static vec3_t _vec3_sub(vec3_t a, vec3_t b)
 {
     return _vec3_init(a.x - b.x, a.y - b.y, a.z - b.z);
@@ -462,14 +869,18 @@ static svec3_t _svec3_init(int32_t x, int32_t y, int32_t z)
     return v;
 }
 
-static int _svec3_equals(svec3_t a, svec3_t b)
+static int _uvec3_equals(uvec3_t a, uvec3_t b)
 {
     return a.x == b.x && a.y == b.y && a.z == b.z;
 }
 
-static int _uvec3_equals(uvec3_t a, uvec3_t b)
+static uvec3_t _uvec3_add(uvec3_t a, uvec3_t b)
 {
-    return a.x == b.x && a.y == b.y && a.z == b.z;
+    uvec3_t v;
+    v.x = a.x + b.x;
+    v.y = a.y + b.y;
+    v.z = a.z + b.z;
+    return v;
 }
 
 static float _float_min(float a, float b) {
@@ -485,6 +896,11 @@ static uint32_t _uint32_t_min(uint32_t a, uint32_t b)
     return a < b ? a : b;
 }
 
+static uint32_t _uint32_t_max(uint32_t a, uint32_t b)
+{
+    return a > b ? a : b;
+}
+
 static vec3_t _vec3_min(vec3_t a, vec3_t b)
 {
     float x = _float_min(a.x, b.x);
@@ -692,10 +1108,10 @@ static bool _aabb_intersects_triangle(const _triangle_t* triangle, vec3_t aabb_c
     return true;
 }
 
-static inline uint32_t _flatten_3d(uvec3_t index, uvec3_t dimension)
+static inline uint64_t _flatten_3d(uvec3_t index, uvec3_t dimension)
 {
-    uint32_t out_index = index.x + dimension.x * index.y + dimension.x * dimension.y * index.z;
-    MELT_ASSERT(out_index < dimension.x * dimension.y * dimension.z);
+    uint64_t out_index = index.x + (uint64_t)dimension.x * (index.y + (uint64_t)dimension.y * index.z);
+    MELT_ASSERT(out_index < (uint64_t)dimension.x * dimension.y * dimension.z);
     return out_index;
 }
 
@@ -706,15 +1122,15 @@ static inline uint32_t _flatten_2d(uvec2_t index, uvec2_t dimension)
     return out_index;
 }
 
-static inline uvec3_t _unflatten_3d(uint32_t position, uvec3_t dimension)
+static inline uvec3_t _unflatten_3d(uint64_t position, uvec3_t dimension)
 {
     uvec3_t out_index;
 
-    uint32_t dim_xy = dimension.x * dimension.y;
-    out_index.z = position / dim_xy;
+    uint64_t dim_xy = (uint64_t)dimension.x * dimension.y;
+    out_index.z = (uint32_t)(position / dim_xy);
     position -= out_index.z * dim_xy;
-    out_index.y = position / dimension.x;
-    out_index.x = position % dimension.x;
+    out_index.y = (uint32_t)(position / dimension.x);
+    out_index.x = (uint32_t)(position % dimension.x);
 
     MELT_ASSERT(out_index.x < dimension.x);
     MELT_ASSERT(out_index.y < dimension.y);
@@ -723,236 +1139,270 @@ static inline uvec3_t _unflatten_3d(uint32_t position, uvec3_t dimension)
     return out_index;
 }
 
-static float _map_to_voxel_max_func(float value, float voxel_size)
+#if defined(MELT_TILED_FIELDS)
+static inline uvec3_t _tile_dimension(uvec3_t dimension)
 {
-    float sign = value < 0.0f ? -1.0f : 1.0f;
-    float result = value + sign * voxel_size * 0.5f;
-    return ceilf(result / voxel_size) * voxel_size;
+    uvec3_t tile_dimension;
+    tile_dimension.x = (dimension.x + MELT_TILE_SIZE - 1) >> MELT_TILE_SIZE_LOG2;
+    tile_dimension.y = (dimension.y + MELT_TILE_SIZE - 1) >> MELT_TILE_SIZE_LOG2;
+    tile_dimension.z = (dimension.z + MELT_TILE_SIZE - 1) >> MELT_TILE_SIZE_LOG2;
+    return tile_dimension;
 }
+#endif
 
-static vec3_t _map_to_voxel_max_bound(vec3_t position, float voxel_size)
+// Number of entries of the fields of a dense grid, tiled fields cover the grid
+// rounded up to whole tiles.
+static inline uint64_t _dense_field_size(uvec3_t dimension)
 {
-    float x = _map_to_voxel_max_func(position.x, voxel_size);
-    float y = _map_to_voxel_max_func(position.y, voxel_size);
-    float z = _map_to_voxel_max_func(position.z, voxel_size);
+#if defined(MELT_TILED_FIELDS)
+    const uvec3_t tile_dimension = _tile_dimension(dimension);
+    return (uint64_t)tile_dimension.x * tile_dimension.y * tile_dimension.z * MELT_TILE_VOXEL_COUNT;
+#else
+    return (uint64_t)dimension.x * dimension.y * dimension.z;
+#endif
+}
 
-    return _vec3_init(x, y, z);
+// Index of the voxel in the fields of a dense grid.
+static inline uint64_t _dense_field_index(uvec3_t position, uvec3_t dimension)
+{
+#if defined(MELT_TILED_FIELDS)
+    uvec3_t tile;
+    tile.x = position.x >> MELT_TILE_SIZE_LOG2;
+    tile.y = position.y >> MELT_TILE_SIZE_LOG2;
+    tile.z = position.z >> MELT_TILE_SIZE_LOG2;
+
+    const uint32_t mask = MELT_TILE_SIZE - 1;
+    const uint32_t local_index = (position.x & mask) | (position.y & mask) << MELT_TILE_SIZE_LOG2 | (position.z & mask) << (2 * MELT_TILE_SIZE_LOG2);
+    return _flatten_3d(tile, _tile_dimension(dimension)) * MELT_TILE_VOXEL_COUNT + local_index;
+#else
+    return _flatten_3d(position, dimension);
+#endif
 }
 
-static float _map_to_voxel_min_func(float value, float voxel_size)
+// Position of the voxel at index in the fields of a dense grid, the entries of
+// tiles crossing the border of the grid may lie outside of the grid.
+static inline uvec3_t _dense_field_position(uint64_t index, uvec3_t dimension)
 {
-    float sign = value < 0.0f ? -1.0f : 1.0f;
-    float result = value + sign * voxel_size * 0.5f;
-    return floorf(result / voxel_size) * voxel_size;
+#if defined(MELT_TILED_FIELDS)
+    const uvec3_t tile = _unflatten_3d(index / MELT_TILE_VOXEL_COUNT, _tile_dimension(dimension));
+    const uint32_t local_index = (uint32_t)(index % MELT_TILE_VOXEL_COUNT);
+    const uint32_t mask = MELT_TILE_SIZE - 1;
+
+    uvec3_t position;
+    position.x = (tile.x << MELT_TILE_SIZE_LOG2) + (local_index & mask);
+    position.y = (tile.y << MELT_TILE_SIZE_LOG2) + ((local_index >> MELT_TILE_SIZE_LOG2) & mask);
+    position.z = (tile.z << MELT_TILE_SIZE_LOG2) + (local_index >> (2 * MELT_TILE_SIZE_LOG2));
+    return position;
+#else
+    return _unflatten_3d(index, dimension);
+#endif
 }
 
-static vec3_t _map_to_voxel_min_bound(vec3_t position, float voxel_size)
+static inline uint64_t _bitset_word_count(uint64_t bit_count)
 {
-    float x = _map_to_voxel_min_func(position.x, voxel_size);
-    float y = _map_to_voxel_min_func(position.y, voxel_size);
-    float z = _map_to_voxel_min_func(position.z, voxel_size);
+    return (bit_count + 63) / 64;
+}
 
-    return _vec3_init(x, y, z);
+static inline bool _bitset_test(const uint64_t* bitset, uint64_t index)
+{
+    return (bitset[index >> 6] >> (index & 63)) & 1;
 }
 
-static _aabb_t _generate_aabb_from_triangle(const _triangle_t* triangle)
+static inline void _bitset_set(uint64_t* bitset, uint64_t index)
 {
-    _aabb_t aabb;
+    bitset[index >> 6] |= (uint64_t)1 << (index & 63);
+}
 
-    aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
-    aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+static inline void _bitset_clear(uint64_t* bitset, uint64_t index)
+{
+    bitset[index >> 6] &= ~((uint64_t)1 << (index & 63));
+}
 
-    aabb.min = _vec3_min(aabb.min, triangle->v0);
-    aabb.max = _vec3_max(aabb.max, triangle->v0);
+static inline uint32_t _popcount64(uint64_t value)
+{
+    value = value - ((value >> 1) & 0x5555555555555555ULL);
+    value = (value & 0x3333333333333333ULL) + ((value >> 2) & 0x3333333333333333ULL);
+    value = (value + (value >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (uint32_t)((value * 0x0101010101010101ULL) >> 56);
+}
 
-    aabb.min = _vec3_min(aabb.min, triangle->v1);
-    aabb.max = _vec3_max(aabb.max, triangle->v1);
+// Returns a copy of the first byte_size bytes of data in a new allocation of
+// new_byte_size bytes, data is freed.
+static void* _grow_allocation(void* data, uint64_t byte_size, uint64_t new_byte_size)
+{
+    uint8_t* new_data = MELT_MALLOC(uint8_t, new_byte_size);
+    if (data)
+    {
+        memcpy(new_data, data, byte_size);
+        MELT_FREE(data);
+    }
+    return new_data;
+}
 
-    aabb.min = _vec3_min(aabb.min, triangle->v2);
-    aabb.max = _vec3_max(aabb.max, triangle->v2);
+static inline uvec3_t _brick_position(uvec3_t position)
+{
+    uvec3_t brick;
+    brick.x = position.x >> MELT_BRICK_SIZE_LOG2;
+    brick.y = position.y >> MELT_BRICK_SIZE_LOG2;
+    brick.z = position.z >> MELT_BRICK_SIZE_LOG2;
+    return brick;
+}
 
-    return aabb;
+static inline uint32_t _brick_local_index(uvec3_t position)
+{
+    const uint32_t mask = MELT_BRICK_SIZE - 1;
+    return (position.x & mask) | ((position.y & mask) << MELT_BRICK_SIZE_LOG2) | ((position.z & mask) << (2 * MELT_BRICK_SIZE_LOG2));
 }
 
-static _aabb_t _generate_aabb_from_mesh(const melt_mesh_t mesh)
+// Local index of the first voxel of the row of the brick at y, z.
+static inline uint32_t _brick_row_index(uint32_t y, uint32_t z)
 {
-    _aabb_t aabb;
+    const uint32_t mask = MELT_BRICK_SIZE - 1;
+    return ((y & mask) << MELT_BRICK_SIZE_LOG2) | ((z & mask) << (2 * MELT_BRICK_SIZE_LOG2));
+}
 
-    aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
-    aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+static inline uvec3_t _brick_voxel_position(uvec3_t brick, uint32_t local_index)
+{
+    const uint32_t mask = MELT_BRICK_SIZE - 1;
+    uvec3_t position;
+    position.x = (brick.x << MELT_BRICK_SIZE_LOG2) | (local_index & mask);
+    position.y = (brick.y << MELT_BRICK_SIZE_LOG2) | ((local_index >> MELT_BRICK_SIZE_LOG2) & mask);
+    position.z = (brick.z << MELT_BRICK_SIZE_LOG2) | (local_index >> (2 * MELT_BRICK_SIZE_LOG2));
+    return position;
+}
 
-    for (uint32_t i = 0; i < mesh.index_count; ++i)
-    {
-        aabb.min = _vec3_min(aabb.min, mesh.vertices[mesh.indices[i]]);
-        aabb.max = _vec3_max(aabb.max, mesh.vertices[mesh.indices[i]]);
-    }
+static uvec3_t _brick_map_dimension(uvec3_t dimension)
+{
+    uvec3_t brick_dimension;
+    brick_dimension.x = (dimension.x + MELT_BRICK_SIZE - 1) >> MELT_BRICK_SIZE_LOG2;
+    brick_dimension.y = (dimension.y + MELT_BRICK_SIZE - 1) >> MELT_BRICK_SIZE_LOG2;
+    brick_dimension.z = (dimension.z + MELT_BRICK_SIZE - 1) >> MELT_BRICK_SIZE_LOG2;
+    return brick_dimension;
+}
 
-    return aabb;
+static inline uint32_t _brick_map_grown_capacity(uint32_t capacity)
+{
+    return capacity > 0 ? capacity * 2 : 64;
 }
 
-static void _free_per_plane_voxel_set(_context_t* context)
+// Capacity of a brick map after count insertions.
+static uint64_t _brick_map_capacity(uint64_t count)
+{
+    uint64_t capacity = 0;
+    while (capacity < count)
+        capacity = _brick_map_grown_capacity((uint32_t)capacity);
+    return capacity;
+}
+
+static void _init_brick_map(_brick_map_t* map, uvec3_t dimension)
 {
-    for (uint32_t i = 0; i < context->voxel_set_planes.x_count; ++i)
-        MELT_FREE(context->voxel_set_planes.x[i].voxels);
-    for (uint32_t i = 0; i < context->voxel_set_planes.y_count; ++i)
-        MELT_FREE(context->voxel_set_planes.y[i].voxels);
-    for (uint32_t i = 0; i < context->voxel_set_planes.z_count; ++i)
-        MELT_FREE(context->voxel_set_planes.z[i].voxels);
+    memset(map, 0, sizeof(_brick_map_t));
+    map->dimension = _brick_map_dimension(dimension);
 
-    MELT_FREE(context->voxel_set_planes.x);
-    MELT_FREE(context->voxel_set_planes.y);
-    MELT_FREE(context->voxel_set_planes.z);
+    const uint64_t brick_count = (uint64_t)map->dimension.x * map->dimension.y * map->dimension.z;
+    map->slots = MELT_MALLOC(uint32_t, brick_count);
+    memset(map->slots, 0xff, brick_count * sizeof(uint32_t));
 }
 
-static void _generate_per_plane_voxel_set(_context_t* context)
+static void _free_brick_map(_brick_map_t* map)
 {
-    MELT_PROFILE_BEGIN();
+    MELT_FREE(map->slots);
+    MELT_FREE(map->positions);
+}
 
-    context->voxel_set_planes.x_count = context->dimension.y * context->dimension.z;
-    context->voxel_set_planes.y_count = context->dimension.x * context->dimension.z;
-    context->voxel_set_planes.z_count = context->dimension.x * context->dimension.y;
+// Bytes allocated for the brick table and the brick positions of a brick map
+// of a grid of the given dimension.
+static uint64_t _brick_map_memory_bytes(uvec3_t dimension, uint64_t capacity)
+{
+    const uvec3_t brick_dimension = _brick_map_dimension(dimension);
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+    return brick_count * sizeof(uint32_t) + capacity * sizeof(uvec3_t);
+}
 
-    context->voxel_set_planes.x = MELT_MALLOC(_voxel_set_plane_t, context->voxel_set_planes.x_count);
-    context->voxel_set_planes.y = MELT_MALLOC(_voxel_set_plane_t, context->voxel_set_planes.y_count);
-    context->voxel_set_planes.z = MELT_MALLOC(_voxel_set_plane_t, context->voxel_set_planes.z_count);
+static inline uint32_t _brick_map_slot(const _brick_map_t* map, uvec3_t position)
+{
+    return map->slots[_flatten_3d(_brick_position(position), map->dimension)];
+}
 
-    for (uint32_t i = 0; i < context->voxel_set_planes.x_count; ++i)
-    {
-        context->voxel_set_planes.x[i].voxels = MELT_MALLOC(_voxel_t, context->dimension.x);
-        context->voxel_set_planes.x[i].voxel_count = 0;
-    }
-    for (uint32_t i = 0; i < context->voxel_set_planes.y_count; ++i)
+// Stores the brick at brick_position and returns its slot, the caller grows
+// the per brick storage along with map->capacity.
+static uint32_t _brick_map_insert(_brick_map_t* map, uvec3_t brick_position)
+{
+    if (map->count == map->capacity)
     {
-        context->voxel_set_planes.y[i].voxels = MELT_MALLOC(_voxel_t, context->dimension.y);
-        context->voxel_set_planes.y[i].voxel_count = 0;
+        const uint32_t capacity = _brick_map_grown_capacity(map->capacity);
+        map->positions = (uvec3_t*)_grow_allocation(map->positions, map->count * sizeof(uvec3_t), capacity * sizeof(uvec3_t));
+        map->capacity = capacity;
     }
-    for (uint32_t i = 0; i < context->voxel_set_planes.z_count; ++i)
+
+    const uint32_t slot = map->count++;
+    map->positions[slot] = brick_position;
+    map->slots[_flatten_3d(brick_position, map->dimension)] = slot;
+    return slot;
+}
+
+static void _set_shell_voxel(_context_t* context, uvec3_t position)
+{
+    if (!context->sparse)
     {
-        context->voxel_set_planes.z[i].voxels = MELT_MALLOC(_voxel_t, context->dimension.z);
-        context->voxel_set_planes.z[i].voxel_count = 0;
+        _bitset_set(context->shell_voxels, _flatten_3d(position, context->dimension));
+        return;
     }
 
-    uvec2_t dim_yz = _uvec2_init(context->dimension.y, context->dimension.z);
-    uvec2_t dim_xz = _uvec2_init(context->dimension.x, context->dimension.z);
-    uvec2_t dim_xy = _uvec2_init(context->dimension.x, context->dimension.y);
-
-    for (uint32_t x = 0; x < context->dimension.x; ++x)
+    _brick_map_t* map = &context->shell_bricks;
+    uint32_t slot = _brick_map_slot(map, position);
+    if (slot == MELT_EMPTY_BRICK)
     {
-        for (uint32_t y = 0; y < context->dimension.y; ++y)
-        {
-            for (uint32_t z = 0; z < context->dimension.z; ++z)
-            {
-                uvec3_t position = _uvec3_init(x, y, z);
-                int32_t voxel_index = context->voxel_indices[_flatten_3d(position, context->dimension)];
-                if (voxel_index != -1)
-                {
-                    uint32_t index_yz = _flatten_2d(_uvec2_init(y, z), dim_yz);
-                    uint32_t index_xz = _flatten_2d(_uvec2_init(x, z), dim_xz);
-                    uint32_t index_xy = _flatten_2d(_uvec2_init(x, y), dim_xy);
+        const uint64_t brick_word_count = _bitset_word_count(MELT_BRICK_VOXEL_COUNT);
+        const uint32_t capacity = map->capacity;
 
-                    _voxel_set_plane_t* voxels_x_planes = &context->voxel_set_planes.x[index_yz];
-                    _voxel_set_plane_t* voxels_y_planes = &context->voxel_set_planes.y[index_xz];
-                    _voxel_set_plane_t* voxels_z_planes = &context->voxel_set_planes.z[index_xy];
+        slot = _brick_map_insert(map, _brick_position(position));
 
-                    voxels_x_planes->voxels[voxels_x_planes->voxel_count++] = context->voxel_set[voxel_index];
-                    voxels_y_planes->voxels[voxels_y_planes->voxel_count++] = context->voxel_set[voxel_index];
-                    voxels_z_planes->voxels[voxels_z_planes->voxel_count++] = context->voxel_set[voxel_index];
-                }
-            }
+        if (map->capacity != capacity)
+        {
+            context->shell_voxels = (uint64_t*)_grow_allocation(context->shell_voxels,
+                capacity * brick_word_count * sizeof(uint64_t), map->capacity * brick_word_count * sizeof(uint64_t));
+            memset(context->shell_voxels + capacity * brick_word_count, 0, (map->capacity - capacity) * brick_word_count * sizeof(uint64_t));
         }
     }
 
-    MELT_PROFILE_END();
+    _bitset_set(context->shell_voxels, (uint64_t)slot * MELT_BRICK_VOXEL_COUNT + _brick_local_index(position));
 }
 
-static void _get_field(_context_t* context, uint32_t x, uint32_t y, uint32_t z, _min_distance_t* out_min_distance, _voxel_status_t* out_status)
+static void _clear_shell_voxel(_context_t* context, uvec3_t position)
 {
-    const svec3_t InfiniteDistance = _svec3_init(INT_MAX, INT_MAX, INT_MAX);
-    const svec3_t NullDistance = _svec3_init(0, 0, 0);
+    if (!context->sparse)
+    {
+        _bitset_clear(context->shell_voxels, _flatten_3d(position, context->dimension));
+        return;
+    }
 
-    out_min_distance->dist = InfiniteDistance;
-    out_min_distance->x = x;
-    out_min_distance->y = y;
-    out_min_distance->z = z;
+    const uint32_t slot = _brick_map_slot(&context->shell_bricks, position);
+    if (slot != MELT_EMPTY_BRICK)
+        _bitset_clear(context->shell_voxels, (uint64_t)slot * MELT_BRICK_VOXEL_COUNT + _brick_local_index(position));
+}
 
-    out_status->visibility = MELT_AXIS_VISIBILITY_NULL;
-    out_status->clipped = false;
-    out_status->inner = false;
+static inline bool _shell_voxel(const _context_t* context, uvec3_t position)
+{
+    if (!context->sparse)
+        return _bitset_test(context->shell_voxels, _flatten_3d(position, context->dimension));
 
-    uvec2_t dim_yz = _uvec2_init(context->dimension.y, context->dimension.z);
-    uint32_t index_yz = _flatten_2d(_uvec2_init(y, z), dim_yz);
-    const _voxel_set_plane_t* voxels_x_plane = &context->voxel_set_planes.x[index_yz];
-    for (uint32_t i = 0; i < voxels_x_plane->voxel_count; ++i)
-    {
-        const _voxel_t* voxel = &voxels_x_plane->voxels[i];
-        int32_t distance = voxel->position.x - x;
-        if (distance > 0)
-        {
-            out_status->visibility |= MELT_AXIS_VISIBILITY_PLUS_X;
-            out_min_distance->dist.x = _uint32_t_min(out_min_distance->dist.x, distance);
-        }
-        else if (distance < 0)
-            out_status->visibility |= MELT_AXIS_VISIBILITY_MINUS_X;
-        else
-            out_min_distance->dist.x = 0;
-    }
-    uvec2_t dim_xz = _uvec2_init(context->dimension.x, context->dimension.z);
-    uint32_t index_xz = _flatten_2d(_uvec2_init(x, z), dim_xz);
-    const _voxel_set_plane_t* voxels_y_plane = &context->voxel_set_planes.y[index_xz];
-    for (uint32_t i = 0; i < voxels_y_plane->voxel_count; ++i)
-    {
-        const _voxel_t* voxel = &voxels_y_plane->voxels[i];
-        int32_t distance = voxel->position.y - y;
-        if (distance > 0)
-        {
-            out_status->visibility |= MELT_AXIS_VISIBILITY_PLUS_Y;
-            out_min_distance->dist.y = _uint32_t_min(out_min_distance->dist.y, distance);
-        }
-        else if (distance < 0)
-            out_status->visibility |= MELT_AXIS_VISIBILITY_MINUS_Y;
-        else
-            out_min_distance->dist.y = 0;
-    }
-    uvec2_t dim_xy = _uvec2_init(context->dimension.x, context->dimension.y);
-    uint32_t index_xy = _flatten_2d(_uvec2_init(x, y), dim_xy);
-    const _voxel_set_plane_t* voxels_z_plane = &context->voxel_set_planes.z[index_xy];
-    for (uint32_t i = 0; i < voxels_z_plane->voxel_count; ++i)
-    {
-        const _voxel_t* voxel = &voxels_z_plane->voxels[i];
-        int32_t distance = voxel->position.z - z;
-        if (distance > 0)
-        {
-            out_status->visibility |= MELT_AXIS_VISIBILITY_PLUS_Z;
-            out_min_distance->dist.z = _uint32_t_min(out_min_distance->dist.z, distance);
-        }
-        else if (distance < 0)
-            out_status->visibility |= MELT_AXIS_VISIBILITY_MINUS_Z;
-        else
-            out_min_distance->dist.z = 0;
-    }
-    if (out_status->visibility == MELT_AXIS_VISIBILITY_ALL)
-    {
-        if (!_svec3_equals(out_min_distance->dist, InfiniteDistance) &&
-            !_svec3_equals(out_min_distance->dist, NullDistance))
-        {
-            out_status->inner = true;
-        }
-    }
+    const uint32_t slot = _brick_map_slot(&context->shell_bricks, position);
+    return slot != MELT_EMPTY_BRICK && _bitset_test(context->shell_voxels, (uint64_t)slot * MELT_BRICK_VOXEL_COUNT + _brick_local_index(position));
 }
 
-static void _generate_fields(_context_t* context)
+static inline uint64_t _shell_voxel_bit_count(const _context_t* context)
 {
-    MELT_PROFILE_BEGIN();
+    return context->sparse ? (uint64_t)context->shell_bricks.count * MELT_BRICK_VOXEL_COUNT : (uint64_t)context->dimension.x * context->dimension.y * context->dimension.z;
+}
 
-    for (uint32_t i = 0; i < context->size; ++i)
-    {
-        _min_distance_t* min_distance = &context->min_distance_field[i];
-        _voxel_status_t* voxel_status = &context->voxel_field[i];
-        const uvec3_t position = _unflatten_3d(i, context->dimension);
-        _get_field(context, position.x, position.y, position.z, min_distance, voxel_status);
-    }
+static inline uvec3_t _shell_voxel_position(const _context_t* context, uint64_t bit_index)
+{
+    if (!context->sparse)
+        return _unflatten_3d(bit_index, context->dimension);
 
-    MELT_PROFILE_END();
+    const uvec3_t brick = context->shell_bricks.positions[bit_index / MELT_BRICK_VOXEL_COUNT];
+    return _brick_voxel_position(brick, (uint32_t)(bit_index % MELT_BRICK_VOXEL_COUNT));
 }
 
 static inline bool _inner_voxel(_voxel_status_t voxel_status)
@@ -960,731 +1410,6108 @@ static inline bool _inner_voxel(_voxel_status_t voxel_status)
     return voxel_status.inner && !voxel_status.clipped;
 }
 
-static uvec3_t _get_max_aabb_extent(const _context_t* context, const _min_distance_t* min_distance)
+// Index of the voxel in the voxel field and the minimum distance field, or
+// MELT_INVALID_INDEX when a sparse grid does not store the brick of the voxel.
+static inline uint64_t _voxel_index(const _context_t* context, uvec3_t position)
 {
-    MELT_PROFILE_BEGIN();
+    if (!context->sparse)
+        return _dense_field_index(position, context->dimension);
 
-    uvec2_t* max_aabb_extents = MELT_ALLOCA(uvec2_t, min_distance->z + min_distance->dist.z);
-    uint32_t max_aabb_extents_count = 0;
+    const uint32_t slot = _brick_map_slot(&context->field_bricks, position);
+    if (slot == MELT_EMPTY_BRICK)
+        return MELT_INVALID_INDEX;
 
-    for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
-    {
-        uvec3_t z_slice_position = _uvec3_init(min_distance->x, min_distance->y, z);
-        uint32_t z_slice_index = _flatten_3d(z_slice_position, context->dimension);
+    return (uint64_t)slot * MELT_BRICK_VOXEL_COUNT + _brick_local_index(position);
+}
 
-        MELT_ASSERT(context->voxel_field[z_slice_index].inner);
+// Whether the fields store the voxels in grid order, the order of _flatten_3d.
+static inline bool _fields_in_grid_order(const _context_t* context)
+{
+#if defined(MELT_TILED_FIELDS)
+    MELT_UNUSED(context);
+    return false;
+#else
+    return !context->sparse;
+#endif
+}
 
-        if (context->voxel_field[z_slice_index].clipped)
-            continue;
+// Index of the voxel when it is an inner voxel that is not clipped, or
+// MELT_INVALID_INDEX.
+static inline uint64_t _inner_voxel_index(const _context_t* context, uvec3_t position)
+{
+    const uint64_t index = _voxel_index(context, position);
+    if (index == MELT_INVALID_INDEX || !_inner_voxel(context->voxel_field[index]))
+        return MELT_INVALID_INDEX;
+    return index;
+}
 
-        const _min_distance_t* sample_min_distance = &context->min_distance_field[z_slice_index];
+// Size of the voxels along each axis of the grid.
+static vec3_t _voxel_extent(const melt_params_t* params)
+{
+    const vec3_t size = params->voxel_size_per_axis;
+    if (size.x > 0.0f && size.y > 0.0f && size.z > 0.0f)
+        return size;
+    return _vec3_init(params->voxel_size, params->voxel_size, params->voxel_size);
+}
 
-        uvec2_t max_extent = _uvec2_init(sample_min_distance->dist.x, sample_min_distance->dist.y);
+static float _map_to_voxel_max_func(float value, float voxel_size)
+{
+    float sign = value < 0.0f ? -1.0f : 1.0f;
+    float result = value + sign * voxel_size * 0.5f;
+    return ceilf(result / voxel_size) * voxel_size;
+}
 
-        uint32_t x = sample_min_distance->x + 1;
-        uint32_t y = sample_min_distance->y + 1;
-        uint32_t i = 1;
-        while (x < sample_min_distance->x + sample_min_distance->dist.x &&
-               y < sample_min_distance->y + sample_min_distance->dist.y)
-        {
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            if (_inner_voxel(context->voxel_field[index]))
-            {
-                const _min_distance_t* distance = &context->min_distance_field[index];
-                max_extent.x = _uint32_t_min(distance->dist.x + i, max_extent.x);
-                max_extent.y = _uint32_t_min(distance->dist.y + i, max_extent.y);
-            }
-            else
-            {
-                max_extent.x = i;
-                max_extent.y = i;
+static vec3_t _map_to_voxel_max_bound(vec3_t position, vec3_t voxel_extent)
+{
+    float x = _map_to_voxel_max_func(position.x, voxel_extent.x);
+    float y = _map_to_voxel_max_func(position.y, voxel_extent.y);
+    float z = _map_to_voxel_max_func(position.z, voxel_extent.z);
+
+    return _vec3_init(x, y, z);
+}
+
+static float _map_to_voxel_min_func(float value, float voxel_size)
+{
+    float sign = value < 0.0f ? -1.0f : 1.0f;
+    float result = value + sign * voxel_size * 0.5f;
+    return floorf(result / voxel_size) * voxel_size;
+}
+
+static vec3_t _map_to_voxel_min_bound(vec3_t position, vec3_t voxel_extent)
+{
+    float x = _map_to_voxel_min_func(position.x, voxel_extent.x);
+    float y = _map_to_voxel_min_func(position.y, voxel_extent.y);
+    float z = _map_to_voxel_min_func(position.z, voxel_extent.z);
+
+    return _vec3_init(x, y, z);
+}
+
+static _aabb_t _generate_aabb_from_triangle(const _triangle_t* triangle)
+{
+    _aabb_t aabb;
+
+    aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    aabb.min = _vec3_min(aabb.min, triangle->v0);
+    aabb.max = _vec3_max(aabb.max, triangle->v0);
+
+    aabb.min = _vec3_min(aabb.min, triangle->v1);
+    aabb.max = _vec3_max(aabb.max, triangle->v1);
+
+    aabb.min = _vec3_min(aabb.min, triangle->v2);
+    aabb.max = _vec3_max(aabb.max, triangle->v2);
+
+    return aabb;
+}
+
+static inline float* _vec3_component(vec3_t* v, uint32_t axis)
+{
+    return axis == 0 ? &v->x : (axis == 1 ? &v->y : &v->z);
+}
+
+static inline uint32_t* _uvec3_component(uvec3_t* v, uint32_t axis)
+{
+    return axis == 0 ? &v->x : (axis == 1 ? &v->y : &v->z);
+}
+
+static inline int32_t* _svec3_component(svec3_t* v, uint32_t axis)
+{
+    return axis == 0 ? &v->x : (axis == 1 ? &v->y : &v->z);
+}
+
+static inline bool _aabbs_overlap(const _aabb_t* a, const _aabb_t* b)
+{
+    return a->min.x <= b->max.x && a->max.x >= b->min.x && a->min.y <= b->max.y && a->max.y >= b->min.y &&
+        a->min.z <= b->max.z && a->max.z >= b->min.z;
+}
+
+static float _aabb_half_area(_aabb_t aabb)
+{
+    vec3_t extent = _vec3_sub(aabb.max, aabb.min);
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+static _triangle_t _mesh_triangle(const melt_mesh_t* mesh, uint32_t triangle)
+{
+    _triangle_t result;
+    result.v0 = mesh->vertices[mesh->indices[triangle * 3 + 0]];
+    result.v1 = mesh->vertices[mesh->indices[triangle * 3 + 1]];
+    result.v2 = mesh->vertices[mesh->indices[triangle * 3 + 2]];
+    return result;
+}
+
+// Meshes voxelized into one grid, the instances of the meshes or each mesh once
+// as is when there is no instance. Overlapping instances are filled as one solid.
+typedef struct
+{
+    const melt_mesh_t* meshes;
+    uint32_t mesh_count;
+    const melt_instance_t* instances;
+    uint32_t instance_count;
+} _scene_t;
+
+static _scene_t _mesh_scene(const melt_mesh_t* mesh)
+{
+    _scene_t scene;
+    scene.meshes = mesh;
+    scene.mesh_count = 1;
+    scene.instances = NULL;
+    scene.instance_count = 0;
+    return scene;
+}
+
+static _scene_t _params_scene(const melt_params_t* params)
+{
+    if (params->mesh_count == 0)
+        return _mesh_scene(&params->mesh);
+
+    _scene_t scene;
+    scene.meshes = params->meshes;
+    scene.mesh_count = params->mesh_count;
+    scene.instances = params->instances;
+    scene.instance_count = params->instance_count;
+    return scene;
+}
+
+static uint32_t _scene_instance_count(const _scene_t* scene)
+{
+    return scene->instance_count > 0 ? scene->instance_count : scene->mesh_count;
+}
+
+static const melt_mesh_t* _scene_instance_mesh(const _scene_t* scene, uint32_t instance)
+{
+    return scene->instance_count > 0 ? &scene->meshes[scene->instances[instance].mesh_index] : &scene->meshes[instance];
+}
+
+static const float* _scene_instance_transform(const _scene_t* scene, uint32_t instance)
+{
+    return scene->instance_count > 0 ? scene->instances[instance].transform : NULL;
+}
+
+static uint32_t _scene_triangle_count(const _scene_t* scene)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < _scene_instance_count(scene); ++i)
+        count += _scene_instance_mesh(scene, i)->index_count / 3;
+    return count;
+}
+
+// Column of a row major 3x4 transform, NULL being the identity.
+static vec3_t _transform_column(const float* transform, uint32_t column)
+{
+    if (!transform)
+        return _vec3_init(column == 0 ? 1.0f : 0.0f, column == 1 ? 1.0f : 0.0f, column == 2 ? 1.0f : 0.0f);
+    return _vec3_init(transform[column], transform[4 + column], transform[8 + column]);
+}
+
+static vec3_t _transform_point(const float* transform, vec3_t v)
+{
+    if (!transform)
+        return v;
+    return _vec3_init(
+        transform[0] * v.x + transform[1] * v.y + transform[2] * v.z + transform[3],
+        transform[4] * v.x + transform[5] * v.y + transform[6] * v.z + transform[7],
+        transform[8] * v.x + transform[9] * v.y + transform[10] * v.z + transform[11]);
+}
+
+// Walks the triangles of a scene in world space, one instance after the other.
+// The triangles are transformed as they are visited, no combined mesh is built.
+typedef struct
+{
+    _scene_t scene;
+    uint32_t instance;
+    uint32_t index;
+} _triangle_cursor_t;
+
+static void _init_triangle_cursor(_triangle_cursor_t* cursor, const _scene_t* scene)
+{
+    cursor->scene = *scene;
+    cursor->instance = 0;
+    cursor->index = 0;
+}
+
+// Sets out_triangle to the next triangle of the scene, cursor->instance is the
+// instance it belongs to. Returns false once all the triangles were visited.
+static bool _next_triangle(_triangle_cursor_t* cursor, _triangle_t* out_triangle)
+{
+    const _scene_t* scene = &cursor->scene;
+    for (; cursor->instance < _scene_instance_count(scene); ++cursor->instance, cursor->index = 0)
+    {
+        const melt_mesh_t* mesh = _scene_instance_mesh(scene, cursor->instance);
+        if (cursor->index + 2 >= mesh->index_count)
+            continue;
+
+        const float* transform = _scene_instance_transform(scene, cursor->instance);
+        const _triangle_t triangle = _mesh_triangle(mesh, cursor->index / 3);
+        out_triangle->v0 = _transform_point(transform, triangle.v0);
+        out_triangle->v1 = _transform_point(transform, triangle.v1);
+        out_triangle->v2 = _transform_point(transform, triangle.v2);
+        cursor->index += 3;
+        return true;
+    }
+    return false;
+}
+
+static _aabb_t _generate_aabb_from_scene(const _scene_t* scene)
+{
+    _aabb_t aabb;
+
+    aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, scene);
+    while (_next_triangle(&cursor, &triangle))
+    {
+        const _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+        aabb.min = _vec3_min(aabb.min, triangle_aabb.min);
+        aabb.max = _vec3_max(aabb.max, triangle_aabb.max);
+    }
+
+    return aabb;
+}
+
+#define MELT_BVH_MAX_LEAF_SIZE 8
+#define MELT_BVH_BIN_COUNT 16
+// Nodes at this depth are leaves whatever their triangle count, which bounds the
+// traversal stacks.
+#define MELT_BVH_MAX_DEPTH 48
+
+typedef struct
+{
+    _aabb_t aabb;
+    uint32_t triangle_count;
+} _bvh_bin_t;
+
+static void _init_bvh_bin(_bvh_bin_t* bin)
+{
+    bin->aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    bin->aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    bin->triangle_count = 0;
+}
+
+static void _add_to_bvh_bin(_bvh_bin_t* bin, const _bvh_bin_t* other)
+{
+    bin->aabb.min = _vec3_min(bin->aabb.min, other->aabb.min);
+    bin->aabb.max = _vec3_max(bin->aabb.max, other->aabb.max);
+    bin->triangle_count += other->triangle_count;
+}
+
+static inline uint32_t _bvh_bin_index(float center, float min, float scale, uint32_t bin_count)
+{
+    const uint32_t bin = (uint32_t)((center - min) * scale);
+    return bin < bin_count - 1 ? bin : bin_count - 1;
+}
+
+// Splits the triangles of the node along the binned split of least surface area
+// cost, the children are added to the hierarchy. Returns false when the node is
+// cheaper as a leaf.
+static bool _split_bvh_node(melt_triangle_bvh_t* bvh, _bvh_node_t* node, const _aabb_t* triangle_aabbs, uint32_t depth)
+{
+    if (node->triangle_count <= 1 || depth >= MELT_BVH_MAX_DEPTH)
+        return false;
+
+    _aabb_t center_aabb;
+    center_aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    center_aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (uint32_t i = node->first; i < node->first + node->triangle_count; ++i)
+    {
+        const vec3_t center = _aabb_center(triangle_aabbs[bvh->triangles[i]]);
+        center_aabb.min = _vec3_min(center_aabb.min, center);
+        center_aabb.max = _vec3_max(center_aabb.max, center);
+    }
+
+    // Small nodes use fewer bins, as many as triangles.
+    const uint32_t bin_count = node->triangle_count < MELT_BVH_BIN_COUNT ? node->triangle_count : MELT_BVH_BIN_COUNT;
+
+    const vec3_t center_extent = _vec3_sub(center_aabb.max, center_aabb.min);
+    vec3_t scale;
+    scale.x = center_extent.x > 0.0f ? bin_count / center_extent.x : 0.0f;
+    scale.y = center_extent.y > 0.0f ? bin_count / center_extent.y : 0.0f;
+    scale.z = center_extent.z > 0.0f ? bin_count / center_extent.z : 0.0f;
+
+    // Triangles are binned along the three axes at once.
+    _bvh_bin_t bins[3][MELT_BVH_BIN_COUNT];
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        for (uint32_t b = 0; b < bin_count; ++b)
+            _init_bvh_bin(&bins[axis][b]);
+    }
+
+    for (uint32_t i = node->first; i < node->first + node->triangle_count; ++i)
+    {
+        _bvh_bin_t triangle_bin;
+        triangle_bin.aabb = triangle_aabbs[bvh->triangles[i]];
+        triangle_bin.triangle_count = 1;
+
+        const vec3_t center = _aabb_center(triangle_bin.aabb);
+        _add_to_bvh_bin(&bins[0][_bvh_bin_index(center.x, center_aabb.min.x, scale.x, bin_count)], &triangle_bin);
+        _add_to_bvh_bin(&bins[1][_bvh_bin_index(center.y, center_aabb.min.y, scale.y, bin_count)], &triangle_bin);
+        _add_to_bvh_bin(&bins[2][_bvh_bin_index(center.z, center_aabb.min.z, scale.z, bin_count)], &triangle_bin);
+    }
+
+    float best_cost = FLT_MAX;
+    uint32_t best_axis = 0;
+    uint32_t best_bin = 0;
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        // Cost of the bins right of each split, then of the bins left of it.
+        float right_costs[MELT_BVH_BIN_COUNT];
+        _bvh_bin_t side;
+        _init_bvh_bin(&side);
+        for (uint32_t b = bin_count - 1; b > 0; --b)
+        {
+            _add_to_bvh_bin(&side, &bins[axis][b]);
+            right_costs[b] = side.triangle_count > 0 ? _aabb_half_area(side.aabb) * side.triangle_count : FLT_MAX;
+        }
+
+        _init_bvh_bin(&side);
+        for (uint32_t b = 0; b + 1 < bin_count; ++b)
+        {
+            _add_to_bvh_bin(&side, &bins[axis][b]);
+            if (side.triangle_count == 0 || right_costs[b + 1] == FLT_MAX)
+                continue;
+
+            const float cost = _aabb_half_area(side.aabb) * side.triangle_count + right_costs[b + 1];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = b;
+            }
+        }
+    }
+
+    // Traversing a node costs as much as intersecting a triangle.
+    const float node_area = _aabb_half_area(node->aabb);
+    const float leaf_cost = node_area * node->triangle_count;
+    if (node->triangle_count <= MELT_BVH_MAX_LEAF_SIZE && node_area + best_cost >= leaf_cost)
+        return false;
+
+    uint32_t left_count = 0;
+    if (best_cost < FLT_MAX)
+    {
+        const float min = *_vec3_component(&center_aabb.min, best_axis);
+        const float axis_scale = *_vec3_component(&scale, best_axis);
+
+        uint32_t begin = node->first;
+        uint32_t end = node->first + node->triangle_count;
+        while (begin < end)
+        {
+            vec3_t center = _aabb_center(triangle_aabbs[bvh->triangles[begin]]);
+            if (_bvh_bin_index(*_vec3_component(&center, best_axis), min, axis_scale, bin_count) <= best_bin)
+            {
+                ++begin;
+                continue;
+            }
+            const uint32_t triangle = bvh->triangles[begin];
+            bvh->triangles[begin] = bvh->triangles[--end];
+            bvh->triangles[end] = triangle;
+        }
+        left_count = begin - node->first;
+    }
+    else
+    {
+        // All the triangles share the same center.
+        left_count = node->triangle_count / 2;
+    }
+
+    _bvh_node_t* children = &bvh->nodes[bvh->node_count];
+    children[0].first = node->first;
+    children[0].triangle_count = left_count;
+    children[1].first = node->first + left_count;
+    children[1].triangle_count = node->triangle_count - left_count;
+
+    node->first = bvh->node_count;
+    node->triangle_count = 0;
+    bvh->node_count += 2;
+    return true;
+}
+
+// Builds the nodes of the hierarchy of count boxes, the leaves hold the indices
+// of the boxes in bvh->triangles. The coordinates of the triangles are left to
+// the caller.
+static void _init_bvh_nodes(melt_triangle_bvh_t* bvh, const _aabb_t* aabbs, uint32_t count)
+{
+    const uint32_t node_capacity = count > 0 ? 2 * count - 1 : 1;
+
+    bvh->nodes = MELT_MALLOC(_bvh_node_t, node_capacity);
+    bvh->node_count = 1;
+    bvh->triangle_count = count;
+    bvh->triangles = MELT_MALLOC(uint32_t, count);
+    for (uint32_t i = 0; i < count; ++i)
+        bvh->triangles[i] = i;
+
+    bvh->nodes[0].first = 0;
+    bvh->nodes[0].triangle_count = count;
+
+    // Depth first, the stack holds at most one node per level.
+    uint32_t stack[MELT_BVH_MAX_DEPTH + 1];
+    uint32_t depths[MELT_BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    stack[stack_size] = 0;
+    depths[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        --stack_size;
+        _bvh_node_t* node = &bvh->nodes[stack[stack_size]];
+        const uint32_t depth = depths[stack_size];
+
+        node->aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+        node->aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (uint32_t i = node->first; i < node->first + node->triangle_count; ++i)
+        {
+            node->aabb.min = _vec3_min(node->aabb.min, aabbs[bvh->triangles[i]].min);
+            node->aabb.max = _vec3_max(node->aabb.max, aabbs[bvh->triangles[i]].max);
+        }
+
+        if (!_split_bvh_node(bvh, node, aabbs, depth))
+            continue;
+
+        stack[stack_size] = node->first + 1;
+        depths[stack_size++] = depth + 1;
+        stack[stack_size] = node->first;
+        depths[stack_size++] = depth + 1;
+    }
+}
+
+// Builds the hierarchy of the triangles of the scene with the surface area
+// heuristic. The hierarchy holds a copy of the triangles, the scene may be freed.
+static void _init_triangle_bvh(melt_triangle_bvh_t* bvh, const _scene_t* scene)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uint32_t triangle_count = _scene_triangle_count(scene);
+
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+
+    _aabb_t* triangle_aabbs = MELT_MALLOC(_aabb_t, triangle_count);
+    _init_triangle_cursor(&cursor, scene);
+    for (uint32_t i = 0; _next_triangle(&cursor, &triangle); ++i)
+        triangle_aabbs[i] = _generate_aabb_from_triangle(&triangle);
+
+    _init_bvh_nodes(bvh, triangle_aabbs, triangle_count);
+    MELT_FREE(triangle_aabbs);
+
+    bvh->coordinates[0] = MELT_MALLOC(float, 9 * (uint64_t)triangle_count);
+    for (uint32_t c = 1; c < 9; ++c)
+        bvh->coordinates[c] = bvh->coordinates[0] + c * (uint64_t)triangle_count;
+
+    // The triangles are visited in the order of the scene and stored in the order
+    // of the leaves.
+    uint32_t* slots = MELT_MALLOC(uint32_t, triangle_count);
+    for (uint32_t i = 0; i < triangle_count; ++i)
+        slots[bvh->triangles[i]] = i;
+
+    _init_triangle_cursor(&cursor, scene);
+    for (uint32_t i = 0; _next_triangle(&cursor, &triangle); ++i)
+    {
+        const melt_vec3_t* vertices[3] = { &triangle.v0, &triangle.v1, &triangle.v2 };
+        for (uint32_t v = 0; v < 3; ++v)
+        {
+            bvh->coordinates[v * 3 + 0][slots[i]] = vertices[v]->x;
+            bvh->coordinates[v * 3 + 1][slots[i]] = vertices[v]->y;
+            bvh->coordinates[v * 3 + 2][slots[i]] = vertices[v]->z;
+        }
+    }
+
+    MELT_FREE(slots);
+
+    MELT_PROFILE_END();
+}
+
+static void _free_triangle_bvh(melt_triangle_bvh_t* bvh)
+{
+    MELT_FREE(bvh->nodes);
+    MELT_FREE(bvh->triangles);
+    MELT_FREE(bvh->coordinates[0]);
+}
+
+// Triangle i in the order of the leaves.
+static _triangle_t _bvh_triangle(const melt_triangle_bvh_t* bvh, uint32_t i)
+{
+    _triangle_t triangle;
+    triangle.v0 = _vec3_init(bvh->coordinates[0][i], bvh->coordinates[1][i], bvh->coordinates[2][i]);
+    triangle.v1 = _vec3_init(bvh->coordinates[3][i], bvh->coordinates[4][i], bvh->coordinates[5][i]);
+    triangle.v2 = _vec3_init(bvh->coordinates[6][i], bvh->coordinates[7][i], bvh->coordinates[8][i]);
+    return triangle;
+}
+
+static inline bool _bvh_triangle_overlaps(const melt_triangle_bvh_t* bvh, uint32_t i, const _aabb_t* aabb)
+{
+    float* const* c = bvh->coordinates;
+    return _float_min(c[0][i], _float_min(c[3][i], c[6][i])) <= aabb->max.x && _float_max(c[0][i], _float_max(c[3][i], c[6][i])) >= aabb->min.x &&
+        _float_min(c[1][i], _float_min(c[4][i], c[7][i])) <= aabb->max.y && _float_max(c[1][i], _float_max(c[4][i], c[7][i])) >= aabb->min.y &&
+        _float_min(c[2][i], _float_min(c[5][i], c[8][i])) <= aabb->max.z && _float_max(c[2][i], _float_max(c[5][i], c[8][i])) >= aabb->min.z;
+}
+
+// Depth first traversal of the nodes overlapping aabb.
+typedef struct
+{
+    _aabb_t aabb;
+    uint32_t stack[MELT_BVH_MAX_DEPTH + 1];
+    uint32_t stack_size;
+} _bvh_query_t;
+
+static void _init_bvh_query(const melt_triangle_bvh_t* bvh, _bvh_query_t* query, _aabb_t aabb)
+{
+    query->aabb = aabb;
+    query->stack_size = 0;
+    if (bvh->triangle_count > 0)
+        query->stack[query->stack_size++] = 0;
+}
+
+// Returns the next leaf overlapping the bounds of the query, false once all the
+// leaves are visited.
+static bool _next_bvh_leaf(const melt_triangle_bvh_t* bvh, _bvh_query_t* query, const _bvh_node_t** out_leaf)
+{
+    while (query->stack_size > 0)
+    {
+        const _bvh_node_t* node = &bvh->nodes[query->stack[--query->stack_size]];
+        if (!_aabbs_overlap(&node->aabb, &query->aabb))
+            continue;
+
+        if (node->triangle_count > 0)
+        {
+            *out_leaf = node;
+            return true;
+        }
+
+        query->stack[query->stack_size++] = node->first + 1;
+        query->stack[query->stack_size++] = node->first;
+    }
+    return false;
+}
+
+// Whether a triangle intersects the box of center and half_extent along the
+// orthonormal axes, by the separating axis test of the triangles whose bounds
+// overlap the bounds of the box. The triangles are tested in the frame of the box.
+static bool _bvh_intersects_box(const melt_triangle_bvh_t* bvh, _aabb_t bounds, vec3_t center, const vec3_t axes[3], vec3_t half_extent)
+{
+    _bvh_query_t query;
+    _init_bvh_query(bvh, &query, bounds);
+
+    const vec3_t origin = _vec3_init(0.0f, 0.0f, 0.0f);
+    const _bvh_node_t* leaf;
+    while (_next_bvh_leaf(bvh, &query, &leaf))
+    {
+        for (uint32_t i = leaf->first; i < leaf->first + leaf->triangle_count; ++i)
+        {
+            if (!_bvh_triangle_overlaps(bvh, i, &bounds))
+                continue;
+
+            const _triangle_t triangle = _bvh_triangle(bvh, i);
+            const vec3_t v0 = _vec3_sub(triangle.v0, center);
+            const vec3_t v1 = _vec3_sub(triangle.v1, center);
+            const vec3_t v2 = _vec3_sub(triangle.v2, center);
+
+            _triangle_t box_triangle;
+            box_triangle.v0 = _vec3_init(_vec3_dot(axes[0], v0), _vec3_dot(axes[1], v0), _vec3_dot(axes[2], v0));
+            box_triangle.v1 = _vec3_init(_vec3_dot(axes[0], v1), _vec3_dot(axes[1], v1), _vec3_dot(axes[2], v1));
+            box_triangle.v2 = _vec3_init(_vec3_dot(axes[0], v2), _vec3_dot(axes[1], v2), _vec3_dot(axes[2], v2));
+            if (_aabb_intersects_triangle(&box_triangle, origin, half_extent))
+                return true;
+        }
+    }
+    return false;
+}
+
+// Whether a triangle intersects aabb.
+static bool _bvh_intersects_aabb(const melt_triangle_bvh_t* bvh, _aabb_t aabb)
+{
+    const vec3_t axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    return _bvh_intersects_box(bvh, aabb, _aabb_center(aabb), axes, _vec3_mulf(_vec3_sub(aabb.max, aabb.min), 0.5f));
+}
+
+typedef struct
+{
+    vec3_t origin;
+    vec3_t direction;
+    vec3_t inverse_direction;
+} _ray_t;
+
+static _ray_t _ray_init(vec3_t origin, vec3_t direction)
+{
+    _ray_t ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    ray.inverse_direction = _vec3_init(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+    return ray;
+}
+
+// Slab test of the ray against aabb, the directions of the rays have no zero component.
+static bool _ray_intersects_aabb(const _ray_t* ray, const _aabb_t* aabb)
+{
+    const vec3_t t0 = _vec3_mul(_vec3_sub(aabb->min, ray->origin), ray->inverse_direction);
+    const vec3_t t1 = _vec3_mul(_vec3_sub(aabb->max, ray->origin), ray->inverse_direction);
+    const float t_enter = _float_max(_float_max(_float_min(t0.x, t1.x), _float_min(t0.y, t1.y)), _float_min(t0.z, t1.z));
+    const float t_exit = _float_min(_float_min(_float_max(t0.x, t1.x), _float_max(t0.y, t1.y)), _float_max(t0.z, t1.z));
+    return t_exit >= _float_max(t_enter, 0.0f);
+}
+
+// Möller-Trumbore intersection of the ray with triangle. Returns 1 when the ray
+// leaves through the front face of the triangle, -1 when it enters through it and
+// 0 when it misses.
+static int _ray_triangle_crossing(const _ray_t* ray, const _triangle_t* triangle)
+{
+    const vec3_t edge1 = _vec3_sub(triangle->v1, triangle->v0);
+    const vec3_t edge2 = _vec3_sub(triangle->v2, triangle->v0);
+    const vec3_t p = _vec3_cross(ray->direction, edge2);
+    const float determinant = _vec3_dot(edge1, p);
+    if (determinant == 0.0f)
+        return 0;
+
+    const float inverse_determinant = 1.0f / determinant;
+    const vec3_t s = _vec3_sub(ray->origin, triangle->v0);
+    const float u = _vec3_dot(s, p) * inverse_determinant;
+    if (u < 0.0f || u > 1.0f)
+        return 0;
+
+    const vec3_t q = _vec3_cross(s, edge1);
+    const float v = _vec3_dot(ray->direction, q) * inverse_determinant;
+    if (v < 0.0f || u + v > 1.0f)
+        return 0;
+
+    if (_vec3_dot(edge2, q) * inverse_determinant <= 0.0f)
+        return 0;
+
+    // The determinant is minus the dot product of the direction with the normal.
+    return determinant < 0.0f ? 1 : -1;
+}
+
+// Sum of the signed crossings of the ray with the triangles, zero when the origin
+// of the ray is outside a closed mesh. The triangles of the scene from
+// excluded_first to excluded_end are skipped.
+static int _bvh_ray_winding(const melt_triangle_bvh_t* bvh, const _ray_t* ray, uint32_t excluded_first, uint32_t excluded_end)
+{
+    uint32_t stack[MELT_BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    if (bvh->triangle_count > 0)
+        stack[stack_size++] = 0;
+
+    int winding = 0;
+    while (stack_size > 0)
+    {
+        const _bvh_node_t* node = &bvh->nodes[stack[--stack_size]];
+        if (!_ray_intersects_aabb(ray, &node->aabb))
+            continue;
+
+        if (node->triangle_count == 0)
+        {
+            stack[stack_size++] = node->first + 1;
+            stack[stack_size++] = node->first;
+            continue;
+        }
+
+        for (uint32_t i = node->first; i < node->first + node->triangle_count; ++i)
+        {
+            if (bvh->triangles[i] >= excluded_first && bvh->triangles[i] < excluded_end)
+                continue;
+            const _triangle_t triangle = _bvh_triangle(bvh, i);
+            winding += _ray_triangle_crossing(ray, &triangle);
+        }
+    }
+    return winding;
+}
+
+// Directions of the rays cast by _bvh_contains_point, off the axes so that they
+// rarely graze the edges of meshes aligned with the grid.
+static const vec3_t _inside_ray_directions[] =
+{
+    {1.0f,    0.0131f, 0.0079f},
+    {0.0107f, 1.0f,    0.0149f},
+    {0.0173f, 0.0097f, 1.0f   },
+};
+
+// Whether point is inside the mesh of bvh by the majority of the rays, which
+// tolerates a ray crossing an edge twice or leaving through a small hole. The
+// triangles from excluded_first to excluded_end are skipped, see _bvh_ray_winding.
+static bool _bvh_contains_point(const melt_triangle_bvh_t* bvh, vec3_t point, uint32_t excluded_first, uint32_t excluded_end)
+{
+    uint32_t inside_count = 0;
+    for (uint32_t i = 0; i < MELT_ARRAY_LENGTH(_inside_ray_directions); ++i)
+    {
+        const _ray_t ray = _ray_init(point, _inside_ray_directions[i]);
+        inside_count += _bvh_ray_winding(bvh, &ray, excluded_first, excluded_end) != 0 ? 1 : 0;
+    }
+    return inside_count * 2 > (uint32_t)MELT_ARRAY_LENGTH(_inside_ray_directions);
+}
+
+// Whether the point (py, pz) is to the left of the edge from a to b in the yz
+// plane. The edge is evaluated from its lowest endpoint whichever way it is
+// given, so that two triangles sharing an edge see exactly opposite sides. A
+// point on the line of the edge is moved by an infinitesimal offset along +y
+// then +z, which puts it strictly on one side of every edge.
+static bool _yz_edge_side(double ay, double az, double by, double bz, double py, double pz)
+{
+    const bool swap = ay > by || (ay == by && az > bz);
+    if (swap)
+    {
+        double t = ay; ay = by; by = t;
+        t = az; az = bz; bz = t;
+    }
+
+    double side = (by - ay) * (pz - az) - (bz - az) * (py - ay);
+    if (side == 0.0)
+        side = az - bz;
+    if (side == 0.0)
+        side = by - ay;
+    return swap ? side < 0.0 : side > 0.0;
+}
+
+// Whether the line along x through (y, z) crosses triangle, out_x is set to the
+// x of the crossing. The lines through the shared edges and vertices of a closed
+// mesh cross exactly one of the triangles around them.
+static bool _row_crosses_triangle(const _triangle_t* triangle, float y, float z, float* out_x)
+{
+    const double y0 = triangle->v0.y, z0 = triangle->v0.z;
+    const double y1 = triangle->v1.y, z1 = triangle->v1.z;
+    const double y2 = triangle->v2.y, z2 = triangle->v2.z;
+
+    const bool side0 = _yz_edge_side(y1, z1, y2, z2, y, z);
+    if (side0 != _yz_edge_side(y2, z2, y0, z0, y, z) || side0 != _yz_edge_side(y0, z0, y1, z1, y, z))
+        return false;
+
+    // Barycentric coordinates of the point in the projection of the triangle.
+    const double w0 = (y2 - y1) * (z - z1) - (z2 - z1) * (y - y1);
+    const double w1 = (y0 - y2) * (z - z2) - (z0 - z2) * (y - y2);
+    const double w2 = (y1 - y0) * (z - z0) - (z1 - z0) * (y - y0);
+    const double area = w0 + w1 + w2;
+    if (area == 0.0)
+        return false;
+
+    *out_x = (float)((w0 * triangle->v0.x + w1 * triangle->v1.x + w2 * triangle->v2.x) / area);
+    return true;
+}
+
+// Flips the bits of row, one per voxel of a row of width voxels along x whose
+// first center is at min_x, for each crossing of the line along x through
+// (y, z) with the triangles of bvh past the center of the voxel. The bits of the
+// voxels inside a closed mesh end up set.
+static void _flip_row_crossings(const melt_triangle_bvh_t* bvh, float y, float z, float min_x, float voxel_size, uint32_t width, uint64_t* row)
+{
+    uint32_t stack[MELT_BVH_MAX_DEPTH + 1];
+    uint32_t stack_size = 0;
+    if (bvh->triangle_count > 0)
+        stack[stack_size++] = 0;
+
+    while (stack_size > 0)
+    {
+        const _bvh_node_t* node = &bvh->nodes[stack[--stack_size]];
+        if (y < node->aabb.min.y || y > node->aabb.max.y || z < node->aabb.min.z || z > node->aabb.max.z)
+            continue;
+
+        if (node->triangle_count == 0)
+        {
+            stack[stack_size++] = node->first + 1;
+            stack[stack_size++] = node->first;
+            continue;
+        }
+
+        for (uint32_t i = node->first; i < node->first + node->triangle_count; ++i)
+        {
+            const _triangle_t triangle = _bvh_triangle(bvh, i);
+            float x;
+            if (!_row_crosses_triangle(&triangle, y, z, &x))
+                continue;
+
+            // Voxels whose center lies before the crossing.
+            const float count = ceilf((x - min_x) / voxel_size);
+            const uint32_t end = count <= 0.0f ? 0 : (count >= (float)width ? width : (uint32_t)count);
+            for (uint32_t word = 0; word < (end >> 6); ++word)
+                row[word] = ~row[word];
+            if (end & 63)
+                row[end >> 6] ^= ((uint64_t)1 << (end & 63)) - 1;
+        }
+    }
+}
+
+static void _free_per_plane_voxel_set(_context_t* context)
+{
+    MELT_FREE(context->voxel_set_planes.x);
+    MELT_FREE(context->voxel_set_planes.y);
+    MELT_FREE(context->voxel_set_planes.z);
+    MELT_FREE(context->voxel_set_planes.voxels);
+}
+
+#if defined(MELT_DEBUG)
+// Extract the shell voxels from the shell bitset, the voxel set is allocated
+// with the exact number of shell voxels.
+static void _generate_voxel_set(_context_t* context)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(context));
+
+    context->voxel_set_count = 0;
+    for (uint64_t i = 0; i < word_count; ++i)
+        context->voxel_set_count += _popcount64(context->shell_voxels[i]);
+
+    context->voxel_set = MELT_MALLOC(_voxel_t, context->voxel_set_count);
+
+    uint32_t voxel_count = 0;
+    for (uint64_t i = 0; i < word_count; ++i)
+    {
+        uint64_t word = context->shell_voxels[i];
+        while (word != 0)
+        {
+            uint64_t lowest_bit = word & (~word + 1);
+            uint64_t index = i * 64 + _popcount64(lowest_bit - 1);
+            context->voxel_set[voxel_count++].position = _shell_voxel_position(context, index);
+            word ^= lowest_bit;
+        }
+    }
+
+    MELT_ASSERT(voxel_count == context->voxel_set_count);
+    MELT_PROFILE_END();
+}
+
+static void _generate_per_plane_voxel_set(_context_t* context)
+{
+    MELT_PROFILE_BEGIN();
+
+    _voxel_set_planes_t* planes = &context->voxel_set_planes;
+
+    planes->x_count = context->dimension.y * context->dimension.z;
+    planes->y_count = context->dimension.x * context->dimension.z;
+    planes->z_count = context->dimension.x * context->dimension.y;
+
+    planes->x = MELT_MALLOC(_voxel_set_plane_t, planes->x_count);
+    planes->y = MELT_MALLOC(_voxel_set_plane_t, planes->y_count);
+    planes->z = MELT_MALLOC(_voxel_set_plane_t, planes->z_count);
+    planes->voxels = MELT_MALLOC(_voxel_t, 3 * context->voxel_set_count);
+
+    memset(planes->x, 0, planes->x_count * sizeof(_voxel_set_plane_t));
+    memset(planes->y, 0, planes->y_count * sizeof(_voxel_set_plane_t));
+    memset(planes->z, 0, planes->z_count * sizeof(_voxel_set_plane_t));
+
+    uvec2_t dim_yz = _uvec2_init(context->dimension.y, context->dimension.z);
+    uvec2_t dim_xz = _uvec2_init(context->dimension.x, context->dimension.z);
+    uvec2_t dim_xy = _uvec2_init(context->dimension.x, context->dimension.y);
+
+    // Count the voxels of each plane, then point each plane to its own range of
+    // the storage and fill the ranges.
+    for (uint32_t i = 0; i < context->voxel_set_count; ++i)
+    {
+        const uvec3_t position = context->voxel_set[i].position;
+        ++planes->x[_flatten_2d(_uvec2_init(position.y, position.z), dim_yz)].voxel_count;
+        ++planes->y[_flatten_2d(_uvec2_init(position.x, position.z), dim_xz)].voxel_count;
+        ++planes->z[_flatten_2d(_uvec2_init(position.x, position.y), dim_xy)].voxel_count;
+    }
+
+    _voxel_t* voxels = planes->voxels;
+    for (uint32_t i = 0; i < planes->x_count; ++i)
+    {
+        planes->x[i].voxels = voxels;
+        voxels += planes->x[i].voxel_count;
+        planes->x[i].voxel_count = 0;
+    }
+    for (uint32_t i = 0; i < planes->y_count; ++i)
+    {
+        planes->y[i].voxels = voxels;
+        voxels += planes->y[i].voxel_count;
+        planes->y[i].voxel_count = 0;
+    }
+    for (uint32_t i = 0; i < planes->z_count; ++i)
+    {
+        planes->z[i].voxels = voxels;
+        voxels += planes->z[i].voxel_count;
+        planes->z[i].voxel_count = 0;
+    }
+
+    for (uint32_t i = 0; i < context->voxel_set_count; ++i)
+    {
+        const _voxel_t* voxel = &context->voxel_set[i];
+
+        _voxel_set_plane_t* voxels_x_planes = &planes->x[_flatten_2d(_uvec2_init(voxel->position.y, voxel->position.z), dim_yz)];
+        _voxel_set_plane_t* voxels_y_planes = &planes->y[_flatten_2d(_uvec2_init(voxel->position.x, voxel->position.z), dim_xz)];
+        _voxel_set_plane_t* voxels_z_planes = &planes->z[_flatten_2d(_uvec2_init(voxel->position.x, voxel->position.y), dim_xy)];
+
+        voxels_x_planes->voxels[voxels_x_planes->voxel_count++] = *voxel;
+        voxels_y_planes->voxels[voxels_y_planes->voxel_count++] = *voxel;
+        voxels_z_planes->voxels[voxels_z_planes->voxel_count++] = *voxel;
+    }
+
+    MELT_PROFILE_END();
+}
+
+#endif
+
+static inline uint32_t _count_trailing_zeros64(uint64_t value)
+{
+    MELT_ASSERT(value != 0);
+    return _popcount64((value & (~value + 1)) - 1);
+}
+
+static inline uint32_t _highest_bit64(uint64_t value)
+{
+    MELT_ASSERT(value != 0);
+    uint32_t bit = 0;
+    if (value >> 32) { value >>= 32; bit += 32; }
+    if (value >> 16) { value >>= 16; bit += 16; }
+    if (value >> 8)  { value >>= 8;  bit += 8;  }
+    if (value >> 4)  { value >>= 4;  bit += 4;  }
+    if (value >> 2)  { value >>= 2;  bit += 2;  }
+    if (value >> 1)  { bit += 1; }
+    return bit;
+}
+
+static void _init_brick_bitset(_brick_bitset_t* bitset, uvec3_t dimension)
+{
+    bitset->dimension = dimension;
+    bitset->words = NULL;
+    _init_brick_map(&bitset->map, dimension);
+}
+
+static void _free_brick_bitset(_brick_bitset_t* bitset)
+{
+    _free_brick_map(&bitset->map);
+    MELT_FREE(bitset->words);
+    bitset->words = NULL;
+}
+
+// Clears the voxels of the bitset, the storage of the bricks is kept for reuse.
+static void _clear_brick_bitset(_brick_bitset_t* bitset)
+{
+    const uvec3_t brick_dimension = bitset->map.dimension;
+    memset(bitset->map.slots, 0xff, (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z * sizeof(uint32_t));
+    bitset->map.count = 0;
+}
+
+// Bytes allocated for a brick bitset of a grid of the given dimension that
+// stores at most capacity bricks.
+static uint64_t _brick_bitset_memory_bytes(uvec3_t dimension, uint64_t capacity)
+{
+    return _brick_map_memory_bytes(dimension, capacity) + capacity * MELT_BRICK_WORD_COUNT * sizeof(uint64_t);
+}
+
+static uint64_t _brick_bitset_allocated_bytes(const _brick_bitset_t* bitset)
+{
+    return _brick_bitset_memory_bytes(bitset->dimension, bitset->map.capacity);
+}
+
+// Mask of the voxels of the brick that lie within the grid of the given
+// dimension. Returns whether the whole brick lies within the grid.
+static bool _brick_grid_mask(uvec3_t dimension, uvec3_t brick, uint64_t* out_mask)
+{
+    const uint32_t width = _uint32_t_min(dimension.x - (brick.x << MELT_BRICK_SIZE_LOG2), MELT_BRICK_SIZE);
+    const uint32_t height = _uint32_t_min(dimension.y - (brick.y << MELT_BRICK_SIZE_LOG2), MELT_BRICK_SIZE);
+    const uint32_t depth = _uint32_t_min(dimension.z - (brick.z << MELT_BRICK_SIZE_LOG2), MELT_BRICK_SIZE);
+    if (width == MELT_BRICK_SIZE && height == MELT_BRICK_SIZE && depth == MELT_BRICK_SIZE)
+    {
+        memset(out_mask, 0xff, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        return true;
+    }
+
+    const uint64_t row = ((uint64_t)1 << width) - 1;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        const uint32_t z = word >> 2;
+        const uint32_t y = (word & 3) << 2;
+        uint64_t mask = 0;
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (z < depth && y + i < height)
+                mask |= row << (i * MELT_BRICK_SIZE);
+        }
+        out_mask[word] = mask;
+    }
+    return false;
+}
+
+// Copies the voxels of the brick at index, in the order of the bricks of the
+// grid, to out_words.
+static void _load_brick(const _brick_bitset_t* bitset, uint64_t index, uint64_t* out_words)
+{
+    const uint32_t slot = bitset->map.slots[index];
+    if (slot == MELT_EMPTY_BRICK)
+        memset(out_words, 0, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+    else if (slot == MELT_FULL_BRICK)
+        _brick_grid_mask(bitset->dimension, _unflatten_3d(index, bitset->map.dimension), out_words);
+    else
+        memcpy(out_words, bitset->words + (uint64_t)slot * MELT_BRICK_WORD_COUNT, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+}
+
+// Storage of the brick at brick_position, allocated and initialized with the
+// voxels of the brick when the brick has none.
+static uint64_t* _brick_words(_brick_bitset_t* bitset, uvec3_t brick_position)
+{
+    _brick_map_t* map = &bitset->map;
+    const uint32_t slot = map->slots[_flatten_3d(brick_position, map->dimension)];
+    if (slot != MELT_EMPTY_BRICK && slot != MELT_FULL_BRICK)
+        return bitset->words + (uint64_t)slot * MELT_BRICK_WORD_COUNT;
+
+    const uint64_t brick_bytes = MELT_BRICK_WORD_COUNT * sizeof(uint64_t);
+    const uint32_t capacity = map->capacity;
+    const uint32_t new_slot = _brick_map_insert(map, brick_position);
+    if (map->capacity != capacity)
+        bitset->words = (uint64_t*)_grow_allocation(bitset->words, capacity * brick_bytes, map->capacity * brick_bytes);
+
+    uint64_t* words = bitset->words + (uint64_t)new_slot * MELT_BRICK_WORD_COUNT;
+    if (slot == MELT_FULL_BRICK)
+        _brick_grid_mask(bitset->dimension, brick_position, words);
+    else
+        memset(words, 0, brick_bytes);
+    return words;
+}
+
+// Sets the voxels of the brick at brick_position to words, the voxels of words
+// past the grid are cleared. A brick without storage whose voxels end up all
+// clear or all set is left without storage.
+static void _store_brick(_brick_bitset_t* bitset, uvec3_t brick_position, uint64_t* words)
+{
+    uint64_t mask[MELT_BRICK_WORD_COUNT];
+    _brick_grid_mask(bitset->dimension, brick_position, mask);
+
+    bool empty = true;
+    bool full = true;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        words[word] &= mask[word];
+        empty = empty && words[word] == 0;
+        full = full && words[word] == mask[word];
+    }
+
+    uint32_t* slot = &bitset->map.slots[_flatten_3d(brick_position, bitset->map.dimension)];
+    if ((*slot == MELT_EMPTY_BRICK || *slot == MELT_FULL_BRICK) && (empty || full))
+        *slot = empty ? MELT_EMPTY_BRICK : MELT_FULL_BRICK;
+    else
+        memcpy(_brick_words(bitset, brick_position), words, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+}
+
+// Whether any voxel of the brick at index is set.
+static bool _brick_any(const _brick_bitset_t* bitset, uint64_t index)
+{
+    const uint32_t slot = bitset->map.slots[index];
+    if (slot == MELT_EMPTY_BRICK || slot == MELT_FULL_BRICK)
+        return slot == MELT_FULL_BRICK;
+
+    const uint64_t* words = bitset->words + (uint64_t)slot * MELT_BRICK_WORD_COUNT;
+    uint64_t any = 0;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        any |= words[word];
+    return any != 0;
+}
+
+// Whether the voxel at position, within the grid, is set.
+static inline bool _brick_bitset_test(const _brick_bitset_t* bitset, uvec3_t position)
+{
+    const uint32_t slot = _brick_map_slot(&bitset->map, position);
+    if (slot == MELT_EMPTY_BRICK || slot == MELT_FULL_BRICK)
+        return slot == MELT_FULL_BRICK;
+    return _bitset_test(bitset->words, (uint64_t)slot * MELT_BRICK_VOXEL_COUNT + _brick_local_index(position));
+}
+
+static void _brick_bitset_set(_brick_bitset_t* bitset, uvec3_t position)
+{
+    if (_brick_map_slot(&bitset->map, position) != MELT_FULL_BRICK)
+        _bitset_set(_brick_words(bitset, _brick_position(position)), _brick_local_index(position));
+}
+
+static void _brick_bitset_clear(_brick_bitset_t* bitset, uvec3_t position)
+{
+    if (_brick_map_slot(&bitset->map, position) != MELT_EMPTY_BRICK)
+        _bitset_clear(_brick_words(bitset, _brick_position(position)), _brick_local_index(position));
+}
+
+// Sets the voxels [x0, x1) of the row (y, z).
+static void _brick_bitset_set_range(_brick_bitset_t* bitset, uint32_t y, uint32_t z, uint32_t x0, uint32_t x1)
+{
+    while (x0 < x1)
+    {
+        const uint32_t x_end = _uint32_t_min((x0 | (MELT_BRICK_SIZE - 1)) + 1, x1);
+        const uvec3_t position = _uvec3_init(x0, y, z);
+        if (_brick_map_slot(&bitset->map, position) != MELT_FULL_BRICK)
+        {
+            uint64_t* words = _brick_words(bitset, _brick_position(position));
+            const uint32_t local_index = _brick_local_index(position);
+            words[local_index >> 6] |= (((uint64_t)1 << (x_end - x0)) - 1) << (local_index & 63);
+        }
+        x0 = x_end;
+    }
+}
+
+// Mask of the bits of the last word of a row that map to voxels of the grid.
+static inline uint64_t _row_tail_mask(uint32_t width)
+{
+    const uint32_t tail_bits = width & 63;
+    return tail_bits ? ((uint64_t)1 << tail_bits) - 1 : ~(uint64_t)0;
+}
+
+// Copies the voxels of the row (y, z) of the bitset to row, one bit per voxel
+// along x. The rows of a brick never cross the words of row.
+static void _brick_bitset_row(const _brick_bitset_t* bitset, uint32_t y, uint32_t z, uint64_t* row)
+{
+    const _brick_map_t* map = &bitset->map;
+    const uint64_t word_count = _bitset_word_count(bitset->dimension.x);
+    const uint64_t first_brick = _flatten_3d(_uvec3_init(0, y >> MELT_BRICK_SIZE_LOG2, z >> MELT_BRICK_SIZE_LOG2), map->dimension);
+    const uint32_t local_index = _brick_local_index(_uvec3_init(0, y, z));
+    const uint64_t brick_row_mask = ((uint64_t)1 << MELT_BRICK_SIZE) - 1;
+
+    memset(row, 0, word_count * sizeof(uint64_t));
+    for (uint32_t x = 0; x < map->dimension.x; ++x)
+    {
+        const uint32_t slot = map->slots[first_brick + x];
+        if (slot == MELT_EMPTY_BRICK)
+            continue;
+
+        uint64_t brick_row = brick_row_mask;
+        if (slot != MELT_FULL_BRICK)
+            brick_row &= bitset->words[(uint64_t)slot * MELT_BRICK_WORD_COUNT + (local_index >> 6)] >> (local_index & 63);
+        row[(x * MELT_BRICK_SIZE) >> 6] |= brick_row << ((x * MELT_BRICK_SIZE) & 63);
+    }
+    row[word_count - 1] &= _row_tail_mask(bitset->dimension.x);
+}
+
+// First set voxel of the row in [x, end), or end.
+static uint32_t _row_next_set(const uint64_t* row, uint32_t x, uint32_t end)
+{
+    while (x < end)
+    {
+        const uint32_t word = x >> 6;
+        const uint64_t set_bits = row[word] & (~(uint64_t)0 << (x & 63));
+        if (set_bits != 0)
+        {
+            const uint32_t set_x = (word << 6) + _count_trailing_zeros64(set_bits);
+            return set_x < end ? set_x : end;
+        }
+        x = (word + 1) << 6;
+    }
+    return end;
+}
+
+// First clear voxel of the row in [x, end), or end.
+static uint32_t _row_next_clear(const uint64_t* row, uint32_t x, uint32_t end)
+{
+    while (x < end)
+    {
+        const uint32_t word = x >> 6;
+        const uint64_t clear_bits = ~row[word] & (~(uint64_t)0 << (x & 63));
+        if (clear_bits != 0)
+        {
+            const uint32_t clear_x = (word << 6) + _count_trailing_zeros64(clear_bits);
+            return clear_x < end ? clear_x : end;
+        }
+        x = (word + 1) << 6;
+    }
+    return end;
+}
+
+static void _span_stack_push(_span_stack_t* stack, uint32_t y, uint32_t z, uint32_t x0, uint32_t x1)
+{
+    if (stack->count == stack->capacity)
+    {
+        const uint32_t capacity = stack->capacity > 0 ? stack->capacity * 2 : 256;
+        stack->spans = (_span_t*)_grow_allocation(stack->spans, stack->count * sizeof(_span_t), capacity * sizeof(_span_t));
+        stack->capacity = capacity;
+    }
+
+    _span_t* span = &stack->spans[stack->count++];
+    span->y = y;
+    span->z = z;
+    span->x0 = x0;
+    span->x1 = x1;
+}
+
+// Bits of the words of a brick for the voxels at the first and the last x of
+// their row.
+static const uint64_t _brick_first_x = 0x0001000100010001ull;
+static const uint64_t _brick_last_x = 0x8000800080008000ull;
+
+// Adds to inout the voxels of the brick words moved by one voxel toward
+// direction, -x, +x, -y, +y, -z or +z. Voxels moved out of the brick are lost.
+static void _brick_shift(const uint64_t* words, uint32_t direction, uint64_t* inout)
+{
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        const uint64_t value = words[word];
+        switch (direction)
+        {
+        case 0: inout[word] |= (value >> 1) & ~_brick_last_x; break;
+        case 1: inout[word] |= (value << 1) & ~_brick_first_x; break;
+        case 2: inout[word] |= (value >> MELT_BRICK_SIZE) | ((word & 3) != 3 ? words[word + 1] << (3 * MELT_BRICK_SIZE) : 0); break;
+        case 3: inout[word] |= (value << MELT_BRICK_SIZE) | ((word & 3) != 0 ? words[word - 1] >> (3 * MELT_BRICK_SIZE) : 0); break;
+        case 4: inout[word] |= word + 4 < MELT_BRICK_WORD_COUNT ? words[word + 4] : 0; break;
+        default: inout[word] |= word >= 4 ? words[word - 4] : 0; break;
+        }
+    }
+}
+
+// Adds to inout the voxels of a brick next to the set voxels of neighbour, the
+// brick next to it toward direction.
+static void _brick_face(const uint64_t* neighbour, uint32_t direction, uint64_t* inout)
+{
+    const uint32_t last_row = 3 * MELT_BRICK_SIZE;
+    const uint32_t last_slice = MELT_BRICK_WORD_COUNT - 4;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        switch (direction)
+        {
+        case 0: inout[word] |= (neighbour[word] >> (MELT_BRICK_SIZE - 1)) & _brick_first_x; break;
+        case 1: inout[word] |= (neighbour[word] & _brick_first_x) << (MELT_BRICK_SIZE - 1); break;
+        case 2: inout[word] |= (word & 3) == 0 ? neighbour[word + 3] >> last_row : 0; break;
+        case 3: inout[word] |= (word & 3) == 3 ? neighbour[word - 3] << last_row : 0; break;
+        case 4: inout[word] |= word < 4 ? neighbour[word + last_slice] : 0; break;
+        default: inout[word] |= word >= last_slice ? neighbour[word - last_slice] : 0; break;
+        }
+    }
+}
+
+// Whether any voxel of the brick words lies on the face of the brick toward
+// direction.
+static bool _brick_face_any(const uint64_t* words, uint32_t direction)
+{
+    uint64_t any = 0;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        switch (direction)
+        {
+        case 0: any |= words[word] & _brick_first_x; break;
+        case 1: any |= words[word] & _brick_last_x; break;
+        case 2: any |= (word & 3) == 0 ? words[word] << (3 * MELT_BRICK_SIZE) : 0; break;
+        case 3: any |= (word & 3) == 3 ? words[word] >> (3 * MELT_BRICK_SIZE) : 0; break;
+        case 4: any |= word < 4 ? words[word] : 0; break;
+        default: any |= word >= MELT_BRICK_WORD_COUNT - 4 ? words[word] : 0; break;
+        }
+    }
+    return any != 0;
+}
+
+// Sets out_neighbour to the brick next to brick toward direction, returns false
+// when it lies past the bricks of the map.
+static bool _brick_neighbour(const _brick_map_t* map, uvec3_t brick, uint32_t direction, uvec3_t* out_neighbour)
+{
+    uvec3_t dimension = map->dimension;
+    const uint32_t size = *_uvec3_component(&dimension, direction >> 1);
+
+    *out_neighbour = brick;
+    uint32_t* coordinate = _uvec3_component(out_neighbour, direction >> 1);
+    if (direction & 1)
+    {
+        if (*coordinate + 1 == size)
+            return false;
+        ++*coordinate;
+    }
+    else
+    {
+        if (*coordinate == 0)
+            return false;
+        --*coordinate;
+    }
+    return true;
+}
+
+// Index of the line of bricks along axis through brick.
+static inline uint64_t _brick_line_index(uvec3_t dimension, uvec3_t brick, uint32_t axis)
+{
+    switch (axis)
+    {
+    case 0: return brick.y + (uint64_t)brick.z * dimension.y;
+    case 1: return brick.x + (uint64_t)brick.z * dimension.x;
+    default: return brick.x + (uint64_t)brick.y * dimension.x;
+    }
+}
+
+static uint64_t _brick_lines_memory_bytes(uvec3_t dimension)
+{
+    const uvec3_t brick_dimension = _brick_map_dimension(dimension);
+    const uint64_t line_count = (uint64_t)brick_dimension.y * brick_dimension.z + (uint64_t)brick_dimension.x * brick_dimension.z +
+        (uint64_t)brick_dimension.x * brick_dimension.y;
+    return 2 * line_count * sizeof(uint32_t);
+}
+
+static void _init_brick_lines(_brick_lines_t* lines, const _brick_bitset_t* bitset)
+{
+    const uvec3_t dimension = bitset->map.dimension;
+    const uint64_t line_counts[3] = { (uint64_t)dimension.y * dimension.z, (uint64_t)dimension.x * dimension.z, (uint64_t)dimension.x * dimension.y };
+
+    lines->dimension = dimension;
+    lines->bounds[0] = MELT_MALLOC(uint32_t, 2 * (line_counts[0] + line_counts[1] + line_counts[2]));
+    lines->bounds[1] = lines->bounds[0] + 2 * line_counts[0];
+    lines->bounds[2] = lines->bounds[1] + 2 * line_counts[1];
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        for (uint64_t line = 0; line < line_counts[axis]; ++line)
+        {
+            lines->bounds[axis][2 * line] = UINT32_MAX;
+            lines->bounds[axis][2 * line + 1] = 0;
+        }
+    }
+
+    const uint64_t brick_count = (uint64_t)dimension.x * dimension.y * dimension.z;
+    for (uint64_t i = 0; i < brick_count; ++i)
+    {
+        if (!_brick_any(bitset, i))
+            continue;
+
+        uvec3_t brick = _unflatten_3d(i, dimension);
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            uint32_t* bounds = lines->bounds[axis] + 2 * _brick_line_index(dimension, brick, axis);
+            const uint32_t coordinate = *_uvec3_component(&brick, axis);
+            bounds[0] = _uint32_t_min(bounds[0], coordinate);
+            bounds[1] = _uint32_t_max(bounds[1], coordinate);
+        }
+    }
+}
+
+static void _free_brick_lines(_brick_lines_t* lines)
+{
+    MELT_FREE(lines->bounds[0]);
+}
+
+// Sets out to the voxels of the brick whose line along axis inside the brick
+// holds set voxels of words.
+static void _brick_collapse(const uint64_t* words, uint32_t axis, uint64_t* out)
+{
+    const uint64_t brick_row_mask = ((uint64_t)1 << MELT_BRICK_SIZE) - 1;
+
+    switch (axis)
+    {
+    case 0:
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        {
+            out[word] = 0;
+            for (uint32_t row = 0; row < 64; row += MELT_BRICK_SIZE)
+                out[word] |= ((words[word] >> row) & brick_row_mask) != 0 ? brick_row_mask << row : 0;
+        }
+        break;
+    case 1:
+        // The four words of a slice along z hold its sixteen rows along x.
+        for (uint32_t slice = 0; slice < MELT_BRICK_WORD_COUNT; slice += 4)
+        {
+            uint64_t any = words[slice] | words[slice + 1] | words[slice + 2] | words[slice + 3];
+            any |= any >> 32;
+            any |= any >> 16;
+            any = (any & brick_row_mask) * _brick_first_x;
+            out[slice] = out[slice + 1] = out[slice + 2] = out[slice + 3] = any;
+        }
+        break;
+    default:
+        for (uint32_t word = 0; word < 4; ++word)
+        {
+            uint64_t any = 0;
+            for (uint32_t slice = 0; slice < MELT_BRICK_WORD_COUNT; slice += 4)
+                any |= words[slice + word];
+            for (uint32_t slice = 0; slice < MELT_BRICK_WORD_COUNT; slice += 4)
+                out[slice + word] = any;
+        }
+        break;
+    }
+}
+
+// Sets out to the voxels of the brick with blocked voxels past them toward
+// direction, -x, +x, -y, +y, -z or +z, blocked_words are the blocked voxels of
+// the brick and lines the lines of bricks of the blocked voxels, which bound the
+// bricks walked past the brick. The walk stops once the voxels of required are
+// all set in out.
+static void _blocked_past_voxels(const _brick_bitset_t* blocked, const _brick_lines_t* lines, uvec3_t brick, const uint64_t* blocked_words,
+    uint32_t direction, const uint64_t* required, uint64_t* out)
+{
+    const uint64_t brick_bytes = MELT_BRICK_WORD_COUNT * sizeof(uint64_t);
+    uint64_t moved[MELT_BRICK_WORD_COUNT];
+    uint64_t next[MELT_BRICK_WORD_COUNT];
+
+    // The blocked voxels are moved back against direction one voxel at a time
+    // over the voxels before them.
+    memset(out, 0, brick_bytes);
+    memcpy(moved, blocked_words, brick_bytes);
+    for (uint32_t step = 1; step < MELT_BRICK_SIZE; ++step)
+    {
+        memset(next, 0, brick_bytes);
+        _brick_shift(moved, direction ^ 1, next);
+
+        uint64_t any = 0;
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        {
+            out[word] |= next[word];
+            moved[word] = next[word];
+            any |= next[word];
+        }
+        if (any == 0)
+            break;
+    }
+
+    bool covered = true;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        covered = covered && (required[word] & ~out[word]) == 0;
+
+    const uint32_t axis = direction >> 1;
+    const uint32_t* bounds = lines->bounds[axis] + 2 * _brick_line_index(lines->dimension, brick, axis);
+    uvec3_t walked = brick;
+    uint32_t* coordinate = _uvec3_component(&walked, axis);
+    while (!covered && ((direction & 1) ? *coordinate < bounds[1] : *coordinate > bounds[0]))
+    {
+        *coordinate = (direction & 1) ? *coordinate + 1 : *coordinate - 1;
+        const uint64_t index = _flatten_3d(walked, blocked->map.dimension);
+        if (blocked->map.slots[index] == MELT_EMPTY_BRICK)
+            continue;
+
+        _load_brick(blocked, index, moved);
+        _brick_collapse(moved, axis, next);
+
+        covered = true;
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        {
+            out[word] |= next[word];
+            covered = covered && (required[word] & ~out[word]) == 0;
+        }
+    }
+}
+
+// Keeps in inout the voxels of the brick with blocked voxels past them both ways
+// along axis. Returns whether any voxel is kept.
+static bool _blocked_around_voxels(const _brick_bitset_t* blocked, const _brick_lines_t* lines, uvec3_t brick, const uint64_t* blocked_words,
+    uint32_t axis, uint64_t* inout)
+{
+    uint64_t past[MELT_BRICK_WORD_COUNT];
+
+    for (uint32_t direction = 2 * axis; direction < 2 * axis + 2; ++direction)
+    {
+        _blocked_past_voxels(blocked, lines, brick, blocked_words, direction, inout, past);
+
+        uint64_t any = 0;
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        {
+            inout[word] &= past[word];
+            any |= inout[word];
+        }
+        if (any == 0)
+            return false;
+    }
+    return true;
+}
+
+// Keeps in inout the voxels of the brick that _exterior_leaks may find inside
+// the mesh, the voxels with blocked voxels past them both ways along x and both
+// ways along y or z, the rows along which a part of the mesh closed around the
+// voxel crosses the shell. Returns whether any voxel is kept.
+static bool _leak_candidate_voxels(const _brick_bitset_t* blocked, const _brick_lines_t* lines, uvec3_t brick, const uint64_t* blocked_words,
+    uint64_t* inout)
+{
+    uint64_t along_y[MELT_BRICK_WORD_COUNT];
+
+    if (!_blocked_around_voxels(blocked, lines, brick, blocked_words, 0, inout))
+        return false;
+
+    memcpy(along_y, inout, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+    const bool any_along_y = _blocked_around_voxels(blocked, lines, brick, blocked_words, 1, along_y);
+    const bool any_along_z = _blocked_around_voxels(blocked, lines, brick, blocked_words, 2, inout);
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        inout[word] |= along_y[word];
+    return any_along_y || any_along_z;
+}
+
+// Bytes allocated by _flood_fill_exterior or _exterior_leaks for a grid of the
+// given dimension.
+static uint64_t _flood_fill_memory_bytes(uvec3_t dimension)
+{
+    const uvec3_t brick_dimension = _brick_map_dimension(dimension);
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+    const uint64_t batch_bytes = MELT_FILL_BATCH_SIZE * (sizeof(uint32_t) + MELT_BRICK_WORD_COUNT * sizeof(uint64_t) + sizeof(uint8_t));
+    return brick_count * sizeof(uint32_t) + _bitset_word_count(brick_count) * sizeof(uint64_t) + _brick_lines_memory_bytes(dimension) + batch_bytes;
+}
+
+// Fills the brick at index of the exterior into filled, see _flood_fill_exterior,
+// reading the exterior voxels of the brick and of its neighbours. Sets the bit of
+// each direction whose face gained exterior voxels in out_grown, and bit 6 when
+// the brick gained any. Returns whether some of the voxels gained may lie
+// inside the mesh, see _leak_candidate_voxels.
+static bool _fill_exterior_brick(const _brick_bitset_t* blocked, const _brick_bitset_t* exterior, const _brick_lines_t* lines, uint64_t index,
+    uint64_t* filled, uint8_t* out_grown)
+{
+    *out_grown = 0;
+    if (exterior->map.slots[index] == MELT_FULL_BRICK)
+        return false;
+
+    const _brick_map_t* map = &blocked->map;
+    const uvec3_t brick = _unflatten_3d(index, map->dimension);
+
+    uint64_t mask[MELT_BRICK_WORD_COUNT];
+    uint64_t previous[MELT_BRICK_WORD_COUNT];
+    uint64_t blocked_words[MELT_BRICK_WORD_COUNT];
+    uint64_t next[MELT_BRICK_WORD_COUNT];
+    uint64_t neighbour_words[MELT_BRICK_WORD_COUNT];
+
+    _brick_grid_mask(blocked->dimension, brick, mask);
+    _load_brick(exterior, index, previous);
+    _load_brick(blocked, index, blocked_words);
+
+    // Seeds from the voxels past the grid and from the exterior voxels of the
+    // neighbours.
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+        filled[word] = ~mask[word] | previous[word];
+
+    for (uint32_t direction = 0; direction < 6; ++direction)
+    {
+        uvec3_t neighbour;
+        if (!_brick_neighbour(map, brick, direction, &neighbour))
+        {
+            memset(neighbour_words, 0xff, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        }
+        else
+        {
+            const uint64_t neighbour_index = _flatten_3d(neighbour, map->dimension);
+            if (exterior->map.slots[neighbour_index] == MELT_EMPTY_BRICK)
+                continue;
+            _load_brick(exterior, neighbour_index, neighbour_words);
+        }
+        _brick_face(neighbour_words, direction, filled);
+    }
+
+    if (map->slots[index] == MELT_EMPTY_BRICK)
+    {
+        uint64_t any = 0;
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+            any |= filled[word];
+        memset(filled, any != 0 ? 0xff : 0, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+    }
+    else
+    {
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+            filled[word] &= ~blocked_words[word];
+
+        bool grown = true;
+        while (grown)
+        {
+            memcpy(next, filled, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+            for (uint32_t direction = 0; direction < 6; ++direction)
+                _brick_shift(filled, direction, next);
+
+            grown = false;
+            for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+            {
+                next[word] &= ~blocked_words[word];
+                grown = grown || next[word] != filled[word];
+                filled[word] = next[word];
+            }
+        }
+    }
+
+    // The voxels gained are kept in next.
+    uint64_t any = 0;
+    for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+    {
+        next[word] = filled[word] & mask[word] & ~previous[word];
+        any |= next[word];
+    }
+    if (any == 0)
+        return false;
+
+    *out_grown = 1u << 6;
+    for (uint32_t direction = 0; direction < 6; ++direction)
+    {
+        if (_brick_face_any(next, direction))
+            *out_grown |= 1u << direction;
+    }
+
+    return _leak_candidate_voxels(blocked, lines, brick, blocked_words, next);
+}
+
+// Marks as exterior the voxels that are not blocked and are connected to the
+// border of the grid, the voxels past the grid count as exterior voxels. The
+// bricks to fill are queued, starting with the bricks on the border. Batches of
+// queued bricks are filled in parallel, each to a fixpoint from the exterior
+// voxels of its neighbours before the batch, then stored in turn. The neighbours
+// across the faces where the exterior of a brick grew are queued again, bricks
+// without blocked voxels are filled at once. Returns whether the exterior
+// reached voxels that may lie inside a mesh, see _leak_candidate_voxels.
+static bool _flood_fill_exterior(const _brick_bitset_t* blocked, _brick_bitset_t* exterior)
+{
+    MELT_PROFILE_BEGIN();
+
+    const _brick_map_t* map = &blocked->map;
+    const uvec3_t brick_dimension = map->dimension;
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+
+    // Queue of brick indices, each brick is queued at most once at a time.
+    uint32_t* queue = MELT_MALLOC(uint32_t, brick_count);
+    uint64_t* queued = MELT_MALLOC(uint64_t, _bitset_word_count(brick_count));
+    memset(queued, 0, _bitset_word_count(brick_count) * sizeof(uint64_t));
+    uint64_t queue_begin = 0;
+    uint64_t queue_count = 0;
+
+    for (uint64_t i = 0; i < brick_count; ++i)
+    {
+        const uvec3_t brick = _unflatten_3d(i, brick_dimension);
+        if (brick.x == 0 || brick.y == 0 || brick.z == 0 ||
+            brick.x + 1 == brick_dimension.x || brick.y + 1 == brick_dimension.y || brick.z + 1 == brick_dimension.z)
+        {
+            queue[queue_count++] = (uint32_t)i;
+            _bitset_set(queued, i);
+        }
+    }
+
+    _brick_lines_t lines;
+    _init_brick_lines(&lines, blocked);
+
+    uint32_t* batch = MELT_MALLOC(uint32_t, MELT_FILL_BATCH_SIZE);
+    uint64_t* batch_words = MELT_MALLOC(uint64_t, MELT_FILL_BATCH_SIZE * MELT_BRICK_WORD_COUNT);
+    uint8_t* batch_grown = MELT_MALLOC(uint8_t, MELT_FILL_BATCH_SIZE);
+
+    bool candidates = false;
+    while (queue_count > 0)
+    {
+        const uint32_t batch_size = (uint32_t)(queue_count < MELT_FILL_BATCH_SIZE ? queue_count : MELT_FILL_BATCH_SIZE);
+        for (uint32_t i = 0; i < batch_size; ++i)
+        {
+            batch[i] = queue[queue_begin];
+            queue_begin = (queue_begin + 1) % brick_count;
+            _bitset_clear(queued, batch[i]);
+        }
+        queue_count -= batch_size;
+
+        // The bricks of the batch only read the exterior.
+        int32_t candidate_count = 0;
+#if defined(_OPENMP)
+        #pragma omp parallel for schedule(dynamic, 8) reduction(+:candidate_count)
+#endif
+        for (int32_t i = 0; i < (int32_t)batch_size; ++i)
+        {
+            if (_fill_exterior_brick(blocked, exterior, &lines, batch[i], batch_words + (uint64_t)i * MELT_BRICK_WORD_COUNT, &batch_grown[i]))
+                ++candidate_count;
+        }
+        candidates = candidates || candidate_count > 0;
+
+        for (uint32_t i = 0; i < batch_size; ++i)
+        {
+            if (batch_grown[i] == 0)
+                continue;
+
+            const uvec3_t brick = _unflatten_3d(batch[i], brick_dimension);
+            _store_brick(exterior, brick, batch_words + (uint64_t)i * MELT_BRICK_WORD_COUNT);
+
+            for (uint32_t direction = 0; direction < 6; ++direction)
+            {
+                uvec3_t neighbour;
+                if (!(batch_grown[i] & (1u << direction)) || !_brick_neighbour(map, brick, direction, &neighbour))
+                    continue;
+
+                const uint64_t neighbour_index = _flatten_3d(neighbour, brick_dimension);
+                if (_bitset_test(queued, neighbour_index))
+                    continue;
+
+                queue[(queue_begin + queue_count) % brick_count] = (uint32_t)neighbour_index;
+                ++queue_count;
+                _bitset_set(queued, neighbour_index);
+            }
+        }
+    }
+
+    MELT_FREE(batch);
+    MELT_FREE(batch_words);
+    MELT_FREE(batch_grown);
+    _free_brick_lines(&lines);
+    MELT_FREE(queue);
+    MELT_FREE(queued);
+    MELT_PROFILE_END();
+    return candidates;
+}
+
+// Whether the exterior leaks inside the mesh of bvh through its holes, testing
+// only the exterior voxels of _leak_candidate_voxels. A closed mesh crosses the
+// line along x through any exterior voxel an even number of times past the
+// voxel, the candidate voxels of each row of a brick are tested at once by the
+// parity of the crossings of the row. A voxel found inside also has to be inside
+// by one of the other rays of _bvh_contains_point, which tolerates a row leaving
+// through a hole that the shell closes.
+static bool _exterior_leaks(const _brick_bitset_t* blocked, const _brick_bitset_t* exterior, const melt_triangle_bvh_t* bvh, _aabb_t grid_aabb, vec3_t voxel_extent)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uvec3_t dimension = blocked->dimension;
+    const uvec3_t brick_dimension = blocked->map.dimension;
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+    const vec3_t first_center = _vec3_add(grid_aabb.min, _vec3_mulf(voxel_extent, 0.5f));
+    const uint64_t brick_row_mask = ((uint64_t)1 << MELT_BRICK_SIZE) - 1;
+
+    _brick_lines_t lines;
+    _init_brick_lines(&lines, blocked);
+
+    uint64_t blocked_words[MELT_BRICK_WORD_COUNT];
+    uint64_t candidates[MELT_BRICK_WORD_COUNT];
+
+    bool leaks = false;
+    for (uint64_t index = 0; index < brick_count && !leaks; ++index)
+    {
+        if (exterior->map.slots[index] == MELT_EMPTY_BRICK)
+            continue;
+
+        const uvec3_t brick = _unflatten_3d(index, brick_dimension);
+        _load_brick(blocked, index, blocked_words);
+        _load_brick(exterior, index, candidates);
+        if (!_leak_candidate_voxels(blocked, &lines, brick, blocked_words, candidates))
+            continue;
+
+        const uvec3_t first_voxel = _uvec3_init(brick.x << MELT_BRICK_SIZE_LOG2, brick.y << MELT_BRICK_SIZE_LOG2, brick.z << MELT_BRICK_SIZE_LOG2);
+        const uint32_t width = _uint32_t_min(MELT_BRICK_SIZE, dimension.x - first_voxel.x);
+        const float min_x = first_center.x + first_voxel.x * voxel_extent.x;
+        for (uint32_t z = first_voxel.z; z < _uint32_t_min(first_voxel.z + MELT_BRICK_SIZE, dimension.z) && !leaks; ++z)
+        {
+            const float center_z = first_center.z + z * voxel_extent.z;
+            for (uint32_t y = first_voxel.y; y < _uint32_t_min(first_voxel.y + MELT_BRICK_SIZE, dimension.y) && !leaks; ++y)
+            {
+                const uint32_t local_index = _brick_row_index(y, z);
+                uint64_t row = (candidates[local_index >> 6] >> (local_index & 63)) & brick_row_mask;
+                if (row == 0)
+                    continue;
+
+                const float center_y = first_center.y + y * voxel_extent.y;
+                uint64_t inside = 0;
+                _flip_row_crossings(bvh, center_y, center_z, min_x, voxel_extent.x, width, &inside);
+
+                row &= inside;
+                while (row != 0 && !leaks)
+                {
+                    const uint32_t x = first_voxel.x + _count_trailing_zeros64(row);
+                    const vec3_t center = _vec3_init(first_center.x + x * voxel_extent.x, center_y, center_z);
+                    for (uint32_t i = 1; i < MELT_ARRAY_LENGTH(_inside_ray_directions) && !leaks; ++i)
+                    {
+                        const _ray_t ray = _ray_init(center, _inside_ray_directions[i]);
+                        leaks = _bvh_ray_winding(bvh, &ray, 0, 0) != 0;
+                    }
+                    row &= row - 1;
+                }
+            }
+        }
+    }
+
+    _free_brick_lines(&lines);
+    MELT_PROFILE_END();
+    return leaks;
+}
+
+// Grows the set voxels of bitset by one voxel on both sides along axis into out,
+// whose voxels are cleared first.
+static void _dilate_brick_bitset_axis(const _brick_bitset_t* bitset, _brick_bitset_t* out, uint32_t axis)
+{
+    const _brick_map_t* map = &bitset->map;
+    const uint64_t brick_count = (uint64_t)map->dimension.x * map->dimension.y * map->dimension.z;
+
+    uint64_t words[MELT_BRICK_WORD_COUNT];
+    uint64_t grown[MELT_BRICK_WORD_COUNT];
+
+    _clear_brick_bitset(out);
+    for (uint64_t i = 0; i < brick_count; ++i)
+    {
+        if (map->slots[i] == MELT_FULL_BRICK)
+        {
+            out->map.slots[i] = MELT_FULL_BRICK;
+            continue;
+        }
+
+        const uvec3_t brick = _unflatten_3d(i, map->dimension);
+        uvec3_t neighbours[2];
+        bool has_neighbour[2];
+        bool grows = map->slots[i] != MELT_EMPTY_BRICK;
+        for (uint32_t side = 0; side < 2; ++side)
+        {
+            has_neighbour[side] = _brick_neighbour(map, brick, 2 * axis + side, &neighbours[side]) &&
+                map->slots[_flatten_3d(neighbours[side], map->dimension)] != MELT_EMPTY_BRICK;
+            grows = grows || has_neighbour[side];
+        }
+        if (!grows)
+            continue;
+
+        _load_brick(bitset, i, words);
+        memcpy(grown, words, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        _brick_shift(words, 2 * axis, grown);
+        _brick_shift(words, 2 * axis + 1, grown);
+        for (uint32_t side = 0; side < 2; ++side)
+        {
+            if (!has_neighbour[side])
+                continue;
+            _load_brick(bitset, _flatten_3d(neighbours[side], map->dimension), words);
+            _brick_face(words, 2 * axis + side, grown);
+        }
+        _store_brick(out, brick, grown);
+    }
+}
+
+// Grows the set voxels of the bitset by a cube of radius voxels, one voxel and
+// one axis at a time. The content of scratch is overwritten, the storage of the
+// two bitsets may be exchanged.
+static void _dilate_brick_bitset(_brick_bitset_t* bitset, _brick_bitset_t* scratch, uint32_t radius)
+{
+    for (uint32_t step = 0; step < radius; ++step)
+    {
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            _dilate_brick_bitset_axis(bitset, scratch, axis);
+
+            const _brick_bitset_t dilated = *scratch;
+            *scratch = *bitset;
+            *bitset = dilated;
+        }
+    }
+}
+
+// Sets the voxels of inout to the voxels set in neither inout nor other.
+static void _invert_union(const _brick_bitset_t* other, _brick_bitset_t* inout)
+{
+    const uvec3_t brick_dimension = inout->map.dimension;
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+
+    uint64_t other_words[MELT_BRICK_WORD_COUNT];
+    uint64_t words[MELT_BRICK_WORD_COUNT];
+    for (uint64_t i = 0; i < brick_count; ++i)
+    {
+        uint32_t* slot = &inout->map.slots[i];
+        const uint32_t other_slot = other->map.slots[i];
+        if (*slot == MELT_FULL_BRICK || (*slot == MELT_EMPTY_BRICK && (other_slot == MELT_EMPTY_BRICK || other_slot == MELT_FULL_BRICK)))
+        {
+            *slot = *slot == MELT_EMPTY_BRICK && other_slot == MELT_EMPTY_BRICK ? MELT_FULL_BRICK : MELT_EMPTY_BRICK;
+            continue;
+        }
+
+        _load_brick(other, i, other_words);
+        _load_brick(inout, i, words);
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+            words[word] = ~(other_words[word] | words[word]);
+        _store_brick(inout, _unflatten_3d(i, brick_dimension), words);
+    }
+}
+
+// Copies the shell voxels of the brick at brick_position to out_words.
+static void _load_shell_brick(const _context_t* context, uvec3_t brick_position, uint64_t* out_words)
+{
+    if (context->sparse)
+    {
+        const uint32_t slot = context->shell_bricks.slots[_flatten_3d(brick_position, context->shell_bricks.dimension)];
+        if (slot == MELT_EMPTY_BRICK)
+            memset(out_words, 0, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        else
+            memcpy(out_words, context->shell_voxels + (uint64_t)slot * MELT_BRICK_WORD_COUNT, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        return;
+    }
+
+    // The rows of the brick are gathered from the rows of the dense bitset.
+    const uvec3_t dimension = context->dimension;
+    const uvec3_t start = _uvec3_init(brick_position.x << MELT_BRICK_SIZE_LOG2, brick_position.y << MELT_BRICK_SIZE_LOG2, brick_position.z << MELT_BRICK_SIZE_LOG2);
+    const uint32_t width = _uint32_t_min(dimension.x - start.x, MELT_BRICK_SIZE);
+    const uint32_t height = _uint32_t_min(dimension.y - start.y, MELT_BRICK_SIZE);
+    const uint32_t depth = _uint32_t_min(dimension.z - start.z, MELT_BRICK_SIZE);
+    const uint64_t row_mask = ((uint64_t)1 << width) - 1;
+
+    memset(out_words, 0, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+    for (uint32_t z = 0; z < depth; ++z)
+    {
+        for (uint32_t y = 0; y < height; ++y)
+        {
+            const uint64_t bit = _flatten_3d(_uvec3_init(start.x, start.y + y, start.z + z), dimension);
+            const uint32_t offset = (uint32_t)(bit & 63);
+            uint64_t row = context->shell_voxels[bit >> 6] >> offset;
+            if (offset + width > 64)
+                row |= context->shell_voxels[(bit >> 6) + 1] << (64 - offset);
+
+            const uint32_t local_index = _brick_row_index(y, z);
+            out_words[local_index >> 6] |= (row & row_mask) << (local_index & 63);
+        }
+    }
+}
+
+// Grows the set voxels of bitset by one voxel along each axis into out, whose
+// voxels are cleared first. Grown voxels that are shell voxels or are set in
+// blocked are left clear, so that repeated steps grow the voxels along paths
+// around them.
+static void _grow_brick_bitset(const _context_t* context, const _brick_bitset_t* bitset, const _brick_bitset_t* blocked, _brick_bitset_t* out)
+{
+    const _brick_map_t* map = &bitset->map;
+    const uint64_t brick_count = (uint64_t)map->dimension.x * map->dimension.y * map->dimension.z;
+
+    uint64_t words[MELT_BRICK_WORD_COUNT];
+    uint64_t grown[MELT_BRICK_WORD_COUNT];
+    uint64_t stopped[MELT_BRICK_WORD_COUNT];
+
+    _clear_brick_bitset(out);
+    for (uint64_t i = 0; i < brick_count; ++i)
+    {
+        if (map->slots[i] == MELT_FULL_BRICK)
+        {
+            out->map.slots[i] = MELT_FULL_BRICK;
+            continue;
+        }
+        if (blocked->map.slots[i] == MELT_FULL_BRICK)
+            continue;
+
+        const uvec3_t brick = _unflatten_3d(i, map->dimension);
+        uvec3_t neighbours[6];
+        bool has_neighbour[6];
+        bool grows = map->slots[i] != MELT_EMPTY_BRICK;
+        for (uint32_t direction = 0; direction < 6; ++direction)
+        {
+            has_neighbour[direction] = _brick_neighbour(map, brick, direction, &neighbours[direction]) &&
+                map->slots[_flatten_3d(neighbours[direction], map->dimension)] != MELT_EMPTY_BRICK;
+            grows = grows || has_neighbour[direction];
+        }
+        if (!grows)
+            continue;
+
+        _load_brick(bitset, i, words);
+        memset(grown, 0, MELT_BRICK_WORD_COUNT * sizeof(uint64_t));
+        for (uint32_t direction = 0; direction < 6; ++direction)
+            _brick_shift(words, direction, grown);
+        for (uint32_t direction = 0; direction < 6; ++direction)
+        {
+            if (!has_neighbour[direction])
+                continue;
+            uint64_t neighbour_words[MELT_BRICK_WORD_COUNT];
+            _load_brick(bitset, _flatten_3d(neighbours[direction], map->dimension), neighbour_words);
+            _brick_face(neighbour_words, direction, grown);
+        }
+
+        _load_brick(blocked, i, stopped);
+        uint64_t shell_words[MELT_BRICK_WORD_COUNT];
+        _load_shell_brick(context, brick, shell_words);
+        for (uint32_t word = 0; word < MELT_BRICK_WORD_COUNT; ++word)
+            grown[word] = words[word] | (grown[word] & ~(stopped[word] | shell_words[word]));
+        _store_brick(out, brick, grown);
+    }
+}
+
+// Bytes allocated by _generate_fields for a grid of the given dimension on top
+// of the inner voxels and the fields.
+static uint64_t _field_runs_memory_bytes(uvec3_t dimension)
+{
+    return ((uint64_t)dimension.x + (uint64_t)dimension.x * dimension.y) * sizeof(uint32_t) + _bitset_word_count(dimension.x) * sizeof(uint64_t);
+}
+
+// Bytes allocated by the interior classification and the field generation on
+// top of the context when the bitsets of the classification store at most
+// brick_count bricks each, the hierarchy of the triangles aside. Closing holes
+// grows the inner voxels back in a third bitset.
+static uint64_t _classification_memory_bytes(uvec3_t dimension, uint64_t brick_count, uint32_t closing_radius)
+{
+    const uint64_t capacity = _brick_map_capacity(brick_count);
+    const uint64_t bitset_count = closing_radius > 0 ? 3 : 2;
+    return bitset_count * _brick_bitset_memory_bytes(dimension, capacity) + _flood_fill_memory_bytes(dimension) + _field_runs_memory_bytes(dimension);
+}
+
+static void _track_classification_bytes(_context_t* context, uint64_t bytes)
+{
+    if (bytes > context->classification_bytes)
+        context->classification_bytes = bytes;
+}
+
+static void _set_shell_brick_bitset(const _context_t* context, _brick_bitset_t* bitset)
+{
+    const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(context));
+    for (uint64_t i = 0; i < word_count; ++i)
+    {
+        uint64_t word = context->shell_voxels[i];
+        while (word != 0)
+        {
+            _brick_bitset_set(bitset, _shell_voxel_position(context, i * 64 + _count_trailing_zeros64(word)));
+            word &= word - 1;
+        }
+    }
+}
+
+// Whether the shell voxel at position lies in a wall along axis, a run of at most
+// max_thickness shell voxels along axis with exterior voxels on both sides. The
+// border of the grid counts as exterior.
+static bool _thin_wall_voxel(const _context_t* context, const _brick_bitset_t* exterior, uvec3_t position, uint32_t axis, uint32_t max_thickness)
+{
+    uvec3_t dimension = context->dimension;
+    const uint32_t size = *_uvec3_component(&dimension, axis);
+
+    uint32_t thickness = 1;
+    for (int32_t direction = -1; direction <= 1; direction += 2)
+    {
+        uvec3_t voxel = position;
+        uint32_t* coordinate = _uvec3_component(&voxel, axis);
+        for (;;)
+        {
+            if ((direction < 0 && *coordinate == 0) || (direction > 0 && *coordinate + 1 == size))
+                break;
+            *coordinate += direction;
+
+            if (!_shell_voxel(context, voxel))
+            {
+                if (!_brick_bitset_test(exterior, voxel))
+                    return false;
+                break;
+            }
+            if (++thickness > max_thickness)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Whether the shell voxel at position is filled as part of a slab: it lies in a
+// wall along some axis, as do its four neighbours across the wall, so that the
+// slabs stop one voxel short of the edges of the walls and stay within their
+// silhouette. Like inner voxels, slab voxels are never on the border of the grid.
+static bool _slab_voxel(const _context_t* context, const _brick_bitset_t* exterior, uvec3_t position, uint32_t max_thickness)
+{
+    const uvec3_t dimension = context->dimension;
+    if (position.x == 0 || position.y == 0 || position.z == 0 ||
+        position.x + 1 == dimension.x || position.y + 1 == dimension.y || position.z + 1 == dimension.z)
+        return false;
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        bool slab = _thin_wall_voxel(context, exterior, position, axis, max_thickness);
+        for (uint32_t i = 0; slab && i < 4; ++i)
+        {
+            uvec3_t neighbour = position;
+            *_uvec3_component(&neighbour, (axis + 1 + i / 2) % 3) += i % 2 == 0 ? -1 : 1;
+
+            slab = _shell_voxel(context, neighbour) && _thin_wall_voxel(context, exterior, neighbour, axis, max_thickness);
+        }
+        if (slab)
+            return true;
+    }
+    return false;
+}
+
+// Unblocks the slab voxels of the shell so that they are classified as inner
+// voxels, blocked holds the shell voxels. Returns the number of slab voxels.
+static uint64_t _unblock_slab_voxels(const _context_t* context, const _brick_bitset_t* exterior, uint32_t max_thickness, _brick_bitset_t* blocked)
+{
+    uint64_t slab_voxel_count = 0;
+    const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(context));
+    for (uint64_t i = 0; i < word_count; ++i)
+    {
+        uint64_t word = context->shell_voxels[i];
+        while (word != 0)
+        {
+            const uvec3_t position = _shell_voxel_position(context, i * 64 + _count_trailing_zeros64(word));
+            if (_slab_voxel(context, exterior, position, max_thickness))
+            {
+                _brick_bitset_clear(blocked, position);
+                ++slab_voxel_count;
+            }
+            word &= word - 1;
+        }
+    }
+    return slab_voxel_count;
+}
+
+// Classifies the voxels of the grid of grid_aabb from the shell voxels of the
+// mesh of params. The exterior is flood filled from the border of the grid,
+// inner voxels are the voxels that are neither shell nor exterior voxels.
+// Returns false when the exterior leaks inside the mesh, see _exterior_leaks,
+// out_inner is left empty in that case. The bitsets of the classification store
+// the bricks holding both set and clear voxels only, which are the bricks of
+// the shell unless holes are closed.
+//
+// When the exterior leaks and a closing radius is given, the shell is dilated by
+// the radius and the exterior flood filled again so that it does not leak
+// through gaps narrower than twice the radius. The voxels neither in the dilated
+// shell nor in that exterior lie at least the radius inside the mesh, they are
+// grown back toward the shell by the radius one voxel along the axes at a time,
+// never into shell or exterior voxels. Inner voxels therefore reach at most the
+// radius past the closed gaps, and parts of the solid thinner than about twice
+// the radius that only connect to the rest through such parts are lost. Meshes
+// that do not leak are classified the same with or without a closing radius.
+//
+// When a wall thickness is given, walls of shell voxels at most that thick with
+// exterior voxels on both sides are filled as slabs, see _slab_voxel, and are
+// removed from the shell. The slabs cross the triangles of their walls. Meshes
+// whose exterior still leaks keep the voxels they enclose and their slabs
+// instead of failing, unless they have no slab. The number of slab voxels is
+// kept in the context.
+static bool _classify_interior(_context_t* context, const melt_params_t* params, _aabb_t grid_aabb, _brick_bitset_t* out_inner)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uint32_t closing_radius = params->hole_closing_voxels;
+    const uint32_t wall_thickness = params->thin_wall_voxels;
+    const vec3_t voxel_extent = _voxel_extent(params);
+    const _scene_t scene = _params_scene(params);
+
+    _brick_bitset_t blocked;
+    _init_brick_bitset(&blocked, context->dimension);
+    _init_brick_bitset(out_inner, context->dimension);
+    _set_shell_brick_bitset(context, &blocked);
+
+    // The exterior is flood filled in the storage of the inner voxels. The
+    // hierarchy of the triangles is only built once the exterior reaches voxels
+    // that may lie inside the mesh, a closed mesh whose exterior does not is
+    // classified from its voxels alone.
+    _brick_bitset_t* exterior = out_inner;
+    melt_triangle_bvh_t bvh;
+    const melt_triangle_bvh_t* scene_bvh = context->scene_bvh;
+    bool leaks = _flood_fill_exterior(&blocked, exterior);
+    if (leaks)
+    {
+        if (scene_bvh == NULL)
+        {
+            _init_triangle_bvh(&bvh, &scene);
+            context->classification_bvh = true;
+            scene_bvh = &bvh;
+        }
+        leaks = _exterior_leaks(&blocked, exterior, scene_bvh, grid_aabb, voxel_extent);
+    }
+
+    uint64_t closing_bytes = 0;
+    if (leaks && closing_radius > 0)
+    {
+        _dilate_brick_bitset(&blocked, exterior, closing_radius);
+        _clear_brick_bitset(exterior);
+
+        leaks = _flood_fill_exterior(&blocked, exterior) && _exterior_leaks(&blocked, exterior, scene_bvh, grid_aabb, voxel_extent);
+        if (!leaks)
+        {
+            // The deep inner voxels are grown back in the storage of the
+            // dilated shell, the exterior then stores the voxels not grown.
+            _brick_bitset_t grown;
+            _init_brick_bitset(&grown, context->dimension);
+            _invert_union(exterior, &blocked);
+            for (uint32_t step = 0; step < closing_radius; ++step)
+            {
+                _grow_brick_bitset(context, &blocked, exterior, &grown);
+
+                const _brick_bitset_t swapped = grown;
+                grown = blocked;
+                blocked = swapped;
+            }
+            closing_bytes = _brick_bitset_allocated_bytes(&grown);
+            _free_brick_bitset(&grown);
+
+            _clear_brick_bitset(exterior);
+            _invert_union(&blocked, exterior);
+            _clear_brick_bitset(&blocked);
+            _set_shell_brick_bitset(context, &blocked);
+        }
+    }
+
+    if (wall_thickness > 0)
+    {
+        // The slabs of a leaking mesh are found from the exterior of the shell
+        // itself.
+        if (leaks && closing_radius > 0)
+        {
+            _clear_brick_bitset(&blocked);
+            _clear_brick_bitset(exterior);
+            _set_shell_brick_bitset(context, &blocked);
+            _flood_fill_exterior(&blocked, exterior);
+        }
+        context->slab_voxel_count = _unblock_slab_voxels(context, exterior, wall_thickness, &blocked);
+
+        // A leaking exterior is only taken as the exterior of the slabs when
+        // there are slabs to fill.
+        if (context->slab_voxel_count > 0)
+            leaks = false;
+    }
+
+    if (scene_bvh == &bvh)
+        _free_triangle_bvh(&bvh);
+    _track_classification_bytes(context, _brick_bitset_allocated_bytes(&blocked) + _brick_bitset_allocated_bytes(out_inner) + closing_bytes +
+        _flood_fill_memory_bytes(context->dimension));
+
+    if (leaks)
+    {
+        _free_brick_bitset(&blocked);
+        _free_brick_bitset(out_inner);
+        MELT_PROFILE_END();
+        return false;
+    }
+
+    // Inner voxels are written over the exterior voxels, brick by brick.
+    _invert_union(&blocked, out_inner);
+
+    // The slab voxels are inner voxels from now on.
+    if (wall_thickness > 0)
+    {
+        const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(context));
+        for (uint64_t i = 0; i < word_count; ++i)
+        {
+            uint64_t word = context->shell_voxels[i];
+            while (word != 0)
+            {
+                const uvec3_t position = _shell_voxel_position(context, i * 64 + _count_trailing_zeros64(word));
+                if (_brick_bitset_test(out_inner, position))
+                    _clear_shell_voxel(context, position);
+                word &= word - 1;
+            }
+        }
+    }
+
+    _free_brick_bitset(&blocked);
+    MELT_PROFILE_END();
+    return true;
+}
+
+// Whether a voxel in the 26-neighbourhood of position is an exterior voxel,
+// neither a shell nor an inner voxel. The voxels past the grid are exterior.
+static bool _near_exterior_voxel(const _context_t* context, const _brick_bitset_t* inner, uvec3_t position)
+{
+    const uvec3_t dimension = context->dimension;
+    for (uint32_t i = 0; i < 27; ++i)
+    {
+        const uvec3_t neighbour = _uvec3_init(position.x + i % 3 - 1, position.y + (i / 3) % 3 - 1, position.z + i / 9 - 1);
+        if (neighbour.x >= dimension.x || neighbour.y >= dimension.y || neighbour.z >= dimension.z)
+            return true;
+        if (!_shell_voxel(context, neighbour) && !_brick_bitset_test(inner, neighbour))
+            return true;
+    }
+    return false;
+}
+
+// Instance of the scene holding the triangle, the instances hold the triangles
+// from first_triangles[instance] to first_triangles[instance + 1].
+static uint32_t _triangle_instance(const uint32_t* first_triangles, uint32_t instance_count, uint32_t triangle)
+{
+    uint32_t first = 0;
+    uint32_t last = instance_count;
+    while (last - first > 1)
+    {
+        const uint32_t middle = first + (last - first) / 2;
+        if (first_triangles[middle] <= triangle)
+            first = middle;
+        else
+            last = middle;
+    }
+    return first;
+}
+
+// Number of instances with a triangle intersecting the box of center and
+// half_extent, counted up to two. out_instance is set to the first one found.
+static uint32_t _bvh_box_instance_count(const melt_triangle_bvh_t* bvh, const uint32_t* first_triangles, uint32_t instance_count, vec3_t center,
+    vec3_t half_extent, uint32_t* out_instance)
+{
+    _aabb_t bounds;
+    bounds.min = _vec3_sub(center, half_extent);
+    bounds.max = _vec3_add(center, half_extent);
+
+    _bvh_query_t query;
+    _init_bvh_query(bvh, &query, bounds);
+
+    uint32_t count = 0;
+    const _bvh_node_t* leaf;
+    while (_next_bvh_leaf(bvh, &query, &leaf))
+    {
+        for (uint32_t i = leaf->first; i < leaf->first + leaf->triangle_count; ++i)
+        {
+            if (!_bvh_triangle_overlaps(bvh, i, &bounds))
+                continue;
+
+            const _triangle_t triangle = _bvh_triangle(bvh, i);
+            if (!_aabb_intersects_triangle(&triangle, center, half_extent))
+                continue;
+
+            const uint32_t instance = _triangle_instance(first_triangles, instance_count, bvh->triangles[i]);
+            if (count == 0)
+            {
+                *out_instance = instance;
+                count = 1;
+            }
+            else if (instance != *out_instance)
+                return 2;
+        }
+    }
+    return count;
+}
+
+// Fills the shell voxels where the instances of a scene meet, so that the union
+// of the instances is filled as one solid. A shell voxel is fused when none of
+// its 26 neighbours is an exterior voxel, and either the triangles of two
+// instances intersect it or it lies inside another instance than the one whose
+// triangles intersect it. The shell voxels of a single instance, such as the
+// voxels of its walls a few voxels thick, are left in the shell. Fused voxels
+// become inner voxels and are removed from the shell, which leaves the exterior
+// unchanged so that the voxels can be fused in any order. Boxes spanning across
+// instances cross the triangles of their shared faces, scenes of a single
+// instance are left unchanged.
+static void _fuse_shell(_context_t* context, const melt_params_t* params, _aabb_t grid_aabb, _brick_bitset_t* inner)
+{
+    const _scene_t scene = _params_scene(params);
+    const uint32_t instance_count = _scene_instance_count(&scene);
+    if (instance_count < 2)
+        return;
+
+    MELT_PROFILE_BEGIN();
+
+    melt_triangle_bvh_t bvh;
+    const melt_triangle_bvh_t* scene_bvh = context->scene_bvh;
+    if (scene_bvh == NULL)
+    {
+        _init_triangle_bvh(&bvh, &scene);
+        scene_bvh = &bvh;
+    }
+
+    uint32_t* first_triangles = MELT_MALLOC(uint32_t, (instance_count + 1));
+    first_triangles[0] = 0;
+    for (uint32_t i = 0; i < instance_count; ++i)
+        first_triangles[i + 1] = first_triangles[i] + _scene_instance_mesh(&scene, i)->index_count / 3;
+
+    // The triangles are searched in voxels grown by a small fraction, so that
+    // faces on the sides of a voxel are found whichever way the voxel
+    // positions round.
+    const vec3_t voxel_extent = _voxel_extent(params);
+    const vec3_t half_voxel_extent = _vec3_mulf(voxel_extent, 0.5f);
+    const vec3_t search_extent = _vec3_mulf(voxel_extent, 0.51f);
+    const vec3_t first_center = _vec3_add(grid_aabb.min, half_voxel_extent);
+
+    const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(context));
+    for (uint64_t i = 0; i < word_count; ++i)
+    {
+        uint64_t word = context->shell_voxels[i];
+        while (word != 0)
+        {
+            const uvec3_t position = _shell_voxel_position(context, i * 64 + _count_trailing_zeros64(word));
+            word &= word - 1;
+            if (_near_exterior_voxel(context, inner, position))
+                continue;
+
+            const vec3_t center = _vec3_add(first_center, _vec3_mul(_vec3_init((float)position.x, (float)position.y, (float)position.z), voxel_extent));
+            uint32_t instance = 0;
+            const uint32_t count = _bvh_box_instance_count(scene_bvh, first_triangles, instance_count, center, search_extent, &instance);
+            if (count == 0 || (count == 1 && !_bvh_contains_point(scene_bvh, center, first_triangles[instance], first_triangles[instance + 1])))
+                continue;
+
+            _brick_bitset_set(inner, position);
+            _clear_shell_voxel(context, position);
+        }
+    }
+
+    MELT_FREE(first_triangles);
+    if (scene_bvh == &bvh)
+        _free_triangle_bvh(&bvh);
+    MELT_PROFILE_END();
+}
+
+static uint32_t _find_run_root(uint32_t* parents, uint32_t run)
+{
+    while (parents[run] != run)
+    {
+        parents[run] = parents[parents[run]];
+        run = parents[run];
+    }
+    return run;
+}
+
+// Joins the runs of [a, a_end) and [b, b_end), runs of two neighbour rows sorted
+// along x, that overlap. A component is rooted at its first run.
+static void _join_overlapping_runs(const _span_t* runs, uint32_t* parents, uint32_t a, uint32_t a_end, uint32_t b, uint32_t b_end)
+{
+    while (a < a_end && b < b_end)
+    {
+        if (runs[a].x1 <= runs[b].x0)
+        {
+            ++a;
+            continue;
+        }
+        if (runs[b].x1 <= runs[a].x0)
+        {
+            ++b;
+            continue;
+        }
+
+        const uint32_t root_a = _find_run_root(parents, a);
+        const uint32_t root_b = _find_run_root(parents, b);
+        if (root_a < root_b)
+            parents[root_b] = root_a;
+        else
+            parents[root_a] = root_b;
+
+        if (runs[a].x1 < runs[b].x1)
+            ++a;
+        else
+            ++b;
+    }
+}
+
+// Labels the 6-connected components of the inner voxels. The runs of inner
+// voxels of the rows of the grid are gathered in grid order and the runs of
+// neighbour rows that overlap are joined. The runs of each component are pushed
+// to out_runs, components are ordered by their first voxel in grid order.
+static _component_t* _label_components(_context_t* context, const _brick_bitset_t* inner, _span_stack_t* out_runs, uint32_t* out_component_count)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uvec3_t dimension = inner->dimension;
+    uint64_t* row = MELT_MALLOC(uint64_t, _bitset_word_count(dimension.x));
+
+    // First run of each row of the previous and the current slice, the runs of
+    // the row y are [row_runs[y], row_runs[y + 1]).
+    uint32_t* slice_runs = MELT_MALLOC(uint32_t, 2 * ((uint64_t)dimension.y + 1));
+    uint32_t* previous_row_runs = slice_runs;
+    uint32_t* row_runs = slice_runs + dimension.y + 1;
+
+    _span_stack_t runs;
+    memset(&runs, 0, sizeof(_span_stack_t));
+    uint32_t* parents = NULL;
+
+    for (uint32_t z = 0; z < dimension.z; ++z)
+    {
+        for (uint32_t y = 0; y < dimension.y; ++y)
+        {
+            row_runs[y] = runs.count;
+
+            _brick_bitset_row(inner, y, z, row);
+            uint32_t x = _row_next_set(row, 0, dimension.x);
+            while (x < dimension.x)
+            {
+                const uint32_t x_end = _row_next_clear(row, x, dimension.x);
+
+                const uint32_t capacity = runs.capacity;
+                _span_stack_push(&runs, y, z, x, x_end);
+                if (runs.capacity != capacity)
+                    parents = (uint32_t*)_grow_allocation(parents, capacity * sizeof(uint32_t), runs.capacity * sizeof(uint32_t));
+                parents[runs.count - 1] = runs.count - 1;
+
+                x = _row_next_set(row, x_end, dimension.x);
+            }
+
+            if (y > 0)
+                _join_overlapping_runs(runs.spans, parents, row_runs[y - 1], row_runs[y], row_runs[y], runs.count);
+            if (z > 0)
+                _join_overlapping_runs(runs.spans, parents, previous_row_runs[y], previous_row_runs[y + 1], row_runs[y], runs.count);
+        }
+        row_runs[dimension.y] = runs.count;
+
+        uint32_t* swap = previous_row_runs;
+        previous_row_runs = row_runs;
+        row_runs = swap;
+    }
+
+    // Roots come before the runs of their component, the parent of each run is
+    // replaced with the index of its component in one pass.
+    uint32_t component_count = 0;
+    for (uint32_t i = 0; i < runs.count; ++i)
+        parents[i] = _find_run_root(parents, i);
+    for (uint32_t i = 0; i < runs.count; ++i)
+        parents[i] = parents[i] == i ? component_count++ : parents[parents[i]];
+
+    _component_t* components = MELT_MALLOC(_component_t, component_count);
+    memset(components, 0, component_count * sizeof(_component_t));
+    for (uint32_t i = 0; i < component_count; ++i)
+    {
+        components[i].min = _uvec3_init(UINT_MAX, UINT_MAX, UINT_MAX);
+        components[i].max = _uvec3_init(0, 0, 0);
+    }
+
+    for (uint32_t i = 0; i < runs.count; ++i)
+    {
+        const _span_t* run = &runs.spans[i];
+        _component_t* component = &components[parents[i]];
+        ++component->run_end;
+        component->min.x = _uint32_t_min(component->min.x, run->x0);
+        component->min.y = _uint32_t_min(component->min.y, run->y);
+        component->min.z = _uint32_t_min(component->min.z, run->z);
+        component->max.x = component->max.x > run->x1 ? component->max.x : run->x1;
+        component->max.y = component->max.y > run->y + 1 ? component->max.y : run->y + 1;
+        component->max.z = component->max.z > run->z + 1 ? component->max.z : run->z + 1;
+    }
+
+    uint32_t run_begin = 0;
+    for (uint32_t i = 0; i < component_count; ++i)
+    {
+        const uint32_t run_count = components[i].run_end;
+        components[i].run_begin = run_begin;
+        components[i].run_end = run_begin;
+        run_begin += run_count;
+    }
+
+    out_runs->spans = MELT_MALLOC(_span_t, runs.count);
+    out_runs->count = runs.count;
+    out_runs->capacity = runs.count;
+    for (uint32_t i = 0; i < runs.count; ++i)
+        out_runs->spans[components[parents[i]].run_end++] = runs.spans[i];
+
+    _track_classification_bytes(context, _brick_bitset_allocated_bytes(inner) + _bitset_word_count(dimension.x) * sizeof(uint64_t) +
+        2 * ((uint64_t)dimension.y + 1) * sizeof(uint32_t) + runs.capacity * (sizeof(_span_t) + sizeof(uint32_t)));
+
+    MELT_FREE(row);
+    MELT_FREE(slice_runs);
+    MELT_FREE(runs.spans);
+    MELT_FREE(parents);
+
+    *out_component_count = component_count;
+    MELT_PROFILE_END();
+    return components;
+}
+
+// Generates the voxel field and the minimum distance field from the inner
+// voxels. The minimum distance of an inner voxel along an axis is the length of
+// the run of inner voxels starting at the voxel, all three distances are found
+// in a single sweep of the grid from its far corner.
+static void _generate_fields(_context_t* context, const _brick_bitset_t* inner)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uvec3_t dimension = context->dimension;
+
+    if (!context->sparse)
+    {
+        context->size = _dense_field_size(dimension);
+        context->voxel_field = MELT_MALLOC(_voxel_status_t, context->size);
+        context->min_distance_field = MELT_MALLOC(_min_distance_t, context->size);
+    }
+    else
+    {
+        _brick_map_t* map = &context->field_bricks;
+        const uint64_t brick_count = (uint64_t)map->dimension.x * map->dimension.y * map->dimension.z;
+        for (uint64_t i = 0; i < brick_count; ++i)
+        {
+            if (_brick_any(inner, i))
+                _brick_map_insert(map, _unflatten_3d(i, map->dimension));
+        }
+
+        context->size = (uint64_t)map->count * MELT_BRICK_VOXEL_COUNT;
+        context->voxel_field = MELT_MALLOC(_voxel_status_t, context->size);
+        context->min_distance_field = MELT_MALLOC(_min_distance_t, context->size);
+    }
+
+    memset(context->voxel_field, 0, context->size * sizeof(_voxel_status_t));
+    for (uint64_t i = 0; i < context->size; ++i)
+    {
+        _min_distance_t* min_distance = &context->min_distance_field[i];
+        min_distance->dist = _svec3_init(0, 0, 0);
+        if (context->sparse)
+            min_distance->position = _brick_voxel_position(context->field_bricks.positions[i / MELT_BRICK_VOXEL_COUNT], (uint32_t)(i % MELT_BRICK_VOXEL_COUNT));
+        else
+            min_distance->position = _dense_field_position(i, dimension);
+    }
+
+    // Length of the runs of inner voxels along y for the current slice, and along
+    // z for the whole xy plane. Voxels on the border of the grid are never inner
+    // voxels, runs never wrap around.
+    uint32_t* runs_y = MELT_MALLOC(uint32_t, dimension.x);
+    uint32_t* runs_z = MELT_MALLOC(uint32_t, (uint64_t)dimension.x * dimension.y);
+    uint64_t* row = MELT_MALLOC(uint64_t, _bitset_word_count(dimension.x));
+    memset(runs_y, 0, dimension.x * sizeof(uint32_t));
+    memset(runs_z, 0, (uint64_t)dimension.x * dimension.y * sizeof(uint32_t));
+
+    for (uint32_t z = dimension.z; z-- > 0;)
+    {
+        for (uint32_t y = dimension.y; y-- > 0;)
+        {
+            uint32_t* row_runs_z = &runs_z[(uint64_t)dimension.x * y];
+            uint32_t run_x = 0;
+
+            _brick_bitset_row(inner, y, z, row);
+            if (_row_next_set(row, 0, dimension.x) == dimension.x)
+            {
+                memset(runs_y, 0, dimension.x * sizeof(uint32_t));
+                memset(row_runs_z, 0, dimension.x * sizeof(uint32_t));
+                continue;
+            }
+
+            for (uint32_t x = dimension.x; x-- > 0;)
+            {
+                if (!_bitset_test(row, x))
+                {
+                    run_x = 0;
+                    runs_y[x] = 0;
+                    row_runs_z[x] = 0;
+                    continue;
+                }
+
+                ++run_x;
+                ++runs_y[x];
+                ++row_runs_z[x];
+
+                uvec3_t position;
+                position.x = x;
+                position.y = y;
+                position.z = z;
+
+                const uint64_t index = _voxel_index(context, position);
+                MELT_ASSERT(index != MELT_INVALID_INDEX);
+                context->voxel_field[index].inner = true;
+                context->min_distance_field[index].dist = _svec3_init(run_x, runs_y[x], row_runs_z[x]);
+            }
+        }
+    }
+
+    _track_classification_bytes(context, _brick_bitset_allocated_bytes(inner) + _field_runs_memory_bytes(dimension));
+
+    MELT_FREE(runs_y);
+    MELT_FREE(runs_z);
+    MELT_FREE(row);
+    MELT_PROFILE_END();
+}
+
+static uvec3_t _get_max_aabb_extent(const _context_t* context, const _min_distance_t* min_distance)
+{
+    MELT_PROFILE_BEGIN();
+
+    uvec2_t* max_aabb_extents = MELT_ALLOCA(uvec2_t, min_distance->z + min_distance->dist.z);
+    uint32_t max_aabb_extents_count = 0;
+
+    for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
+    {
+        uvec3_t z_slice_position = _uvec3_init(min_distance->x, min_distance->y, z);
+        uint64_t z_slice_index = _voxel_index(context, z_slice_position);
+
+        MELT_ASSERT(z_slice_index != MELT_INVALID_INDEX && context->voxel_field[z_slice_index].inner);
+
+        if (context->voxel_field[z_slice_index].clipped)
+            continue;
+
+        const _min_distance_t* sample_min_distance = &context->min_distance_field[z_slice_index];
+
+        uvec2_t max_extent = _uvec2_init(sample_min_distance->dist.x, sample_min_distance->dist.y);
+
+        uint32_t x = sample_min_distance->x + 1;
+        uint32_t y = sample_min_distance->y + 1;
+        uint32_t i = 1;
+        while (x < sample_min_distance->x + sample_min_distance->dist.x &&
+               y < sample_min_distance->y + sample_min_distance->dist.y)
+        {
+            const uint64_t index = _inner_voxel_index(context, _uvec3_init(x, y, z));
+            if (index != MELT_INVALID_INDEX)
+            {
+                const _min_distance_t* distance = &context->min_distance_field[index];
+                max_extent.x = _uint32_t_min(distance->dist.x + i, max_extent.x);
+                max_extent.y = _uint32_t_min(distance->dist.y + i, max_extent.y);
+            }
+            else
+            {
+                max_extent.x = _uint32_t_min(i, max_extent.x);
+                max_extent.y = _uint32_t_min(i, max_extent.y);
+                break;
+            }
+            ++x;
+            ++y;
+            ++i;
+        }
+
+        max_aabb_extents[max_aabb_extents_count++] = max_extent;
+    }
+
+    uvec2_t min_extent = _uvec2_init(UINT_MAX, UINT_MAX);
+
+    uint32_t z_slice = 1;
+    uint64_t max_volume = 0;
+
+    MELT_ASSERT(max_aabb_extents_count > 0);
+
+    for (uint32_t i = 0; i < max_aabb_extents_count; ++i)
+    {
+        const uvec2_t* extent = &max_aabb_extents[i];
+        min_extent.x = _uint32_t_min(extent->x, min_extent.x);
+        min_extent.y = _uint32_t_min(extent->y, min_extent.y);
+
+        const uint64_t volume = (uint64_t)min_extent.x * min_extent.y * z_slice;
+        if (volume > max_volume)
+            max_volume = volume;
+
+        ++z_slice;
+    }
+
+    MELT_ASSERT(max_volume > 0);
+    MELT_ASSERT(min_extent.x > 0);
+    MELT_ASSERT(min_extent.y > 0);
+    MELT_ASSERT(z_slice > 1);
+    MELT_PROFILE_END();
+
+    return _uvec3_init(min_extent.x, min_extent.y, z_slice - 1);
+}
+
+// Part of the box [box_min, box_max) that lies in the brick.
+static void _brick_box_bounds(uvec3_t brick, uvec3_t box_min, uvec3_t box_max, uvec3_t* out_min, uvec3_t* out_max)
+{
+    out_min->x = _uint32_t_max(brick.x << MELT_BRICK_SIZE_LOG2, box_min.x);
+    out_min->y = _uint32_t_max(brick.y << MELT_BRICK_SIZE_LOG2, box_min.y);
+    out_min->z = _uint32_t_max(brick.z << MELT_BRICK_SIZE_LOG2, box_min.z);
+    out_max->x = _uint32_t_min((brick.x + 1) << MELT_BRICK_SIZE_LOG2, box_max.x);
+    out_max->y = _uint32_t_min((brick.y + 1) << MELT_BRICK_SIZE_LOG2, box_max.y);
+    out_max->z = _uint32_t_min((brick.z + 1) << MELT_BRICK_SIZE_LOG2, box_max.z);
+}
+
+static void _clip_voxel_field(const _context_t* context, const uvec3_t start_position, const uvec3_t extent)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uvec3_t end_position = _uvec3_add(start_position, extent);
+
+    if (!context->sparse)
+    {
+        for (uint32_t z = start_position.z; z < end_position.z; ++z)
+        {
+            for (uint32_t y = start_position.y; y < end_position.y; ++y)
+            {
+                for (uint32_t x = start_position.x; x < end_position.x; ++x)
+                {
+                    const uint64_t index = _dense_field_index(_uvec3_init(x, y, z), context->dimension);
+                    MELT_ASSERT(!context->voxel_field[index].clipped && "Clipping already clipped voxel field index");
+                    context->voxel_field[index].clipped = true;
+                }
+            }
+        }
+
+        MELT_PROFILE_END();
+        return;
+    }
+
+    // The box only holds inner voxels, so each brick it overlaps is stored
+    // and its slot is looked up once for all of its voxels.
+    const uvec3_t brick_start = _brick_position(start_position);
+    const uvec3_t brick_end = _brick_position(_uvec3_init(end_position.x - 1, end_position.y - 1, end_position.z - 1));
+    for (uint32_t brick_z = brick_start.z; brick_z <= brick_end.z; ++brick_z)
+    {
+        for (uint32_t brick_y = brick_start.y; brick_y <= brick_end.y; ++brick_y)
+        {
+            for (uint32_t brick_x = brick_start.x; brick_x <= brick_end.x; ++brick_x)
+            {
+                const uvec3_t brick = _uvec3_init(brick_x, brick_y, brick_z);
+                const uint32_t slot = context->field_bricks.slots[_flatten_3d(brick, context->field_bricks.dimension)];
+                MELT_ASSERT(slot != MELT_EMPTY_BRICK);
+                _voxel_status_t* voxels = &context->voxel_field[(uint64_t)slot * MELT_BRICK_VOXEL_COUNT];
+
+                uvec3_t min, max;
+                _brick_box_bounds(brick, start_position, end_position, &min, &max);
+                for (uint32_t z = min.z; z < max.z; ++z)
+                {
+                    for (uint32_t y = min.y; y < max.y; ++y)
+                    {
+                        _voxel_status_t* row = &voxels[_brick_row_index(y, z)];
+                        for (uint32_t x = min.x; x < max.x; ++x)
+                        {
+                            _voxel_status_t* voxel = &row[x & (MELT_BRICK_SIZE - 1)];
+                            MELT_ASSERT(!voxel->clipped && "Clipping already clipped voxel field index");
+                            voxel->clipped = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    MELT_PROFILE_END();
+}
+
+static void _debug_validate_min_distance_field(const _context_t* context)
+{
+#if defined(MELT_DEBUG) && defined(MELT_ASSERT)
+    for (uint64_t i = 0; i < context->size; ++i)
+    {
+        const _min_distance_t* min_distance = &context->min_distance_field[i];
+        if (!_inner_voxel(context->voxel_field[i]))
+            continue;
+
+        for (uint32_t x = min_distance->x; x < min_distance->x + min_distance->dist.x; ++x)
+        {
+            const uint32_t y = min_distance->y;
+            const uint32_t z = min_distance->z;
+            MELT_ASSERT(!_shell_voxel(context, _uvec3_init(x, y, z)));
+            MELT_ASSERT(_inner_voxel_index(context, _uvec3_init(x, y, z)) != MELT_INVALID_INDEX);
+        }
+        for (uint32_t y = min_distance->y; y < min_distance->y + min_distance->dist.y; ++y)
+        {
+            const uint32_t x = min_distance->x;
+            const uint32_t z = min_distance->z;
+            MELT_ASSERT(!_shell_voxel(context, _uvec3_init(x, y, z)));
+            MELT_ASSERT(_inner_voxel_index(context, _uvec3_init(x, y, z)) != MELT_INVALID_INDEX);
+        }
+        for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
+        {
+            const uint32_t x = min_distance->x;
+            const uint32_t y = min_distance->y;
+            MELT_ASSERT(!_shell_voxel(context, _uvec3_init(x, y, z)));
+            MELT_ASSERT(_inner_voxel_index(context, _uvec3_init(x, y, z)) != MELT_INVALID_INDEX);
+        }
+    }
+#else
+    MELT_UNUSED(context);
+#endif
+}
+
+static void _debug_validate_max_extents(const _context_t* context, const _max_extent_t* max_extents, uint32_t max_extent_count)
+{
+#if defined(MELT_DEBUG) && defined(MELT_ASSERT)
+    for (uint32_t i = 0; i < max_extent_count; ++i)
+    {
+        const _max_extent_t* extent = &max_extents[i];
+        for (uint32_t z = extent->position.z; z < extent->position.z + extent->extent.z; ++z)
+        {
+            for (uint32_t y = extent->position.y; y < extent->position.y + extent->extent.y; ++y)
+            {
+                for (uint32_t x = extent->position.x; x < extent->position.x + extent->extent.x; ++x)
+                {
+                    MELT_ASSERT(!_shell_voxel(context, _uvec3_init(x, y, z)));
+                }
+            }
+        }
+    }
+#else
+    MELT_UNUSED(context);
+    MELT_UNUSED(max_extents);
+    MELT_UNUSED(max_extent_count);
+#endif
+}
+
+static inline void _update_min_distance(_min_distance_t* min_distance, uint32_t axis, uint32_t plane)
+{
+    int32_t* dist = _svec3_component(&min_distance->dist, axis);
+    const uint32_t updated_distance = plane - *_uvec3_component(&min_distance->position, axis);
+    *dist = _uint32_t_min(updated_distance, *dist);
+}
+
+// Caps the distance along axis of the inner voxels of the box [box_min,
+// box_max), which lies below the plane along that axis.
+static void _update_min_distance_box(const _context_t* context, uvec3_t box_min, uvec3_t box_max, uint32_t axis, uint32_t plane)
+{
+    if (!context->sparse)
+    {
+        for (uint32_t z = box_min.z; z < box_max.z; ++z)
+        {
+            for (uint32_t y = box_min.y; y < box_max.y; ++y)
+            {
+                for (uint32_t x = box_min.x; x < box_max.x; ++x)
+                {
+                    const uint64_t index = _dense_field_index(_uvec3_init(x, y, z), context->dimension);
+                    if (_inner_voxel(context->voxel_field[index]))
+                        _update_min_distance(&context->min_distance_field[index], axis, plane);
+                }
+            }
+        }
+        return;
+    }
+
+    // Bricks without field voxels are skipped as a whole, the others look up
+    // their slot once.
+    const uvec3_t brick_start = _brick_position(box_min);
+    const uvec3_t brick_end = _brick_position(_uvec3_init(box_max.x - 1, box_max.y - 1, box_max.z - 1));
+    for (uint32_t brick_z = brick_start.z; brick_z <= brick_end.z; ++brick_z)
+    {
+        for (uint32_t brick_y = brick_start.y; brick_y <= brick_end.y; ++brick_y)
+        {
+            for (uint32_t brick_x = brick_start.x; brick_x <= brick_end.x; ++brick_x)
+            {
+                const uvec3_t brick = _uvec3_init(brick_x, brick_y, brick_z);
+                const uint32_t slot = context->field_bricks.slots[_flatten_3d(brick, context->field_bricks.dimension)];
+                if (slot == MELT_EMPTY_BRICK)
+                    continue;
+
+                const uint64_t brick_index = (uint64_t)slot * MELT_BRICK_VOXEL_COUNT;
+                uvec3_t min, max;
+                _brick_box_bounds(brick, box_min, box_max, &min, &max);
+                for (uint32_t z = min.z; z < max.z; ++z)
+                {
+                    for (uint32_t y = min.y; y < max.y; ++y)
+                    {
+                        const uint64_t row_index = brick_index + _brick_row_index(y, z);
+                        for (uint32_t x = min.x; x < max.x; ++x)
+                        {
+                            const uint64_t index = row_index + (x & (MELT_BRICK_SIZE - 1));
+                            if (_inner_voxel(context->voxel_field[index]))
+                                _update_min_distance(&context->min_distance_field[index], axis, plane);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void _update_min_distance_field(const _context_t* context, uvec3_t start_position, uvec3_t extent)
+{
+    MELT_PROFILE_BEGIN();
+    MELT_ASSERT(start_position.x - 1 != ~0U);
+    MELT_ASSERT(start_position.y - 1 != ~0U);
+    MELT_ASSERT(start_position.z - 1 != ~0U);
+
+    // The voxels below the box along each axis.
+    const uvec3_t end_position = _uvec3_add(start_position, extent);
+    _update_min_distance_box(context, _uvec3_init(0, start_position.y, start_position.z), _uvec3_init(start_position.x, end_position.y, end_position.z), 0, start_position.x);
+    _update_min_distance_box(context, _uvec3_init(start_position.x, 0, start_position.z), _uvec3_init(end_position.x, start_position.y, end_position.z), 1, start_position.y);
+    _update_min_distance_box(context, _uvec3_init(start_position.x, start_position.y, 0), _uvec3_init(end_position.x, end_position.y, start_position.z), 2, start_position.z);
+
+    MELT_PROFILE_END();
+}
+
+static melt_occluder_box_type_t _select_voxel_indices(melt_occluder_box_type_flags_t box_type_flags, const uint16_t** out_indices, uint32_t* out_index_length)
+{
+#define CHECK_FLAG(flag) (box_type_flags & flag) == flag
+
+    if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_REGULAR))
+    {
+        *out_indices = (const uint16_t*)_voxel_cube_indices;
+        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices);
+        return MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    }
+    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_SIDES))
+    {
+        *out_indices = (const uint16_t*)_voxel_cube_indices_sides;
+        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_sides);
+        return MELT_OCCLUDER_BOX_TYPE_SIDES;
+    }
+    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_BOTTOM))
+    {
+        *out_indices = (const uint16_t*)_voxel_cube_indices_bottom;
+        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_bottom);
+        return MELT_OCCLUDER_BOX_TYPE_BOTTOM;
+    }
+    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_TOP))
+    {
+        *out_indices = (const uint16_t*)_voxel_cube_indices_top;
+        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_top);
+        return MELT_OCCLUDER_BOX_TYPE_TOP;
+    }
+    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_DIAGONALS))
+    {
+        *out_indices = (const uint16_t*)_voxel_cube_indices_diagonals;
+        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_diagonals);
+        return MELT_OCCLUDER_BOX_TYPE_DIAGONALS;
+    }
+
+#undef CHECK_FLAG
+
+    return MELT_OCCLUDER_BOX_TYPE_NONE;
+}
+
+static uint16_t _index_count_per_aabb(melt_occluder_box_type_flags_t box_type_flags)
+{
+    uint16_t index_count = 0;
+    while (box_type_flags != MELT_OCCLUDER_BOX_TYPE_NONE)
+    {
+        const uint16_t* indices = NULL;
+        uint32_t indices_length = 0;
+        melt_occluder_box_type_t selected_type = _select_voxel_indices(box_type_flags, &indices, &indices_length);
+        MELT_ASSERT(indices && indices_length > 0);
+        index_count += indices_length;
+        box_type_flags &= ~selected_type;
+    }
+    return index_count;
+}
+
+static uint32_t _vertex_count_per_aabb()
+{
+    return MELT_ARRAY_LENGTH(_voxel_cube_vertices);
+}
+
+static void _add_voxel_to_mesh_with_color(vec3_t voxel_center, vec3_t half_voxel_size, melt_mesh_t* mesh, melt_occluder_box_type_flags_t box_type_flags, const color_3u8_t color)
+{
+    bool has_color = !_uvec3_equals(color, _color_null);
+    melt_index_t index_offset = (melt_index_t)(has_color ? mesh->vertex_count / 2 : mesh->vertex_count);
+
+    for (uint32_t i = 0; i < MELT_ARRAY_LENGTH(_voxel_cube_vertices); ++i)
+    {
+        vec3_t vertex = _vec3_add(_vec3_mul(half_voxel_size, _voxel_cube_vertices[i]), voxel_center);
+        mesh->vertices[mesh->vertex_count++] = vertex;
+        if (has_color) mesh->vertices[mesh->vertex_count++] = _vec3_div(_uvec3_to_vec3(color), 255.0f);
+    }
+
+    while (box_type_flags != MELT_OCCLUDER_BOX_TYPE_NONE)
+    {
+        const uint16_t* indices = NULL;
+        uint32_t indices_length = 0;
+
+        melt_occluder_box_type_t selected_type = _select_voxel_indices(box_type_flags, &indices, &indices_length);
+
+        MELT_ASSERT(indices && indices_length > 0);
+        for (uint32_t i = 0; i < indices_length; ++i)
+        {
+            mesh->indices[mesh->index_count++] = (melt_index_t)(indices[i] + index_offset);
+        }
+
+        box_type_flags &= ~selected_type;
+    }
+}
+
+static void _add_voxel_to_mesh(vec3_t voxel_center, vec3_t half_voxel_size, melt_mesh_t* mesh, melt_occluder_box_type_flags_t box_type_flags)
+{
+    _add_voxel_to_mesh_with_color(voxel_center, half_voxel_size, mesh, box_type_flags, _color_null);
+}
+
+#if defined(MELT_DEBUG)
+static void _add_voxel_set_to_mesh(const _voxel_t* voxel_set, const uint32_t voxel_set_count, vec3_t grid_origin, vec3_t voxel_extent, vec3_t half_voxel_extent, melt_mesh_t* mesh)
+{
+    for (uint32_t i = 0; i < voxel_set_count; ++i)
+    {
+        vec3_t voxel_min = _vec3_add(grid_origin, _vec3_mul(_uvec3_to_vec3(voxel_set[i].position), voxel_extent));
+        vec3_t voxel_center = _vec3_add(voxel_min, _vec3_mulf(voxel_extent, 0.5f));
+        _add_voxel_to_mesh_with_color(voxel_center, half_voxel_extent, mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+    }
+}
+#endif
+
+static inline uint64_t _summed_volume_index(const _summed_volume_table_t* table, uint32_t x, uint32_t y, uint32_t z)
+{
+    return x + (uint64_t)table->dimension.x * (y + (uint64_t)table->dimension.y * z);
+}
+
+static inline uint32_t _brick_corner_index(uint32_t x, uint32_t y, uint32_t z)
+{
+    return x + (MELT_BRICK_SIZE + 1) * (y + (MELT_BRICK_SIZE + 1) * z);
+}
+
+// Bytes of the table of a grid of the given dimension, or of the tables of
+// field_brick_count bricks on sparse grids.
+static uint64_t _summed_volume_table_memory_bytes(uvec3_t dimension, bool sparse, uint64_t field_brick_count)
+{
+    if (sparse)
+        return field_brick_count * MELT_BRICK_CORNER_COUNT * sizeof(uint16_t);
+    return (uint64_t)(dimension.x + 1) * (dimension.y + 1) * (dimension.z + 1) * sizeof(uint32_t);
+}
+
+static uint64_t _extent_search_memory_bytes(const melt_params_t* params, uvec3_t dimension, uint64_t field_brick_count)
+{
+    const bool sparse = params->grid_type == MELT_GRID_TYPE_SPARSE;
+    return params->extent_search == MELT_EXTENT_SEARCH_SUMMED_VOLUME ? _summed_volume_table_memory_bytes(dimension, sparse, field_brick_count) : 0;
+}
+
+static void _init_summed_volume_table(_summed_volume_table_t* table, const _context_t* context)
+{
+    MELT_PROFILE_BEGIN();
+
+    memset(table, 0, sizeof(_summed_volume_table_t));
+    table->dimension.x = context->dimension.x + 1;
+    table->dimension.y = context->dimension.y + 1;
+    table->dimension.z = context->dimension.z + 1;
+    if (context->sparse)
+    {
+        table->bricks = &context->field_bricks;
+        const uint64_t size = (uint64_t)table->bricks->count * MELT_BRICK_CORNER_COUNT;
+        table->brick_sums = MELT_MALLOC(uint16_t, size);
+        memset(table->brick_sums, 0, size * sizeof(uint16_t));
+    }
+    else
+    {
+        const uint64_t size = (uint64_t)table->dimension.x * table->dimension.y * table->dimension.z;
+        table->sums = MELT_MALLOC(uint32_t, size);
+        memset(table->sums, 0, size * sizeof(uint32_t));
+    }
+
+    const uint32_t mask = MELT_BRICK_SIZE - 1;
+    for (uint64_t i = 0; i < context->size; ++i)
+    {
+        if (!_inner_voxel(context->voxel_field[i]))
+            continue;
+
+        const uvec3_t position = context->min_distance_field[i].position;
+        if (context->sparse)
+        {
+            uint16_t* sums = table->brick_sums + (uint64_t)_brick_map_slot(table->bricks, position) * MELT_BRICK_CORNER_COUNT;
+            sums[_brick_corner_index((position.x & mask) + 1, (position.y & mask) + 1, (position.z & mask) + 1)] = 1;
+        }
+        else
+        {
+            table->sums[_summed_volume_index(table, position.x + 1, position.y + 1, position.z + 1)] = 1;
+        }
+    }
+
+    // Prefix sums along x, then y, then z, the sums of the grid wrap past 2^32.
+    if (context->sparse)
+    {
+        const uint32_t strides[3] = { 1, MELT_BRICK_SIZE + 1, (MELT_BRICK_SIZE + 1) * (MELT_BRICK_SIZE + 1) };
+        for (uint32_t slot = 0; slot < table->bricks->count; ++slot)
+        {
+            uint16_t* sums = table->brick_sums + (uint64_t)slot * MELT_BRICK_CORNER_COUNT;
+            for (uint32_t axis = 0; axis < 3; ++axis)
+            {
+                for (uint32_t z = 1; z <= MELT_BRICK_SIZE; ++z)
+                {
+                    for (uint32_t y = 1; y <= MELT_BRICK_SIZE; ++y)
+                    {
+                        for (uint32_t x = 1; x <= MELT_BRICK_SIZE; ++x)
+                        {
+                            const uint32_t index = _brick_corner_index(x, y, z);
+                            sums[index] = (uint16_t)(sums[index] + sums[index - strides[axis]]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    else
+    {
+        const uint64_t strides[3] = { 1, table->dimension.x, (uint64_t)table->dimension.x * table->dimension.y };
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            for (uint32_t z = 1; z < table->dimension.z; ++z)
+            {
+                for (uint32_t y = 1; y < table->dimension.y; ++y)
+                {
+                    for (uint32_t x = 1; x < table->dimension.x; ++x)
+                    {
+                        const uint64_t index = _summed_volume_index(table, x, y, z);
+                        table->sums[index] += table->sums[index - strides[axis]];
+                    }
+                }
+            }
+        }
+    }
+
+    MELT_PROFILE_END();
+}
+
+static void _free_summed_volume_table(_summed_volume_table_t* table)
+{
+    MELT_FREE(table->sums);
+    MELT_FREE(table->brick_sums);
+}
+
+// Number of voxels left to fill in the box [first, last) of the voxels of a brick.
+static uint32_t _brick_summed_volume(const uint16_t* sums, uvec3_t first, uvec3_t last)
+{
+    const int32_t upper = (int32_t)sums[_brick_corner_index(last.x, last.y, last.z)]
+        - sums[_brick_corner_index(first.x, last.y, last.z)]
+        - sums[_brick_corner_index(last.x, first.y, last.z)]
+        + sums[_brick_corner_index(first.x, first.y, last.z)];
+    const int32_t lower = (int32_t)sums[_brick_corner_index(last.x, last.y, first.z)]
+        - sums[_brick_corner_index(first.x, last.y, first.z)]
+        - sums[_brick_corner_index(last.x, first.y, first.z)]
+        + sums[_brick_corner_index(first.x, first.y, first.z)];
+    return (uint32_t)(upper - lower);
+}
+
+// Number of voxels left to fill in the box of the given extent at position, the
+// box holds fewer than 2^32 voxels. On sparse grids, the bricks without fields
+// hold no voxel to fill.
+static uint32_t _summed_volume(const _summed_volume_table_t* table, uvec3_t position, uvec3_t extent)
+{
+    const uint32_t x0 = position.x, x1 = position.x + extent.x;
+    const uint32_t y0 = position.y, y1 = position.y + extent.y;
+    const uint32_t z0 = position.z, z1 = position.z + extent.z;
+
+    if (table->bricks == NULL)
+    {
+        // The sums wrap, their differences are taken modulo 2^32 as well.
+        const uint32_t upper = table->sums[_summed_volume_index(table, x1, y1, z1)]
+            - table->sums[_summed_volume_index(table, x0, y1, z1)]
+            - table->sums[_summed_volume_index(table, x1, y0, z1)]
+            + table->sums[_summed_volume_index(table, x0, y0, z1)];
+        const uint32_t lower = table->sums[_summed_volume_index(table, x1, y1, z0)]
+            - table->sums[_summed_volume_index(table, x0, y1, z0)]
+            - table->sums[_summed_volume_index(table, x1, y0, z0)]
+            + table->sums[_summed_volume_index(table, x0, y0, z0)];
+        return upper - lower;
+    }
+
+    const uvec3_t first_brick = _brick_position(position);
+    const uvec3_t last_brick = _brick_position(_uvec3_init(x1 - 1, y1 - 1, z1 - 1));
+    uint32_t volume = 0;
+    for (uint32_t bz = first_brick.z; bz <= last_brick.z; ++bz)
+    {
+        for (uint32_t by = first_brick.y; by <= last_brick.y; ++by)
+        {
+            for (uint32_t bx = first_brick.x; bx <= last_brick.x; ++bx)
+            {
+                const uint32_t slot = table->bricks->slots[_flatten_3d(_uvec3_init(bx, by, bz), table->bricks->dimension)];
+                if (slot == MELT_EMPTY_BRICK)
+                    continue;
+
+                const uvec3_t origin = _uvec3_init(bx << MELT_BRICK_SIZE_LOG2, by << MELT_BRICK_SIZE_LOG2, bz << MELT_BRICK_SIZE_LOG2);
+                uvec3_t first;
+                first.x = (x0 > origin.x ? x0 : origin.x) - origin.x;
+                first.y = (y0 > origin.y ? y0 : origin.y) - origin.y;
+                first.z = (z0 > origin.z ? z0 : origin.z) - origin.z;
+                uvec3_t last;
+                last.x = _uint32_t_min(x1 - origin.x, MELT_BRICK_SIZE);
+                last.y = _uint32_t_min(y1 - origin.y, MELT_BRICK_SIZE);
+                last.z = _uint32_t_min(z1 - origin.z, MELT_BRICK_SIZE);
+                volume += _brick_summed_volume(table->brick_sums + (uint64_t)slot * MELT_BRICK_CORNER_COUNT, first, last);
+            }
+        }
+    }
+    return volume;
+}
+
+// Removes the voxels of the clipped box from the table, only the corners past
+// the position of the box change. On sparse grids, only the tables of the
+// bricks the box covers change.
+static void _clip_summed_volume_table(_summed_volume_table_t* table, uvec3_t start_position, uvec3_t extent)
+{
+    MELT_PROFILE_BEGIN();
+
+    if (table->bricks == NULL)
+    {
+        for (uint32_t z = start_position.z + 1; z < table->dimension.z; ++z)
+        {
+            const uint32_t overlap_z = _uint32_t_min(z - start_position.z, extent.z);
+            for (uint32_t y = start_position.y + 1; y < table->dimension.y; ++y)
+            {
+                const uint32_t overlap_yz = _uint32_t_min(y - start_position.y, extent.y) * overlap_z;
+                uint32_t* row = &table->sums[_summed_volume_index(table, 0, y, z)];
+                for (uint32_t x = start_position.x + 1; x < table->dimension.x; ++x)
+                    row[x] -= _uint32_t_min(x - start_position.x, extent.x) * overlap_yz;
+            }
+        }
+        MELT_PROFILE_END();
+        return;
+    }
+
+    const uvec3_t end_position = _uvec3_init(start_position.x + extent.x, start_position.y + extent.y, start_position.z + extent.z);
+    const uvec3_t first_brick = _brick_position(start_position);
+    const uvec3_t last_brick = _brick_position(_uvec3_init(end_position.x - 1, end_position.y - 1, end_position.z - 1));
+    for (uint32_t bz = first_brick.z; bz <= last_brick.z; ++bz)
+    {
+        for (uint32_t by = first_brick.y; by <= last_brick.y; ++by)
+        {
+            for (uint32_t bx = first_brick.x; bx <= last_brick.x; ++bx)
+            {
+                const uint32_t slot = table->bricks->slots[_flatten_3d(_uvec3_init(bx, by, bz), table->bricks->dimension)];
+                if (slot == MELT_EMPTY_BRICK)
+                    continue;
+
+                // The part of the box within the brick, in the voxels of the brick.
+                const uvec3_t origin = _uvec3_init(bx << MELT_BRICK_SIZE_LOG2, by << MELT_BRICK_SIZE_LOG2, bz << MELT_BRICK_SIZE_LOG2);
+                uvec3_t first;
+                first.x = (start_position.x > origin.x ? start_position.x : origin.x) - origin.x;
+                first.y = (start_position.y > origin.y ? start_position.y : origin.y) - origin.y;
+                first.z = (start_position.z > origin.z ? start_position.z : origin.z) - origin.z;
+                uvec3_t size;
+                size.x = _uint32_t_min(end_position.x - origin.x, MELT_BRICK_SIZE) - first.x;
+                size.y = _uint32_t_min(end_position.y - origin.y, MELT_BRICK_SIZE) - first.y;
+                size.z = _uint32_t_min(end_position.z - origin.z, MELT_BRICK_SIZE) - first.z;
+
+                uint16_t* sums = table->brick_sums + (uint64_t)slot * MELT_BRICK_CORNER_COUNT;
+                for (uint32_t z = first.z + 1; z <= MELT_BRICK_SIZE; ++z)
+                {
+                    const uint32_t overlap_z = _uint32_t_min(z - first.z, size.z);
+                    for (uint32_t y = first.y + 1; y <= MELT_BRICK_SIZE; ++y)
+                    {
+                        const uint32_t overlap_yz = _uint32_t_min(y - first.y, size.y) * overlap_z;
+                        uint16_t* row = &sums[_brick_corner_index(0, y, z)];
+                        for (uint32_t x = first.x + 1; x <= MELT_BRICK_SIZE; ++x)
+                            row[x] = (uint16_t)(row[x] - _uint32_t_min(x - first.x, size.x) * overlap_yz);
+                    }
+                }
+            }
+        }
+    }
+
+    MELT_PROFILE_END();
+}
+
+// Grows the box one layer at a time along the axis adding the most voxels, as
+// long as the layer added holds only voxels left to fill, as the box does. Layers
+// of 2^32 voxels or more are not added.
+static uvec3_t _grow_extent(const _summed_volume_table_t* table, uvec3_t position, uvec3_t extent)
+{
+    for (;;)
+    {
+        const uint64_t volume = (uint64_t)extent.x * extent.y * extent.z;
+        uvec3_t best_extent = extent;
+        uint64_t best_volume = volume;
+
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            uvec3_t grown = extent;
+            if (axis == 0) ++grown.x;
+            if (axis == 1) ++grown.y;
+            if (axis == 2) ++grown.z;
+
+            if (position.x + grown.x >= table->dimension.x ||
+                position.y + grown.y >= table->dimension.y ||
+                position.z + grown.z >= table->dimension.z)
+                continue;
+
+            uvec3_t layer_position = position;
+            uvec3_t layer = grown;
+            *_uvec3_component(&layer_position, axis) += *_uvec3_component(&extent, axis);
+            *_uvec3_component(&layer, axis) = 1;
+
+            const uint64_t layer_volume = (uint64_t)layer.x * layer.y * layer.z;
+            const uint64_t grown_volume = (uint64_t)grown.x * grown.y * grown.z;
+            if (grown_volume > best_volume && layer_volume <= UINT32_MAX && _summed_volume(table, layer_position, layer) == layer_volume)
+            {
+                best_extent = grown;
+                best_volume = grown_volume;
+            }
+        }
+
+        if (best_volume == volume)
+            return extent;
+        extent = best_extent;
+    }
+}
+
+// Largest box of voxels left to fill whose first corner is the voxel. The
+// minimum distance along x of a voxel is the run left to fill from it, the width
+// of a box is the shortest run over its first dy rows of its first dz slices.
+// The running minimum over the rows is the largest rectangle search of a
+// histogram, reduced to the rectangles anchored at the voxel.
+static uvec3_t _get_max_anchored_extent(const _context_t* context, const _min_distance_t* min_distance)
+{
+    MELT_PROFILE_BEGIN();
+
+    // Per row, the shortest run over the slices so far.
+    uint32_t* widths = MELT_ALLOCA(uint32_t, min_distance->dist.y);
+    for (uint32_t dy = 0; dy < (uint32_t)min_distance->dist.y; ++dy)
+        widths[dy] = UINT_MAX;
+
+    uvec3_t max_extent = _uvec3_init(0, 0, 0);
+    uint64_t max_volume = 0;
+
+    for (uint32_t dz = 0; dz < (uint32_t)min_distance->dist.z; ++dz)
+    {
+        uint32_t width = UINT_MAX;
+        for (uint32_t dy = 0; dy < (uint32_t)min_distance->dist.y; ++dy)
+        {
+            const uint64_t index = _inner_voxel_index(context, _uvec3_init(min_distance->x, min_distance->y + dy, min_distance->z + dz));
+            const uint32_t run = index != MELT_INVALID_INDEX ? (uint32_t)context->min_distance_field[index].dist.x : 0;
+
+            widths[dy] = _uint32_t_min(widths[dy], run);
+            width = _uint32_t_min(width, widths[dy]);
+            if (width == 0)
                 break;
+
+            const uint64_t volume = (uint64_t)width * (dy + 1) * (dz + 1);
+            if (volume > max_volume)
+            {
+                max_extent.x = width;
+                max_extent.y = dy + 1;
+                max_extent.z = dz + 1;
+                max_volume = volume;
+            }
+        }
+
+        if (widths[0] == 0)
+            break;
+    }
+
+    MELT_ASSERT(max_volume > 0);
+    MELT_PROFILE_END();
+    return max_extent;
+}
+
+static _max_extent_t _get_max_extent(const _context_t* context, melt_extent_search_t extent_search, const _summed_volume_table_t* table)
+{
+    MELT_PROFILE_BEGIN();
+
+    _max_extent_t max_extent;
+    max_extent.extent = _uvec3_init(0, 0, 0);
+    max_extent.position = _uvec3_init(0, 0, 0);
+    max_extent.volume = 0;
+
+    for (uint64_t i = 0; i < context->size; ++i)
+    {
+        const _min_distance_t* min_distance = &context->min_distance_field[i];
+        if (_inner_voxel(context->voxel_field[i]))
+        {
+            uvec3_t extent;
+            if (extent_search == MELT_EXTENT_SEARCH_EXACT)
+            {
+                // No box at this voxel can be larger than its minimum distances.
+                const uint64_t volume_bound = (uint64_t)min_distance->dist.x * min_distance->dist.y * min_distance->dist.z;
+                if (volume_bound < max_extent.volume)
+                    continue;
+                extent = _get_max_anchored_extent(context, min_distance);
+            }
+            else
+            {
+                extent = _get_max_aabb_extent(context, min_distance);
+                if (table)
+                    extent = _grow_extent(table, min_distance->position, extent);
+            }
+            uint64_t volume = (uint64_t)extent.x * extent.y * extent.z;
+
+            // Ties go to the first voxel in grid order, whatever the storage order.
+            if (volume > max_extent.volume || (volume == max_extent.volume && !_fields_in_grid_order(context) &&
+                _flatten_3d(min_distance->position, context->dimension) < _flatten_3d(max_extent.position, context->dimension)))
+            {
+                max_extent.extent = extent;
+                max_extent.position = min_distance->position;
+                max_extent.volume = volume;
+            }
+        }
+    }
+
+    MELT_PROFILE_END();
+
+    return max_extent;
+}
+
+// Bytes allocated for a context of the given dimension whose fields hold
+// field_size voxels and whose shell bitset holds shell_bit_count bits, with
+// brick_map_bytes bytes of brick maps, classification_bytes bytes allocated by
+// the classification, shell_voxel_count shell voxels and inner_voxel_count inner
+// voxels. Must be kept in sync with the allocations of the context.
+static uint64_t _context_memory_bytes(uvec3_t dimension, uint64_t field_size, uint64_t shell_bit_count, uint64_t brick_map_bytes,
+    uint64_t classification_bytes, uint64_t shell_voxel_count, uint64_t inner_voxel_count)
+{
+    const uint64_t plane_count = (uint64_t)dimension.y * dimension.z + (uint64_t)dimension.x * dimension.z + (uint64_t)dimension.x * dimension.y;
+
+    uint64_t bytes = brick_map_bytes;
+    bytes += field_size * sizeof(_voxel_status_t);
+    bytes += field_size * sizeof(_min_distance_t);
+    bytes += _bitset_word_count(shell_bit_count) * sizeof(uint64_t);
+    bytes += classification_bytes;
+#if defined(MELT_DEBUG)
+    bytes += shell_voxel_count * sizeof(_voxel_t);
+    bytes += plane_count * sizeof(_voxel_set_plane_t);
+    bytes += 3 * shell_voxel_count * sizeof(_voxel_t);
+#else
+    MELT_UNUSED(plane_count);
+    MELT_UNUSED(shell_voxel_count);
+#endif
+    bytes += inner_voxel_count * sizeof(_max_extent_t);
+    return bytes;
+}
+
+static uvec3_t _coarse_dimension(uvec3_t dimension, uint32_t factor)
+{
+    uvec3_t coarse_dimension;
+    coarse_dimension.x = (dimension.x + factor - 1) / factor;
+    coarse_dimension.y = (dimension.y + factor - 1) / factor;
+    coarse_dimension.z = (dimension.z + factor - 1) / factor;
+    return coarse_dimension;
+}
+
+// Bytes allocated by the coarsest level of the coarse to fine fill, the levels
+// are filled one after the other.
+static uint64_t _coarse_levels_memory_bytes(const melt_params_t* params, uvec3_t dimension)
+{
+    if (params->coarse_levels == 0)
+        return 0;
+
+    const uvec3_t coarse_dimension = _coarse_dimension(dimension, 2);
+    const uvec3_t brick_dimension = _brick_map_dimension(coarse_dimension);
+    const uint64_t size = (uint64_t)coarse_dimension.x * coarse_dimension.y * coarse_dimension.z;
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+    return _context_memory_bytes(coarse_dimension, _dense_field_size(coarse_dimension), size, 0,
+        _classification_memory_bytes(coarse_dimension, brick_count, 0), 0, 0);
+}
+
+// Number of slots of the face hash of _merge_max_extents, at most three quarters
+// of them are used.
+static uint64_t _face_hash_capacity(uint64_t max_extent_count)
+{
+    uint64_t capacity = 1;
+    while (capacity < 4 * max_extent_count)
+        capacity <<= 1;
+    return capacity;
+}
+
+static uint64_t _merge_memory_bytes(const melt_params_t* params, uint64_t max_extent_count)
+{
+    if (!params->merge_boxes)
+        return 0;
+    return _face_hash_capacity(max_extent_count) * sizeof(uint32_t) + max_extent_count * sizeof(uint8_t);
+}
+
+// Bytes allocated while building the hierarchy of triangle_count triangles, a
+// hierarchy has at most 2 * triangle_count - 1 nodes.
+static uint64_t _bvh_memory_bytes(uint64_t triangle_count)
+{
+    const uint64_t node_capacity = triangle_count > 0 ? 2 * triangle_count - 1 : 1;
+    return node_capacity * sizeof(_bvh_node_t) + triangle_count * (sizeof(uint32_t) + 9 * sizeof(float) + sizeof(_aabb_t));
+}
+
+// Bytes of the hierarchy of the triangles of the scene, built to find whether
+// the exterior leaks inside the mesh, to fuse instances and to refine the boxes.
+static uint64_t _scene_bvh_memory_bytes(const melt_params_t* params)
+{
+    const _scene_t scene = _params_scene(params);
+    return _bvh_memory_bytes(_scene_triangle_count(&scene));
+}
+
+// Bytes of the hierarchy of the triangles of the scene when the generation of
+// the occluder of the context builds it, one at a time, none when the caller
+// holds it.
+static uint64_t _context_bvh_memory_bytes(const _context_t* context, const melt_params_t* params)
+{
+    if (context->scene_bvh != NULL)
+        return 0;
+
+    const bool built = context->classification_bvh || params->fuse_instances || params->refine_boxes;
+    return built ? _scene_bvh_memory_bytes(params) : 0;
+}
+
+static uint64_t _mesh_memory_bytes(const melt_mesh_t* mesh)
+{
+    return (uint64_t)mesh->vertex_count * sizeof(vec3_t) + (uint64_t)mesh->index_count * sizeof(melt_index_t);
+}
+
+static uint64_t _context_allocated_bytes(const _context_t* context, uint64_t inner_voxel_count)
+{
+    uint64_t brick_map_bytes = 0;
+    uint64_t shell_bit_count = _shell_voxel_bit_count(context);
+    if (context->sparse)
+    {
+        brick_map_bytes += _brick_map_memory_bytes(context->dimension, context->shell_bricks.capacity);
+        brick_map_bytes += _brick_map_memory_bytes(context->dimension, context->field_bricks.capacity);
+        shell_bit_count = (uint64_t)context->shell_bricks.capacity * MELT_BRICK_VOXEL_COUNT;
+    }
+    return _context_memory_bytes(context->dimension, context->size, shell_bit_count, brick_map_bytes, context->classification_bytes,
+        context->voxel_set_count, inner_voxel_count);
+}
+
+void _init_context(_context_t* context, uvec3_t dimension, bool sparse)
+{
+    memset(context, 0, sizeof(_context_t));
+    context->dimension = dimension;
+    context->sparse = sparse;
+
+    if (sparse)
+    {
+        // Bricks and fields are allocated as the shell and the inner voxels are found.
+        _init_brick_map(&context->shell_bricks, context->dimension);
+        _init_brick_map(&context->field_bricks, context->dimension);
+        return;
+    }
+
+    // Fields are allocated once the inner voxels are found.
+    const uint64_t size = (uint64_t)context->dimension.x * context->dimension.y * context->dimension.z;
+    context->shell_voxels = MELT_MALLOC(uint64_t, _bitset_word_count(size));
+    memset(context->shell_voxels, 0, _bitset_word_count(size) * sizeof(uint64_t));
+}
+
+void _free_context(_context_t* context)
+{
+    if (context->sparse)
+    {
+        _free_brick_map(&context->shell_bricks);
+        _free_brick_map(&context->field_bricks);
+    }
+    _free_per_plane_voxel_set(context);
+    MELT_FREE(context->shell_voxels);
+    MELT_FREE(context->voxel_field);
+    MELT_FREE(context->min_distance_field);
+    MELT_FREE(context->voxel_set);
+}
+
+void melt_free_result(melt_result_t result)
+{
+    MELT_FREE(result.mesh.vertices);
+    MELT_FREE(result.mesh.indices);
+    MELT_FREE(result.debug_mesh.vertices);
+    MELT_FREE(result.debug_mesh.indices);
+    MELT_FREE(result.box_fill_pcts);
+    MELT_FREE(result.box_instance_offsets);
+    MELT_FREE(result.box_instances);
+}
+
+// Eigenvectors of the symmetric matrix m by cyclic Jacobi rotations, written as
+// the rows of out_vectors. m is diagonalized in place.
+static void _symmetric_eigenvectors(double m[3][3], vec3_t out_vectors[3])
+{
+    double v[3][3] = { { 1.0, 0.0, 0.0 }, { 0.0, 1.0, 0.0 }, { 0.0, 0.0, 1.0 } };
+
+    for (uint32_t sweep = 0; sweep < 32; ++sweep)
+    {
+        const double diagonal = m[0][0] * m[0][0] + m[1][1] * m[1][1] + m[2][2] * m[2][2];
+        const double off_diagonal = m[0][1] * m[0][1] + m[0][2] * m[0][2] + m[1][2] * m[1][2];
+        if (off_diagonal <= 1e-24 * diagonal)
+            break;
+
+        for (uint32_t p = 0; p < 2; ++p)
+        {
+            for (uint32_t q = p + 1; q < 3; ++q)
+            {
+                if (m[p][q] == 0.0)
+                    continue;
+
+                // Rotation in the (p, q) plane zeroing m[p][q].
+                const double theta = (m[q][q] - m[p][p]) / (2.0 * m[p][q]);
+                const double t = (theta >= 0.0 ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+                const double c = 1.0 / sqrt(t * t + 1.0);
+                const double s = t * c;
+
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    const double mkp = m[k][p];
+                    const double mkq = m[k][q];
+                    m[k][p] = c * mkp - s * mkq;
+                    m[k][q] = s * mkp + c * mkq;
+                }
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    const double mpk = m[p][k];
+                    const double mqk = m[q][k];
+                    m[p][k] = c * mpk - s * mqk;
+                    m[q][k] = s * mpk + c * mqk;
+                }
+                for (uint32_t k = 0; k < 3; ++k)
+                {
+                    const double vkp = v[k][p];
+                    const double vkq = v[k][q];
+                    v[k][p] = c * vkp - s * vkq;
+                    v[k][q] = s * vkp + c * vkq;
+                }
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < 3; ++i)
+        out_vectors[i] = _vec3_init((float)v[0][i], (float)v[1][i], (float)v[2][i]);
+}
+
+static vec3_t _vec3_normalize(vec3_t v)
+{
+    const float length = sqrtf(_vec3_dot(v, v));
+    return length > 0.0f ? _vec3_mulf(v, 1.0f / length) : v;
+}
+
+// Coordinates of the world space point v in the frame of axes.
+static vec3_t _to_grid_frame(const vec3_t axes[3], vec3_t v)
+{
+    return _vec3_init(_vec3_dot(axes[0], v), _vec3_dot(axes[1], v), _vec3_dot(axes[2], v));
+}
+
+static vec3_t _from_grid_frame(const vec3_t axes[3], vec3_t v)
+{
+    return _vec3_add(_vec3_add(_vec3_mulf(axes[0], v.x), _vec3_mulf(axes[1], v.y)), _vec3_mulf(axes[2], v.z));
+}
+
+// Volume of the bounds of the triangles of scene in the frame of axes.
+static double _grid_frame_bounds_volume(const _scene_t* scene, const vec3_t axes[3])
+{
+    _aabb_t aabb;
+    aabb.min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+    aabb.max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, scene);
+    while (_next_triangle(&cursor, &triangle))
+    {
+        const vec3_t vertices[3] = { triangle.v0, triangle.v1, triangle.v2 };
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            const vec3_t v = _to_grid_frame(axes, vertices[i]);
+            aabb.min = _vec3_min(aabb.min, v);
+            aabb.max = _vec3_max(aabb.max, v);
+        }
+    }
+    const vec3_t extent = _vec3_sub(aabb.max, aabb.min);
+    return (double)extent.x * extent.y * extent.z;
+}
+
+// Principal axes of the surface of scene, the eigenvectors of the covariance of
+// the triangles weighted by their area. Returns false for scenes without area.
+static bool _principal_axes(const _scene_t* scene, vec3_t out_axes[3])
+{
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, scene);
+    if (!_next_triangle(&cursor, &triangle))
+        return false;
+
+    // Moments are taken relative to a vertex of the scene, far from the origin
+    // the covariance would cancel out in the mean.
+    const vec3_t origin = triangle.v0;
+
+    double area_sum = 0.0;
+    double mean[3] = { 0.0, 0.0, 0.0 };
+    double covariance[3][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 } };
+    do
+    {
+        vec3_t v[3];
+        v[0] = _vec3_sub(triangle.v0, origin);
+        v[1] = _vec3_sub(triangle.v1, origin);
+        v[2] = _vec3_sub(triangle.v2, origin);
+
+        const vec3_t normal = _vec3_cross(_vec3_sub(v[1], v[0]), _vec3_sub(v[2], v[0]));
+        const double area = 0.5 * sqrt((double)_vec3_dot(normal, normal));
+        vec3_t center = _vec3_mulf(_vec3_add(_vec3_add(v[0], v[1]), v[2]), 1.0f / 3.0f);
+
+        // Second moment of the triangle, area / 12 * (9 c c^T + sum of v v^T).
+        for (uint32_t a = 0; a < 3; ++a)
+        {
+            mean[a] += area * *_vec3_component(&center, a);
+            for (uint32_t b = a; b < 3; ++b)
+            {
+                double moment = 9.0 * *_vec3_component(&center, a) * *_vec3_component(&center, b);
+                for (uint32_t j = 0; j < 3; ++j)
+                    moment += (double)*_vec3_component(&v[j], a) * *_vec3_component(&v[j], b);
+                covariance[a][b] += area / 12.0 * moment;
+            }
+        }
+        area_sum += area;
+    } while (_next_triangle(&cursor, &triangle));
+
+    if (area_sum <= 0.0)
+        return false;
+
+    for (uint32_t a = 0; a < 3; ++a)
+    {
+        for (uint32_t b = a; b < 3; ++b)
+        {
+            covariance[a][b] = covariance[a][b] / area_sum - mean[a] * mean[b] / (area_sum * area_sum);
+            covariance[b][a] = covariance[a][b];
+        }
+    }
+
+    _symmetric_eigenvectors(covariance, out_axes);
+
+    // The largest component of each axis is made positive so that meshes close
+    // to the world axes keep their orientation, the frame is right handed.
+    for (uint32_t i = 0; i < 2; ++i)
+    {
+        const vec3_t abs_axis = _vec3_abs(out_axes[i]);
+        const float largest = abs_axis.x > abs_axis.y ? (abs_axis.x > abs_axis.z ? out_axes[i].x : out_axes[i].z) :
+            (abs_axis.y > abs_axis.z ? out_axes[i].y : out_axes[i].z);
+        out_axes[i] = _vec3_normalize(largest < 0.0f ? _vec3_mulf(out_axes[i], -1.0f) : out_axes[i]);
+    }
+    out_axes[2] = _vec3_normalize(_vec3_cross(out_axes[0], out_axes[1]));
+    return true;
+}
+
+// Axes of the grid in world space for params->grid_frame. Returns false when the
+// grid is aligned with the world axes, the mesh is then voxelized as is.
+static bool _grid_axes(const melt_params_t* params, vec3_t out_axes[3])
+{
+    out_axes[0] = _vec3_init(1.0f, 0.0f, 0.0f);
+    out_axes[1] = _vec3_init(0.0f, 1.0f, 0.0f);
+    out_axes[2] = _vec3_init(0.0f, 0.0f, 1.0f);
+
+    if (params->grid_frame == MELT_GRID_FRAME_CUSTOM)
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            vec3_t axis = params->grid_axes[i];
+            for (uint32_t j = 0; j < i; ++j)
+                axis = _vec3_sub(axis, _vec3_mulf(out_axes[j], _vec3_dot(axis, out_axes[j])));
+            out_axes[i] = _vec3_normalize(axis);
+        }
+        return true;
+    }
+
+    if (params->grid_frame != MELT_GRID_FRAME_PRINCIPAL_AXES)
+        return false;
+
+    // Meshes rotated in their source file are voxelized in their own frame rather
+    // than as staircases, unless the world axes bound them more tightly.
+    const _scene_t scene = _params_scene(params);
+    vec3_t axes[3];
+    if (!_principal_axes(&scene, axes) || _grid_frame_bounds_volume(&scene, axes) >= _grid_frame_bounds_volume(&scene, out_axes))
+        return false;
+
+    for (uint32_t i = 0; i < 3; ++i)
+        out_axes[i] = axes[i];
+    return true;
+}
+
+// Bytes of the copy of the vertices of the mesh, or of the instances of the
+// scene, taken by a rotated grid.
+static uint64_t _grid_frame_memory_bytes(const melt_params_t* params)
+{
+    if (params->grid_frame == MELT_GRID_FRAME_WORLD)
+        return 0;
+    if (params->mesh_count == 0)
+        return (uint64_t)params->mesh.vertex_count * sizeof(vec3_t);
+
+    const _scene_t scene = _params_scene(params);
+    return (uint64_t)_scene_instance_count(&scene) * (sizeof(melt_instance_t) + 12 * sizeof(float));
+}
+
+// Moves the mesh of params to the frame of axes, where it is voxelized before the
+// boxes are rotated back to world space. The vertices of the mesh are copied and
+// its indices shared. The instances of a scene are copied instead, their
+// transforms followed by the rotation, and the meshes are shared.
+// _free_grid_frame releases the copy.
+static void _params_to_grid_frame(melt_params_t* params, const vec3_t axes[3])
+{
+    if (params->mesh_count == 0)
+    {
+        const melt_mesh_t mesh = params->mesh;
+        params->mesh.vertices = MELT_MALLOC(vec3_t, mesh.vertex_count);
+        for (uint32_t i = 0; i < mesh.vertex_count; ++i)
+            params->mesh.vertices[i] = _to_grid_frame(axes, mesh.vertices[i]);
+        return;
+    }
+
+    const _scene_t scene = _params_scene(params);
+    const uint32_t instance_count = _scene_instance_count(&scene);
+    melt_instance_t* instances = MELT_MALLOC(melt_instance_t, instance_count);
+    float* transforms = MELT_MALLOC(float, 12 * (uint64_t)instance_count);
+    for (uint32_t i = 0; i < instance_count; ++i)
+    {
+        const float* transform = _scene_instance_transform(&scene, i);
+        float* grid_transform = &transforms[12 * (uint64_t)i];
+        for (uint32_t row = 0; row < 3; ++row)
+            for (uint32_t column = 0; column < 4; ++column)
+                grid_transform[row * 4 + column] = _vec3_dot(axes[row], _transform_column(transform, column));
+
+        instances[i].mesh_index = scene.instance_count > 0 ? scene.instances[i].mesh_index : i;
+        instances[i].transform = grid_transform;
+    }
+
+    params->instances = instances;
+    params->instance_count = instance_count;
+}
+
+static void _free_grid_frame(melt_params_t* params)
+{
+    if (params->mesh_count == 0)
+    {
+        MELT_FREE(params->mesh.vertices);
+        return;
+    }
+
+    // The transforms of the instances are allocated at once.
+    if (params->instance_count > 0)
+        MELT_FREE((float*)params->instances[0].transform);
+    MELT_FREE((melt_instance_t*)params->instances);
+}
+
+// Rotates the meshes of result from the frame of axes back to world space and
+// records the axes. The debug mesh interleaves positions and colors.
+static void _result_from_grid_frame(melt_result_t* result, const vec3_t axes[3], bool oriented)
+{
+    for (uint32_t i = 0; i < 3; ++i)
+        result->grid_axes[i] = axes[i];
+
+    if (!oriented)
+        return;
+
+    for (uint32_t i = 0; i < result->mesh.vertex_count; ++i)
+        result->mesh.vertices[i] = _from_grid_frame(axes, result->mesh.vertices[i]);
+    for (uint32_t i = 0; i < result->debug_mesh.vertex_count; i += 2)
+        result->debug_mesh.vertices[i] = _from_grid_frame(axes, result->debug_mesh.vertices[i]);
+}
+
+// Scales the voxels of params by factor on each axis.
+static void _scale_voxel_size(melt_params_t* params, float factor)
+{
+    params->voxel_size *= factor;
+    params->voxel_size_per_axis = _vec3_mulf(params->voxel_size_per_axis, factor);
+}
+
+// Voxels of the grid around the bounds of the mesh on each side. Walls on the
+// bounds of the mesh are filled as slabs one voxel away from the border of the
+// grid.
+static uint32_t _grid_padding_voxels(const melt_params_t* params)
+{
+    return 1 + params->hole_closing_voxels + (params->thin_wall_voxels > 0 ? 1 : 0);
+}
+
+// Bounds of the voxel grid, the mesh bounds snapped to the voxel grid and padded
+// by one voxel on each side. The padding grows by the hole closing radius so
+// that the exterior still surrounds the dilated shell, and by one more voxel
+// when thin walls are filled so that their slabs stay off the border.
+static _aabb_t _generate_grid_aabb(const melt_params_t* params)
+{
+    const vec3_t voxel_extent = _voxel_extent(params);
+    const vec3_t padding = _vec3_mulf(voxel_extent, (float)_grid_padding_voxels(params));
+
+    const _scene_t scene = _params_scene(params);
+    _aabb_t mesh_aabb = _generate_aabb_from_scene(&scene);
+
+    mesh_aabb.min = _vec3_sub(_map_to_voxel_min_bound(mesh_aabb.min, voxel_extent), padding);
+    mesh_aabb.max = _vec3_add(_map_to_voxel_max_bound(mesh_aabb.max, voxel_extent), padding);
+
+    return mesh_aabb;
+}
+
+static uvec3_t _grid_dimension(const melt_params_t* params, _aabb_t grid_aabb)
+{
+    return _vec3_to_uvev3(_vec3_div_vec3(_vec3_sub(grid_aabb.max, grid_aabb.min), _voxel_extent(params)));
+}
+
+// Upper bound of the number of shell voxels, the number of voxels tested during
+// the shell voxelization of each triangle.
+static uint64_t _shell_voxel_count_bound(const melt_params_t* params, uint64_t size)
+{
+    vec3_t voxel_extent = _voxel_extent(params);
+
+    const _scene_t scene = _params_scene(params);
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, &scene);
+
+    uint64_t bound = 0;
+    while (bound < size && _next_triangle(&cursor, &triangle))
+    {
+        _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+
+        triangle_aabb.min = _vec3_sub(_map_to_voxel_min_bound(triangle_aabb.min, voxel_extent), voxel_extent);
+        triangle_aabb.max = _vec3_add(_map_to_voxel_max_bound(triangle_aabb.max, voxel_extent), voxel_extent);
+
+        // One extra voxel per axis accounts for the accumulation error of the
+        // voxelization loops.
+        vec3_t count = _vec3_div_vec3(_vec3_sub(triangle_aabb.max, triangle_aabb.min), voxel_extent);
+        bound += ((uint64_t)count.x + 2) * ((uint64_t)count.y + 2) * ((uint64_t)count.z + 2);
+    }
+
+    return bound < size ? bound : size;
+}
+
+// Upper bound of the number of bricks holding shell voxels, the bricks
+// overlapped by the voxels tested during the shell voxelization.
+static uint64_t _shell_brick_count_bound(const melt_params_t* params, _aabb_t grid_aabb, uvec3_t dimension)
+{
+    vec3_t voxel_extent = _voxel_extent(params);
+    const uvec3_t brick_dimension = _brick_map_dimension(dimension);
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+
+    uint64_t* bricks = MELT_MALLOC(uint64_t, _bitset_word_count(brick_count));
+    memset(bricks, 0, _bitset_word_count(brick_count) * sizeof(uint64_t));
+
+    const _scene_t scene = _params_scene(params);
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, &scene);
+    while (_next_triangle(&cursor, &triangle))
+    {
+        _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+
+        triangle_aabb.min = _vec3_sub(_map_to_voxel_min_bound(triangle_aabb.min, voxel_extent), voxel_extent);
+        triangle_aabb.max = _vec3_add(_map_to_voxel_max_bound(triangle_aabb.max, voxel_extent), voxel_extent);
+
+        vec3_t min = _vec3_max(_vec3_div_vec3(_vec3_sub(triangle_aabb.min, grid_aabb.min), voxel_extent), _vec3_init(0.0f, 0.0f, 0.0f));
+        vec3_t max = _vec3_div_vec3(_vec3_sub(triangle_aabb.max, grid_aabb.min), voxel_extent);
+
+        uvec3_t brick_min = _brick_position(_vec3_to_uvev3(min));
+        uvec3_t brick_max = _brick_position(_vec3_to_uvev3(max));
+        brick_max.x = _uint32_t_min(brick_max.x, brick_dimension.x - 1);
+        brick_max.y = _uint32_t_min(brick_max.y, brick_dimension.y - 1);
+        brick_max.z = _uint32_t_min(brick_max.z, brick_dimension.z - 1);
+
+        for (uint32_t z = brick_min.z; z <= brick_max.z; ++z)
+            for (uint32_t y = brick_min.y; y <= brick_max.y; ++y)
+                for (uint32_t x = brick_min.x; x <= brick_max.x; ++x)
+                {
+                    uvec3_t brick;
+                    brick.x = x;
+                    brick.y = y;
+                    brick.z = z;
+                    _bitset_set(bricks, _flatten_3d(brick, brick_dimension));
+                }
+    }
+
+    uint64_t count = 0;
+    for (uint64_t i = 0; i < _bitset_word_count(brick_count); ++i)
+        count += _popcount64(bricks[i]);
+
+    MELT_FREE(bricks);
+    return count;
+}
+
+// Sum of the volumes of the instances of the scene, mirrored instances
+// included.
+static float _scene_volume(const _scene_t* scene)
+{
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, scene);
+
+    float volume = 0.0f;
+    float instance_volume = 0.0f;
+    uint32_t instance = 0;
+    while (_next_triangle(&cursor, &triangle))
+    {
+        if (cursor.instance != instance)
+        {
+            volume += fabsf(instance_volume);
+            instance_volume = 0.0f;
+            instance = cursor.instance;
+        }
+        instance_volume += _vec3_dot(triangle.v0, _vec3_cross(triangle.v1, triangle.v2)) / 6.0f;
+    }
+    return volume + fabsf(instance_volume);
+}
+
+// Estimate of melt_estimate_memory for the grid of the given bounds and
+// dimension with the voxels of params. out_shell_bytes is set to the part
+// of the estimate held by the shell voxels.
+static uint64_t _estimate_memory(const melt_params_t* params, _aabb_t mesh_aabb, uvec3_t dimension, uint64_t* out_shell_bytes)
+{
+    // Any voxel of the grid may be an inner voxel.
+    const uint64_t size = (uint64_t)dimension.x * dimension.y * dimension.z;
+    const uint64_t shell_voxel_count = _shell_voxel_count_bound(params, size);
+
+    const uvec3_t brick_dimension = _brick_map_dimension(dimension);
+    const uint64_t brick_count = (uint64_t)brick_dimension.x * brick_dimension.y * brick_dimension.z;
+
+    if (params->grid_type != MELT_GRID_TYPE_SPARSE)
+    {
+        *out_shell_bytes = _bitset_word_count(size) * sizeof(uint64_t);
+        return _context_memory_bytes(dimension, _dense_field_size(dimension), size, 0, _classification_memory_bytes(dimension, brick_count, params->hole_closing_voxels),
+            shell_voxel_count, size) +
+            _extent_search_memory_bytes(params, dimension, 0) + _coarse_levels_memory_bytes(params, dimension) + _merge_memory_bytes(params, size) +
+            _scene_bvh_memory_bytes(params);
+    }
+
+    // Inner voxels lie within a closed mesh, so bricks holding inner voxels either
+    // hold shell voxels or are entirely made of inner voxels. Meshes whose holes
+    // are closed or whose thin walls are filled may not be closed, any brick may
+    // hold inner voxels.
+    const uint64_t shell_brick_count = _shell_brick_count_bound(params, mesh_aabb, dimension);
+    const vec3_t voxel_extent = _voxel_extent(params);
+    const _scene_t scene = _params_scene(params);
+    const uint64_t inner_voxel_bound = (uint64_t)(_scene_volume(&scene) / (voxel_extent.x * voxel_extent.y * voxel_extent.z));
+
+    uint64_t field_brick_count = shell_brick_count + (inner_voxel_bound + MELT_BRICK_VOXEL_COUNT - 1) / MELT_BRICK_VOXEL_COUNT;
+    if (params->hole_closing_voxels > 0 || params->thin_wall_voxels > 0 || field_brick_count > brick_count)
+        field_brick_count = brick_count;
+
+    uint64_t inner_voxel_count = field_brick_count * MELT_BRICK_VOXEL_COUNT;
+    inner_voxel_count = inner_voxel_count < size ? inner_voxel_count : size;
+
+    const uint64_t shell_brick_capacity = _brick_map_capacity(shell_brick_count);
+    const uint64_t brick_map_bytes = _brick_map_memory_bytes(dimension, shell_brick_capacity) + _brick_map_memory_bytes(dimension, _brick_map_capacity(field_brick_count));
+
+    // The bitsets of the classification store the bricks of the shell only, or
+    // once holes are closed the bricks within twice the closing radius of them.
+    uint64_t classification_brick_count = shell_brick_count;
+    if (params->hole_closing_voxels > 0)
+    {
+        const uint64_t reach = 2 * ((params->hole_closing_voxels + MELT_BRICK_SIZE - 1) >> MELT_BRICK_SIZE_LOG2) + 1;
+        classification_brick_count *= reach * reach * reach;
+    }
+    classification_brick_count = classification_brick_count < brick_count ? classification_brick_count : brick_count;
+
+    *out_shell_bytes = _brick_map_memory_bytes(dimension, shell_brick_capacity) + _bitset_word_count(shell_brick_capacity * MELT_BRICK_VOXEL_COUNT) * sizeof(uint64_t);
+
+    return _context_memory_bytes(dimension, field_brick_count * MELT_BRICK_VOXEL_COUNT, shell_brick_capacity * MELT_BRICK_VOXEL_COUNT,
+        brick_map_bytes, _classification_memory_bytes(dimension, classification_brick_count, params->hole_closing_voxels), shell_voxel_count, inner_voxel_count) +
+        _extent_search_memory_bytes(params, dimension, field_brick_count) +
+        _coarse_levels_memory_bytes(params, dimension) + _merge_memory_bytes(params, inner_voxel_count) + _scene_bvh_memory_bytes(params);
+}
+
+uint64_t melt_estimate_memory(melt_params_t params)
+{
+    vec3_t grid_axes[3];
+    const bool oriented = _grid_axes(&params, grid_axes);
+    if (oriented)
+        _params_to_grid_frame(&params, grid_axes);
+
+    _aabb_t mesh_aabb = _generate_grid_aabb(&params);
+    uint64_t shell_bytes = 0;
+    const uint64_t bytes = _estimate_memory(&params, mesh_aabb, _grid_dimension(&params, mesh_aabb), &shell_bytes) + _grid_frame_memory_bytes(&params);
+
+    if (oriented)
+        _free_grid_frame(&params);
+    return bytes;
+}
+
+// Sets the shell voxels of the context, the voxels of the grid of mesh_aabb
+// intersecting the triangles of the mesh.
+static void _voxelize_shell(_context_t* context, const melt_params_t* params, _aabb_t mesh_aabb)
+{
+    vec3_t voxel_extent = _voxel_extent(params);
+    vec3_t half_voxel_extent = _vec3_mulf(voxel_extent, 0.5f);
+
+    vec3_t mesh_extent = _vec3_sub(mesh_aabb.max, mesh_aabb.min);
+    vec3_t inv_mesh_extent = _vec3_init(1.0f / mesh_extent.x, 1.0f / mesh_extent.y, 1.0f / mesh_extent.z);
+    vec3_t voxel_resolution = _vec3_mul(_vec3_div_vec3(mesh_extent, voxel_extent), inv_mesh_extent);
+
+    const _scene_t scene = _params_scene(params);
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    _init_triangle_cursor(&cursor, &scene);
+
+    // Perform shell voxelization
+    while (_next_triangle(&cursor, &triangle))
+    {
+        MELT_PROFILE_BEGIN();
+
+        _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+
+        // Voxel snapping, snap the triangle extent to find the 3d grid to iterate on.
+        triangle_aabb.min = _vec3_sub(_map_to_voxel_min_bound(triangle_aabb.min, voxel_extent), voxel_extent);
+        triangle_aabb.max = _vec3_add(_map_to_voxel_max_bound(triangle_aabb.max, voxel_extent), voxel_extent);
+
+        for (float x = triangle_aabb.min.x; x <= triangle_aabb.max.x; x += voxel_extent.x)
+        {
+            for (float y = triangle_aabb.min.y; y <= triangle_aabb.max.y; y += voxel_extent.y)
+            {
+                for (float z = triangle_aabb.min.z; z <= triangle_aabb.max.z; z += voxel_extent.z)
+                {
+                    _aabb_t voxel_aabb;
+
+                    voxel_aabb.min = _vec3_sub(_vec3_init(x, y, z), half_voxel_extent);
+                    voxel_aabb.max = _vec3_add(_vec3_init(x, y, z), half_voxel_extent);
+
+                    MELT_ASSERT(voxel_aabb.min.x >= mesh_aabb.min.x - half_voxel_extent.x);
+                    MELT_ASSERT(voxel_aabb.min.y >= mesh_aabb.min.y - half_voxel_extent.y);
+                    MELT_ASSERT(voxel_aabb.min.z >= mesh_aabb.min.z - half_voxel_extent.z);
+
+                    MELT_ASSERT(voxel_aabb.max.x <= mesh_aabb.max.x + half_voxel_extent.x);
+                    MELT_ASSERT(voxel_aabb.max.y <= mesh_aabb.max.y + half_voxel_extent.y);
+                    MELT_ASSERT(voxel_aabb.max.z <= mesh_aabb.max.z + half_voxel_extent.z);
+
+                    vec3_t voxel_center = _aabb_center(voxel_aabb);
+                    vec3_t relative_to_origin = _vec3_sub(_vec3_sub(voxel_center, mesh_aabb.min), half_voxel_extent);
+
+                    if (!_aabb_intersects_triangle(&triangle, voxel_center, half_voxel_extent))
+                        continue;
+
+                    uvec3_t position = _vec3_to_uvev3(_vec3_mul(relative_to_origin, voxel_resolution));
+                    _set_shell_voxel(context, position);
+                }
+            }
+        }
+
+        MELT_PROFILE_END();
+    }
+}
+
+// Classifies the voxels of the context from its shell voxels and generates the
+// voxel field and the minimum distance field. Returns false when the mesh is not
+// water tight.
+static bool _generate_fields_from_shell(_context_t* context, const melt_params_t* params, _aabb_t grid_aabb)
+{
+#if defined(MELT_DEBUG)
+    // Gather the shell voxels into a compact list
+    _generate_voxel_set(context);
+
+    // Generate a flat voxel list per plane (x,y), (x,z), (y,z)
+    _generate_per_plane_voxel_set(context);
+#endif
+
+    // Inner voxels are the voxels that the exterior, flood filled from the border
+    // of the grid, does not reach. A mesh with holes lets the exterior leak inside
+    // unless the holes are narrow enough to be closed.
+    _brick_bitset_t inner_voxels;
+    if (!_classify_interior(context, params, grid_aabb, &inner_voxels))
+        return false;
+
+    if (params->fuse_instances)
+        _fuse_shell(context, params, grid_aabb, &inner_voxels);
+
+    // The minimum distance field is a data structure representing, for each voxel,
+    // the minimum distance that we can go in each of the positive directions x, y,
+    // z until we collide with a shell voxel. The voxel field is a data structure
+    // representing the state of the voxels. The clip status is a representation of
+    // whether a voxel is in the clip state, and whether the voxel is an 'inner'
+    // voxel (contained within the shell voxels).
+
+    // Generate the minimum distance field, and voxel status from the inner voxels.
+    _generate_fields(context, &inner_voxels);
+    _free_brick_bitset(&inner_voxels);
+
+    _debug_validate_min_distance_field(context);
+    return true;
+}
+
+// Sets the levels of detail of result from the cumulative fill of its boxes.
+static void _generate_lod_levels(melt_result_t* result)
+{
+    uint32_t box_count = 0;
+    for (uint32_t lod = 0; lod < MELT_LOD_COUNT; ++lod)
+    {
+        while (box_count < result->box_count && (box_count == 0 || result->box_fill_pcts[box_count - 1] < _lod_fill_pcts[lod]))
+            ++box_count;
+
+        result->lods[lod].box_count = box_count;
+        result->lods[lod].fill_pct = box_count > 0 ? result->box_fill_pcts[box_count - 1] : 0.0f;
+    }
+}
+
+// Records the cumulative fill after each box, accumulated the same way as in the
+// greedy fill so that the prefix reaching a fill matches the boxes a generation
+// with that fill_pct would stop at.
+static void _generate_lods(melt_result_t* result, const _max_extent_t* max_extents, uint32_t max_extent_count, uint64_t total_volume)
+{
+    result->box_count = max_extent_count;
+    result->box_fill_pcts = MELT_MALLOC(float, max_extent_count);
+
+    float fill_pct = 0.0f;
+    for (uint32_t i = 0; i < max_extent_count; ++i)
+    {
+        fill_pct += (float)max_extents[i].volume / total_volume;
+        result->box_fill_pcts[i] = fill_pct;
+    }
+
+    _generate_lod_levels(result);
+}
+
+// Orders boxes by decreasing volume, then by position in grid order. Boxes never
+// overlap, no two boxes share a position.
+static int _compare_max_extents(const void* a, const void* b)
+{
+    const _max_extent_t* extent_a = (const _max_extent_t*)a;
+    const _max_extent_t* extent_b = (const _max_extent_t*)b;
+    if (extent_a->volume != extent_b->volume)
+        return extent_a->volume > extent_b->volume ? -1 : 1;
+    if (extent_a->position.z != extent_b->position.z)
+        return extent_a->position.z < extent_b->position.z ? -1 : 1;
+    if (extent_a->position.y != extent_b->position.y)
+        return extent_a->position.y < extent_b->position.y ? -1 : 1;
+    return extent_a->position.x < extent_b->position.x ? -1 : (extent_a->position.x > extent_b->position.x ? 1 : 0);
+}
+
+// Face of a box orthogonal to axis, at offset along axis, spanning the box along
+// the two other axes.
+typedef struct
+{
+    uint32_t axis;
+    uint32_t offset;
+    uvec2_t position;
+    uvec2_t extent;
+} _box_face_t;
+
+static _box_face_t _box_face(const _max_extent_t* max_extent, uint32_t axis, bool max_face)
+{
+    uvec3_t position = max_extent->position;
+    uvec3_t extent = max_extent->extent;
+
+    _box_face_t face;
+    face.axis = axis;
+    face.offset = *_uvec3_component(&position, axis) + (max_face ? *_uvec3_component(&extent, axis) : 0);
+    face.position.x = *_uvec3_component(&position, (axis + 1) % 3);
+    face.position.y = *_uvec3_component(&position, (axis + 2) % 3);
+    face.extent.x = *_uvec3_component(&extent, (axis + 1) % 3);
+    face.extent.y = *_uvec3_component(&extent, (axis + 2) % 3);
+    return face;
+}
+
+static inline bool _box_faces_equal(const _box_face_t* a, const _box_face_t* b)
+{
+    return a->axis == b->axis && a->offset == b->offset && a->position.x == b->position.x && a->position.y == b->position.y &&
+        a->extent.x == b->extent.x && a->extent.y == b->extent.y;
+}
+
+static inline uint64_t _hash_box_face(const _box_face_t* face)
+{
+    const uint32_t words[6] = { face->axis, face->offset, face->position.x, face->position.y, face->extent.x, face->extent.y };
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < 6; ++i)
+        hash = (hash ^ words[i]) * 0x100000001b3ull;
+    return hash ^ (hash >> 32);
+}
+
+// Merges boxes sharing a whole face until no two boxes do, two boxes whose union
+// is a box always share a whole face. Each pass hashes the max faces of the boxes
+// and looks up their min faces, a box takes part in at most one merge per pass.
+// Returns the number of boxes left, ordered by decreasing volume.
+static uint32_t _merge_max_extents(_max_extent_t* max_extents, uint32_t max_extent_count)
+{
+    MELT_PROFILE_BEGIN();
+
+    enum { _BOX_KEPT, _BOX_GROWN, _BOX_REMOVED };
+
+    const uint64_t capacity = _face_hash_capacity(max_extent_count);
+    uint32_t* slots = MELT_MALLOC(uint32_t, capacity);
+    uint8_t* states = MELT_MALLOC(uint8_t, max_extent_count);
+
+    uint32_t count = max_extent_count;
+    uint32_t merge_count = 1;
+    while (merge_count > 0)
+    {
+        merge_count = 0;
+        memset(slots, 0xff, capacity * sizeof(uint32_t));
+        memset(states, _BOX_KEPT, count * sizeof(uint8_t));
+
+        // Slots hold the index of a box times 3 plus the axis of its face.
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            for (uint32_t axis = 0; axis < 3; ++axis)
+            {
+                const _box_face_t face = _box_face(&max_extents[i], axis, true);
+                uint64_t slot = _hash_box_face(&face) & (capacity - 1);
+                while (slots[slot] != UINT32_MAX)
+                    slot = (slot + 1) & (capacity - 1);
+                slots[slot] = i * 3 + axis;
+            }
+        }
+
+        for (uint32_t j = 0; j < count; ++j)
+        {
+            for (uint32_t axis = 0; axis < 3 && states[j] == _BOX_KEPT; ++axis)
+            {
+                const _box_face_t face = _box_face(&max_extents[j], axis, false);
+                for (uint64_t slot = _hash_box_face(&face) & (capacity - 1); slots[slot] != UINT32_MAX; slot = (slot + 1) & (capacity - 1))
+                {
+                    const uint32_t i = slots[slot] / 3;
+                    if (slots[slot] % 3 != axis || i == j || states[i] != _BOX_KEPT)
+                        continue;
+
+                    const _box_face_t max_face = _box_face(&max_extents[i], axis, true);
+                    if (!_box_faces_equal(&face, &max_face))
+                        continue;
+
+                    *_uvec3_component(&max_extents[i].extent, axis) += *_uvec3_component(&max_extents[j].extent, axis);
+                    max_extents[i].volume += max_extents[j].volume;
+                    states[i] = _BOX_GROWN;
+                    states[j] = _BOX_REMOVED;
+                    ++merge_count;
+                    break;
+                }
+            }
+        }
+
+        uint32_t kept_count = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            if (states[i] != _BOX_REMOVED)
+                max_extents[kept_count++] = max_extents[i];
+        }
+        count = kept_count;
+    }
+
+    MELT_FREE(slots);
+    MELT_FREE(states);
+
+    qsort(max_extents, count, sizeof(_max_extent_t), _compare_max_extents);
+
+    MELT_PROFILE_END();
+    return count;
+}
+
+// Takes the largest box left to fill, clips the voxel field and updates the
+// minimum distance field and the summed volume table if any.
+static _max_extent_t _fill_max_extent(const _context_t* context, melt_extent_search_t extent_search, _summed_volume_table_t* table)
+{
+    _max_extent_t max_extent = _get_max_extent(context, extent_search, table);
+
+    _clip_voxel_field(context, max_extent.position, max_extent.extent);
+    if (table)
+        _clip_summed_volume_table(table, max_extent.position, max_extent.extent);
+
+    _update_min_distance_field(context, max_extent.position, max_extent.extent);
+
+    _debug_validate_min_distance_field(context);
+    return max_extent;
+}
+
+// Initializes a dense context whose voxels each cover factor^3 voxels of the
+// context. A coarse voxel is an inner voxel when all the voxels it covers are
+// inner voxels left to fill, the coarse voxels on the border of the grid cover
+// the border of the context and are never inner voxels.
+static void _init_coarse_context(_context_t* coarse, const _context_t* context, uint32_t factor)
+{
+    MELT_PROFILE_BEGIN();
+
+    const uvec3_t dimension = _coarse_dimension(context->dimension, factor);
+    _init_context(coarse, dimension, false);
+
+    _brick_bitset_t inner_voxels;
+    _init_brick_bitset(&inner_voxels, dimension);
+
+    for (uint32_t z = 0; z < dimension.z; ++z)
+    {
+        for (uint32_t y = 0; y < dimension.y; ++y)
+        {
+            for (uint32_t x = 0; x < dimension.x; ++x)
+            {
+                bool inner = (x + 1) * factor <= context->dimension.x && (y + 1) * factor <= context->dimension.y && (z + 1) * factor <= context->dimension.z;
+                for (uint32_t i = 0; inner && i < factor * factor * factor; ++i)
+                {
+                    const uvec3_t position = _uvec3_init(x * factor + i % factor, y * factor + (i / factor) % factor, z * factor + i / (factor * factor));
+                    inner = _inner_voxel_index(context, position) != MELT_INVALID_INDEX;
+                }
+                if (inner)
+                    _brick_bitset_set(&inner_voxels, _uvec3_init(x, y, z));
+            }
+        }
+    }
+
+    _generate_fields(coarse, &inner_voxels);
+    _free_brick_bitset(&inner_voxels);
+
+    MELT_PROFILE_END();
+}
+
+// Fits boxes on grids 2^coarse_levels down to 2 times coarser than the context
+// before the greedy fill of the context. Each coarse box is clipped from the
+// context, the following levels and the context fill what the coarse boxes
+// leave. A coarse voxel is only filled when all the voxels it covers are inner
+// voxels, large solids are filled in far fewer iterations. The boxes, their
+// count, the covered volume and the fill are updated.
+static void _fill_coarse_levels(const _context_t* context, const melt_params_t* params, uint64_t total_volume,
+    _max_extent_t* max_extents, uint32_t* inout_max_extent_count, uint64_t* inout_volume, float* inout_fill_pct)
+{
+    // Summed volume tables only extend the boxes of the context.
+    const melt_extent_search_t extent_search = params->extent_search == MELT_EXTENT_SEARCH_EXACT ? MELT_EXTENT_SEARCH_EXACT : MELT_EXTENT_SEARCH_DIAGONAL;
+
+    for (uint32_t level = params->coarse_levels; level > 0; --level)
+    {
+        const uint32_t factor = 1u << level;
+
+        _context_t coarse;
+        _init_coarse_context(&coarse, context, factor);
+
+        uint64_t coarse_total_volume = 0;
+        for (uint64_t i = 0; i < coarse.size; ++i)
+        {
+            if (_inner_voxel(coarse.voxel_field[i]))
+                ++coarse_total_volume;
+        }
+
+        uint64_t coarse_volume = 0;
+        while (*inout_fill_pct < params->fill_pct && coarse_volume != coarse_total_volume &&
+            (params->max_box_count == 0 || *inout_max_extent_count < params->max_box_count))
+        {
+            const _max_extent_t coarse_extent = _fill_max_extent(&coarse, extent_search, NULL);
+            coarse_volume += coarse_extent.volume;
+
+            _max_extent_t max_extent;
+            max_extent.position = _uvec3_init(coarse_extent.position.x * factor, coarse_extent.position.y * factor, coarse_extent.position.z * factor);
+            max_extent.extent = _uvec3_init(coarse_extent.extent.x * factor, coarse_extent.extent.y * factor, coarse_extent.extent.z * factor);
+            max_extent.volume = coarse_extent.volume * factor * factor * factor;
+
+            _clip_voxel_field(context, max_extent.position, max_extent.extent);
+            _update_min_distance_field(context, max_extent.position, max_extent.extent);
+            _debug_validate_min_distance_field(context);
+
+            max_extents[(*inout_max_extent_count)++] = max_extent;
+            *inout_fill_pct += (float)max_extent.volume / total_volume;
+            *inout_volume += max_extent.volume;
+        }
+
+        _free_context(&coarse);
+    }
+}
+
+// Greedy fill of the inner voxels of the context, clips the voxel field and
+// updates the minimum distance field. Returns the boxes in the order they are
+// found, or by decreasing volume when coarse levels are filled first,
+// out_total_volume is set to the number of inner voxels.
+static _max_extent_t* _generate_max_extents(const _context_t* context, const melt_params_t* params, uint32_t* out_max_extent_count, uint64_t* out_total_volume)
+{
+    uint64_t volume = 0;
+    uint64_t total_volume = 0;
+    float fill_pct = 0.0f;
+
+    // Approximate the volume of the mesh by the number of voxels that can fit within.
+    for (uint64_t i = 0; i < context->size; ++i)
+    {
+        // Each inner voxel adds one unit to the volume.
+        if (_inner_voxel(context->voxel_field[i]))
+            ++total_volume;
+    }
+
+    _max_extent_t* max_extents = MELT_MALLOC(_max_extent_t, total_volume);
+    uint32_t max_extent_count = 0;
+
+    if (params->coarse_levels > 0)
+        _fill_coarse_levels(context, params, total_volume, max_extents, &max_extent_count, &volume, &fill_pct);
+
+    _summed_volume_table_t summed_volume_table;
+    _summed_volume_table_t* table = NULL;
+    if (params->extent_search == MELT_EXTENT_SEARCH_SUMMED_VOLUME && total_volume > 0)
+    {
+        table = &summed_volume_table;
+        _init_summed_volume_table(table, context);
+    }
+
+    // One iteration to find an extent does the following:
+    // . Get the extent that maximizes the volume considering the minimum distance
+    //    field
+    // . Clip the max extent found to the set of inner voxels
+    // . Update the minimum distance field by adjusting the distances on the set
+    //    of inner voxels. This is done by extending the extent cube to infinity
+    //    on each of the axes +x, +y, +z
+    while (fill_pct < params->fill_pct && volume != total_volume &&
+        (params->max_box_count == 0 || max_extent_count < params->max_box_count))
+    {
+        _max_extent_t max_extent = _fill_max_extent(context, params->extent_search, table);
+
+        max_extents[max_extent_count++] = max_extent;
+
+        fill_pct += (float)max_extent.volume / total_volume;
+        volume += max_extent.volume;
+    }
+
+    if (table)
+        _free_summed_volume_table(table);
+
+    // Boxes of the context may be larger than the last coarse boxes.
+    if (params->coarse_levels > 0)
+        qsort(max_extents, max_extent_count, sizeof(_max_extent_t), _compare_max_extents);
+
+    *out_max_extent_count = max_extent_count;
+    *out_total_volume = total_volume;
+    return max_extents;
+}
+
+// Keeps the part of the polygon where sign * (p[axis] - value) >= 0, returns the
+// number of vertices left. out_vertices holds at least vertex_count + 1 vertices.
+static uint32_t _clip_polygon(const vec3_t* vertices, uint32_t vertex_count, uint32_t axis, float value, float sign, vec3_t* out_vertices)
+{
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < vertex_count; ++i)
+    {
+        vec3_t a = vertices[i];
+        vec3_t b = vertices[(i + 1) % vertex_count];
+        const float distance_a = sign * (*_vec3_component(&a, axis) - value);
+        const float distance_b = sign * (*_vec3_component(&b, axis) - value);
+
+        if (distance_a >= 0.0f)
+            out_vertices[count++] = a;
+        if ((distance_a >= 0.0f) != (distance_b >= 0.0f))
+        {
+            const float t = distance_a / (distance_a - distance_b);
+            vec3_t p = _vec3_add(a, _vec3_mulf(_vec3_sub(b, a), t));
+            *_vec3_component(&p, axis) = value;
+            out_vertices[count++] = p;
+        }
+    }
+    return count;
+}
+
+// Distance along the outward normal of a face of the box to the closest part of
+// the triangle within the prism the face sweeps, or max_distance when the
+// triangle does not cross the prism. The sides of the prism are widened by
+// clearance.
+static float _triangle_face_distance(const _triangle_t* triangle, const _aabb_t* box, uint32_t axis, bool max_face, float max_distance, float clearance)
+{
+    vec3_t polygons[2][8];
+    polygons[0][0] = triangle->v0;
+    polygons[0][1] = triangle->v1;
+    polygons[0][2] = triangle->v2;
+    uint32_t vertex_count = 3;
+    uint32_t polygon = 0;
+
+    _aabb_t bounds = *box;
+    const float sign = max_face ? 1.0f : -1.0f;
+    const float face = max_face ? *_vec3_component(&bounds.max, axis) : *_vec3_component(&bounds.min, axis);
+
+    for (uint32_t i = 1; i < 3 && vertex_count > 0; ++i)
+    {
+        const uint32_t side_axis = (axis + i) % 3;
+        vertex_count = _clip_polygon(polygons[polygon], vertex_count, side_axis, *_vec3_component(&bounds.min, side_axis) - clearance, 1.0f, polygons[1 - polygon]);
+        polygon = 1 - polygon;
+        vertex_count = _clip_polygon(polygons[polygon], vertex_count, side_axis, *_vec3_component(&bounds.max, side_axis) + clearance, -1.0f, polygons[1 - polygon]);
+        polygon = 1 - polygon;
+    }
+    if (vertex_count > 0)
+    {
+        vertex_count = _clip_polygon(polygons[polygon], vertex_count, axis, face, sign, polygons[1 - polygon]);
+        polygon = 1 - polygon;
+    }
+
+    float distance = max_distance;
+    for (uint32_t i = 0; i < vertex_count; ++i)
+        distance = _float_min(distance, sign * (*_vec3_component(&polygons[polygon][i], axis) - face));
+    return distance;
+}
+
+// Pushes the face of the box outwards by up to max_distance, stopping short of
+// the first triangle the face would cross. The space the face sweeps keeps a
+// clearance from the triangles to absorb the rounding of the clipping.
+static void _push_box_face(const melt_triangle_bvh_t* bvh, _aabb_t* box, uint32_t axis, bool max_face, float max_distance)
+{
+    const float clearance = max_distance * 1e-2f;
+
+    _aabb_t prism = *box;
+    prism.min = _vec3_sub(prism.min, _vec3_init(clearance, clearance, clearance));
+    prism.max = _vec3_add(prism.max, _vec3_init(clearance, clearance, clearance));
+    if (max_face)
+        *_vec3_component(&prism.max, axis) += max_distance;
+    else
+        *_vec3_component(&prism.min, axis) -= max_distance;
+
+    float distance = max_distance;
+    _bvh_query_t query;
+    _init_bvh_query(bvh, &query, prism);
+
+    const _bvh_node_t* leaf;
+    while (_next_bvh_leaf(bvh, &query, &leaf))
+    {
+        for (uint32_t i = leaf->first; i < leaf->first + leaf->triangle_count; ++i)
+        {
+            if (!_bvh_triangle_overlaps(bvh, i, &prism))
+                continue;
+
+            const _triangle_t triangle = _bvh_triangle(bvh, i);
+            distance = _float_min(distance, _triangle_face_distance(&triangle, box, axis, max_face, max_distance, clearance));
+        }
+    }
+
+    distance = _float_max(0.0f, distance - clearance);
+    if (max_face)
+        *_vec3_component(&box->max, axis) += distance;
+    else
+        *_vec3_component(&box->min, axis) -= distance;
+}
+
+// Returns true when the voxels across the face of the box are all shell voxels,
+// faces next to inner voxels would be pushed into the neighbouring boxes.
+static bool _box_face_on_shell(const _context_t* context, const _max_extent_t* max_extent, uint32_t axis, bool max_face)
+{
+    uvec3_t begin = max_extent->position;
+    uvec3_t end = _uvec3_init(0, 0, 0);
+    end.x = begin.x + max_extent->extent.x;
+    end.y = begin.y + max_extent->extent.y;
+    end.z = begin.z + max_extent->extent.z;
+
+    // The border of the grid holds no inner voxel, boxes never touch it.
+    uint32_t* begin_axis = _uvec3_component(&begin, axis);
+    uint32_t* end_axis = _uvec3_component(&end, axis);
+    *begin_axis = max_face ? *end_axis : *begin_axis - 1;
+    *end_axis = *begin_axis + 1;
+
+    for (uint32_t z = begin.z; z < end.z; ++z)
+    {
+        for (uint32_t y = begin.y; y < end.y; ++y)
+        {
+            for (uint32_t x = begin.x; x < end.x; ++x)
+            {
+                if (!_shell_voxel(context, _uvec3_init(x, y, z)))
+                    return false;
             }
-            ++x;
-            ++y;
-            ++i;
         }
+    }
+    return true;
+}
+
+// Pushes the faces of the box that lie against shell voxels one after the other,
+// the faces pushed first widen the prisms swept by the following ones. The box
+// is within the interior of the mesh and each prism crosses no triangle, so the
+// box stays within the interior of closed meshes. The refined box is no longer
+// aligned on the grid, box_fill_pcts still counts the voxels of the box.
+static void _refine_box(const _context_t* context, const melt_triangle_bvh_t* bvh, const _max_extent_t* max_extent, _aabb_t* box, vec3_t voxel_extent)
+{
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        const float voxel_size = *_vec3_component(&voxel_extent, axis);
+        if (_box_face_on_shell(context, max_extent, axis, false))
+            _push_box_face(bvh, box, axis, false, voxel_size);
+        if (_box_face_on_shell(context, max_extent, axis, true))
+            _push_box_face(bvh, box, axis, true, voxel_size);
+    }
+}
+
+// Adds the boxes to the occluder mesh, records the levels of detail and
+// generates the debug mesh. The grid of the context covers mesh_aabb with the
+// voxels of params.
+static void _generate_occluder_from_max_extents(const _context_t* context, const melt_params_t* params, _aabb_t mesh_aabb,
+    const _max_extent_t* max_extents, uint32_t max_extent_count, uint64_t total_volume, melt_result_t* out_result)
+{
+    vec3_t voxel_extent = _voxel_extent(params);
+    vec3_t half_voxel_extent = _vec3_mulf(voxel_extent, 0.5f);
+
+    out_result->mesh.vertices = MELT_MALLOC(vec3_t, _vertex_count_per_aabb() * max_extent_count);
+    out_result->mesh.indices = MELT_MALLOC(melt_index_t, _index_count_per_aabb(params->box_type_flags) * max_extent_count);
+    out_result->slab_voxel_count = context->slab_voxel_count;
+
+    melt_triangle_bvh_t bvh;
+    const melt_triangle_bvh_t* scene_bvh = context->scene_bvh;
+    const _scene_t scene = _params_scene(params);
+    // Refining needs the triangles of the meshes.
+    const bool refine_boxes = params->refine_boxes && _scene_triangle_count(&scene) > 0;
+    if (refine_boxes && scene_bvh == NULL)
+    {
+        _init_triangle_bvh(&bvh, &scene);
+        scene_bvh = &bvh;
+    }
+
+    for (uint32_t i = 0; i < max_extent_count; ++i)
+    {
+        const _max_extent_t* extent = &max_extents[i];
+
+        vec3_t half_extent = _vec3_mul(_uvec3_to_vec3(extent->extent), half_voxel_extent);
+        vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(extent->position), voxel_extent);
+        vec3_t voxel_position_biased_to_center = _vec3_add(voxel_position, half_extent);
+        vec3_t aabb_center = _vec3_add(_vec3_add(mesh_aabb.min, voxel_position_biased_to_center), half_voxel_extent);
+
+        if (refine_boxes)
+        {
+            _aabb_t box;
+            box.min = _vec3_sub(aabb_center, half_extent);
+            box.max = _vec3_add(aabb_center, half_extent);
+            _refine_box(context, scene_bvh, extent, &box, voxel_extent);
+
+            aabb_center = _aabb_center(box);
+            half_extent = _vec3_mulf(_vec3_sub(box.max, box.min), 0.5f);
+        }
+
+        _add_voxel_to_mesh(aabb_center, half_extent, &out_result->mesh, params->box_type_flags);
+    }
+
+    if (scene_bvh == &bvh)
+        _free_triangle_bvh(&bvh);
+
+    _generate_lods(out_result, max_extents, max_extent_count, total_volume);
+
+    _debug_validate_max_extents(context, max_extents, max_extent_count);
+
+#if defined(MELT_DEBUG)
+    if (params->debug.flags > 0)
+    {
+        // _add_voxel_to_mesh(aabb_center(mesh_aabb), (mesh_aabb.max - mesh_aabb.min) * 0.5f, out_result->debug_mesh, _colors[0]);
+
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_OUTER)
+        {
+            _add_voxel_set_to_mesh(context->voxel_set, context->voxel_set_count, mesh_aabb.min, voxel_extent, _vec3_mulf(half_voxel_extent, params->debug.voxelScale), &out_result->debug_mesh);
+        }
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_SLICE_SELECTION)
+        {
+            if (params->debug.voxel_y > 0 && params->debug.voxel_z > 0)
+            {
+                uint32_t index = _flatten_2d(_uvec2_init(params->debug.voxel_y, params->debug.voxel_z), _uvec2_init(context->dimension.y, context->dimension.z));
+                const _voxel_set_plane_t* voxels_x = &context->voxel_set_planes.x[index];
+                _add_voxel_set_to_mesh(voxels_x->voxels, voxels_x->voxel_count, mesh_aabb.min, voxel_extent, _vec3_mulf(half_voxel_extent, params->debug.voxelScale), &out_result->debug_mesh);
+            }
+            if (params->debug.voxel_x > 0 && params->debug.voxel_z > 0)
+            {
+                uint32_t index = _flatten_2d(_uvec2_init(params->debug.voxel_x, params->debug.voxel_z), _uvec2_init(context->dimension.x, context->dimension.z));
+                const _voxel_set_plane_t* voxels_y = &context->voxel_set_planes.y[index];
+                _add_voxel_set_to_mesh(voxels_y->voxels, voxels_y->voxel_count, mesh_aabb.min, voxel_extent, _vec3_mulf(half_voxel_extent, params->debug.voxelScale), &out_result->debug_mesh);
+            }
+            if (params->debug.voxel_x > 0 && params->debug.voxel_y > 0)
+            {
+                uint32_t index = _flatten_2d(_uvec2_init(params->debug.voxel_x, params->debug.voxel_y), _uvec2_init(context->dimension.x, context->dimension.y));
+                const _voxel_set_plane_t* voxels_z = &context->voxel_set_planes.z[index];
+                _add_voxel_set_to_mesh(voxels_z->voxels, voxels_z->voxel_count, mesh_aabb.min, voxel_extent, _vec3_mulf(half_voxel_extent, params->debug.voxelScale), &out_result->debug_mesh);
+            }
+        }
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_INNER)
+        {
+            for (uint64_t i = 0; i < context->size; ++i)
+            {
+                const _min_distance_t* min_distance = &context->min_distance_field[i];
+                if (!context->voxel_field[i].inner)
+                    continue;
+
+                vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(min_distance->position), voxel_extent);
+                vec3_t voxel_center = _vec3_add(mesh_aabb.min, voxel_position);
+                if (params->debug.voxel_x < 0 ||
+                    params->debug.voxel_y < 0 ||
+                    params->debug.voxel_z < 0)
+                {
+                    _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent,
+                        &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+                }
+            }
+        }
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_MIN_DISTANCE)
+        {
+            for (uint64_t i = 0; i < context->size; ++i)
+            {
+                const _min_distance_t* min_distance = &context->min_distance_field[i];
+                vec3_t voxel_center = _vec3_add(mesh_aabb.min, _vec3_mul(_uvec3_to_vec3(min_distance->position), voxel_extent));
+                if ((uint32_t)params->debug.voxel_x == min_distance->x &&
+                    (uint32_t)params->debug.voxel_y == min_distance->y &&
+                    (uint32_t)params->debug.voxel_z == min_distance->z)
+                {
+                    _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent, &out_result->debug_mesh,
+                        MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+
+                    for (uint32_t x = min_distance->x; x < min_distance->x + min_distance->dist.x; ++x)
+                    {
+                        vec3_t voxel_center_x = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(x, min_distance->y, min_distance->z), voxel_extent));
+                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_x, voxel_extent), half_voxel_extent,
+                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+                    }
+                    for (uint32_t y = min_distance->y; y < min_distance->y + min_distance->dist.y; ++y)
+                    {
+                        vec3_t voxel_center_y = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(min_distance->x, y, min_distance->z), voxel_extent));
+                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_y, voxel_extent), half_voxel_extent,
+                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+                    }
+                    for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
+                    {
+                        vec3_t voxel_center_z = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(min_distance->x, min_distance->y, z), voxel_extent));
+                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_z, voxel_extent), half_voxel_extent,
+                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+                    }
+                }
+            }
+        }
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_EXTENT)
+        {
+            for (uint64_t i = 0; i < context->size; ++i)
+            {
+                const _min_distance_t* min_distance = &context->min_distance_field[i];
+                if (!_inner_voxel(context->voxel_field[i]))
+                    continue;
+
+                uvec3_t max_extent = _get_max_aabb_extent(context, min_distance);
+                for (uint32_t z = min_distance->z; z < min_distance->z + max_extent.z; ++z)
+                {
+                    for (uint32_t y = min_distance->y; y < min_distance->y + max_extent.y; ++y)
+                    {
+                        for (uint32_t x = min_distance->x; x < min_distance->x + max_extent.x; ++x)
+                        {
+                            vec3_t voxel_center = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(x, y, z), voxel_extent));
+                            _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent, &out_result->debug_mesh,
+                                MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+                        }
+                    }
+                }
+            }
+        }
+        if (params->debug.flags & MELT_DEBUG_TYPE_SHOW_RESULT)
+        {
+            out_result->debug_mesh.vertices = MELT_MALLOC(vec3_t, _vertex_count_per_aabb() * max_extent_count * 2);
+            out_result->debug_mesh.indices = MELT_MALLOC(melt_index_t, _index_count_per_aabb(params->box_type_flags) * max_extent_count);
+
+            for (size_t i = 0; i < max_extent_count; ++i)
+            {
+                const _max_extent_t* extent = &max_extents[i];
+                if ((int32_t)i == params->debug.extent_index || params->debug.extent_index < 0)
+                {
+                    vec3_t half_extent = _vec3_mul(_uvec3_to_vec3(extent->extent), half_voxel_extent);
+                    vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(extent->position), voxel_extent);
+                    vec3_t voxel_position_biased_to_center = _vec3_add(voxel_position, half_extent);
+                    vec3_t aabb_center = _vec3_add(mesh_aabb.min, voxel_position_biased_to_center);
+                    color_3u8_t color = _colors[i % MELT_ARRAY_LENGTH(_colors)];
+                    _add_voxel_to_mesh_with_color(_vec3_add(aabb_center, half_voxel_extent), half_extent, &out_result->debug_mesh, params->box_type_flags, color);
+                }
+            }
+
+            MELT_ASSERT(out_result->debug_mesh.vertex_count == _vertex_count_per_aabb() * max_extent_count * 2);
+            MELT_ASSERT(out_result->debug_mesh.index_count ==  _index_count_per_aabb(params->box_type_flags) * max_extent_count);
+        }
+    }
+#endif
+
+    out_result->voxel_size = params->voxel_size;
+    out_result->voxel_size_per_axis = voxel_extent;
+}
+
+// Bytes allocated for the occluder mesh, the debug mesh and the fill of each box.
+static uint64_t _result_allocated_bytes(const melt_result_t* result)
+{
+    return _mesh_memory_bytes(&result->mesh) + _mesh_memory_bytes(&result->debug_mesh) + result->box_count * sizeof(float);
+}
+
+// Generates the occluder from the fields of the context, the grid of the context
+// covers mesh_aabb with the voxels of params. The greedy fill clips the
+// voxel field and updates the minimum distance field. out_volume is set to the
+// number of voxels covered by the boxes.
+static int _generate_occluder_from_fields(const _context_t* context, const melt_params_t* params, _aabb_t mesh_aabb, uint64_t* out_volume, melt_result_t* out_result)
+{
+    uint32_t max_extent_count = 0;
+    uint64_t total_volume = 0;
+    _max_extent_t* max_extents = _generate_max_extents(context, params, &max_extent_count, &total_volume);
+
+    const uint32_t greedy_count = max_extent_count;
+    if (params->merge_boxes)
+        max_extent_count = _merge_max_extents(max_extents, max_extent_count);
+
+    _generate_occluder_from_max_extents(context, params, mesh_aabb, max_extents, max_extent_count, total_volume, out_result);
+    out_result->merged_box_count = greedy_count - max_extent_count;
+    out_result->peak_memory_bytes = _context_allocated_bytes(context, total_volume) + _extent_search_memory_bytes(params, context->dimension, context->field_bricks.count) +
+        _coarse_levels_memory_bytes(params, context->dimension) + _merge_memory_bytes(params, greedy_count) + _context_bvh_memory_bytes(context, params) +
+        _result_allocated_bytes(out_result);
+
+    uint64_t volume = 0;
+    for (uint32_t i = 0; i < max_extent_count; ++i)
+        volume += max_extents[i].volume;
+
+    *out_volume = volume;
+    MELT_FREE(max_extents);
+    return 1;
+}
+
+// Generates the fields of the component in a grid cropped to its bounds and
+// fills them. The boxes of the component are positioned in the grid of the
+// inner voxels the component was labelled from.
+static void _fill_component(_component_t* component, const _span_t* runs, const melt_params_t* params, bool sparse)
+{
+    // One voxel of padding on each side, the border of a grid holds no inner voxel.
+    uvec3_t origin;
+    origin.x = component->min.x - 1;
+    origin.y = component->min.y - 1;
+    origin.z = component->min.z - 1;
+
+    uvec3_t dimension;
+    dimension.x = component->max.x - origin.x + 1;
+    dimension.y = component->max.y - origin.y + 1;
+    dimension.z = component->max.z - origin.z + 1;
+
+    _context_t context;
+    _init_context(&context, dimension, sparse);
+
+    _brick_bitset_t inner_voxels;
+    _init_brick_bitset(&inner_voxels, dimension);
+    for (uint32_t i = component->run_begin; i < component->run_end; ++i)
+    {
+        const _span_t* run = &runs[i];
+        _brick_bitset_set_range(&inner_voxels, run->y - origin.y, run->z - origin.z, run->x0 - origin.x, run->x1 - origin.x);
+    }
+
+    _generate_fields(&context, &inner_voxels);
+    _free_brick_bitset(&inner_voxels);
+    _debug_validate_min_distance_field(&context);
+
+    component->max_extents = _generate_max_extents(&context, params, &component->max_extent_count, &component->inner_voxel_count);
+    for (uint32_t i = 0; i < component->max_extent_count; ++i)
+    {
+        uvec3_t* position = &component->max_extents[i].position;
+        position->x += origin.x;
+        position->y += origin.y;
+        position->z += origin.z;
+    }
+
+    component->allocated_bytes = _context_allocated_bytes(&context, component->inner_voxel_count) + _extent_search_memory_bytes(params, dimension, context.field_bricks.count) +
+        _coarse_levels_memory_bytes(params, dimension);
+    _free_context(&context);
+}
+
+// Orders components by decreasing number of runs.
+static int _compare_component_sizes(const void* a, const void* b)
+{
+    const _component_t* component_a = (const _component_t*)a;
+    const _component_t* component_b = (const _component_t*)b;
+    const uint32_t run_count_a = component_a->run_end - component_a->run_begin;
+    const uint32_t run_count_b = component_b->run_end - component_b->run_begin;
+    if (run_count_a != run_count_b)
+        return run_count_a > run_count_b ? -1 : 1;
+    return component_a->run_begin < component_b->run_begin ? -1 : (component_a->run_begin > component_b->run_begin ? 1 : 0);
+}
+
+// Generates the occluder of the shell voxels of the context one connected
+// component of inner voxels at a time, components are filled in parallel. The
+// context holds the shell voxels only, each component allocates the fields of
+// its own cropped grid, so meshes made of disjoint solids use smaller fields and
+// more cores. fill_pct applies to each component, the boxes of all the components
+// are ordered by decreasing volume and cut to max_box_count. Debug views of the
+// fields are not generated.
+static int _generate_occluder_from_components(_context_t* context, const melt_params_t* params, _aabb_t mesh_aabb, uint64_t* out_volume, melt_result_t* out_result)
+{
+#if defined(MELT_DEBUG)
+    _generate_voxel_set(context);
+    _generate_per_plane_voxel_set(context);
+#endif
+
+    _brick_bitset_t inner_voxels;
+    if (!_classify_interior(context, params, mesh_aabb, &inner_voxels))
+    {
+        out_result->error = MELT_ERROR_MESH_NOT_WATER_TIGHT;
+        return 0;
+    }
+
+    if (params->fuse_instances)
+        _fuse_shell(context, params, mesh_aabb, &inner_voxels);
+
+    _span_stack_t runs;
+    memset(&runs, 0, sizeof(_span_stack_t));
+
+    uint32_t component_count = 0;
+    _component_t* components = _label_components(context, &inner_voxels, &runs, &component_count);
+    _free_brick_bitset(&inner_voxels);
+
+    // Largest components first, so that the last component to start is a small one.
+    qsort(components, component_count, sizeof(_component_t), _compare_component_sizes);
+
+#if defined(_OPENMP)
+    #pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int32_t i = 0; i < (int32_t)component_count; ++i)
+        _fill_component(&components[i], runs.spans, params, context->sparse);
+
+    uint64_t total_volume = 0;
+    uint64_t component_bytes = 0;
+    uint32_t max_extent_count = 0;
+    for (uint32_t i = 0; i < component_count; ++i)
+    {
+        total_volume += components[i].inner_voxel_count;
+        max_extent_count += components[i].max_extent_count;
+#if defined(_OPENMP)
+        component_bytes += components[i].allocated_bytes;
+#else
+        component_bytes = component_bytes > components[i].allocated_bytes ? component_bytes : components[i].allocated_bytes;
+#endif
+    }
+
+    _max_extent_t* max_extents = MELT_MALLOC(_max_extent_t, max_extent_count);
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < component_count; ++i)
+    {
+        memcpy(max_extents + offset, components[i].max_extents, components[i].max_extent_count * sizeof(_max_extent_t));
+        offset += components[i].max_extent_count;
+        MELT_FREE(components[i].max_extents);
+    }
+
+    const uint32_t greedy_count = max_extent_count;
+    if (params->merge_boxes)
+        max_extent_count = _merge_max_extents(max_extents, max_extent_count);
+    else
+        qsort(max_extents, max_extent_count, sizeof(_max_extent_t), _compare_max_extents);
+
+    const uint32_t merged_count = max_extent_count;
+    if (params->max_box_count > 0 && max_extent_count > params->max_box_count)
+        max_extent_count = params->max_box_count;
+
+    _generate_occluder_from_max_extents(context, params, mesh_aabb, max_extents, max_extent_count, total_volume, out_result);
+    out_result->merged_box_count = greedy_count - merged_count;
+    out_result->peak_memory_bytes = _context_allocated_bytes(context, 0) + component_bytes + runs.capacity * sizeof(_span_t) +
+        component_count * sizeof(_component_t) + greedy_count * sizeof(_max_extent_t) + _merge_memory_bytes(params, greedy_count) +
+        _context_bvh_memory_bytes(context, params) + _result_allocated_bytes(out_result);
+
+    uint64_t volume = 0;
+    for (uint32_t i = 0; i < max_extent_count; ++i)
+        volume += max_extents[i].volume;
+
+    *out_volume = volume;
+    MELT_FREE(max_extents);
+    MELT_FREE(components);
+    MELT_FREE(runs.spans);
+    return 1;
+}
+
+// Generates the occluder of the shell voxels of the context, the grid of the
+// context covers mesh_aabb with the voxels of params. The context is left
+// to the caller to free.
+static int _generate_occluder_from_shell(_context_t* context, const melt_params_t* params, _aabb_t mesh_aabb, uint64_t* out_volume, melt_result_t* out_result)
+{
+    if (params->split_components)
+        return _generate_occluder_from_components(context, params, mesh_aabb, out_volume, out_result);
+
+    if (!_generate_fields_from_shell(context, params, mesh_aabb))
+    {
+        out_result->error = MELT_ERROR_MESH_NOT_WATER_TIGHT;
+        return 0;
+    }
+    return _generate_occluder_from_fields(context, params, mesh_aabb, out_volume, out_result);
+}
+
+static int _compare_instances(const void* a, const void* b)
+{
+    const uint32_t instance_a = *(const uint32_t*)a;
+    const uint32_t instance_b = *(const uint32_t*)b;
+    return instance_a < instance_b ? -1 : (instance_a > instance_b ? 1 : 0);
+}
+
+// Tags each box of the occluder with the instances of the scene whose world
+// bounds overlap the world bounds of the box, by increasing instance index, so
+// that the boxes of an instance can be dropped when it unloads. The tags are
+// conservative, a box may be tagged with an instance it does not cover. Boxes
+// are shrunk by a small fraction of a voxel first so that the boxes of an
+// instance are not tagged with the instances it merely touches. The bounds of
+// the instances are searched through a hierarchy whose leaves hold instances in
+// place of triangles.
+static void _tag_box_instances(const _scene_t* scene, melt_result_t* result)
+{
+    const uint32_t instance_count = _scene_instance_count(scene);
+    _aabb_t* instance_bounds = MELT_MALLOC(_aabb_t, instance_count);
+    for (uint32_t i = 0; i < instance_count; ++i)
+    {
+        instance_bounds[i].min = _vec3_init( FLT_MAX,  FLT_MAX,  FLT_MAX);
+        instance_bounds[i].max = _vec3_init(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    }
+
+    _triangle_cursor_t cursor;
+    _init_triangle_cursor(&cursor, scene);
+    _triangle_t triangle;
+    while (_next_triangle(&cursor, &triangle))
+    {
+        const _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+        _aabb_t* bounds = &instance_bounds[cursor.instance];
+        bounds->min = _vec3_min(bounds->min, triangle_aabb.min);
+        bounds->max = _vec3_max(bounds->max, triangle_aabb.max);
+    }
+
+    melt_triangle_bvh_t instance_bvh;
+    _init_bvh_nodes(&instance_bvh, instance_bounds, instance_count);
+    uint32_t* box_instances = MELT_MALLOC(uint32_t, instance_count);
+
+    const vec3_t voxel_extent = result->voxel_size_per_axis;
+    const float min_extent = _float_min(voxel_extent.x, _float_min(voxel_extent.y, voxel_extent.z));
+    const vec3_t tolerance = _vec3_init(0.01f * min_extent, 0.01f * min_extent, 0.01f * min_extent);
+
+    const uint32_t vertex_count_per_aabb = _vertex_count_per_aabb();
+    const uint32_t box_count = result->mesh.vertex_count / vertex_count_per_aabb;
+    result->box_instance_offsets = MELT_MALLOC(uint32_t, (box_count + 1));
+
+    // Instances are counted in a first pass and written in a second one.
+    uint32_t tag_count = 0;
+    for (uint32_t pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1)
+            result->box_instances = MELT_MALLOC(uint32_t, tag_count);
+
+        tag_count = 0;
+        for (uint32_t box = 0; box < box_count; ++box)
+        {
+            const melt_vec3_t* vertices = &result->mesh.vertices[box * vertex_count_per_aabb];
+            _aabb_t bounds;
+            bounds.min = bounds.max = vertices[0];
+            for (uint32_t i = 1; i < vertex_count_per_aabb; ++i)
+            {
+                bounds.min = _vec3_min(bounds.min, vertices[i]);
+                bounds.max = _vec3_max(bounds.max, vertices[i]);
+            }
+            bounds.min = _vec3_add(bounds.min, tolerance);
+            bounds.max = _vec3_sub(bounds.max, tolerance);
+
+            result->box_instance_offsets[box] = tag_count;
+
+            uint32_t box_instance_count = 0;
+            _bvh_query_t query;
+            _init_bvh_query(&instance_bvh, &query, bounds);
+            const _bvh_node_t* leaf;
+            while (_next_bvh_leaf(&instance_bvh, &query, &leaf))
+            {
+                for (uint32_t i = leaf->first; i < leaf->first + leaf->triangle_count; ++i)
+                {
+                    const uint32_t instance = instance_bvh.triangles[i];
+                    if (_aabbs_overlap(&bounds, &instance_bounds[instance]))
+                        box_instances[box_instance_count++] = instance;
+                }
+            }
+
+            if (pass == 1)
+            {
+                qsort(box_instances, box_instance_count, sizeof(uint32_t), _compare_instances);
+                memcpy(&result->box_instances[tag_count], box_instances, box_instance_count * sizeof(uint32_t));
+            }
+            tag_count += box_instance_count;
+        }
+        result->box_instance_offsets[box_count] = tag_count;
+    }
+
+    MELT_FREE(box_instances);
+    MELT_FREE(instance_bvh.nodes);
+    MELT_FREE(instance_bvh.triangles);
+    MELT_FREE(instance_bounds);
+
+    // The tags are generated once the grid is released, next to the result.
+    const uint64_t instance_bytes = (uint64_t)instance_count * (sizeof(_aabb_t) + 2 * sizeof(uint32_t)) +
+        (uint64_t)(instance_count > 0 ? 2 * instance_count - 1 : 1) * sizeof(_bvh_node_t);
+    const uint64_t tag_bytes = _result_allocated_bytes(result) + ((uint64_t)box_count + 1 + tag_count) * sizeof(uint32_t) + instance_bytes;
+    if (tag_bytes > result->peak_memory_bytes)
+        result->peak_memory_bytes = tag_bytes;
+}
+
+int melt_generate_occluder(melt_params_t params, melt_result_t* out_result)
+{
+    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
+
+    memset(out_result, 0, sizeof(melt_result_t));
 
-        max_aabb_extents[max_aabb_extents_count++] = max_extent;
+    if (params.max_memory_bytes > 0 && melt_estimate_memory(params) > params.max_memory_bytes)
+    {
+        out_result->error = MELT_ERROR_MEMORY_LIMIT_EXCEEDED;
+        return 0;
     }
 
-    uvec2_t min_extent = _uvec2_init(UINT_MAX, UINT_MAX);
+    const _scene_t scene = _params_scene(&params);
 
-    uint32_t z_slice = 1;
-    uint32_t max_volume = 0;
+    vec3_t grid_axes[3];
+    const bool oriented = _grid_axes(&params, grid_axes);
+    if (oriented)
+        _params_to_grid_frame(&params, grid_axes);
 
-    MELT_ASSERT(max_aabb_extents_count > 0);
+    _aabb_t mesh_aabb = _generate_grid_aabb(&params);
 
-    for (uint32_t i = 0; i < max_aabb_extents_count; ++i)
+    _context_t context;
+    _init_context(&context, _grid_dimension(&params, mesh_aabb), params.grid_type == MELT_GRID_TYPE_SPARSE);
+
+    _voxelize_shell(&context, &params, mesh_aabb);
+
+    uint64_t volume = 0;
+    const int success = _generate_occluder_from_shell(&context, &params, mesh_aabb, &volume, out_result);
+
+    _free_context(&context);
+
+    _result_from_grid_frame(out_result, grid_axes, oriented);
+    if (oriented)
     {
-        const uvec2_t* extent = &max_aabb_extents[i];
-        min_extent.x = _uint32_t_min(extent->x, min_extent.x);
-        min_extent.y = _uint32_t_min(extent->y, min_extent.y);
+        out_result->peak_memory_bytes += _grid_frame_memory_bytes(&params);
+        _free_grid_frame(&params);
+    }
+    if (success && params.mesh_count > 0)
+        _tag_box_instances(&scene, out_result);
+    return success;
+}
 
-        const uint32_t volume = min_extent.x * min_extent.y * z_slice;
-        if (volume > max_volume)
-            max_volume = volume;
+melt_voxelized_mesh_t* melt_voxelize_mesh(melt_params_t params, melt_error_t* out_error)
+{
+    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
 
-        ++z_slice;
+    *out_error = MELT_ERROR_NONE;
+
+    if (params.max_memory_bytes > 0 && melt_estimate_memory(params) > params.max_memory_bytes)
+    {
+        *out_error = MELT_ERROR_MEMORY_LIMIT_EXCEEDED;
+        return NULL;
     }
 
-    MELT_ASSERT(max_volume > 0);
-    MELT_ASSERT(min_extent.x > 0);
-    MELT_ASSERT(min_extent.y > 0);
-    MELT_ASSERT(z_slice > 1);
-    MELT_PROFILE_END();
+    // Only the params shaping the grid and the classification are kept, the fill
+    // params are given to each generation from the voxelized mesh.
+    melt_voxelized_mesh_t* voxelized_mesh = MELT_MALLOC(melt_voxelized_mesh_t, 1);
+    voxelized_mesh->oriented = _grid_axes(&params, voxelized_mesh->grid_axes);
+    if (voxelized_mesh->oriented)
+        _params_to_grid_frame(&params, voxelized_mesh->grid_axes);
 
-    return _uvec3_init(min_extent.x, min_extent.y, z_slice - 1);
+    voxelized_mesh->grid_aabb = _generate_grid_aabb(&params);
+    voxelized_mesh->voxel_size = params.voxel_size;
+    voxelized_mesh->voxel_size_per_axis = params.voxel_size_per_axis;
+
+    _context_t* context = &voxelized_mesh->context;
+    _init_context(context, _grid_dimension(&params, voxelized_mesh->grid_aabb), params.grid_type == MELT_GRID_TYPE_SPARSE);
+
+    _voxelize_shell(context, &params, voxelized_mesh->grid_aabb);
+    const bool classified = _generate_fields_from_shell(context, &params, voxelized_mesh->grid_aabb);
+
+    if (voxelized_mesh->oriented)
+        _free_grid_frame(&params);
+
+    if (!classified)
+    {
+        melt_free_voxelized_mesh(voxelized_mesh);
+        *out_error = MELT_ERROR_MESH_NOT_WATER_TIGHT;
+        return NULL;
+    }
+
+    return voxelized_mesh;
 }
 
-static void _clip_voxel_field(const _context_t* context, const uvec3_t start_position, const uvec3_t extent)
+int melt_generate_occluder_from_voxelized_mesh(const melt_voxelized_mesh_t* voxelized_mesh, melt_params_t params, melt_result_t* out_result)
 {
-    MELT_PROFILE_BEGIN();
+    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
+
+    memset(out_result, 0, sizeof(melt_result_t));
 
-    for (uint32_t x = start_position.x; x < start_position.x + extent.x; ++x)
+    // Only the greedy box fill runs, with the fill params of params, the other
+    // params are the ones the mesh was voxelized with.
+    params.voxel_size = voxelized_mesh->voxel_size;
+    params.voxel_size_per_axis = voxelized_mesh->voxel_size_per_axis;
+    const _scene_t scene = _params_scene(&params);
+
+    // Boxes are refined against the mesh in the frame of the grid.
+    const bool rotate_mesh = voxelized_mesh->oriented && params.refine_boxes;
+    if (rotate_mesh)
+        _params_to_grid_frame(&params, voxelized_mesh->grid_axes);
+
+    // The greedy fill clips the voxel field and updates the minimum distance
+    // field, it runs on copies of the fields sharing everything else.
+    _context_t context = voxelized_mesh->context;
+    const uint64_t voxel_field_bytes = context.size * sizeof(_voxel_status_t);
+    const uint64_t min_distance_field_bytes = context.size * sizeof(_min_distance_t);
+
+    context.voxel_field = MELT_MALLOC(_voxel_status_t, context.size);
+    context.min_distance_field = MELT_MALLOC(_min_distance_t, context.size);
+    memcpy(context.voxel_field, voxelized_mesh->context.voxel_field, voxel_field_bytes);
+    memcpy(context.min_distance_field, voxelized_mesh->context.min_distance_field, min_distance_field_bytes);
+
+    uint64_t volume = 0;
+    const int success = _generate_occluder_from_fields(&context, &params, voxelized_mesh->grid_aabb, &volume, out_result);
+    out_result->peak_memory_bytes += voxel_field_bytes + min_distance_field_bytes;
+
+    MELT_FREE(context.voxel_field);
+    MELT_FREE(context.min_distance_field);
+
+    _result_from_grid_frame(out_result, voxelized_mesh->grid_axes, voxelized_mesh->oriented);
+    if (rotate_mesh)
     {
-        for (uint32_t y = start_position.y; y < start_position.y + extent.y; ++y)
-        {
-            for (uint32_t z = start_position.z; z < start_position.z + extent.z; ++z)
-            {
-                uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-                MELT_ASSERT(!context->voxel_field[index].clipped && "Clipping already clipped voxel field index");
-                context->voxel_field[index].clipped = true;
-            }
-        }
+        out_result->peak_memory_bytes += _grid_frame_memory_bytes(&params);
+        _free_grid_frame(&params);
     }
+    if (success && params.mesh_count > 0)
+        _tag_box_instances(&scene, out_result);
+    return success;
+}
 
-    MELT_PROFILE_END();
+void melt_free_voxelized_mesh(melt_voxelized_mesh_t* voxelized_mesh)
+{
+    if (!voxelized_mesh)
+        return;
+
+    _free_context(&voxelized_mesh->context);
+    MELT_FREE(voxelized_mesh);
 }
 
-static bool _water_tight_mesh(const _context_t* context)
+melt_triangle_bvh_t* melt_build_triangle_bvh(melt_mesh_t mesh)
 {
-    for (uint32_t i = 0; i < context->size; ++i)
-    {
-        const _min_distance_t* min_distance = &context->min_distance_field[i];
-        if (!_inner_voxel(context->voxel_field[_flatten_3d(min_distance->position, context->dimension)]))
-            continue;
+    const _scene_t scene = _mesh_scene(&mesh);
+    melt_triangle_bvh_t* bvh = MELT_MALLOC(melt_triangle_bvh_t, 1);
+    _init_triangle_bvh(bvh, &scene);
+    return bvh;
+}
 
-        for (uint32_t x = min_distance->x; x < min_distance->x + min_distance->dist.x; ++x)
-        {
-            const uint32_t y = min_distance->y;
-            const uint32_t z = min_distance->z;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            if (!_inner_voxel(context->voxel_field[index]))
-            {
-                return false;
-            }
-        }
-        for (uint32_t y = min_distance->y; y < min_distance->y + min_distance->dist.y; ++y)
-        {
-            const uint32_t x = min_distance->x;
-            const uint32_t z = min_distance->z;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            if (!_inner_voxel(context->voxel_field[index]))
-            {
-                return false;
-            }
-        }
-        for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
+uint32_t melt_query_triangle_bvh(const melt_triangle_bvh_t* bvh, melt_vec3_t min, melt_vec3_t max, uint32_t* out_triangles, uint32_t max_triangle_count)
+{
+    _aabb_t aabb;
+    aabb.min = min;
+    aabb.max = max;
+
+    _bvh_query_t query;
+    _init_bvh_query(bvh, &query, aabb);
+
+    uint32_t triangle_count = 0;
+    const _bvh_node_t* leaf;
+    while (_next_bvh_leaf(bvh, &query, &leaf))
+    {
+        for (uint32_t i = leaf->first; i < leaf->first + leaf->triangle_count; ++i)
         {
-            const uint32_t x = min_distance->x;
-            const uint32_t y = min_distance->y;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            if (!_inner_voxel(context->voxel_field[index]))
-            {
-                return false;
-            }
+            if (!_bvh_triangle_overlaps(bvh, i, &aabb))
+                continue;
+            // Triangles past max_triangle_count are counted but not written.
+            if (triangle_count < max_triangle_count)
+                out_triangles[triangle_count] = bvh->triangles[i];
+            ++triangle_count;
         }
     }
+    return triangle_count;
+}
 
-    return true;
+int melt_triangle_bvh_intersects_box(const melt_triangle_bvh_t* bvh, melt_vec3_t min, melt_vec3_t max)
+{
+    _aabb_t aabb;
+    aabb.min = min;
+    aabb.max = max;
+    return _bvh_intersects_aabb(bvh, aabb) ? 1 : 0;
 }
 
-static void _debug_validate_min_distance_field(const _context_t* context)
+void melt_free_triangle_bvh(melt_triangle_bvh_t* bvh)
 {
-#if defined(MELT_DEBUG) && defined(MELT_ASSERT)
-    for (uint32_t i = 0; i < context->size; ++i)
+    _free_triangle_bvh(bvh);
+    MELT_FREE(bvh);
+}
+
+// A box is valid when it is clear of the triangles and its center is inside the
+// mesh, by the signed crossings of rays cast from it, so overlapping closed parts
+// count as inside.
+int melt_validate_occluder(melt_mesh_t mesh, const melt_result_t* result, melt_validation_t* out_validation)
+{
+    MELT_PROFILE_BEGIN();
+
+    melt_validation_t validation;
+    validation.intersecting_box_count = 0;
+    validation.outside_box_count = 0;
+    validation.first_invalid_box = UINT32_MAX;
+
+    const _scene_t scene = _mesh_scene(&mesh);
+    melt_triangle_bvh_t bvh;
+    _init_triangle_bvh(&bvh, &scene);
+
+    const uint32_t vertex_count_per_aabb = _vertex_count_per_aabb();
+    const uint32_t box_count = result->mesh.vertex_count / vertex_count_per_aabb;
+    for (uint32_t box = 0; box < box_count; ++box)
     {
-        const _min_distance_t* min_distance = &context->min_distance_field[i];
-        if (!_inner_voxel(context->voxel_field[_flatten_3d(min_distance->position, context->dimension)]))
-            continue;
+        const melt_vec3_t* vertices = &result->mesh.vertices[box * vertex_count_per_aabb];
+        _aabb_t bounds;
+        bounds.min = bounds.max = vertices[0];
+        for (uint32_t i = 1; i < vertex_count_per_aabb; ++i)
+        {
+            bounds.min = _vec3_min(bounds.min, vertices[i]);
+            bounds.max = _vec3_max(bounds.max, vertices[i]);
+        }
 
-        for (uint32_t x = min_distance->x; x < min_distance->x + min_distance->dist.x; ++x)
+        // Boxes of rotated grids are oriented, their frame follows the edges from
+        // the corner at the minimum of _voxel_cube_vertices.
+        const vec3_t edges[3] = { _vec3_sub(vertices[2], vertices[1]), _vec3_sub(vertices[0], vertices[1]), _vec3_sub(vertices[1], vertices[5]) };
+        vec3_t axes[3];
+        vec3_t half_extent;
+        for (uint32_t axis = 0; axis < 3; ++axis)
         {
-            const uint32_t y = min_distance->y;
-            const uint32_t z = min_distance->z;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            for (uint32_t i = 0; i < context->voxel_set_count; ++i)
-                MELT_ASSERT(!_uvec3_equals(context->voxel_set[i].position, _uvec3_init(x, y, z)));
-            MELT_ASSERT(_inner_voxel(context->voxel_field[index]));
+            const float length = sqrtf(_vec3_dot(edges[axis], edges[axis]));
+            axes[axis] = length > 0.0f ? _vec3_mulf(edges[axis], 1.0f / length) : _vec3_init(axis == 0, axis == 1, axis == 2);
+            *_vec3_component(&half_extent, axis) = 0.5f * length;
         }
-        for (uint32_t y = min_distance->y; y < min_distance->y + min_distance->dist.y; ++y)
+        const vec3_t center = _aabb_center(bounds);
+
+        // A box clear of the triangles is either wholly inside or wholly outside.
+        bool valid = true;
+        if (_bvh_intersects_box(&bvh, bounds, center, axes, half_extent))
         {
-            const uint32_t x = min_distance->x;
-            const uint32_t z = min_distance->z;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            for (uint32_t i = 0; i < context->voxel_set_count; ++i)
-                MELT_ASSERT(!_uvec3_equals(context->voxel_set[i].position, _uvec3_init(x, y, z)));
-            MELT_ASSERT(_inner_voxel(context->voxel_field[index]));
+            ++validation.intersecting_box_count;
+            valid = false;
         }
-        for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
+        else if (!_bvh_contains_point(&bvh, center, 0, 0))
         {
-            const uint32_t x = min_distance->x;
-            const uint32_t y = min_distance->y;
-            const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-            for (uint32_t i = 0; i < context->voxel_set_count; ++i)
-                MELT_ASSERT(!_uvec3_equals(context->voxel_set[i].position, _uvec3_init(x, y, z)));
-            MELT_ASSERT(_inner_voxel(context->voxel_field[index]));
+            ++validation.outside_box_count;
+            valid = false;
         }
+
+        if (!valid && validation.first_invalid_box == UINT32_MAX)
+            validation.first_invalid_box = box;
     }
-#else
-    MELT_UNUSED(context);
-#endif
+
+    _free_triangle_bvh(&bvh);
+
+    if (out_validation)
+        *out_validation = validation;
+
+    MELT_PROFILE_END();
+    return validation.first_invalid_box == UINT32_MAX ? 1 : 0;
 }
 
-static void _debug_validate_max_extents(const _context_t* context, const _max_extent_t* max_extents, uint32_t max_extent_count)
+// Bytes allocated for the shell voxels of a context that holds no fields.
+static uint64_t _shell_allocated_bytes(const _context_t* context)
 {
-#if defined(MELT_DEBUG) && defined(MELT_ASSERT)
-    for (uint32_t i = 0; i < max_extent_count; ++i)
-    {
-        const _max_extent_t* extent = &max_extents[i];
-        for (uint32_t x = extent->position.x; x < extent->position.x + extent->extent.x; ++x)
-        {
-            for (uint32_t y = extent->position.y; y < extent->position.y + extent->extent.y; ++y)
-            {
-                for (uint32_t z = extent->position.z; z < extent->position.z + extent->extent.z; ++z)
-                {
-                    for (uint32_t i = 0; i < context->voxel_set_count; ++i)
-                    {
-                        const _voxel_t* voxel = &context->voxel_set[i];
-                        MELT_ASSERT(!_uvec3_equals(voxel->position, _uvec3_init(x, y, z)));
-                    }
-                }
-            }
-        }
-    }
-#else
-    MELT_UNUSED(context);
-    MELT_UNUSED(max_extents);
-    MELT_UNUSED(max_extent_count);
-#endif
+    if (!context->sparse)
+        return _bitset_word_count(_shell_voxel_bit_count(context)) * sizeof(uint64_t);
+
+    return _brick_map_memory_bytes(context->dimension, context->shell_bricks.capacity) +
+        _brick_map_memory_bytes(context->dimension, context->field_bricks.capacity) +
+        _bitset_word_count((uint64_t)context->shell_bricks.capacity * MELT_BRICK_VOXEL_COUNT) * sizeof(uint64_t);
 }
 
-static void _update_min_distance_field(const _context_t* context, uvec3_t start_position, uvec3_t extent)
+// Sets the shell voxels of the context from the shell voxels of source, each
+// voxel of the context covers factor^3 voxels of source. The voxels of source
+// are offset by padding voxels of the context on each axis.
+static void _downsample_shell(_context_t* context, const _context_t* source, uint32_t factor, uint32_t padding)
 {
     MELT_PROFILE_BEGIN();
-    MELT_ASSERT(start_position.x - 1 != ~0U);
-    MELT_ASSERT(start_position.y - 1 != ~0U);
-    MELT_ASSERT(start_position.z - 1 != ~0U);
 
-    for (uint32_t x = start_position.x - 1; x != ~0U; --x)
+    const uint64_t word_count = _bitset_word_count(_shell_voxel_bit_count(source));
+    for (uint64_t i = 0; i < word_count; ++i)
     {
-        for (uint32_t y = start_position.y; y < start_position.y + extent.y; ++y)
+        uint64_t word = source->shell_voxels[i];
+        while (word != 0)
         {
-            for (uint32_t z = start_position.z; z < start_position.z + extent.z; ++z)
-            {
-                const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-                if (_inner_voxel(context->voxel_field[index]))
-                {
-                    _min_distance_t* min_distance = &context->min_distance_field[index];
-                    const uint32_t updated_distance_x = start_position.x - min_distance->x;
-                    min_distance->dist.x = _uint32_t_min(updated_distance_x, min_distance->dist.x);
-                }
-            }
+            uvec3_t position = _shell_voxel_position(source, i * 64 + _count_trailing_zeros64(word));
+            position.x = position.x / factor + padding;
+            position.y = position.y / factor + padding;
+            position.z = position.z / factor + padding;
+            _set_shell_voxel(context, position);
+            word &= word - 1;
         }
     }
-    for (uint32_t x = start_position.x; x < start_position.x + extent.x; ++x)
+
+    MELT_PROFILE_END();
+}
+
+// Whether the shell voxelized with voxels factor times the voxels of params and
+// the generation of an occluder from it fit params->max_memory_bytes.
+static bool _auto_shell_fits(const melt_params_t* params, uint32_t factor)
+{
+    melt_params_t shell_params = *params;
+    _scale_voxel_size(&shell_params, (float)factor);
+
+    _aabb_t grid_aabb = _generate_grid_aabb(&shell_params);
+    uint64_t shell_bytes = 0;
+    const uint64_t bytes = _estimate_memory(&shell_params, grid_aabb, _grid_dimension(&shell_params, grid_aabb), &shell_bytes);
+    return bytes + shell_bytes <= params->max_memory_bytes;
+}
+
+// Generates the occluder with voxels factor times the size of the voxels of the
+// shell, from the hierarchy of the triangles of the scene held with the shell.
+// Returns whether the occluder fits the memory limit and max_box_count, the
+// result of the probe is freed otherwise.
+static bool _auto_probe(const _context_t* shell, const melt_params_t* shell_params, _aabb_t shell_aabb, const melt_triangle_bvh_t* scene_bvh,
+    uint32_t factor, uint32_t max_box_count, float mesh_volume, uint64_t held_bytes, uint64_t* peak_memory_bytes, _auto_probe_t* out_probe)
+{
+    melt_params_t params = *shell_params;
+    _scale_voxel_size(&params, (float)factor);
+
+    // The downsampled grid keeps the padding of the grid of the shell, voxels of
+    // the shell are offset so that each voxel of the grid covers whole voxels of
+    // the shell.
+    const uint32_t padding = _grid_padding_voxels(&params);
+    const vec3_t shell_voxel_extent = _voxel_extent(shell_params);
+    const vec3_t voxel_extent = _voxel_extent(&params);
+    const vec3_t offset = _vec3_sub(_vec3_mulf(_vec3_sub(shell_voxel_extent, voxel_extent), 0.5f), _vec3_mulf(voxel_extent, (float)padding));
+
+    uvec3_t dimension;
+    dimension.x = (shell->dimension.x + factor - 1) / factor + 2 * padding;
+    dimension.y = (shell->dimension.y + factor - 1) / factor + 2 * padding;
+    dimension.z = (shell->dimension.z + factor - 1) / factor + 2 * padding;
+
+    _aabb_t grid_aabb;
+    grid_aabb.min = _vec3_add(shell_aabb.min, offset);
+    grid_aabb.max = _vec3_add(grid_aabb.min, _vec3_mul(_uvec3_to_vec3(dimension), voxel_extent));
+
+    memset(out_probe, 0, sizeof(_auto_probe_t));
+    out_probe->factor = factor;
+
+    // The hierarchy of the estimate is held with the shell.
+    if (params.max_memory_bytes > 0)
     {
-        for (uint32_t y = start_position.y - 1; y != ~0U; --y)
+        uint64_t shell_bytes = 0;
+        if (held_bytes + _estimate_memory(&params, grid_aabb, dimension, &shell_bytes) - _scene_bvh_memory_bytes(&params) > params.max_memory_bytes)
         {
-            for (uint32_t z = start_position.z; z < start_position.z + extent.z; ++z)
-            {
-                const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-                if (_inner_voxel(context->voxel_field[index]))
-                {
-                    _min_distance_t* min_distance = &context->min_distance_field[index];
-                    const uint32_t updated_distance_y = start_position.y - min_distance->y;
-                    min_distance->dist.y = _uint32_t_min(updated_distance_y, min_distance->dist.y);
-                }
-            }
+            out_probe->result.error = MELT_ERROR_MEMORY_LIMIT_EXCEEDED;
+            return false;
         }
     }
-    for (uint32_t x = start_position.x; x < start_position.x + extent.x; ++x)
+
+    _context_t context;
+    _init_context(&context, dimension, shell->sparse);
+    context.scene_bvh = scene_bvh;
+    _downsample_shell(&context, shell, factor, padding);
+
+    uint64_t volume = 0;
+    const int success = _generate_occluder_from_shell(&context, &params, grid_aabb, &volume, &out_probe->result);
+    _free_context(&context);
+
+    if (held_bytes + out_probe->result.peak_memory_bytes > *peak_memory_bytes)
+        *peak_memory_bytes = held_bytes + out_probe->result.peak_memory_bytes;
+
+    if (!success)
+        return false;
+
+    if (max_box_count > 0 && out_probe->result.mesh.vertex_count / _vertex_count_per_aabb() > max_box_count)
     {
-        for (uint32_t y = start_position.y; y < start_position.y + extent.y; ++y)
-        {
-            for (uint32_t z = start_position.z - 1; z != ~0U; --z)
-            {
-                const uint32_t index = _flatten_3d(_uvec3_init(x, y, z), context->dimension);
-                if (_inner_voxel(context->voxel_field[index]))
-                {
-                    _min_distance_t* min_distance = &context->min_distance_field[index];
-                    const uint32_t updated_distance_z = start_position.z - min_distance->z;
-                    min_distance->dist.z = _uint32_t_min(updated_distance_z, min_distance->dist.z);
-                }
-            }
-        }
+        melt_free_result(out_probe->result);
+        memset(&out_probe->result, 0, sizeof(melt_result_t));
+        out_probe->result.error = MELT_ERROR_BOX_LIMIT_EXCEEDED;
+        return false;
     }
 
-    MELT_PROFILE_END();
+    const float voxel_volume = voxel_extent.x * voxel_extent.y * voxel_extent.z;
+    out_probe->fill_pct = mesh_volume > 0.0f ? (float)volume * voxel_volume / mesh_volume : 0.0f;
+    return true;
 }
 
-static melt_occluder_box_type_t _select_voxel_indices(melt_occluder_box_type_flags_t box_type_flags, const uint16_t** out_indices, uint32_t* out_index_length)
+int melt_generate_occluder_auto(melt_params_t params, uint32_t max_box_count, float target_fill_pct, melt_result_t* out_result)
 {
-#define CHECK_FLAG(flag) (box_type_flags & flag) == flag
+    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
 
-    if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_REGULAR))
-    {
-        *out_indices = (const uint16_t*)_voxel_cube_indices;
-        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices);
-        return MELT_OCCLUDER_BOX_TYPE_REGULAR;
-    }
-    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_SIDES))
+    memset(out_result, 0, sizeof(melt_result_t));
+
+    // Boxes are tagged with the instances of the scene in world space.
+    const _scene_t world_scene = _params_scene(&params);
+
+    // The shell and every probe are voxelized in the frame of the grid.
+    vec3_t grid_axes[3];
+    const bool oriented = _grid_axes(&params, grid_axes);
+    if (oriented)
+        _params_to_grid_frame(&params, grid_axes);
+
+    // The shell is voxelized with the finest multiple of the voxel size whose
+    // generation fits the memory limit, next to the shell itself.
+    uint32_t shell_factor = 1;
+    if (params.max_memory_bytes > 0 && !_auto_shell_fits(&params, shell_factor))
     {
-        *out_indices = (const uint16_t*)_voxel_cube_indices_sides;
-        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_sides);
-        return MELT_OCCLUDER_BOX_TYPE_SIDES;
+        uint32_t factor = 2;
+        while (!_auto_shell_fits(&params, factor))
+        {
+            if (factor >= (1u << 20))
+            {
+                if (oriented)
+                    _free_grid_frame(&params);
+                out_result->error = MELT_ERROR_MEMORY_LIMIT_EXCEEDED;
+                return 0;
+            }
+            factor *= 2;
+        }
+
+        uint32_t low = factor / 2 + 1;
+        while (low < factor)
+        {
+            const uint32_t middle = low + (factor - low) / 2;
+            if (_auto_shell_fits(&params, middle))
+                factor = middle;
+            else
+                low = middle + 1;
+        }
+        shell_factor = factor;
     }
-    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_BOTTOM))
+
+    melt_params_t shell_params = params;
+    _scale_voxel_size(&shell_params, (float)shell_factor);
+
+    _aabb_t shell_aabb = _generate_grid_aabb(&shell_params);
+
+    // The shell is voxelized once, the grid of each probe is downsampled from it.
+    _context_t shell;
+    _init_context(&shell, _grid_dimension(&shell_params, shell_aabb), params.grid_type == MELT_GRID_TYPE_SPARSE);
+    _voxelize_shell(&shell, &shell_params, shell_aabb);
+
+    // The hierarchy of the triangles is built once for every probe, it is held
+    // with the shell as are the rotated vertices.
+    const _scene_t scene = _params_scene(&params);
+    melt_triangle_bvh_t scene_bvh;
+    _init_triangle_bvh(&scene_bvh, &scene);
+    const uint64_t shell_bytes = _shell_allocated_bytes(&shell) + _scene_bvh_memory_bytes(&params) + (oriented ? _grid_frame_memory_bytes(&params) : 0);
+    const float mesh_volume = _scene_volume(&scene);
+    uint64_t peak_memory_bytes = shell_bytes;
+
+    // The coarsest grid keeps a few voxels along the longest axis of the mesh.
+    const uint32_t longest_axis = shell.dimension.x > shell.dimension.y ?
+        (shell.dimension.x > shell.dimension.z ? shell.dimension.x : shell.dimension.z) :
+        (shell.dimension.y > shell.dimension.z ? shell.dimension.y : shell.dimension.z);
+    const uint32_t max_factor = longest_axis > 8 ? longest_axis / 4 : 1;
+
+    // Voxel sizes are searched by bisection, which assumes that coarser voxels
+    // give fewer boxes, a lower fill and fewer leaks.
+    _auto_probe_t best;
+    if (!_auto_probe(&shell, &shell_params, shell_aabb, &scene_bvh, max_factor, max_box_count, mesh_volume, shell_bytes, &peak_memory_bytes, &best))
     {
-        *out_indices = (const uint16_t*)_voxel_cube_indices_bottom;
-        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_bottom);
-        return MELT_OCCLUDER_BOX_TYPE_BOTTOM;
+        _free_triangle_bvh(&scene_bvh);
+        _free_context(&shell);
+        if (oriented)
+            _free_grid_frame(&params);
+        out_result->error = best.result.error;
+        return 0;
     }
-    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_TOP))
+
+    // Coarsest voxel size whose occluder reaches the target fill. Probes that do
+    // not fit the limits are taken as too fine, probes below the target fill as
+    // too coarse.
+    bool target_reached = target_fill_pct > 0.0f && best.fill_pct >= target_fill_pct;
+    if (target_fill_pct > 0.0f && !target_reached)
     {
-        *out_indices = (const uint16_t*)_voxel_cube_indices_top;
-        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_top);
-        return MELT_OCCLUDER_BOX_TYPE_TOP;
+        uint32_t low = 1;
+        uint32_t high = max_factor - 1;
+        while (low <= high)
+        {
+            const uint32_t middle = low + (high - low) / 2;
+            const uint64_t held_bytes = shell_bytes + _mesh_memory_bytes(&best.result.mesh) + _mesh_memory_bytes(&best.result.debug_mesh);
+
+            _auto_probe_t probe;
+            const bool fits = _auto_probe(&shell, &shell_params, shell_aabb, &scene_bvh, middle, max_box_count, mesh_volume, held_bytes, &peak_memory_bytes, &probe);
+            if (fits && probe.fill_pct >= target_fill_pct)
+            {
+                melt_free_result(best.result);
+                best = probe;
+                target_reached = true;
+                low = middle + 1;
+            }
+            else
+            {
+                melt_free_result(probe.result);
+                if (fits)
+                    high = middle - 1;
+                else
+                    low = middle + 1;
+            }
+        }
     }
-    else if (CHECK_FLAG(MELT_OCCLUDER_BOX_TYPE_DIAGONALS))
+
+    // Finest voxel size whose occluder fits the limits, when no target fill is
+    // given or when it cannot be reached.
+    if (!target_reached)
     {
-        *out_indices = (const uint16_t*)_voxel_cube_indices_diagonals;
-        *out_index_length = MELT_ARRAY_LENGTH(_voxel_cube_indices_diagonals);
-        return MELT_OCCLUDER_BOX_TYPE_DIAGONALS;
+        uint32_t low = 1;
+        uint32_t high = best.factor;
+        while (low < high)
+        {
+            const uint32_t middle = low + (high - low) / 2;
+            const uint64_t held_bytes = shell_bytes + _mesh_memory_bytes(&best.result.mesh) + _mesh_memory_bytes(&best.result.debug_mesh);
+
+            _auto_probe_t probe;
+            if (_auto_probe(&shell, &shell_params, shell_aabb, &scene_bvh, middle, max_box_count, mesh_volume, held_bytes, &peak_memory_bytes, &probe))
+            {
+                melt_free_result(best.result);
+                best = probe;
+                high = middle;
+            }
+            else
+            {
+                low = middle + 1;
+            }
+        }
     }
 
-#undef CHECK_FLAG
+    _free_triangle_bvh(&scene_bvh);
+    _free_context(&shell);
+    if (oriented)
+        _free_grid_frame(&params);
 
-    return MELT_OCCLUDER_BOX_TYPE_NONE;
+    *out_result = best.result;
+    out_result->peak_memory_bytes = peak_memory_bytes;
+    _result_from_grid_frame(out_result, grid_axes, oriented);
+    if (params.mesh_count > 0)
+        _tag_box_instances(&world_scene, out_result);
+    return 1;
 }
 
-static uint16_t _index_count_per_aabb(melt_occluder_box_type_flags_t box_type_flags)
-{
-    uint16_t index_count = 0;
-    while (box_type_flags != MELT_OCCLUDER_BOX_TYPE_NONE)
-    {
-        const uint16_t* indices = NULL;
-        uint32_t indices_length = 0;
-        melt_occluder_box_type_t selected_type = _select_voxel_indices(box_type_flags, &indices, &indices_length);
-        MELT_ASSERT(indices && indices_length > 0);
-        index_count += indices_length;
-        box_type_flags &= ~selected_type;
-    }
-    return index_count;
-}
+// Cells of a heightfield. The height of a cell is the lowest of its four samples
+// and of cell_heights when given, the lowest height of a surface linear between
+// the samples. Samples at FLT_MAX are not covered by the surface, the cells
+// around them are holes and get -FLT_MAX.
+typedef struct
+{
+    const float* samples;
+    const float* cell_heights;
+    uint32_t width;
+    uint32_t depth;
+} _heightfield_cells_t;
 
-static uint32_t _vertex_count_per_aabb()
+static float _heightfield_cell_height(const _heightfield_cells_t* cells, uint32_t x, uint32_t z)
 {
-    return MELT_ARRAY_LENGTH(_voxel_cube_vertices);
+    const float* row = cells->samples + (uint64_t)z * cells->width + x;
+    const float* next_row = row + cells->width;
+    if (row[0] == FLT_MAX || row[1] == FLT_MAX || next_row[0] == FLT_MAX || next_row[1] == FLT_MAX)
+        return -FLT_MAX;
+
+    float height = _float_min(_float_min(row[0], row[1]), _float_min(next_row[0], next_row[1]));
+    if (cells->cell_heights)
+        height = _float_min(height, cells->cell_heights[(uint64_t)z * (cells->width - 1) + x]);
+    return height;
 }
 
-static void _add_voxel_to_mesh_with_color(vec3_t voxel_center, vec3_t half_voxel_size, melt_mesh_t* mesh, melt_occluder_box_type_flags_t box_type_flags, const color_3u8_t color)
+typedef struct
 {
-    bool has_color = !_uvec3_equals(color, _color_null);
-    uint16_t index_offset = (uint16_t)(has_color ? mesh->vertex_count / 2 : mesh->vertex_count);
+    vec3_t min;
+    vec3_t max;
+    float volume;
+} _heightfield_box_t;
 
-    for (uint32_t i = 0; i < MELT_ARRAY_LENGTH(_voxel_cube_vertices); ++i)
-    {
-        vec3_t vertex = _vec3_add(_vec3_mul(half_voxel_size, _voxel_cube_vertices[i]), voxel_center);
-        mesh->vertices[mesh->vertex_count++] = vertex;
-        if (has_color) mesh->vertices[mesh->vertex_count++] = _vec3_div(_uvec3_to_vec3(color), 255.0f);
-    }
+// Minimum heights of the cells of a tile, level 0 holds the cells and each level
+// above the minimum of 2x2 nodes of the level below. Cells past the border of
+// the heightfield are at FLT_MAX and never lower a node.
+typedef struct
+{
+    const melt_heightfield_t* heightfield;
+    const _heightfield_cells_t* cells;
+    uint32_t size_log2;
+    float* levels;
+    uvec2_t tile;
+    // Boxes are only counted when NULL.
+    _heightfield_box_t* boxes;
+    uint32_t box_count;
+} _min_height_quadtree_t;
+
+static uint32_t _heightfield_tile_size_log2(const melt_heightfield_t* heightfield)
+{
+    const uint32_t tile_size = heightfield->tile_size > 0 ? heightfield->tile_size : 64;
+    uint32_t size_log2 = 0;
+    while ((1u << size_log2) < tile_size)
+        ++size_log2;
+    return size_log2;
+}
 
-    while (box_type_flags != MELT_OCCLUDER_BOX_TYPE_NONE)
-    {
-        const uint16_t* indices = NULL;
-        uint32_t indices_length = 0;
+// Nodes of the levels of a quadtree below level.
+static uint64_t _quadtree_level_offset(uint32_t size_log2, uint32_t level)
+{
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < level; ++i)
+        offset += (uint64_t)1 << (2 * (size_log2 - i));
+    return offset;
+}
 
-        melt_occluder_box_type_t selected_type = _select_voxel_indices(box_type_flags, &indices, &indices_length);
+static void _build_min_height_quadtree(_min_height_quadtree_t* tree, uvec2_t tile)
+{
+    const _heightfield_cells_t* cells = tree->cells;
+    const uint32_t size = 1u << tree->size_log2;
+    tree->tile = tile;
 
-        MELT_ASSERT(indices && indices_length > 0);
-        for (uint32_t i = 0; i < indices_length; ++i)
+    for (uint32_t z = 0; z < size; ++z)
+    {
+        for (uint32_t x = 0; x < size; ++x)
         {
-            mesh->indices[mesh->index_count++] = indices[i] + index_offset;
+            const uint32_t cell_x = tile.x + x;
+            const uint32_t cell_z = tile.y + z;
+            const bool inside = cell_x + 1 < cells->width && cell_z + 1 < cells->depth;
+            tree->levels[x + z * size] = inside ? _heightfield_cell_height(cells, cell_x, cell_z) : FLT_MAX;
         }
-
-        box_type_flags &= ~selected_type;
     }
-}
-
-static void _add_voxel_to_mesh(vec3_t voxel_center, vec3_t half_voxel_size, melt_mesh_t* mesh, melt_occluder_box_type_flags_t box_type_flags)
-{
-    _add_voxel_to_mesh_with_color(voxel_center, half_voxel_size, mesh, box_type_flags, _color_null);
-}
 
-#if defined(MELT_DEBUG)
-static void _add_voxel_set_to_mesh(const _voxel_t* voxel_set, const uint32_t voxel_set_count, vec3_t half_voxel_extent, melt_mesh_t* mesh)
-{
-    for (uint32_t i = 0; i < voxel_set_count; ++i)
+    for (uint32_t level = 1; level <= tree->size_log2; ++level)
     {
-        _add_voxel_to_mesh_with_color(_aabb_center(voxel_set[i].aabb), half_voxel_extent, mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
+        const float* children = tree->levels + _quadtree_level_offset(tree->size_log2, level - 1);
+        float* nodes = tree->levels + _quadtree_level_offset(tree->size_log2, level);
+        const uint32_t level_size = size >> level;
+        for (uint32_t z = 0; z < level_size; ++z)
+        {
+            for (uint32_t x = 0; x < level_size; ++x)
+            {
+                const float* child = children + 2 * x + 4 * z * level_size;
+                nodes[x + z * level_size] = _float_min(_float_min(child[0], child[1]), _float_min(child[2 * level_size], child[2 * level_size + 1]));
+            }
+        }
     }
 }
-#endif
 
-static _max_extent_t _get_max_extent(const _context_t* context)
+// Adds the box of the node (x, z) of level, from floor up to the lowest height
+// under the node, and the boxes of its children on top of it.
+static void _add_min_height_boxes(_min_height_quadtree_t* tree, uint32_t level, uint32_t x, uint32_t z, float floor)
 {
-    MELT_PROFILE_BEGIN();
+    const uint32_t level_size = 1u << (tree->size_log2 - level);
+    const float height = tree->levels[_quadtree_level_offset(tree->size_log2, level) + x + (uint64_t)z * level_size];
 
-    _max_extent_t max_extent;
-    max_extent.extent = _uvec3_init(0, 0, 0);
-    max_extent.position = _uvec3_init(0, 0, 0);
-    max_extent.volume = 0;
+    // Nodes past the border of the heightfield.
+    if (height == FLT_MAX)
+        return;
 
-    for (uint32_t i = 0; i < context->size; ++i)
+    if (height > floor)
     {
-        const _min_distance_t* min_distance = &context->min_distance_field[i];
-        _voxel_status_t voxel_status = context->voxel_field[_flatten_3d(min_distance->position, context->dimension)];
-        if (_inner_voxel(voxel_status))
+        if (tree->boxes)
         {
-            uvec3_t extent = _get_max_aabb_extent(context, min_distance);
-            uint32_t volume = extent.x * extent.y * extent.z;
-            if (volume > max_extent.volume)
-            {
-                max_extent.extent = extent;
-                max_extent.position = min_distance->position;
-                max_extent.volume = max_extent.extent.x * max_extent.extent.y * max_extent.extent.z;
-            }
+            const melt_heightfield_t* heightfield = tree->heightfield;
+            const uint32_t cell_x0 = tree->tile.x + (x << level);
+            const uint32_t cell_z0 = tree->tile.y + (z << level);
+            const uint32_t cell_x1 = _uint32_t_min(cell_x0 + (1u << level), tree->cells->width - 1);
+            const uint32_t cell_z1 = _uint32_t_min(cell_z0 + (1u << level), tree->cells->depth - 1);
+
+            _heightfield_box_t* box = &tree->boxes[tree->box_count];
+            box->min = _vec3_init(heightfield->origin.x + cell_x0 * heightfield->spacing_x, heightfield->origin.y + floor, heightfield->origin.z + cell_z0 * heightfield->spacing_z);
+            box->max = _vec3_init(heightfield->origin.x + cell_x1 * heightfield->spacing_x, heightfield->origin.y + height, heightfield->origin.z + cell_z1 * heightfield->spacing_z);
+            box->volume = (box->max.x - box->min.x) * (box->max.y - box->min.y) * (box->max.z - box->min.z);
         }
+        ++tree->box_count;
+        floor = height;
     }
 
-    MELT_PROFILE_END();
+    if (level == 0)
+        return;
 
-    return max_extent;
+    for (uint32_t i = 0; i < 4; ++i)
+        _add_min_height_boxes(tree, level - 1, 2 * x + (i & 1), 2 * z + (i >> 1), floor);
 }
 
-void _init_context(_context_t* context, vec3_t voxel_count)
+// Adds the boxes of all the tiles of the heightfield to the tree.
+static void _add_heightfield_boxes(_min_height_quadtree_t* tree)
 {
-    memset(context, 0, sizeof(_context_t));
-    context->dimension = _vec3_to_uvev3(voxel_count);
-    context->size = (uint32_t)voxel_count.x * (uint32_t)voxel_count.y * (uint32_t)voxel_count.z;
-    context->voxel_field = MELT_MALLOC(_voxel_status_t, context->size);
-    context->min_distance_field = MELT_MALLOC(_min_distance_t, context->size);
-    context->voxel_indices = MELT_MALLOC(int32_t, context->size);
-    context->voxel_set = MELT_MALLOC(_voxel_t, context->size);
-    for (uint32_t i = 0; i < context->size; ++i)
-        context->voxel_indices[i] = -1;
+    const uint32_t size = 1u << tree->size_log2;
+    const uint32_t cell_width = tree->cells->width - 1;
+    const uint32_t cell_depth = tree->cells->depth - 1;
+
+    for (uint32_t z = 0; z < cell_depth; z += size)
+    {
+        for (uint32_t x = 0; x < cell_width; x += size)
+        {
+            _build_min_height_quadtree(tree, _uvec2_init(x, z));
+            _add_min_height_boxes(tree, tree->size_log2, 0, 0, tree->heightfield->bottom);
+        }
+    }
 }
 
-void _free_context(_context_t* context)
+// Orders boxes by decreasing volume, then by position.
+static int _compare_heightfield_boxes(const void* a, const void* b)
 {
-    _free_per_plane_voxel_set(context);
-    MELT_FREE(context->voxel_indices);
-    MELT_FREE(context->voxel_field);
-    MELT_FREE(context->min_distance_field);
-    MELT_FREE(context->voxel_set);
+    const _heightfield_box_t* box_a = (const _heightfield_box_t*)a;
+    const _heightfield_box_t* box_b = (const _heightfield_box_t*)b;
+    if (box_a->volume != box_b->volume)
+        return box_a->volume > box_b->volume ? -1 : 1;
+    if (box_a->min.z != box_b->min.z)
+        return box_a->min.z < box_b->min.z ? -1 : 1;
+    if (box_a->min.x != box_b->min.x)
+        return box_a->min.x < box_b->min.x ? -1 : 1;
+    return box_a->min.y < box_b->min.y ? -1 : (box_a->min.y > box_b->min.y ? 1 : 0);
 }
 
-void melt_free_result(melt_result_t result)
+// Sets the grid of the samples of the mesh or the scene of params, cells of the
+// voxel size along x and z over the bounds of the mesh. The heights are the
+// heights of the mesh, the origin is at 0 along y.
+static void _heightfield_mesh_grid(const melt_params_t* params, melt_heightfield_t* heightfield)
 {
-    MELT_FREE(result.mesh.vertices);
-    MELT_FREE(result.mesh.indices);
-    MELT_FREE(result.debug_mesh.vertices);
-    MELT_FREE(result.debug_mesh.indices);
+    const _scene_t scene = _params_scene(params);
+    const _aabb_t aabb = _generate_aabb_from_scene(&scene);
+    const vec3_t voxel_extent = _voxel_extent(params);
+
+    heightfield->heights = NULL;
+    heightfield->origin = _vec3_init(aabb.min.x, 0.0f, aabb.min.z);
+    heightfield->spacing_x = voxel_extent.x;
+    heightfield->spacing_z = voxel_extent.z;
+    heightfield->width = (uint32_t)ceilf((aabb.max.x - aabb.min.x) / voxel_extent.x) + 1;
+    heightfield->depth = (uint32_t)ceilf((aabb.max.z - aabb.min.z) / voxel_extent.z) + 1;
 }
 
-int melt_generate_occluder(melt_params_t params, melt_result_t* out_result)
+// Samples the mesh or the scene of params on the grid of heightfield. Samples are
+// the heights of the triangles above them, cell_heights lower bounds of the
+// triangles over each cell. Returns false when the surface is not single valued
+// along y, some triangles facing up and others down.
+static bool _sample_heightfield_mesh(const melt_params_t* params, const melt_heightfield_t* heightfield, float* samples, float* cell_heights)
 {
-    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
-
-    vec3_t voxel_extent = _vec3_init(params.voxel_size, params.voxel_size, params.voxel_size);
-    vec3_t half_voxel_extent = _vec3_mulf(voxel_extent, 0.5f);
-
-    _aabb_t mesh_aabb = _generate_aabb_from_mesh(params.mesh);
-
-    mesh_aabb.min = _vec3_sub(_map_to_voxel_min_bound(mesh_aabb.min, params.voxel_size), voxel_extent);
-    mesh_aabb.max = _vec3_add(_map_to_voxel_max_bound(mesh_aabb.max, params.voxel_size), voxel_extent);
-
-    vec3_t mesh_extent = _vec3_sub(mesh_aabb.max, mesh_aabb.min);
-    vec3_t inv_mesh_extent = _vec3_init(1.0f / mesh_extent.x, 1.0f / mesh_extent.y, 1.0f / mesh_extent.z);
-    vec3_t voxel_count = _vec3_div(mesh_extent, params.voxel_size);
-    vec3_t voxel_resolution = _vec3_mul(voxel_count, inv_mesh_extent);
-
-    _context_t context;
-    _init_context(&context, voxel_count);
-
-    // Perform shell voxelization
-    for (uint32_t i = 0; i < params.mesh.index_count; i += 3)
+    const _scene_t scene = _params_scene(params);
+    const uint32_t width = heightfield->width;
+    const uint32_t depth = heightfield->depth;
+    const float spacing_x = heightfield->spacing_x;
+    const float spacing_z = heightfield->spacing_z;
+    const vec3_t origin = heightfield->origin;
+
+    _triangle_cursor_t cursor;
+    _triangle_t triangle;
+    bool facing_up = false;
+    bool facing_down = false;
+    _init_triangle_cursor(&cursor, &scene);
+    while (_next_triangle(&cursor, &triangle))
     {
-        MELT_PROFILE_BEGIN();
-
-        _triangle_t triangle;
+        const vec3_t normal = _vec3_cross(_vec3_sub(triangle.v1, triangle.v0), _vec3_sub(triangle.v2, triangle.v0));
+        const float tolerance = 1e-6f * sqrtf(_vec3_dot(normal, normal));
+        facing_up |= normal.y > tolerance;
+        facing_down |= normal.y < -tolerance;
+    }
+    if (facing_up && facing_down)
+        return false;
 
-        triangle.v0 = params.mesh.vertices[params.mesh.indices[i + 0]];
-        triangle.v1 = params.mesh.vertices[params.mesh.indices[i + 1]];
-        triangle.v2 = params.mesh.vertices[params.mesh.indices[i + 2]];
+    for (uint64_t i = 0; i < (uint64_t)width * depth; ++i)
+        samples[i] = FLT_MAX;
+    for (uint64_t i = 0; i < (uint64_t)(width - 1) * (depth - 1); ++i)
+        cell_heights[i] = FLT_MAX;
 
-        _aabb_t triangle_aabb = _generate_aabb_from_triangle(&triangle);
+    _init_triangle_cursor(&cursor, &scene);
+    while (_next_triangle(&cursor, &triangle))
+    {
+        const vec3_t a = _vec3_sub(triangle.v0, origin);
+        const vec3_t ab = _vec3_sub(triangle.v1, triangle.v0);
+        const vec3_t ac = _vec3_sub(triangle.v2, triangle.v0);
+
+        // Twice the signed area of the triangle seen from above, vertical
+        // triangles do not cover any sample.
+        const float area = ab.x * ac.z - ac.x * ab.z;
+        if (fabsf(area) <= 1e-6f * (fabsf(ab.x * ac.z) + fabsf(ac.x * ab.z)))
+            continue;
+        const float inv_area = 1.0f / area;
+
+        const _aabb_t aabb = _generate_aabb_from_triangle(&triangle);
+        const float min_x = (aabb.min.x - origin.x) / spacing_x;
+        const float max_x = (aabb.max.x - origin.x) / spacing_x;
+        const float min_z = (aabb.min.z - origin.z) / spacing_z;
+        const float max_z = (aabb.max.z - origin.z) / spacing_z;
+
+        // The samples within the triangle, with a small tolerance for the
+        // samples on its edges.
+        const uint32_t sample_x0 = (uint32_t)_float_max(ceilf(min_x - 1e-4f), 0.0f);
+        const uint32_t sample_x1 = _uint32_t_min((uint32_t)_float_max(floorf(max_x + 1e-4f), 0.0f), width - 1);
+        const uint32_t sample_z0 = (uint32_t)_float_max(ceilf(min_z - 1e-4f), 0.0f);
+        const uint32_t sample_z1 = _uint32_t_min((uint32_t)_float_max(floorf(max_z + 1e-4f), 0.0f), depth - 1);
+        for (uint32_t z = sample_z0; z <= sample_z1; ++z)
+        {
+            for (uint32_t x = sample_x0; x <= sample_x1; ++x)
+            {
+                const float px = x * spacing_x - a.x;
+                const float pz = z * spacing_z - a.z;
+                const float u = (px * ac.z - ac.x * pz) * inv_area;
+                const float v = (ab.x * pz - px * ab.z) * inv_area;
+                if (u < -1e-5f || v < -1e-5f || u + v > 1.0f + 1e-5f)
+                    continue;
 
-        // Voxel snapping, snap the triangle extent to find the 3d grid to iterate on.
-        triangle_aabb.min = _vec3_sub(_map_to_voxel_min_bound(triangle_aabb.min, params.voxel_size), voxel_extent);
-        triangle_aabb.max = _vec3_add(_map_to_voxel_max_bound(triangle_aabb.max, params.voxel_size), voxel_extent);
+                float* sample = &samples[x + (uint64_t)z * width];
+                *sample = _float_min(*sample, a.y + u * ab.y + v * ac.y);
+            }
+        }
 
-        for (float x = triangle_aabb.min.x; x <= triangle_aabb.max.x; x += params.voxel_size)
+        // The plane of the triangle is lowest at a corner of each cell, the
+        // triangle is not lower than its lowest vertex.
+        const uint32_t cell_x0 = _uint32_t_min((uint32_t)_float_max(floorf(min_x), 0.0f), width - 2);
+        const uint32_t cell_x1 = _uint32_t_min((uint32_t)_float_max(ceilf(max_x), 1.0f), width - 1);
+        const uint32_t cell_z0 = _uint32_t_min((uint32_t)_float_max(floorf(min_z), 0.0f), depth - 2);
+        const uint32_t cell_z1 = _uint32_t_min((uint32_t)_float_max(ceilf(max_z), 1.0f), depth - 1);
+        for (uint32_t z = cell_z0; z < cell_z1; ++z)
         {
-            for (float y = triangle_aabb.min.y; y <= triangle_aabb.max.y; y += params.voxel_size)
+            for (uint32_t x = cell_x0; x < cell_x1; ++x)
             {
-                for (float z = triangle_aabb.min.z; z <= triangle_aabb.max.z; z += params.voxel_size)
+                float lowest = FLT_MAX;
+                for (uint32_t corner = 0; corner < 4; ++corner)
                 {
-                    _voxel_t voxel;
-
-                    voxel.aabb.min = _vec3_sub(_vec3_init(x, y, z), half_voxel_extent);
-                    voxel.aabb.max = _vec3_add(_vec3_init(x, y, z), half_voxel_extent);
+                    const float px = (x + (corner & 1)) * spacing_x - a.x;
+                    const float pz = (z + (corner >> 1)) * spacing_z - a.z;
+                    const float u = (px * ac.z - ac.x * pz) * inv_area;
+                    const float v = (ab.x * pz - px * ab.z) * inv_area;
+                    lowest = _float_min(lowest, a.y + u * ab.y + v * ac.y);
+                }
 
-                    MELT_ASSERT(voxel.aabb.min.x >= mesh_aabb.min.x - half_voxel_extent.x);
-                    MELT_ASSERT(voxel.aabb.min.y >= mesh_aabb.min.y - half_voxel_extent.y);
-                    MELT_ASSERT(voxel.aabb.min.z >= mesh_aabb.min.z - half_voxel_extent.z);
+                float* cell_height = &cell_heights[x + (uint64_t)z * (width - 1)];
+                *cell_height = _float_min(*cell_height, _float_max(lowest, aabb.min.y - origin.y));
+            }
+        }
+    }
+    return true;
+}
 
-                    MELT_ASSERT(voxel.aabb.max.x <= mesh_aabb.max.x + half_voxel_extent.x);
-                    MELT_ASSERT(voxel.aabb.max.y <= mesh_aabb.max.y + half_voxel_extent.y);
-                    MELT_ASSERT(voxel.aabb.max.z <= mesh_aabb.max.z + half_voxel_extent.z);
+// Bytes of the quadtree of a tile.
+static uint64_t _min_height_quadtree_memory_bytes(uint32_t size_log2)
+{
+    return _quadtree_level_offset(size_log2, size_log2 + 1) * sizeof(float);
+}
 
-                    vec3_t voxel_center = _aabb_center(voxel.aabb);
-                    vec3_t relative_to_origin = _vec3_sub(_vec3_sub(voxel_center, mesh_aabb.min), half_voxel_extent);
+// Upper bound of the number of boxes of a heightfield, one per node of the
+// quadtrees of the tiles.
+static uint64_t _heightfield_box_count_bound(const melt_heightfield_t* heightfield)
+{
+    const uint32_t size_log2 = _heightfield_tile_size_log2(heightfield);
+    const uint32_t size = 1u << size_log2;
+    const uint64_t tile_count = (uint64_t)((heightfield->width - 1 + size - 1) / size) * ((heightfield->depth - 1 + size - 1) / size);
+    return tile_count * _quadtree_level_offset(size_log2, size_log2 + 1);
+}
 
-                    if (!_aabb_intersects_triangle(&triangle, voxel_center, half_voxel_extent))
-                        continue;
-                    voxel.position = _vec3_to_uvev3(_vec3_mul(relative_to_origin, voxel_resolution));
+// Upper bound of the memory of the generation of the heightfield occluder,
+// sampled tells whether the samples are taken from the mesh of params.
+static uint64_t _estimate_heightfield_memory(const melt_heightfield_t* heightfield, const melt_params_t* params, bool sampled)
+{
+    if (heightfield->width < 2 || heightfield->depth < 2)
+        return 0;
 
-                    const uint32_t index = _flatten_3d(voxel.position, context.dimension);
-                    if (context.voxel_indices[index] != -1)
-                        continue;
+    const uint64_t sample_bytes = sampled ? ((uint64_t)heightfield->width * heightfield->depth + (uint64_t)(heightfield->width - 1) * (heightfield->depth - 1)) * sizeof(float) : 0;
 
-                    context.voxel_indices[index] = (int32_t)context.voxel_set_count;
-                    context.voxel_set[context.voxel_set_count] = voxel;
-                    ++context.voxel_set_count;
-                }
-            }
-        }
+    uint64_t box_count = _heightfield_box_count_bound(heightfield);
+    const uint64_t box_bytes = box_count * sizeof(_heightfield_box_t);
+    if (params->max_box_count > 0 && box_count > params->max_box_count)
+        box_count = params->max_box_count;
+    const uint64_t result_bytes = box_count * (_vertex_count_per_aabb() * sizeof(vec3_t) + _index_count_per_aabb(params->box_type_flags) * sizeof(melt_index_t) + sizeof(float));
 
-        MELT_PROFILE_END();
-    }
+    return sample_bytes + _min_height_quadtree_memory_bytes(_heightfield_tile_size_log2(heightfield)) + box_bytes + result_bytes;
+}
 
-    // Generate a flat voxel list per plane (x,y), (x,z), (y,z)
-    _generate_per_plane_voxel_set(&context);
+uint64_t melt_estimate_heightfield_memory(melt_heightfield_t heightfield, melt_params_t params)
+{
+    const bool sampled = heightfield.heights == NULL;
+    if (sampled)
+        _heightfield_mesh_grid(&params, &heightfield);
+    return _estimate_heightfield_memory(&heightfield, &params, sampled);
+}
 
-    // The minimum distance field is a data structure representing, for each voxel,
-    // the minimum distance that we can go in each of the positive directions x, y,
-    // z until we collide with a shell voxel. The voxel field is a data structure
-    // representing the state of the voxels. The clip status is a representation of
-    // whether a voxel is in the clip state, whether a voxel can 'see' a voxel in
-    // each of the directions +x,-x,+y,-y,+z,-z, and whether the voxel is an 'inner'
-    // voxel (contained within the shell voxels).
+// Fills the terrain from heightfield.bottom up without a 3D grid. The cells of
+// each tile are filled from a quadtree of their minimum heights: each node gives
+// a box from the top of the box of its parent up to the lowest height under the
+// node, the boxes are under the surface and do not overlap. Time and memory are
+// linear in the number of cells. A mesh must be single valued along y, it is
+// sampled on cells of the voxel size along x and z and cells not entirely
+// covered by it get no box. Uses the fill_pct, max_box_count, box_type_flags and
+// max_memory_bytes of params.
+int melt_generate_heightfield_occluder(melt_heightfield_t heightfield, melt_params_t params, melt_result_t* out_result)
+{
+    MELT_ASSERT(params._start_canary == 0 && params._end_canary == 0 && "Make sure to memset params to 0 before use");
 
-    // Generate the minimum distance field, and voxel status from the initial shell.
+    memset(out_result, 0, sizeof(melt_result_t));
+    for (uint32_t i = 0; i < 3; ++i)
+        out_result->grid_axes[i] = _vec3_init(i == 0 ? 1.0f : 0.0f, i == 1 ? 1.0f : 0.0f, i == 2 ? 1.0f : 0.0f);
 
-    _generate_fields(&context);
+    const bool sampled = heightfield.heights == NULL;
+    if (sampled)
+        _heightfield_mesh_grid(&params, &heightfield);
 
-    if (!_water_tight_mesh(&context))
+    if (params.max_memory_bytes > 0 && _estimate_heightfield_memory(&heightfield, &params, sampled) > params.max_memory_bytes)
     {
-        _free_context(&context);
+        out_result->error = MELT_ERROR_MEMORY_LIMIT_EXCEEDED;
         return 0;
     }
 
-    _debug_validate_min_distance_field(&context);
+    if (heightfield.width < 2 || heightfield.depth < 2)
+        return 1;
 
-    uint32_t volume = 0;
-    uint32_t total_volume = 0;
-    float fill_pct = 0.0f;
+    _heightfield_cells_t cells;
+    cells.samples = heightfield.heights;
+    cells.cell_heights = NULL;
+    cells.width = heightfield.width;
+    cells.depth = heightfield.depth;
 
-    // Approximate the volume of the mesh by the number of voxels that can fit within.
-    for (uint32_t i = 0; i < context.size; ++i)
+    float* samples = NULL;
+    float* cell_heights = NULL;
+    uint64_t sample_bytes = 0;
+    if (sampled)
     {
-        const _min_distance_t* min_distance = &context.min_distance_field[i];
-        _voxel_status_t voxel_status = context.voxel_field[_flatten_3d(min_distance->position, context.dimension)];
+        const uint64_t sample_count = (uint64_t)heightfield.width * heightfield.depth;
+        const uint64_t cell_count = (uint64_t)(heightfield.width - 1) * (heightfield.depth - 1);
+        samples = MELT_MALLOC(float, sample_count);
+        cell_heights = MELT_MALLOC(float, cell_count);
+        sample_bytes = (sample_count + cell_count) * sizeof(float);
 
-        // Each inner voxel adds one unit to the volume.
-        if (_inner_voxel(voxel_status))
-            ++total_volume;
+        if (!_sample_heightfield_mesh(&params, &heightfield, samples, cell_heights))
+        {
+            MELT_FREE(samples);
+            MELT_FREE(cell_heights);
+            out_result->error = MELT_ERROR_MESH_NOT_HEIGHTFIELD;
+            return 0;
+        }
+        cells.samples = samples;
+        cells.cell_heights = cell_heights;
     }
 
-    _max_extent_t* max_extents = MELT_MALLOC(_max_extent_t, total_volume);
-    uint32_t max_extent_count = 0;
-
-    // One iteration to find an extent does the following:
-    // . Get the extent that maximizes the volume considering the minimum distance
-    //    field
-    // . Clip the max extent found to the set of inner voxels
-    // . Update the minimum distance field by adjusting the distances on the set
-    //    of inner voxels. This is done by extending the extent cube to infinity
-    //    on each of the axes +x, +y, +z
-    while (fill_pct < params.fill_pct && volume != total_volume)
-    {
-        _max_extent_t max_extent = _get_max_extent(&context);
+    _min_height_quadtree_t tree;
+    tree.heightfield = &heightfield;
+    tree.cells = &cells;
+    tree.size_log2 = _heightfield_tile_size_log2(&heightfield);
+    tree.levels = MELT_MALLOC(float, _quadtree_level_offset(tree.size_log2, tree.size_log2 + 1));
+    tree.boxes = NULL;
+    tree.box_count = 0;
 
-        _clip_voxel_field(&context, max_extent.position, max_extent.extent);
+    // The boxes are counted in a first pass over the tiles and added in a second one.
+    _add_heightfield_boxes(&tree);
+    const uint32_t box_count = tree.box_count;
+    tree.boxes = MELT_MALLOC(_heightfield_box_t, box_count);
+    tree.box_count = 0;
+    _add_heightfield_boxes(&tree);
 
-        _update_min_distance_field(&context, max_extent.position, max_extent.extent);
+    const uint64_t box_bytes = (uint64_t)box_count * sizeof(_heightfield_box_t);
+    out_result->peak_memory_bytes = sample_bytes + _min_height_quadtree_memory_bytes(tree.size_log2) + box_bytes;
 
-        _debug_validate_min_distance_field(&context);
+    MELT_FREE(tree.levels);
+    MELT_FREE(samples);
+    MELT_FREE(cell_heights);
 
-        max_extents[max_extent_count++] = max_extent;
+    qsort(tree.boxes, box_count, sizeof(_heightfield_box_t), _compare_heightfield_boxes);
 
-        fill_pct += (float)max_extent.volume / total_volume;
-        volume += max_extent.volume;
-    }
+    float total_volume = 0.0f;
+    for (uint32_t i = 0; i < box_count; ++i)
+        total_volume += tree.boxes[i].volume;
 
-    memset(out_result, 0, sizeof(melt_result_t));
+    // The largest boxes up to fill_pct of the volume under the surface.
+    uint32_t selected_count = 0;
+    float fill_pct = 0.0f;
+    while (fill_pct < params.fill_pct && selected_count < box_count &&
+        (params.max_box_count == 0 || selected_count < params.max_box_count))
+        fill_pct += tree.boxes[selected_count++].volume / total_volume;
 
-    out_result->mesh.vertices = MELT_MALLOC(vec3_t, _vertex_count_per_aabb() * max_extent_count);
-    out_result->mesh.indices = MELT_MALLOC(uint16_t, _index_count_per_aabb(params.box_type_flags) * max_extent_count);
+    out_result->mesh.vertices = MELT_MALLOC(vec3_t, _vertex_count_per_aabb() * selected_count);
+    out_result->mesh.indices = MELT_MALLOC(melt_index_t, _index_count_per_aabb(params.box_type_flags) * selected_count);
+    out_result->box_fill_pcts = MELT_MALLOC(float, selected_count);
+    out_result->box_count = selected_count;
 
-    for (uint32_t i = 0; i < max_extent_count; ++i)
+    fill_pct = 0.0f;
+    for (uint32_t i = 0; i < selected_count; ++i)
     {
-        const _max_extent_t* extent = &max_extents[i];
-
-        vec3_t half_extent = _vec3_mul(_uvec3_to_vec3(extent->extent), half_voxel_extent);
-        vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(extent->position), voxel_extent);
-        vec3_t voxel_position_biased_to_center = _vec3_add(voxel_position, half_extent);
-        vec3_t aabb_center = _vec3_add(mesh_aabb.min, voxel_position_biased_to_center);
+        const _heightfield_box_t* box = &tree.boxes[i];
+        _add_voxel_to_mesh(_vec3_mulf(_vec3_add(box->min, box->max), 0.5f), _vec3_mulf(_vec3_sub(box->max, box->min), 0.5f), &out_result->mesh, params.box_type_flags);
 
-        _add_voxel_to_mesh(_vec3_add(aabb_center, half_voxel_extent), half_extent, &out_result->mesh, params.box_type_flags);
+        fill_pct += box->volume / total_volume;
+        out_result->box_fill_pcts[i] = fill_pct;
     }
+    _generate_lod_levels(out_result);
 
-    _debug_validate_max_extents(&context, max_extents, max_extent_count);
-
-#if defined(MELT_DEBUG)
-    if (params.debug.flags > 0)
-    {
-        // _add_voxel_to_mesh(aabb_center(mesh_aabb), (mesh_aabb.max - mesh_aabb.min) * 0.5f, out_result->debug_mesh, _colors[0]);
-
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_OUTER)
-        {
-            _add_voxel_set_to_mesh(context.voxel_set, context.voxel_set_count, _vec3_mulf(half_voxel_extent, params.debug.voxelScale), &out_result->debug_mesh);
-        }
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_SLICE_SELECTION)
-        {
-            if (params.debug.voxel_y > 0 && params.debug.voxel_z > 0)
-            {
-                uint32_t index = _flatten_2d(_uvec2_init(params.debug.voxel_y, params.debug.voxel_z), _uvec2_init(context.dimension.y, context.dimension.z));
-                const _voxel_set_plane_t* voxels_x = &context.voxel_set_planes.x[index];
-                _add_voxel_set_to_mesh(voxels_x->voxels, voxels_x->voxel_count, _vec3_mulf(half_voxel_extent, params.debug.voxelScale), &out_result->debug_mesh);
-            }
-            if (params.debug.voxel_x > 0 && params.debug.voxel_z > 0)
-            {
-                uint32_t index = _flatten_2d(_uvec2_init(params.debug.voxel_x, params.debug.voxel_z), _uvec2_init(context.dimension.x, context.dimension.z));
-                const _voxel_set_plane_t* voxels_y = &context.voxel_set_planes.y[index];
-                _add_voxel_set_to_mesh(voxels_y->voxels, voxels_y->voxel_count, _vec3_mulf(half_voxel_extent, params.debug.voxelScale), &out_result->debug_mesh);
-            }
-            if (params.debug.voxel_x > 0 && params.debug.voxel_y > 0)
-            {
-                uint32_t index = _flatten_2d(_uvec2_init(params.debug.voxel_x, params.debug.voxel_y), _uvec2_init(context.dimension.x, context.dimension.y));
-                const _voxel_set_plane_t* voxels_z = &context.voxel_set_planes.z[index];
-                _add_voxel_set_to_mesh(voxels_z->voxels, voxels_z->voxel_count, _vec3_mulf(half_voxel_extent, params.debug.voxelScale), &out_result->debug_mesh);
-            }
-        }
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_INNER)
-        {
-            for (uint32_t i = 0; i < context.size; ++i)
-            {
-                const _min_distance_t* min_distance = &context.min_distance_field[i];
-                const uint32_t index = _flatten_3d(min_distance->position, context.dimension);
-                if (!context.voxel_field[index].inner)
-                    continue;
-
-                vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(min_distance->position), voxel_extent);
-                vec3_t voxel_center = _vec3_add(mesh_aabb.min, voxel_position);
-                if (params.debug.voxel_x < 0 ||
-                    params.debug.voxel_y < 0 ||
-                    params.debug.voxel_z < 0)
-                {
-                    _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent,
-                        &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-                }
-            }
-        }
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_MIN_DISTANCE)
-        {
-            for (uint32_t i = 0; i < context.size; ++i)
-            {
-                const _min_distance_t* min_distance = &context.min_distance_field[i];
-                vec3_t voxel_center = _vec3_add(mesh_aabb.min, _vec3_mul(_uvec3_to_vec3(min_distance->position), voxel_extent));
-                if ((uint32_t)params.debug.voxel_x == min_distance->x &&
-                    (uint32_t)params.debug.voxel_y == min_distance->y &&
-                    (uint32_t)params.debug.voxel_z == min_distance->z)
-                {
-                    _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent, &out_result->debug_mesh,
-                        MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-
-                    for (uint32_t x = min_distance->x; x < min_distance->x + min_distance->dist.x; ++x)
-                    {
-                        vec3_t voxel_center_x = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(x, min_distance->y, min_distance->z), voxel_extent));
-                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_x, voxel_extent), half_voxel_extent,
-                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-                    }
-                    for (uint32_t y = min_distance->y; y < min_distance->y + min_distance->dist.y; ++y)
-                    {
-                        vec3_t voxel_center_y = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(min_distance->x, y, min_distance->z), voxel_extent));
-                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_y, voxel_extent), half_voxel_extent,
-                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-                    }
-                    for (uint32_t z = min_distance->z; z < min_distance->z + min_distance->dist.z; ++z)
-                    {
-                        vec3_t voxel_center_z = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(min_distance->x, min_distance->y, z), voxel_extent));
-                        _add_voxel_to_mesh_with_color(_vec3_add(voxel_center_z, voxel_extent), half_voxel_extent,
-                            &out_result->debug_mesh, MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-                    }
-                }
-            }
-        }
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_EXTENT)
-        {
-            for (uint32_t i = 0; i < context.size; ++i)
-            {
-                const _min_distance_t* min_distance = &context.min_distance_field[i];
-                uvec3_t max_extent = _get_max_aabb_extent(&context, min_distance);
-                for (uint32_t x = min_distance->x; x < min_distance->x + max_extent.x; ++x)
-                {
-                    for (uint32_t y = min_distance->y; y < min_distance->y + max_extent.y; ++y)
-                    {
-                        for (uint32_t z = min_distance->z; z < min_distance->z + max_extent.z; ++z)
-                        {
-                            vec3_t voxel_center = _vec3_add(mesh_aabb.min, _vec3_mul(_vec3_init(x, y, z), voxel_extent));
-                            _add_voxel_to_mesh_with_color(_vec3_add(voxel_center, voxel_extent), half_voxel_extent, &out_result->debug_mesh,
-                                MELT_OCCLUDER_BOX_TYPE_REGULAR, _color_steel_blue);
-                        }
-                    }
-                }
-            }
-        }
-        if (params.debug.flags & MELT_DEBUG_TYPE_SHOW_RESULT)
-        {
-            out_result->debug_mesh.vertices = MELT_MALLOC(vec3_t, _vertex_count_per_aabb() * max_extent_count * 2);
-            out_result->debug_mesh.indices = MELT_MALLOC(uint16_t, _index_count_per_aabb(params.box_type_flags) * max_extent_count);
-
-            for (size_t i = 0; i < max_extent_count; ++i)
-            {
-                const _max_extent_t* extent = &max_extents[i];
-                if ((int32_t)i == params.debug.extent_index || params.debug.extent_index < 0)
-                {
-                    vec3_t half_extent = _vec3_mul(_uvec3_to_vec3(extent->extent), half_voxel_extent);
-                    vec3_t voxel_position = _vec3_mul(_uvec3_to_vec3(extent->position), voxel_extent);
-                    vec3_t voxel_position_biased_to_center = _vec3_add(voxel_position, half_extent);
-                    vec3_t aabb_center = _vec3_add(mesh_aabb.min, voxel_position_biased_to_center);
-                    color_3u8_t color = _colors[i % MELT_ARRAY_LENGTH(_colors)];
-                    _add_voxel_to_mesh_with_color(_vec3_add(aabb_center, half_voxel_extent), half_extent, &out_result->debug_mesh, params.box_type_flags, color);
-                }
-            }
-
-            MELT_ASSERT(out_result->debug_mesh.vertex_count == _vertex_count_per_aabb() * max_extent_count * 2);
-            MELT_ASSERT(out_result->debug_mesh.index_count ==  _index_count_per_aabb(params.box_type_flags) * max_extent_count);
-        }
-    }
-#endif
+    const uint64_t result_bytes = _result_allocated_bytes(out_result);
+    if (box_bytes + result_bytes > out_result->peak_memory_bytes)
+        out_result->peak_memory_bytes = box_bytes + result_bytes;
 
-    _free_context(&context);
-    MELT_FREE(max_extents);
+    MELT_FREE(tree.boxes);
     return 1;
 }
 
@@ -0,0 +1,3 @@
+// Runs the unit tests with the fields of dense grids stored in tiles.
+#define MELT_TILED_FIELDS
+#include "unit-tests.cpp"
@@ -8,6 +8,8 @@
 #include "tiny_obj_loader.h"
 
 #include <math.h>
+#include <algorithm>
+#include <vector>
 
 #define FABS(x) ((float)fabs(x))
 #define USE_EPSILON_TEST TRUE
@@ -309,9 +311,15 @@ static bool LoadModelMesh(const char* model_path, melt_params_t& melt_params)
     return true;
 }
 
+// Only the triangles of mesh1 whose bounds overlap a triangle of mesh0 are
+// tested against it, they are looked up in a hierarchy of the triangles of mesh1.
 bool EnsureMeshExclusive(const melt_mesh_t& mesh0, const melt_mesh_t& mesh1)
 {
-    for (uint32_t i = 0; i < mesh0.index_count; i += 3)
+    melt_triangle_bvh_t* bvh = melt_build_triangle_bvh(mesh1);
+    std::vector<uint32_t> triangles(64);
+    bool exclusive = true;
+
+    for (uint32_t i = 0; i < mesh0.index_count && exclusive; i += 3)
     {
         float v0[3];
         float v1[3];
@@ -329,8 +337,25 @@ bool EnsureMeshExclusive(const melt_mesh_t& mesh0, const melt_mesh_t& mesh1)
 
         CROSS(normal, e1, e2);
 
-        for (uint32_t j = 0; j < mesh1.index_count; j += 3)
+        melt_vec3_t min, max;
+        min.x = std::min(v0[0], std::min(v1[0], v2[0])) - (float)EPSILON;
+        min.y = std::min(v0[1], std::min(v1[1], v2[1])) - (float)EPSILON;
+        min.z = std::min(v0[2], std::min(v1[2], v2[2])) - (float)EPSILON;
+        max.x = std::max(v0[0], std::max(v1[0], v2[0])) + (float)EPSILON;
+        max.y = std::max(v0[1], std::max(v1[1], v2[1])) + (float)EPSILON;
+        max.z = std::max(v0[2], std::max(v1[2], v2[2])) + (float)EPSILON;
+
+        uint32_t triangle_count = melt_query_triangle_bvh(bvh, min, max, triangles.data(), (uint32_t)triangles.size());
+        if (triangle_count > triangles.size())
+        {
+            triangles.resize(triangle_count);
+            triangle_count = melt_query_triangle_bvh(bvh, min, max, triangles.data(), (uint32_t)triangles.size());
+        }
+
+        for (uint32_t t = 0; t < triangle_count; ++t)
         {
+            const uint32_t j = triangles[t] * 3;
+
             float u0[3];
             float u1[3];
             float u2[3];
@@ -350,11 +375,14 @@ bool EnsureMeshExclusive(const melt_mesh_t& mesh0, const melt_mesh_t& mesh1)
 
             if (tri_tri_intersect(&v0[0], &v1[0], &v2[0], &u0[0], &u1[0], &u2[0]))
             {
-                return false;
+                exclusive = false;
+                break;
             }
         }
     }
-    return true;
+
+    melt_free_triangle_bvh(bvh);
+    return exclusive;
 }
 
 TEST_CASE("melt.bunny", "")
@@ -482,3 +510,1724 @@ TEST_CASE("melt.column", "")
     MELT_FREE(params.mesh.vertices);
     MELT_FREE(params.mesh.indices);
 }
+
+TEST_CASE("melt.memory_limit", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.25f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+
+    uint64_t estimated_bytes = melt_estimate_memory(params);
+    REQUIRE(estimated_bytes > 0);
+
+    params.max_memory_bytes = estimated_bytes;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_NONE);
+    REQUIRE(result.peak_memory_bytes > 0);
+    REQUIRE(result.peak_memory_bytes <= estimated_bytes + (uint64_t)result.mesh.vertex_count * sizeof(melt_vec3_t) + (uint64_t)result.mesh.index_count * sizeof(melt_index_t));
+    melt_free_result(result);
+
+    params.voxel_size = 0.05f;
+    REQUIRE(melt_estimate_memory(params) > estimated_bytes);
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_MEMORY_LIMIT_EXCEEDED);
+
+    params.voxel_size = 0.25f;
+    params.max_memory_bytes = 0;
+    REQUIRE(LoadModelMesh("models/teapot.obj", params));
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.sparse_grid", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t dense_result;
+    melt_result_t sparse_result;
+
+    const char* models[] = { "models/suzanne.obj", "models/bunny.obj", "models/column.obj" };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+
+        params.voxel_size = 0.25f;
+        params.grid_type = MELT_GRID_TYPE_DENSE;
+        REQUIRE(melt_generate_occluder(params, &dense_result));
+
+        params.grid_type = MELT_GRID_TYPE_SPARSE;
+        REQUIRE(melt_estimate_memory(params) > 0);
+        REQUIRE(melt_generate_occluder(params, &sparse_result));
+
+        REQUIRE(sparse_result.mesh.vertex_count == dense_result.mesh.vertex_count);
+        REQUIRE(sparse_result.mesh.index_count == dense_result.mesh.index_count);
+        REQUIRE(memcmp(sparse_result.mesh.vertices, dense_result.mesh.vertices, dense_result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+        REQUIRE(sparse_result.peak_memory_bytes <= melt_estimate_memory(params) + (uint64_t)sparse_result.mesh.vertex_count * sizeof(melt_vec3_t) + (uint64_t)sparse_result.mesh.index_count * sizeof(melt_index_t));
+
+        melt_free_result(dense_result);
+        melt_free_result(sparse_result);
+    }
+
+    REQUIRE(LoadModelMesh("models/teapot.obj", params));
+    REQUIRE(!melt_generate_occluder(params, &sparse_result));
+    REQUIRE(sparse_result.error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.hole_closing", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.25f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+    melt_result_t closed_result;
+
+    REQUIRE(LoadModelMesh("models/teapot.obj", params));
+    params.hole_closing_voxels = 1;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_NONE);
+    REQUIRE(result.mesh.vertex_count > 0);
+    REQUIRE(EnsureMeshExclusive(params.mesh, result.mesh));
+    melt_free_result(result);
+
+    REQUIRE(LoadModelMesh("models/bunny.obj", params));
+    params.voxel_size = 0.05f;
+    params.hole_closing_voxels = 0;
+    REQUIRE(!melt_generate_occluder(params, &result));
+    params.hole_closing_voxels = 2;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(EnsureMeshExclusive(params.mesh, result.mesh));
+    melt_free_result(result);
+
+    // Water tight meshes are not affected by hole closing.
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+    params.voxel_size = 0.25f;
+    params.hole_closing_voxels = 0;
+    REQUIRE(melt_generate_occluder(params, &result));
+    params.hole_closing_voxels = 2;
+    REQUIRE(melt_generate_occluder(params, &closed_result));
+    REQUIRE(closed_result.mesh.vertex_count == result.mesh.vertex_count);
+    REQUIRE(memcmp(closed_result.mesh.vertices, result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+
+    melt_free_result(result);
+    melt_free_result(closed_result);
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.auto_voxel_size", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.05f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+    REQUIRE(melt_generate_occluder_auto(params, 20, 0.0f, &result));
+    REQUIRE(result.error == MELT_ERROR_NONE);
+    REQUIRE(result.mesh.vertex_count > 0);
+    REQUIRE(result.mesh.vertex_count <= 20 * 8);
+    REQUIRE(result.voxel_size > params.voxel_size);
+    REQUIRE(EnsureMeshExclusive(params.mesh, result.mesh));
+    melt_free_result(result);
+
+    REQUIRE(melt_generate_occluder_auto(params, 0, 0.3f, &result));
+    REQUIRE(result.mesh.vertex_count > 0);
+    REQUIRE(result.voxel_size > params.voxel_size);
+    melt_free_result(result);
+
+    melt_params_t limit_params = params;
+    limit_params.voxel_size = 0.25f;
+    params.max_memory_bytes = melt_estimate_memory(limit_params);
+    REQUIRE(melt_generate_occluder_auto(params, 0, 0.0f, &result));
+    REQUIRE(result.peak_memory_bytes <= params.max_memory_bytes + (uint64_t)result.mesh.vertex_count * sizeof(melt_vec3_t) + (uint64_t)result.mesh.index_count * sizeof(melt_index_t));
+    melt_free_result(result);
+
+    // The teapot leaks at fine voxel sizes, coarser ones are found.
+    params.max_memory_bytes = 0;
+    params.voxel_size = 0.1f;
+    REQUIRE(LoadModelMesh("models/teapot.obj", params));
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(melt_generate_occluder_auto(params, 100, 0.0f, &result));
+    REQUIRE(result.mesh.vertex_count <= 100 * 8);
+    melt_free_result(result);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.voxelized_mesh", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.25f;
+
+    melt_result_t result;
+    melt_result_t voxelized_result;
+    melt_error_t error;
+
+    const char* models[] = { "models/suzanne.obj", "models/column.obj" };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+
+        melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(params, &error);
+        REQUIRE(voxelized_mesh != NULL);
+        REQUIRE(error == MELT_ERROR_NONE);
+
+        const float fill_pcts[] = { 1.0f, 0.5f };
+        const melt_occluder_box_type_flags_t box_types[] = { MELT_OCCLUDER_BOX_TYPE_REGULAR, MELT_OCCLUDER_BOX_TYPE_SIDES };
+        for (float fill_pct : fill_pcts)
+        {
+            for (melt_occluder_box_type_flags_t box_type : box_types)
+            {
+                params.fill_pct = fill_pct;
+                params.box_type_flags = box_type;
+
+                REQUIRE(melt_generate_occluder(params, &result));
+                REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, params, &voxelized_result));
+
+                REQUIRE(voxelized_result.mesh.vertex_count == result.mesh.vertex_count);
+                REQUIRE(voxelized_result.mesh.index_count == result.mesh.index_count);
+                REQUIRE(memcmp(voxelized_result.mesh.vertices, result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+                REQUIRE(memcmp(voxelized_result.mesh.indices, result.mesh.indices, result.mesh.index_count * sizeof(melt_index_t)) == 0);
+
+                melt_free_result(result);
+                melt_free_result(voxelized_result);
+            }
+        }
+
+        params.fill_pct = 1.0f;
+        params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+        params.max_box_count = 3;
+        REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, params, &voxelized_result));
+        REQUIRE(voxelized_result.mesh.vertex_count == 3 * 8);
+        melt_free_result(voxelized_result);
+        params.max_box_count = 0;
+
+        melt_free_voxelized_mesh(voxelized_mesh);
+    }
+
+    REQUIRE(LoadModelMesh("models/teapot.obj", params));
+    REQUIRE(melt_voxelize_mesh(params, &error) == NULL);
+    REQUIRE(error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.lods", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.25f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+    melt_result_t lod_result;
+
+    const char* models[] = { "models/suzanne.obj", "models/column.obj" };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+
+        params.fill_pct = 1.0f;
+        REQUIRE(melt_generate_occluder(params, &result));
+        REQUIRE(result.box_count == result.mesh.vertex_count / 8);
+        REQUIRE(result.lods[MELT_LOD_COUNT - 1].box_count == result.box_count);
+
+        for (uint32_t i = 1; i < result.box_count; ++i)
+            REQUIRE(result.box_fill_pcts[i] >= result.box_fill_pcts[i - 1]);
+
+        // Each level is the prefix of the boxes a generation with its fill stops at.
+        const float lod_fill_pcts[MELT_LOD_COUNT - 1] = { 0.5f, 0.75f, 0.9f };
+        for (uint32_t lod = 0; lod < MELT_LOD_COUNT - 1; ++lod)
+        {
+            REQUIRE(result.lods[lod].box_count > 0);
+            REQUIRE(result.lods[lod].fill_pct >= lod_fill_pcts[lod]);
+            REQUIRE(result.lods[lod].box_count <= result.lods[lod + 1].box_count);
+
+            params.fill_pct = lod_fill_pcts[lod];
+            REQUIRE(melt_generate_occluder(params, &lod_result));
+            REQUIRE(lod_result.box_count == result.lods[lod].box_count);
+            REQUIRE(memcmp(lod_result.mesh.vertices, result.mesh.vertices, lod_result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+            REQUIRE(memcmp(lod_result.mesh.indices, result.mesh.indices, lod_result.mesh.index_count * sizeof(melt_index_t)) == 0);
+            melt_free_result(lod_result);
+        }
+
+        melt_free_result(result);
+    }
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+// Runs check(params) on both grid types of each test model, params start as a
+// complete fill of regular boxes.
+template <typename Check>
+static void ForEachFillCase(Check check)
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+
+    const char* models[] = { "models/suzanne.obj", "models/column.obj", "models/bunny.obj" };
+    const melt_grid_type_t grid_types[] = { MELT_GRID_TYPE_DENSE, MELT_GRID_TYPE_SPARSE };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+        const melt_mesh_t mesh = params.mesh;
+
+        for (melt_grid_type_t grid_type : grid_types)
+        {
+            memset(&params, 0, sizeof(melt_params_t));
+            params.mesh = mesh;
+            params.voxel_size = 0.25f;
+            params.fill_pct = 1.0f;
+            params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+            params.grid_type = grid_type;
+
+            check(params);
+        }
+    }
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+// Generates the occluder and checks it stays within the memory estimate.
+static void GenerateWithinEstimate(const melt_params_t& params, melt_result_t* result)
+{
+    REQUIRE(melt_generate_occluder(params, result));
+    REQUIRE(result->peak_memory_bytes <= melt_estimate_memory(params));
+}
+
+// Vertices of each box of the occluder, sorted so that occluders made of the same
+// boxes in a different order compare equal.
+static std::vector<std::vector<float>> SortedBoxes(const melt_result_t& result)
+{
+    std::vector<std::vector<float>> boxes;
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        const float* vertices = &result.mesh.vertices[i * 8].x;
+        boxes.emplace_back(vertices, vertices + 8 * 3);
+    }
+    std::sort(boxes.begin(), boxes.end());
+    return boxes;
+}
+
+// Bounds of the i-th box of the occluder.
+static void BoxBounds(const melt_result_t& result, uint32_t i, float min[3], float max[3])
+{
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        min[axis] = FLT_MAX;
+        max[axis] = -FLT_MAX;
+    }
+    for (uint32_t j = 0; j < 8; ++j)
+    {
+        const float* vertex = &result.mesh.vertices[i * 8 + j].x;
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = std::min(min[axis], vertex[axis]);
+            max[axis] = std::max(max[axis], vertex[axis]);
+        }
+    }
+}
+
+// Sorted voxels of the boxes of an occluder on the grid, a voxel appears once per
+// box covering it. Voxels are counted from the minimum corner of the boxes.
+static std::vector<uint64_t> BoxVoxels(const melt_result_t& result, float voxel_size)
+{
+    float origin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        float min[3], max[3];
+        BoxBounds(result, i, min, max);
+        for (uint32_t axis = 0; axis < 3; ++axis)
+            origin[axis] = std::min(origin[axis], min[axis]);
+    }
+
+    std::vector<uint64_t> voxels;
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        float min[3], max[3];
+        uint64_t first[3], end[3];
+        BoxBounds(result, i, min, max);
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            first[axis] = (uint64_t)roundf((min[axis] - origin[axis]) / voxel_size);
+            end[axis] = (uint64_t)roundf((max[axis] - origin[axis]) / voxel_size);
+        }
+        for (uint64_t z = first[2]; z < end[2]; ++z)
+            for (uint64_t y = first[1]; y < end[1]; ++y)
+                for (uint64_t x = first[0]; x < end[0]; ++x)
+                    voxels.push_back(x | y << 21 | z << 42);
+    }
+    std::sort(voxels.begin(), voxels.end());
+    return voxels;
+}
+
+TEST_CASE("melt.split_components", "")
+{
+    ForEachFillCase([](melt_params_t params)
+    {
+        melt_result_t result;
+        melt_result_t split_result;
+
+        for (uint32_t coarse_levels = 0; coarse_levels < 2; ++coarse_levels)
+        {
+            params.coarse_levels = coarse_levels;
+            params.split_components = 0;
+            GenerateWithinEstimate(params, &result);
+            params.split_components = 1;
+            GenerateWithinEstimate(params, &split_result);
+
+            // A complete fill covers the same voxels, each of them once.
+            const std::vector<uint64_t> voxels = BoxVoxels(result, params.voxel_size);
+            const std::vector<uint64_t> split_voxels = BoxVoxels(split_result, params.voxel_size);
+            REQUIRE(split_voxels == voxels);
+            REQUIRE(std::adjacent_find(split_voxels.begin(), split_voxels.end()) == split_voxels.end());
+
+            // Without coarse levels the same boxes are found, ordered by volume.
+            if (coarse_levels == 0)
+            {
+                REQUIRE(split_result.box_count == result.box_count);
+                REQUIRE(SortedBoxes(split_result) == SortedBoxes(result));
+                for (uint32_t i = 2; i < split_result.box_count; ++i)
+                {
+                    const float box_fill_pct = split_result.box_fill_pcts[i] - split_result.box_fill_pcts[i - 1];
+                    const float previous_box_fill_pct = split_result.box_fill_pcts[i - 1] - split_result.box_fill_pcts[i - 2];
+                    REQUIRE(box_fill_pct <= previous_box_fill_pct + 1e-6f);
+                }
+            }
+
+            melt_free_result(result);
+            melt_free_result(split_result);
+        }
+
+        if (params.grid_type != MELT_GRID_TYPE_DENSE)
+            return;
+
+        params.coarse_levels = 0;
+        params.split_components = 1;
+        params.fill_pct = 0.5f;
+        REQUIRE(melt_generate_occluder(params, &split_result));
+        REQUIRE(split_result.lods[0].fill_pct >= 0.5f);
+        REQUIRE(EnsureMeshExclusive(split_result.mesh, params.mesh));
+        melt_free_result(split_result);
+
+        params.fill_pct = 1.0f;
+        params.max_box_count = 3;
+        REQUIRE(melt_generate_occluder(params, &split_result));
+        REQUIRE(split_result.box_count == 3);
+        REQUIRE(split_result.mesh.vertex_count == 3 * 8);
+        melt_free_result(split_result);
+    });
+}
+
+TEST_CASE("melt.extent_search", "")
+{
+    ForEachFillCase([](melt_params_t params)
+    {
+        melt_result_t result;
+        melt_result_t search_result;
+
+        params.extent_search = MELT_EXTENT_SEARCH_DIAGONAL;
+        GenerateWithinEstimate(params, &result);
+
+        // The first box is at least the largest diagonal box, the following
+        // boxes depend on the first ones.
+        float first_box_fill_pct = result.box_fill_pcts[0];
+        const melt_extent_search_t extent_searches[] = { MELT_EXTENT_SEARCH_SUMMED_VOLUME, MELT_EXTENT_SEARCH_EXACT };
+        for (melt_extent_search_t extent_search : extent_searches)
+        {
+            params.extent_search = extent_search;
+            GenerateWithinEstimate(params, &search_result);
+
+            REQUIRE(search_result.box_fill_pcts[0] >= first_box_fill_pct);
+            REQUIRE(search_result.box_fill_pcts[search_result.box_count - 1] == Approx(1.0f));
+            REQUIRE(EnsureMeshExclusive(search_result.mesh, params.mesh));
+            if (extent_search == MELT_EXTENT_SEARCH_SUMMED_VOLUME)
+                REQUIRE(search_result.box_count <= result.box_count);
+
+            first_box_fill_pct = search_result.box_fill_pcts[0];
+            melt_free_result(search_result);
+        }
+
+        melt_free_result(result);
+
+        if (params.grid_type != MELT_GRID_TYPE_DENSE)
+            return;
+
+        params.split_components = 1;
+        REQUIRE(melt_generate_occluder(params, &search_result));
+        REQUIRE(search_result.box_fill_pcts[search_result.box_count - 1] == Approx(1.0f));
+        melt_free_result(search_result);
+    });
+
+    // An L shaped prism of arms 0.8 thick. The diagonal search grows the cube at
+    // the corner of the L into one arm, the other searches find the whole arm.
+    const float polygon[6][2] = { { 0.0f, 0.0f }, { 3.0f, 0.0f }, { 3.0f, 0.8f }, { 0.8f, 0.8f }, { 0.8f, 3.0f }, { 0.0f, 3.0f } };
+    const melt_index_t fan[4][3] = { { 3, 4, 5 }, { 3, 5, 0 }, { 3, 0, 1 }, { 3, 1, 2 } };
+
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (uint32_t z = 0; z < 2; ++z)
+    {
+        for (uint32_t i = 0; i < 6; ++i)
+        {
+            const melt_vec3_t vertex = { polygon[i][0], polygon[i][1], (float)z };
+            vertices.push_back(vertex);
+        }
+    }
+    for (const melt_index_t* triangle : fan)
+    {
+        const melt_index_t caps[6] = { (melt_index_t)(6 + triangle[0]), (melt_index_t)(6 + triangle[1]), (melt_index_t)(6 + triangle[2]), triangle[0], triangle[2], triangle[1] };
+        indices.insert(indices.end(), caps, caps + 6);
+    }
+    for (uint32_t i = 0; i < 6; ++i)
+    {
+        const uint32_t j = (i + 1) % 6;
+        const melt_index_t side[6] = { (melt_index_t)i, (melt_index_t)j, (melt_index_t)(6 + j), (melt_index_t)i, (melt_index_t)(6 + j), (melt_index_t)(6 + i) };
+        indices.insert(indices.end(), side, side + 6);
+    }
+
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.mesh.vertices = vertices.data();
+    params.mesh.vertex_count = (uint32_t)vertices.size();
+    params.mesh.indices = indices.data();
+    params.mesh.index_count = (uint32_t)indices.size();
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    // Sparse grids keep a summed volume table per brick, the boxes are the same.
+    std::vector<melt_vec3_t> summed_volume_vertices;
+    const melt_grid_type_t grid_types[] = { MELT_GRID_TYPE_DENSE, MELT_GRID_TYPE_SPARSE };
+    for (melt_grid_type_t grid_type : grid_types)
+    {
+        params.grid_type = grid_type;
+
+        melt_result_t result;
+        params.extent_search = MELT_EXTENT_SEARCH_DIAGONAL;
+        GenerateWithinEstimate(params, &result);
+        const float diagonal_fill_pct = result.box_fill_pcts[0];
+        melt_free_result(result);
+
+        const melt_extent_search_t extent_searches[] = { MELT_EXTENT_SEARCH_SUMMED_VOLUME, MELT_EXTENT_SEARCH_EXACT };
+        for (melt_extent_search_t extent_search : extent_searches)
+        {
+            params.extent_search = extent_search;
+            GenerateWithinEstimate(params, &result);
+            REQUIRE(result.box_fill_pcts[0] > diagonal_fill_pct + 0.1f);
+            REQUIRE(EnsureMeshExclusive(result.mesh, params.mesh));
+
+            if (extent_search == MELT_EXTENT_SEARCH_SUMMED_VOLUME && grid_type == MELT_GRID_TYPE_DENSE)
+            {
+                summed_volume_vertices.assign(result.mesh.vertices, result.mesh.vertices + result.mesh.vertex_count);
+            }
+            else if (extent_search == MELT_EXTENT_SEARCH_SUMMED_VOLUME)
+            {
+                REQUIRE(result.mesh.vertex_count == summed_volume_vertices.size());
+                REQUIRE(memcmp(result.mesh.vertices, summed_volume_vertices.data(), result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+            }
+            melt_free_result(result);
+        }
+    }
+
+    // The sums of the table wrap past 2^32 voxels, a voxel of a grid whose
+    // corners before it wrapped is still counted once.
+    uint32_t sums[8];
+    for (uint32_t i = 0; i < 7; ++i)
+        sums[i] = UINT32_MAX;
+    sums[7] = 0;
+    _summed_volume_table_t table;
+    memset(&table, 0, sizeof(_summed_volume_table_t));
+    table.dimension = _uvec3_init(2, 2, 2);
+    table.sums = sums;
+    REQUIRE(_summed_volume(&table, _uvec3_init(0, 0, 0), _uvec3_init(1, 1, 1)) == 1);
+}
+
+// Greedy iterations on the grid of the voxelized mesh to reach params.fill_pct,
+// once the coarse levels of params are filled. The fields of the voxelized mesh
+// are copied as by melt_generate_occluder_from_voxelized_mesh.
+static uint32_t GridFillIterationCount(const melt_voxelized_mesh_t* voxelized_mesh, const melt_params_t& params)
+{
+    _context_t context = voxelized_mesh->context;
+    context.voxel_field = MELT_MALLOC(_voxel_status_t, context.size);
+    context.min_distance_field = MELT_MALLOC(_min_distance_t, context.size);
+    memcpy(context.voxel_field, voxelized_mesh->context.voxel_field, context.size * sizeof(_voxel_status_t));
+    memcpy(context.min_distance_field, voxelized_mesh->context.min_distance_field, context.size * sizeof(_min_distance_t));
+
+    uint64_t total_volume = 0;
+    for (uint64_t i = 0; i < context.size; ++i)
+        total_volume += _inner_voxel(context.voxel_field[i]) ? 1 : 0;
+
+    std::vector<_max_extent_t> max_extents(total_volume);
+    uint32_t max_extent_count = 0;
+    uint64_t volume = 0;
+    float fill_pct = 0.0f;
+    if (params.coarse_levels > 0)
+        _fill_coarse_levels(&context, &params, total_volume, max_extents.data(), &max_extent_count, &volume, &fill_pct);
+
+    uint32_t iteration_count = 0;
+    for (; fill_pct < params.fill_pct && volume != total_volume; ++iteration_count)
+    {
+        const uint64_t max_extent_volume = _fill_max_extent(&context, params.extent_search, NULL).volume;
+        fill_pct += (float)max_extent_volume / total_volume;
+        volume += max_extent_volume;
+    }
+
+    MELT_FREE(context.voxel_field);
+    MELT_FREE(context.min_distance_field);
+    return iteration_count;
+}
+
+TEST_CASE("melt.coarse_levels", "")
+{
+    ForEachFillCase([](melt_params_t params)
+    {
+        melt_result_t result;
+
+        for (uint32_t coarse_levels = 1; coarse_levels <= 3; ++coarse_levels)
+        {
+            params.coarse_levels = coarse_levels;
+            params.split_components = params.grid_type == MELT_GRID_TYPE_DENSE && coarse_levels == 3;
+            GenerateWithinEstimate(params, &result);
+
+            REQUIRE(result.box_fill_pcts[result.box_count - 1] == Approx(1.0f));
+            REQUIRE(EnsureMeshExclusive(result.mesh, params.mesh));
+
+            // Boxes are ordered by decreasing volume.
+            for (uint32_t i = 1; i + 1 < result.box_count; ++i)
+            {
+                const float previous_box_fill_pct = result.box_fill_pcts[i] - result.box_fill_pcts[i - 1];
+                const float box_fill_pct = result.box_fill_pcts[i + 1] - result.box_fill_pcts[i];
+                REQUIRE(box_fill_pct <= previous_box_fill_pct + 1e-5f);
+            }
+
+            melt_free_result(result);
+        }
+    });
+
+    // The coarse boxes reach most of the fill of the sphere and leave fewer
+    // iterations to its grid. Their leftovers take more iterations to fill
+    // completely.
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.05f;
+    params.fill_pct = 0.9f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    REQUIRE(LoadModelMesh("models/sphere.obj", params));
+
+    const melt_grid_type_t grid_types[] = { MELT_GRID_TYPE_DENSE, MELT_GRID_TYPE_SPARSE };
+    for (melt_grid_type_t grid_type : grid_types)
+    {
+        params.grid_type = grid_type;
+
+        melt_error_t error;
+        melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(params, &error);
+        REQUIRE(voxelized_mesh != NULL);
+
+        params.coarse_levels = 0;
+        const uint32_t iteration_count = GridFillIterationCount(voxelized_mesh, params);
+        for (uint32_t coarse_levels = 1; coarse_levels <= 2; ++coarse_levels)
+        {
+            params.coarse_levels = coarse_levels;
+            const uint32_t coarse_iteration_count = GridFillIterationCount(voxelized_mesh, params);
+            REQUIRE(coarse_iteration_count < iteration_count / 2);
+        }
+
+        melt_free_voxelized_mesh(voxelized_mesh);
+    }
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+// Whether the i-th and j-th boxes of the occluder share a whole face.
+static bool BoxesShareFace(const melt_result_t& result, uint32_t i, uint32_t j)
+{
+    float min_i[3], max_i[3], min_j[3], max_j[3];
+    BoxBounds(result, i, min_i, max_i);
+    BoxBounds(result, j, min_j, max_j);
+
+    for (uint32_t axis = 0; axis < 3; ++axis)
+    {
+        const uint32_t axis1 = (axis + 1) % 3;
+        const uint32_t axis2 = (axis + 2) % 3;
+        const bool touch = fabsf(max_i[axis] - min_j[axis]) < 1e-4f || fabsf(max_j[axis] - min_i[axis]) < 1e-4f;
+        const bool same_face = fabsf(min_i[axis1] - min_j[axis1]) < 1e-4f && fabsf(max_i[axis1] - max_j[axis1]) < 1e-4f &&
+            fabsf(min_i[axis2] - min_j[axis2]) < 1e-4f && fabsf(max_i[axis2] - max_j[axis2]) < 1e-4f;
+        if (touch && same_face)
+            return true;
+    }
+    return false;
+}
+
+TEST_CASE("melt.merge_boxes", "")
+{
+    uint32_t merged_box_count = 0;
+    ForEachFillCase([&merged_box_count](melt_params_t params)
+    {
+        melt_result_t result;
+        melt_result_t merged_result;
+
+        for (uint32_t split_components = 0; split_components < 2; ++split_components)
+        {
+            params.split_components = split_components;
+            params.merge_boxes = 0;
+            GenerateWithinEstimate(params, &result);
+            REQUIRE(result.merged_box_count == 0);
+
+            params.merge_boxes = 1;
+            GenerateWithinEstimate(params, &merged_result);
+
+            // Merged boxes cover the same voxels.
+            const uint32_t greedy_box_count = merged_result.box_count + merged_result.merged_box_count;
+            REQUIRE(greedy_box_count == result.box_count);
+            REQUIRE(merged_result.box_fill_pcts[merged_result.box_count - 1] == Approx(result.box_fill_pcts[result.box_count - 1]));
+            REQUIRE(BoxVoxels(merged_result, params.voxel_size) == BoxVoxels(result, params.voxel_size));
+            REQUIRE(EnsureMeshExclusive(merged_result.mesh, params.mesh));
+            merged_box_count += merged_result.merged_box_count;
+
+            // No two merged boxes are left sharing a whole face.
+            for (uint32_t i = 0; i < merged_result.box_count; ++i)
+            {
+                for (uint32_t j = i + 1; j < merged_result.box_count; ++j)
+                    REQUIRE(!BoxesShareFace(merged_result, i, j));
+            }
+
+            melt_free_result(merged_result);
+            melt_free_result(result);
+        }
+    });
+
+    REQUIRE(merged_box_count > 0);
+}
+
+TEST_CASE("melt.refine_boxes", "")
+{
+    ForEachFillCase([](melt_params_t params)
+    {
+        melt_result_t result;
+        melt_result_t refined_result;
+
+        for (uint32_t split_components = 0; split_components < 2; ++split_components)
+        {
+            params.split_components = split_components;
+            params.refine_boxes = 0;
+            GenerateWithinEstimate(params, &result);
+
+            params.refine_boxes = 1;
+            GenerateWithinEstimate(params, &refined_result);
+            REQUIRE(refined_result.box_count == result.box_count);
+            REQUIRE(EnsureMeshExclusive(refined_result.mesh, params.mesh));
+
+            // Refined boxes contain the boxes on the grid, some of them grow.
+            uint32_t grown_box_count = 0;
+            for (uint32_t i = 0; i < result.box_count; ++i)
+            {
+                float min[3], max[3], refined_min[3], refined_max[3];
+                BoxBounds(result, i, min, max);
+                BoxBounds(refined_result, i, refined_min, refined_max);
+
+                // Boxes are rebuilt from their bounds, their vertices may round differently.
+                bool grown = false;
+                for (uint32_t axis = 0; axis < 3; ++axis)
+                {
+                    REQUIRE(refined_min[axis] <= min[axis] + 1e-5f);
+                    REQUIRE(refined_max[axis] >= max[axis] - 1e-5f);
+                    grown = grown || refined_min[axis] < min[axis] - 1e-5f || refined_max[axis] > max[axis] + 1e-5f;
+                }
+                grown_box_count += grown ? 1 : 0;
+            }
+            REQUIRE(grown_box_count > 0);
+
+            melt_free_result(refined_result);
+            melt_free_result(result);
+        }
+    });
+}
+
+TEST_CASE("melt.triangle_bvh", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.25f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+
+    const char* models[] = { "models/suzanne.obj", "models/column.obj", "models/bunny.obj" };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+        melt_triangle_bvh_t* bvh = melt_build_triangle_bvh(params.mesh);
+
+        melt_vec3_t mesh_min = params.mesh.vertices[0];
+        melt_vec3_t mesh_max = params.mesh.vertices[0];
+        for (uint32_t i = 0; i < params.mesh.vertex_count; ++i)
+        {
+            const melt_vec3_t& v = params.mesh.vertices[i];
+            mesh_min.x = std::min(mesh_min.x, v.x); mesh_min.y = std::min(mesh_min.y, v.y); mesh_min.z = std::min(mesh_min.z, v.z);
+            mesh_max.x = std::max(mesh_max.x, v.x); mesh_max.y = std::max(mesh_max.y, v.y); mesh_max.z = std::max(mesh_max.z, v.z);
+        }
+
+        // Queries match a linear scan of the triangle bounds.
+        std::vector<uint32_t> triangles(params.mesh.index_count / 3);
+        uint32_t seed = 1;
+        for (uint32_t query = 0; query < 64; ++query)
+        {
+            float corners[2][3];
+            for (uint32_t c = 0; c < 6; ++c)
+            {
+                seed = seed * 1664525u + 1013904223u;
+                const float t = (seed >> 8) / (float)(1u << 24);
+                const float lo = (&mesh_min.x)[c % 3];
+                const float hi = (&mesh_max.x)[c % 3];
+                corners[c / 3][c % 3] = lo + (hi - lo) * t;
+            }
+            melt_vec3_t min, max;
+            min.x = std::min(corners[0][0], corners[1][0]); max.x = std::max(corners[0][0], corners[1][0]);
+            min.y = std::min(corners[0][1], corners[1][1]); max.y = std::max(corners[0][1], corners[1][1]);
+            min.z = std::min(corners[0][2], corners[1][2]); max.z = std::max(corners[0][2], corners[1][2]);
+
+            std::vector<uint32_t> expected;
+            for (uint32_t i = 0; i < params.mesh.index_count; i += 3)
+            {
+                bool overlap = true;
+                for (uint32_t axis = 0; axis < 3; ++axis)
+                {
+                    float tri_min = FLT_MAX, tri_max = -FLT_MAX;
+                    for (uint32_t v = 0; v < 3; ++v)
+                    {
+                        const float coordinate = (&params.mesh.vertices[params.mesh.indices[i + v]].x)[axis];
+                        tri_min = std::min(tri_min, coordinate);
+                        tri_max = std::max(tri_max, coordinate);
+                    }
+                    overlap = overlap && tri_min <= (&max.x)[axis] && tri_max >= (&min.x)[axis];
+                }
+                if (overlap)
+                    expected.push_back(i / 3);
+            }
+
+            const uint32_t triangle_count = melt_query_triangle_bvh(bvh, min, max, triangles.data(), (uint32_t)triangles.size());
+            REQUIRE(triangle_count == expected.size());
+            std::sort(triangles.begin(), triangles.begin() + triangle_count);
+            REQUIRE(std::equal(expected.begin(), expected.end(), triangles.begin()));
+
+            // Counts are returned past the capacity of out_triangles.
+            REQUIRE(melt_query_triangle_bvh(bvh, min, max, nullptr, 0) == triangle_count);
+        }
+
+        // The mesh crosses its bounds, the boxes of its occluder are inside.
+        REQUIRE(melt_triangle_bvh_intersects_box(bvh, mesh_min, mesh_max) == 1);
+
+        REQUIRE(melt_generate_occluder(params, &result));
+        for (uint32_t i = 0; i < result.box_count; ++i)
+        {
+            melt_vec3_t min = result.mesh.vertices[i * 8];
+            melt_vec3_t max = result.mesh.vertices[i * 8];
+            for (uint32_t j = 0; j < 8; ++j)
+            {
+                const melt_vec3_t& v = result.mesh.vertices[i * 8 + j];
+                min.x = std::min(min.x, v.x); min.y = std::min(min.y, v.y); min.z = std::min(min.z, v.z);
+                max.x = std::max(max.x, v.x); max.y = std::max(max.y, v.y); max.z = std::max(max.z, v.z);
+            }
+            REQUIRE(melt_triangle_bvh_intersects_box(bvh, min, max) == 0);
+        }
+        melt_free_result(result);
+
+        melt_free_triangle_bvh(bvh);
+    }
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.validate_occluder", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+    melt_validation_t validation;
+
+    const char* models[] = { "models/suzanne.obj", "models/column.obj", "models/bunny.obj" };
+    const float voxel_sizes[] = { 0.25f, 0.1f };
+    for (const char* model : models)
+    {
+        REQUIRE(LoadModelMesh(model, params));
+
+        for (float voxel_size : voxel_sizes)
+        {
+            params.voxel_size = voxel_size;
+
+            for (uint32_t refine_boxes = 0; refine_boxes < 2; ++refine_boxes)
+            {
+                params.refine_boxes = refine_boxes;
+                REQUIRE(melt_generate_occluder(params, &result));
+                REQUIRE(result.box_count > 0);
+                REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 1);
+                REQUIRE(validation.intersecting_box_count == 0);
+                REQUIRE(validation.outside_box_count == 0);
+                REQUIRE(validation.first_invalid_box == UINT32_MAX);
+                melt_free_result(result);
+            }
+        }
+        params.refine_boxes = 0;
+
+        REQUIRE(melt_generate_occluder(params, &result));
+        const uint32_t last_box = result.box_count - 1;
+        melt_vec3_t mesh_min = params.mesh.vertices[0];
+        melt_vec3_t mesh_max = params.mesh.vertices[0];
+        for (uint32_t i = 0; i < params.mesh.vertex_count; ++i)
+        {
+            const melt_vec3_t& v = params.mesh.vertices[i];
+            mesh_min.x = std::min(mesh_min.x, v.x); mesh_min.y = std::min(mesh_min.y, v.y); mesh_min.z = std::min(mesh_min.z, v.z);
+            mesh_max.x = std::max(mesh_max.x, v.x); mesh_max.y = std::max(mesh_max.y, v.y); mesh_max.z = std::max(mesh_max.z, v.z);
+        }
+
+        // Moving the last box past the bounds of the mesh puts it outside.
+        const float offset = (mesh_max.x - mesh_min.x) * 2.0f;
+        for (uint32_t j = 0; j < 8; ++j)
+            result.mesh.vertices[last_box * 8 + j].x += offset;
+        REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 0);
+        REQUIRE(validation.intersecting_box_count == 0);
+        REQUIRE(validation.outside_box_count == 1);
+        REQUIRE(validation.first_invalid_box == last_box);
+
+        // Stretching the first box to the bounds of the mesh crosses its surface.
+        float center_x = 0.0f;
+        for (uint32_t j = 0; j < 8; ++j)
+            center_x += result.mesh.vertices[j].x / 8.0f;
+        for (uint32_t j = 0; j < 8; ++j)
+        {
+            melt_vec3_t& v = result.mesh.vertices[j];
+            v.x = v.x < center_x ? mesh_min.x : mesh_max.x;
+        }
+        REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 0);
+        REQUIRE(validation.intersecting_box_count == 1);
+        REQUIRE(validation.outside_box_count == 1);
+        REQUIRE(validation.first_invalid_box == 0);
+        melt_free_result(result);
+    }
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+// Box from min to max in the frame of axes, with the given world space axes.
+static melt_mesh_t OrientedBoxMesh(const float min[3], const float max[3], const melt_vec3_t axes[3], std::vector<melt_vec3_t>& vertices, std::vector<melt_index_t>& indices)
+{
+    vertices.clear();
+    for (uint32_t i = 0; i < 8; ++i)
+    {
+        const float x = (i & 1) ? max[0] : min[0];
+        const float y = (i & 2) ? max[1] : min[1];
+        const float z = (i & 4) ? max[2] : min[2];
+        melt_vec3_t v;
+        v.x = axes[0].x * x + axes[1].x * y + axes[2].x * z;
+        v.y = axes[0].y * x + axes[1].y * y + axes[2].y * z;
+        v.z = axes[0].z * x + axes[1].z * y + axes[2].z * z;
+        vertices.push_back(v);
+    }
+    const melt_index_t faces[] = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+    indices.assign(faces, faces + 36);
+
+    melt_mesh_t mesh;
+    mesh.vertices = vertices.data();
+    mesh.indices = indices.data();
+    mesh.vertex_count = (uint32_t)vertices.size();
+    mesh.index_count = (uint32_t)indices.size();
+    return mesh;
+}
+
+TEST_CASE("melt.grid_frame", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+    melt_result_t world_result;
+    melt_validation_t validation;
+
+    // A wall turned by 30 degrees about y then 0.3 radians about x.
+    const float cy = cosf(0.5236f), sy = sinf(0.5236f), cx = cosf(0.3f), sx = sinf(0.3f);
+    melt_vec3_t wall_axes[3];
+    wall_axes[0].x = cy;      wall_axes[0].y = sx * sy;  wall_axes[0].z = -cx * sy;
+    wall_axes[1].x = 0.0f;    wall_axes[1].y = cx;       wall_axes[1].z = sx;
+    wall_axes[2].x = sy;      wall_axes[2].y = -sx * cy; wall_axes[2].z = cx * cy;
+
+    const float wall_min[3] = { -2.0f, -1.0f, -0.3f };
+    const float wall_max[3] = { 2.0f, 1.0f, 0.3f };
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    params.mesh = OrientedBoxMesh(wall_min, wall_max, wall_axes, vertices, indices);
+
+    // Staircases in the world grid, a single box in the frame of the wall.
+    REQUIRE(melt_generate_occluder(params, &world_result));
+    REQUIRE(melt_validate_occluder(params.mesh, &world_result, nullptr) == 1);
+
+    const melt_grid_frame_t frames[] = { MELT_GRID_FRAME_PRINCIPAL_AXES, MELT_GRID_FRAME_CUSTOM };
+    for (melt_grid_frame_t frame : frames)
+    {
+        params.grid_frame = frame;
+        for (uint32_t i = 0; i < 3; ++i)
+            params.grid_axes[i] = wall_axes[i];
+
+        REQUIRE(melt_generate_occluder(params, &result));
+        REQUIRE(result.box_count == 1);
+        REQUIRE(world_result.box_count > 20 * result.box_count);
+        REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+        REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 1);
+
+        // The axes of the grid are the axes of the wall up to their order and sign.
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            float max_dot = 0.0f;
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                const melt_vec3_t& a = result.grid_axes[i];
+                const melt_vec3_t& b = wall_axes[j];
+                max_dot = std::max(max_dot, fabsf(a.x * b.x + a.y * b.y + a.z * b.z));
+            }
+            REQUIRE(max_dot > 0.999f);
+        }
+        melt_free_result(result);
+
+        // Voxelized meshes and automatic voxel sizes keep the frame of the grid.
+        melt_error_t error;
+        melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(params, &error);
+        REQUIRE(voxelized_mesh != NULL);
+        REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, params, &result));
+        REQUIRE(result.box_count == 1);
+        REQUIRE(melt_validate_occluder(params.mesh, &result, nullptr) == 1);
+        melt_free_result(result);
+        melt_free_voxelized_mesh(voxelized_mesh);
+
+        REQUIRE(melt_generate_occluder_auto(params, 0, 0.0f, &result));
+        REQUIRE(melt_validate_occluder(params.mesh, &result, nullptr) == 1);
+        melt_free_result(result);
+    }
+    melt_free_result(world_result);
+
+    // Meshes bound more tightly by the world axes keep the world grid.
+    memset(&params.mesh, 0, sizeof(melt_mesh_t));
+    REQUIRE(LoadModelMesh("models/bunny.obj", params));
+    params.grid_frame = MELT_GRID_FRAME_WORLD;
+    REQUIRE(melt_generate_occluder(params, &world_result));
+    params.grid_frame = MELT_GRID_FRAME_PRINCIPAL_AXES;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.grid_axes[0].x == 1.0f);
+    REQUIRE(result.grid_axes[1].y == 1.0f);
+    REQUIRE(result.grid_axes[2].z == 1.0f);
+    REQUIRE(result.mesh.vertex_count == world_result.mesh.vertex_count);
+    REQUIRE(memcmp(result.mesh.vertices, world_result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+    melt_free_result(result);
+    melt_free_result(world_result);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.voxel_size_per_axis", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    REQUIRE(LoadModelMesh("models/column.obj", params));
+
+    melt_result_t result;
+    melt_result_t uniform_result;
+    REQUIRE(melt_generate_occluder(params, &uniform_result));
+    REQUIRE(uniform_result.voxel_size_per_axis.x == 0.1f);
+    REQUIRE(uniform_result.voxel_size_per_axis.y == 0.1f);
+    REQUIRE(uniform_result.voxel_size_per_axis.z == 0.1f);
+
+    // The same size on each axis gives the occluder of voxel_size.
+    params.voxel_size_per_axis.x = params.voxel_size_per_axis.y = params.voxel_size_per_axis.z = 0.1f;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.mesh.vertex_count == uniform_result.mesh.vertex_count);
+    REQUIRE(memcmp(result.mesh.vertices, uniform_result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+    melt_free_result(result);
+
+    // The column is tall along y, longer voxels along y need far less memory.
+    const uint64_t uniform_estimate = melt_estimate_memory(params);
+    params.voxel_size_per_axis.y = 0.4f;
+    REQUIRE(melt_estimate_memory(params) < uniform_estimate / 3);
+    for (uint32_t refine_boxes = 0; refine_boxes < 2; ++refine_boxes)
+    {
+        params.refine_boxes = refine_boxes;
+        REQUIRE(melt_generate_occluder(params, &result));
+        REQUIRE(result.voxel_size_per_axis.y == 0.4f);
+        REQUIRE(result.box_count < uniform_result.box_count);
+        REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+        REQUIRE(result.peak_memory_bytes < uniform_result.peak_memory_bytes / 3);
+        REQUIRE(melt_validate_occluder(params.mesh, &result, nullptr) == 1);
+        melt_free_result(result);
+    }
+    params.refine_boxes = 0;
+
+    // Voxelized meshes and automatic voxel sizes keep the sizes of each axis.
+    melt_error_t error;
+    melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(params, &error);
+    REQUIRE(voxelized_mesh != NULL);
+    melt_params_t voxelized_params = params;
+    voxelized_params.voxel_size_per_axis.y = 0.0f;
+    REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, voxelized_params, &result));
+    REQUIRE(result.voxel_size_per_axis.y == 0.4f);
+    REQUIRE(melt_validate_occluder(params.mesh, &result, nullptr) == 1);
+    melt_free_result(result);
+    melt_free_voxelized_mesh(voxelized_mesh);
+
+    REQUIRE(melt_generate_occluder_auto(params, 0, 0.0f, &result));
+    REQUIRE(result.voxel_size_per_axis.y == 4.0f * result.voxel_size_per_axis.x);
+    REQUIRE(melt_validate_occluder(params.mesh, &result, nullptr) == 1);
+    melt_free_result(result);
+
+    melt_free_result(uniform_result);
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+// Appends the triangles of mesh moved by the row major 3x4 transform, or as is
+// when transform is NULL.
+static void AppendTransformedMesh(melt_mesh_t mesh, const float* transform, std::vector<melt_vec3_t>& vertices, std::vector<melt_index_t>& indices)
+{
+    const melt_index_t first = (melt_index_t)vertices.size();
+    for (uint32_t i = 0; i < mesh.vertex_count; ++i)
+    {
+        melt_vec3_t v = mesh.vertices[i];
+        if (transform)
+        {
+            const melt_vec3_t p = v;
+            v.x = transform[0] * p.x + transform[1] * p.y + transform[2] * p.z + transform[3];
+            v.y = transform[4] * p.x + transform[5] * p.y + transform[6] * p.z + transform[7];
+            v.z = transform[8] * p.x + transform[9] * p.y + transform[10] * p.z + transform[11];
+        }
+        vertices.push_back(v);
+    }
+    for (uint32_t i = 0; i < mesh.index_count; ++i)
+        indices.push_back(first + mesh.indices[i]);
+}
+
+static melt_mesh_t VectorMesh(std::vector<melt_vec3_t>& vertices, std::vector<melt_index_t>& indices)
+{
+    melt_mesh_t mesh;
+    mesh.vertices = vertices.data();
+    mesh.indices = indices.data();
+    mesh.vertex_count = (uint32_t)vertices.size();
+    mesh.index_count = (uint32_t)indices.size();
+    return mesh;
+}
+
+TEST_CASE("melt.instances", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+
+    // Three monkeys next to a block.
+    const melt_vec3_t identity_axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float box_min[3] = { -4.5f, -1.0f, -1.0f };
+    const float box_max[3] = { -2.5f, 1.0f, 1.0f };
+    std::vector<melt_vec3_t> box_vertices;
+    std::vector<melt_index_t> box_indices;
+
+    melt_mesh_t meshes[2];
+    meshes[0] = params.mesh;
+    meshes[1] = OrientedBoxMesh(box_min, box_max, identity_axes, box_vertices, box_indices);
+
+    const float translation[12] = { 1.0f, 0.0f, 0.0f, 3.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+    const float rotation[12] = { 0.0f, 0.0f, 1.0f, 6.0f, 0.0f, 1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f };
+    melt_instance_t instances[4];
+    instances[0].mesh_index = 0; instances[0].transform = nullptr;
+    instances[1].mesh_index = 0; instances[1].transform = translation;
+    instances[2].mesh_index = 0; instances[2].transform = rotation;
+    instances[3].mesh_index = 1; instances[3].transform = nullptr;
+
+    // The same scene as a single mesh.
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (const melt_instance_t& instance : instances)
+        AppendTransformedMesh(meshes[instance.mesh_index], instance.transform, vertices, indices);
+    const melt_mesh_t combined_mesh = VectorMesh(vertices, indices);
+
+    melt_params_t scene_params = params;
+    memset(&scene_params.mesh, 0, sizeof(melt_mesh_t));
+    scene_params.meshes = meshes;
+    scene_params.mesh_count = 2;
+    scene_params.instances = instances;
+    scene_params.instance_count = 4;
+
+    melt_params_t combined_params = params;
+    combined_params.mesh = combined_mesh;
+
+    melt_result_t result;
+    melt_result_t combined_result;
+    for (uint32_t refine_boxes = 0; refine_boxes < 2; ++refine_boxes)
+    {
+        scene_params.refine_boxes = combined_params.refine_boxes = refine_boxes;
+
+        REQUIRE(melt_generate_occluder(scene_params, &result));
+        REQUIRE(melt_generate_occluder(combined_params, &combined_result));
+        REQUIRE(result.box_count == combined_result.box_count);
+        REQUIRE(memcmp(result.mesh.vertices, combined_result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+        REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(scene_params));
+        REQUIRE(melt_validate_occluder(combined_mesh, &result, nullptr) == 1);
+        melt_free_result(result);
+        melt_free_result(combined_result);
+    }
+    scene_params.refine_boxes = combined_params.refine_boxes = 0;
+
+    // Voxelized meshes and automatic voxel sizes take scenes as well.
+    melt_error_t error;
+    melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(scene_params, &error);
+    REQUIRE(voxelized_mesh != NULL);
+    REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, scene_params, &result));
+    REQUIRE(melt_validate_occluder(combined_mesh, &result, nullptr) == 1);
+    melt_free_result(result);
+    melt_free_voxelized_mesh(voxelized_mesh);
+
+    REQUIRE(melt_generate_occluder_auto(scene_params, 0, 0.0f, &result));
+    REQUIRE(melt_generate_occluder_auto(combined_params, 0, 0.0f, &combined_result));
+    REQUIRE(result.voxel_size == combined_result.voxel_size);
+    REQUIRE(result.box_count == combined_result.box_count);
+    melt_free_result(result);
+    melt_free_result(combined_result);
+
+    // Without instances each mesh is placed once as is.
+    vertices.clear();
+    indices.clear();
+    AppendTransformedMesh(meshes[0], nullptr, vertices, indices);
+    AppendTransformedMesh(meshes[1], nullptr, vertices, indices);
+    combined_params.mesh = VectorMesh(vertices, indices);
+    scene_params.instance_count = 0;
+
+    REQUIRE(melt_generate_occluder(scene_params, &result));
+    REQUIRE(melt_generate_occluder(combined_params, &combined_result));
+    REQUIRE(result.mesh.vertex_count == combined_result.mesh.vertex_count);
+    REQUIRE(memcmp(result.mesh.vertices, combined_result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+    melt_free_result(result);
+    melt_free_result(combined_result);
+
+    // A rotated wall made of three instances of one block is filled in the frame
+    // of the blocks.
+    const float cy = cosf(0.5236f), sy = sinf(0.5236f);
+    const float block_min[3] = { -1.0f, -1.0f, -0.3f };
+    const float block_max[3] = { 1.0f, 1.0f, 0.3f };
+    std::vector<melt_vec3_t> block_vertices;
+    std::vector<melt_index_t> block_indices;
+    const melt_mesh_t block = OrientedBoxMesh(block_min, block_max, identity_axes, block_vertices, block_indices);
+
+    float block_transforms[3][12];
+    melt_instance_t block_instances[3];
+    vertices.clear();
+    indices.clear();
+    for (uint32_t i = 0; i < 3; ++i)
+    {
+        const float offset = 2.0f * (float)i;
+        const float transform[12] = { cy, 0.0f, sy, cy * offset, 0.0f, 1.0f, 0.0f, 0.0f, -sy, 0.0f, cy, -sy * offset };
+        memcpy(block_transforms[i], transform, sizeof(transform));
+        block_instances[i].mesh_index = 0;
+        block_instances[i].transform = block_transforms[i];
+        AppendTransformedMesh(block, block_transforms[i], vertices, indices);
+    }
+    const melt_mesh_t wall_mesh = VectorMesh(vertices, indices);
+
+    scene_params.meshes = &block;
+    scene_params.mesh_count = 1;
+    scene_params.instances = block_instances;
+    scene_params.instance_count = 3;
+    scene_params.grid_frame = MELT_GRID_FRAME_PRINCIPAL_AXES;
+
+    REQUIRE(melt_generate_occluder(scene_params, &result));
+    REQUIRE(result.box_count <= 3);
+    REQUIRE(fabsf(result.grid_axes[0].x * cy - result.grid_axes[0].z * sy) > 0.999f);
+    REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(scene_params));
+    REQUIRE(melt_validate_occluder(wall_mesh, &result, nullptr) == 1);
+    melt_free_result(result);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.concave_room", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    // A room of seven closed boxes a little apart: floor, ceiling, three walls
+    // and a wall split by a doorway. The exterior fills the room through the
+    // doorway without leaking inside any box.
+    const melt_vec3_t identity_axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float box_bounds[7][6] =
+    {
+        { 0.0f,  0.0f,  0.0f,  5.0f,  0.6f,  5.0f  },
+        { 0.0f,  3.0f,  0.0f,  5.0f,  3.6f,  5.0f  },
+        { 0.0f,  0.64f, 0.0f,  0.6f,  2.96f, 5.0f  },
+        { 4.4f,  0.64f, 0.0f,  5.0f,  2.96f, 5.0f  },
+        { 0.64f, 0.64f, 4.4f,  4.36f, 2.96f, 5.0f  },
+        { 0.64f, 0.64f, 0.0f,  2.0f,  2.96f, 0.6f  },
+        { 3.0f,  0.64f, 0.0f,  4.36f, 2.96f, 0.6f  },
+    };
+
+    std::vector<melt_vec3_t> box_vertices;
+    std::vector<melt_index_t> box_indices;
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (uint32_t i = 0; i < 7; ++i)
+        AppendTransformedMesh(OrientedBoxMesh(box_bounds[i], box_bounds[i] + 3, identity_axes, box_vertices, box_indices), nullptr, vertices, indices);
+    params.mesh = VectorMesh(vertices, indices);
+
+    melt_result_t result;
+    melt_validation_t validation;
+    const melt_grid_type_t grid_types[] = { MELT_GRID_TYPE_DENSE, MELT_GRID_TYPE_SPARSE };
+    for (melt_grid_type_t grid_type : grid_types)
+    {
+        params.grid_type = grid_type;
+        REQUIRE(melt_generate_occluder(params, &result));
+        REQUIRE(result.box_count >= 7);
+        REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+        REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 1);
+        REQUIRE(validation.intersecting_box_count == 0);
+        REQUIRE(validation.outside_box_count == 0);
+        melt_free_result(result);
+    }
+
+    // Without the face of the floor towards the room the exterior leaks inside
+    // the floor.
+    indices.erase(indices.begin() + 18, indices.begin() + 24);
+    params.mesh = VectorMesh(vertices, indices);
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+}
+
+TEST_CASE("melt.closing_concavity", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    params.hole_closing_voxels = 2;
+
+    // Two blocks on a base with a slot narrower than the closing between them,
+    // and a small box without its -z face so that the exterior leaks. Closing the
+    // hole of the small box must not fill the slot, which lies outside the mesh.
+    const melt_vec3_t identity_axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float box_bounds[4][6] =
+    {
+        { 0.0f,  0.0f, 0.0f, 3.0f,  1.0f, 3.0f },
+        { 0.0f,  1.0f, 0.0f, 1.35f, 3.0f, 3.0f },
+        { 1.65f, 1.0f, 0.0f, 3.0f,  3.0f, 3.0f },
+        { 4.0f,  0.0f, 0.0f, 4.3f,  0.3f, 0.3f },
+    };
+
+    std::vector<melt_vec3_t> box_vertices;
+    std::vector<melt_index_t> box_indices;
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (uint32_t i = 0; i < 4; ++i)
+        AppendTransformedMesh(OrientedBoxMesh(box_bounds[i], box_bounds[i] + 3, identity_axes, box_vertices, box_indices), nullptr, vertices, indices);
+    indices.erase(indices.end() - 36, indices.end() - 30);
+    params.mesh = VectorMesh(vertices, indices);
+
+    melt_result_t result;
+    const melt_grid_type_t grid_types[] = { MELT_GRID_TYPE_DENSE, MELT_GRID_TYPE_SPARSE };
+    for (melt_grid_type_t grid_type : grid_types)
+    {
+        params.grid_type = grid_type;
+        params.hole_closing_voxels = 0;
+        REQUIRE(!melt_generate_occluder(params, &result));
+        params.hole_closing_voxels = 2;
+        REQUIRE(melt_generate_occluder(params, &result));
+        REQUIRE(result.box_count >= 3);
+        REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+
+        for (uint32_t i = 0; i < result.box_count; ++i)
+        {
+            float min[3];
+            float max[3];
+            BoxBounds(result, i, min, max);
+            REQUIRE(!(min[0] < 1.6f && max[0] > 1.4f && max[1] > 1.3f));
+        }
+        melt_free_result(result);
+    }
+}
+
+TEST_CASE("melt.thin_walls", "")
+{
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    // A box without its top face, its walls are a single voxel thick.
+    const melt_vec3_t identity_axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float box_min[3] = { 0.0f, 0.0f, 0.0f };
+    const float box_max[3] = { 2.0f, 2.0f, 2.0f };
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    params.mesh = OrientedBoxMesh(box_min, box_max, identity_axes, vertices, indices);
+    indices.erase(indices.begin() + 6, indices.begin() + 12);
+    params.mesh.index_count = (uint32_t)indices.size();
+    const melt_mesh_t open_box = params.mesh;
+
+    melt_result_t result;
+    melt_result_t sparse_result;
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+
+    // Walls thicker than allowed give no slab, the mesh still leaks. The faces of
+    // this box lie on the boundaries of the voxels, its walls are two voxels thick.
+    const float shifted_min[3] = { 0.125f, 0.125f, 0.125f };
+    const float shifted_max[3] = { 2.125f, 2.125f, 2.125f };
+    std::vector<melt_vec3_t> shifted_vertices;
+    std::vector<melt_index_t> shifted_indices;
+    params.mesh = OrientedBoxMesh(shifted_min, shifted_max, identity_axes, shifted_vertices, shifted_indices);
+    shifted_indices.erase(shifted_indices.begin() + 6, shifted_indices.begin() + 12);
+    params.mesh.index_count = (uint32_t)shifted_indices.size();
+    params.voxel_size = 0.25f;
+    params.thin_wall_voxels = 1;
+    REQUIRE(!melt_generate_occluder(params, &result));
+    REQUIRE(result.error == MELT_ERROR_MESH_NOT_WATER_TIGHT);
+    params.thin_wall_voxels = 2;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.slab_voxel_count > 0);
+    melt_free_result(result);
+
+    params.mesh = open_box;
+    params.voxel_size = 0.1f;
+
+    // Each wall gives one slab, within the walls and no thicker than allowed.
+    params.thin_wall_voxels = 2;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.box_count == 5);
+    REQUIRE(result.slab_voxel_count > 0);
+    REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        float min[3], max[3];
+        BoxBounds(result, i, min, max);
+
+        uint32_t thin_axis_count = 0;
+        for (uint32_t axis = 0; axis < 3; ++axis)
+        {
+            REQUIRE(min[axis] >= box_min[axis] - params.voxel_size);
+            REQUIRE(max[axis] <= box_max[axis] + params.voxel_size);
+            if (max[axis] - min[axis] <= 2.0f * params.voxel_size + 1e-4f)
+                ++thin_axis_count;
+        }
+        REQUIRE(thin_axis_count == 1);
+    }
+
+    params.grid_type = MELT_GRID_TYPE_SPARSE;
+    REQUIRE(melt_generate_occluder(params, &sparse_result));
+    REQUIRE(sparse_result.mesh.vertex_count == result.mesh.vertex_count);
+    REQUIRE(memcmp(sparse_result.mesh.vertices, result.mesh.vertices, result.mesh.vertex_count * sizeof(melt_vec3_t)) == 0);
+    REQUIRE(sparse_result.peak_memory_bytes <= melt_estimate_memory(params));
+    melt_free_result(result);
+    melt_free_result(sparse_result);
+    params.grid_type = MELT_GRID_TYPE_DENSE;
+
+    // A single sided quad is covered by a slab within its edges.
+    const melt_vec3_t quad_vertices[4] = { { 0.0f, 0.0f, 0.0f }, { 4.0f, 0.0f, 0.0f }, { 4.0f, 3.0f, 0.0f }, { 0.0f, 3.0f, 0.0f } };
+    const melt_index_t quad_indices[6] = { 0, 1, 2, 0, 2, 3 };
+    vertices.assign(quad_vertices, quad_vertices + 4);
+    indices.assign(quad_indices, quad_indices + 6);
+    params.mesh = VectorMesh(vertices, indices);
+
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.box_count == 1);
+    float min[3], max[3];
+    BoxBounds(result, 0, min, max);
+    REQUIRE(min[0] >= 0.0f);
+    REQUIRE(min[1] >= 0.0f);
+    REQUIRE(max[0] <= 4.0f);
+    REQUIRE(max[1] <= 3.0f);
+    const float area = (max[0] - min[0]) * (max[1] - min[1]);
+    REQUIRE(area > 0.9f * 12.0f);
+    melt_free_result(result);
+
+    // Meshes that are not water tight are filled with their slabs.
+    params.thin_wall_voxels = 0;
+    memset(&params.mesh, 0, sizeof(melt_mesh_t));
+    REQUIRE(LoadModelMesh("models/bunny.obj", params));
+    params.voxel_size = 0.05f;
+    REQUIRE(!melt_generate_occluder(params, &result));
+    params.thin_wall_voxels = 2;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.box_count > 0);
+    REQUIRE(result.slab_voxel_count > 0);
+    REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+    melt_free_result(result);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.scene_fusion", "")
+{
+    // A wall of three touching blocks and a block set apart.
+    const melt_vec3_t identity_axes[3] = { { 1.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f } };
+    const float block_min[3] = { -1.0f, -1.0f, -0.3f };
+    const float block_max[3] = { 1.0f, 1.0f, 0.3f };
+    std::vector<melt_vec3_t> block_vertices;
+    std::vector<melt_index_t> block_indices;
+    const melt_mesh_t block = OrientedBoxMesh(block_min, block_max, identity_axes, block_vertices, block_indices);
+
+    const float offsets[4] = { 0.0f, 2.0f, 4.0f, 10.0f };
+    float transforms[4][12];
+    melt_instance_t instances[4];
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        const float transform[12] = { 1.0f, 0.0f, 0.0f, offsets[i], 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+        memcpy(transforms[i], transform, sizeof(transform));
+        instances[i].mesh_index = 0;
+        instances[i].transform = transforms[i];
+        AppendTransformedMesh(block, transforms[i], vertices, indices);
+    }
+    const melt_mesh_t combined_mesh = VectorMesh(vertices, indices);
+
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    params.grid_type = MELT_GRID_TYPE_SPARSE;
+    params.meshes = &block;
+    params.mesh_count = 1;
+    params.instances = instances;
+    params.instance_count = 4;
+
+    // The blocks are filled apart, each box is tagged with its block only.
+    melt_result_t result;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.box_count >= 4);
+    REQUIRE(result.box_instance_offsets != nullptr);
+    REQUIRE(melt_validate_occluder(combined_mesh, &result, nullptr) == 1);
+    for (uint32_t i = 0; i < result.box_count; ++i)
+        REQUIRE(result.box_instance_offsets[i + 1] == result.box_instance_offsets[i] + 1);
+    const uint32_t box_count = result.box_count;
+    melt_free_result(result);
+
+    // Fused, the wall is filled as one solid and its boxes cross the faces where
+    // the blocks meet.
+    params.fuse_instances = 1;
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(result.box_count < box_count);
+    REQUIRE(result.peak_memory_bytes <= melt_estimate_memory(params));
+
+    melt_validation_t validation;
+    melt_validate_occluder(combined_mesh, &result, &validation);
+    REQUIRE(validation.outside_box_count == 0);
+
+    bool wall_box = false;
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        const uint32_t* box_instances = &result.box_instances[result.box_instance_offsets[i]];
+        const uint32_t count = result.box_instance_offsets[i + 1] - result.box_instance_offsets[i];
+        wall_box |= count == 3 && box_instances[0] == 0 && box_instances[2] == 2;
+        if (box_instances[0] == 3)
+            REQUIRE(count == 1);
+    }
+    REQUIRE(wall_box);
+    melt_free_result(result);
+
+    // The voxelized mesh is fused once.
+    melt_error_t error;
+    melt_voxelized_mesh_t* voxelized_mesh = melt_voxelize_mesh(params, &error);
+    REQUIRE(voxelized_mesh != NULL);
+    REQUIRE(melt_generate_occluder_from_voxelized_mesh(voxelized_mesh, params, &result));
+    REQUIRE(result.box_count < box_count);
+    REQUIRE(result.box_instance_offsets[result.box_count] > result.box_count);
+    melt_free_result(result);
+    melt_free_voxelized_mesh(voxelized_mesh);
+
+    // A single mesh has nothing to fuse, its boxes stay inside its faces.
+    memset(&params, 0, sizeof(melt_params_t));
+    params.voxel_size = 0.1f;
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+    params.fuse_instances = 1;
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+    REQUIRE(melt_generate_occluder(params, &result));
+    REQUIRE(melt_validate_occluder(params.mesh, &result, &validation) == 1);
+    REQUIRE(validation.intersecting_box_count == 0);
+    melt_free_result(result);
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}
+
+TEST_CASE("melt.heightfield", "")
+{
+    const uint32_t size = 70;
+    std::vector<float> heights(size * size);
+    for (uint32_t z = 0; z < size; ++z)
+    {
+        for (uint32_t x = 0; x < size; ++x)
+            heights[x + z * size] = 2.0f + sinf(x * 0.2f) * cosf(z * 0.15f);
+    }
+
+    melt_heightfield_t heightfield;
+    memset(&heightfield, 0, sizeof(melt_heightfield_t));
+    heightfield.heights = heights.data();
+    heightfield.width = size;
+    heightfield.depth = size;
+    heightfield.origin = { -10.0f, 1.0f, 5.0f };
+    heightfield.spacing_x = 0.5f;
+    heightfield.spacing_z = 0.25f;
+    heightfield.tile_size = 32;
+
+    melt_params_t params;
+    memset(&params, 0, sizeof(melt_params_t));
+    params.fill_pct = 1.0f;
+    params.box_type_flags = MELT_OCCLUDER_BOX_TYPE_REGULAR;
+
+    melt_result_t result;
+    REQUIRE(melt_generate_heightfield_occluder(heightfield, params, &result));
+    REQUIRE(result.box_count > 0);
+    REQUIRE(result.box_fill_pcts[result.box_count - 1] > 0.999f);
+    REQUIRE(result.peak_memory_bytes <= melt_estimate_heightfield_memory(heightfield, params));
+
+    // Boxes stand on the bottom or on other boxes and stay under the surface,
+    // whose lowest point over a box is one of the samples the box covers.
+    float volume = 0.0f;
+    for (uint32_t i = 0; i < result.box_count; ++i)
+    {
+        float min[3], max[3];
+        BoxBounds(result, i, min, max);
+        REQUIRE(min[1] >= heightfield.origin.y - 1e-4f);
+        volume += (max[0] - min[0]) * (max[1] - min[1]) * (max[2] - min[2]);
+
+        const uint32_t x0 = (uint32_t)roundf((min[0] - heightfield.origin.x) / heightfield.spacing_x);
+        const uint32_t x1 = (uint32_t)roundf((max[0] - heightfield.origin.x) / heightfield.spacing_x);
+        const uint32_t z0 = (uint32_t)roundf((min[2] - heightfield.origin.z) / heightfield.spacing_z);
+        const uint32_t z1 = (uint32_t)roundf((max[2] - heightfield.origin.z) / heightfield.spacing_z);
+        REQUIRE(x1 < size);
+        REQUIRE(z1 < size);
+        REQUIRE(x1 <= x0 + heightfield.tile_size);
+        float lowest = FLT_MAX;
+        for (uint32_t z = z0; z <= z1; ++z)
+        {
+            for (uint32_t x = x0; x <= x1; ++x)
+                lowest = std::min(lowest, heights[x + z * size]);
+        }
+        REQUIRE(max[1] <= heightfield.origin.y + lowest + 1e-4f);
+    }
+
+    // The boxes fill the volume under the lowest height of each cell.
+    float cell_volume = 0.0f;
+    for (uint32_t z = 0; z + 1 < size; ++z)
+    {
+        for (uint32_t x = 0; x + 1 < size; ++x)
+        {
+            const float height = std::min(std::min(heights[x + z * size], heights[x + 1 + z * size]),
+                std::min(heights[x + (z + 1) * size], heights[x + 1 + (z + 1) * size]));
+            cell_volume += height * heightfield.spacing_x * heightfield.spacing_z;
+        }
+    }
+    REQUIRE(fabsf(volume - cell_volume) < 1e-3f * cell_volume);
+
+    // The same surface as a mesh gives the same boxes, up to the rounding of the
+    // heights interpolated from its triangles.
+    std::vector<melt_vec3_t> vertices;
+    std::vector<melt_index_t> indices;
+    for (uint32_t z = 0; z < size; ++z)
+    {
+        for (uint32_t x = 0; x < size; ++x)
+            vertices.push_back({ heightfield.origin.x + x * heightfield.spacing_x, heightfield.origin.y + heights[x + z * size], heightfield.origin.z + z * heightfield.spacing_z });
+    }
+    for (uint32_t z = 0; z + 1 < size; ++z)
+    {
+        for (uint32_t x = 0; x + 1 < size; ++x)
+        {
+            const melt_index_t i = (melt_index_t)(x + z * size);
+            const melt_index_t quad[6] = { i, (melt_index_t)(i + size), (melt_index_t)(i + 1), (melt_index_t)(i + 1), (melt_index_t)(i + size), (melt_index_t)(i + size + 1) };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+
+    melt_heightfield_t mesh_heightfield;
+    memset(&mesh_heightfield, 0, sizeof(melt_heightfield_t));
+    mesh_heightfield.tile_size = heightfield.tile_size;
+    mesh_heightfield.bottom = heightfield.origin.y;
+    params.mesh = VectorMesh(vertices, indices);
+    params.voxel_size_per_axis = { heightfield.spacing_x, 1.0f, heightfield.spacing_z };
+
+    melt_result_t mesh_result;
+    REQUIRE(melt_generate_heightfield_occluder(mesh_heightfield, params, &mesh_result));
+    REQUIRE(mesh_result.peak_memory_bytes <= melt_estimate_heightfield_memory(mesh_heightfield, params));
+
+    float mesh_volume = 0.0f;
+    for (uint32_t i = 0; i < mesh_result.box_count; ++i)
+    {
+        float min[3], max[3];
+        BoxBounds(mesh_result, i, min, max);
+        mesh_volume += (max[0] - min[0]) * (max[1] - min[1]) * (max[2] - min[2]);
+    }
+    REQUIRE(mesh_volume <= cell_volume * 1.0001f);
+    REQUIRE(mesh_volume >= cell_volume * 0.999f);
+    REQUIRE(mesh_result.box_count < result.box_count + result.box_count / 100);
+    REQUIRE(mesh_result.box_count > result.box_count - result.box_count / 100);
+    melt_free_result(mesh_result);
+
+    // Lower fills and box limits keep the largest boxes.
+    params.fill_pct = 0.75f;
+    REQUIRE(melt_generate_heightfield_occluder(heightfield, params, &mesh_result));
+    REQUIRE(mesh_result.box_count == result.lods[1].box_count);
+    melt_free_result(mesh_result);
+    melt_free_result(result);
+
+    // Meshes that are not single valued along y are rejected.
+    memset(&params.mesh, 0, sizeof(melt_mesh_t));
+    REQUIRE(LoadModelMesh("models/suzanne.obj", params));
+    REQUIRE(!melt_generate_heightfield_occluder(mesh_heightfield, params, &result));
+    REQUIRE(result.error == MELT_ERROR_MESH_NOT_HEIGHTFIELD);
+
+    MELT_FREE(params.mesh.vertices);
+    MELT_FREE(params.mesh.indices);
+}